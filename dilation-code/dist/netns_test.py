@@ -0,0 +1,146 @@
+#
+# File  : netns_test.py
+#
+# Brief : Runs the distributed round barrier on one machine. Every stand-in host is a network namespace connected
+#         to the root namespace by a veth pair, with its own TimeKeeper experiment on its own cpus. Host 0 sends
+#         UDP datagrams to host 1 over a virtual link and host 1 echoes them back over another one (udp_ping.py),
+#         so the round trip time udp_ping.py reports should be twice the link latency, give or take a round each way
+#         since datagrams are only delivered at round barriers.
+#
+#         sudo python netns_test.py --rounds 5000 --latency 1000
+#
+
+
+import sys
+import os
+import time
+import signal
+import argparse
+import subprocess
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "../tests"))
+from timekeeper_functions import *
+
+N_HOSTS = 2
+COORD_IP = "10.200.0.1"
+COORD_PORT = 9950
+AGENT_PORT = 9951
+LINK_PORT = 7000
+APP_PORT = 7001
+TDF = 1
+TIMESLICE = 100000
+CPUS_PER_HOST = 1
+
+procs = []
+
+def host_ip(host) :
+	return "10.200." + str(host + 1) + ".2"
+
+def root_ip(host) :
+	return "10.200." + str(host + 1) + ".1"
+
+def setup_netns(host) :
+	ns = "tkhost" + str(host)
+	os.system("ip netns add " + ns)
+	os.system("ip link add veth" + str(host) + " type veth peer name eth0 netns " + ns)
+	os.system("ip addr add " + root_ip(host) + "/24 dev veth" + str(host))
+	os.system("ip link set veth" + str(host) + " up")
+	os.system("ip netns exec " + ns + " ip addr add " + host_ip(host) + "/24 dev eth0")
+	os.system("ip netns exec " + ns + " ip link set eth0 up")
+	os.system("ip netns exec " + ns + " ip link set lo up")
+	os.system("ip netns exec " + ns + " ip route add default via " + root_ip(host))
+
+def cleanup_netns(host) :
+	os.system("ip netns del tkhost" + str(host) + " 2> /dev/null")
+	os.system("ip link del veth" + str(host) + " 2> /dev/null")
+
+def run_in_netns(host, cmd) :
+	proc = subprocess.Popen("ip netns exec tkhost" + str(host) + " " + cmd, shell=True, preexec_fn=os.setsid)
+	procs.append(proc)
+	return proc
+
+# the pid of the workload itself, not of the ip netns exec wrapping it
+def workload_pid(proc) :
+	for i in xrange(0, 50) :
+		try :
+			pids = subprocess.check_output("pgrep -P " + str(proc.pid), shell=True).split()
+			if len(pids) > 0 :
+				return int(pids[0])
+		except subprocess.CalledProcessError :
+			pass
+		time.sleep(0.1)
+	return proc.pid
+
+def stop_all() :
+	for proc in procs :
+		try :
+			os.killpg(proc.pid, signal.SIGKILL)
+		except OSError :
+			pass
+	for host in xrange(0, N_HOSTS) :
+		select_experiment(host + 1)
+		stopExp()
+	time.sleep(2)
+	for host in xrange(0, N_HOSTS) :
+		cleanup_netns(host)
+
+def signal_handler(signal, frame) :
+	print 'Stopping Experiment'
+	stop_all()
+	sys.exit(0)
+
+signal.signal(signal.SIGINT, signal_handler)
+
+def main() :
+	parser = argparse.ArgumentParser()
+	parser.add_argument("--rounds", dest="rounds", help="Rounds to run", default="5000")
+	parser.add_argument("--latency", dest="latency", help="Link latency (us)", default="1000")
+	parser.add_argument("--count", dest="count", help="Datagrams host 0 sends", default="100")
+	args = parser.parse_args()
+
+	if not is_root() or not is_Module_Loaded() :
+		print "Needs root and the TimeKeeper module"
+		return 1
+
+	dist_bin = os.path.join(os.path.dirname(os.path.abspath(__file__)), "bin")
+	ping = os.path.join(os.path.dirname(os.path.abspath(__file__)), "udp_ping.py")
+
+	for host in xrange(0, N_HOSTS) :
+		cleanup_netns(host)
+		setup_netns(host)
+
+	coord = subprocess.Popen(dist_bin + "/tk_coordinator -n " + str(N_HOSTS) + " -p " + str(COORD_PORT) + " -r " + args.rounds, shell=True)
+
+	# host 0 sends to host 1 and host 1 echoes back, both through their agent's link port
+	workloads = []
+	workloads.append(run_in_netns(0, "python " + ping + " --port " + str(APP_PORT) + " --link " + str(LINK_PORT) + " --count " + args.count))
+	workloads.append(run_in_netns(1, "python " + ping + " --server --port " + str(APP_PORT) + " --link " + str(LINK_PORT)))
+
+	for host in xrange(0, N_HOSTS) :
+		select_experiment(host + 1)
+		set_experiment_cpus(1 + host * CPUS_PER_HOST, CPUS_PER_HOST)
+		set_cbe_experiment_timeslice(TIMESLICE * TDF)
+		pid = workload_pid(workloads[host])
+		dilate_all(pid, TDF)
+		addToExp(pid)
+
+	for host in xrange(0, N_HOSTS) :
+		select_experiment(host + 1)
+		synchronizeAndFreeze()
+	for host in xrange(0, N_HOSTS) :
+		select_experiment(host + 1)
+		startExp()
+
+	# the agents run outside the experiments, in the namespace of their host
+	for host in xrange(0, N_HOSTS) :
+		peer = 1 - host
+		link = str(LINK_PORT) + "," + str(peer) + "," + host_ip(peer) + "," + str(APP_PORT) + "," + args.latency
+		run_in_netns(host, dist_bin + "/tk_agent -i " + str(host) + " -c " + COORD_IP + ":" + str(COORD_PORT) + " -p " + str(AGENT_PORT) + " -e " + str(host + 1) + " -l " + link)
+
+	coord.wait()
+	time.sleep(1)
+	stop_all()
+	return coord.returncode
+
+if __name__ == "__main__" :
+	sys.exit(main())
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "TimeKeeper_functions.h"
+#include "TimeKeeper_definitions.h"
+#include "utility_functions.h"
+#include "tk_dist.h"
+
+/***
+Agent of the distributed round barrier, one per TimeKeeper host. It holds the host's CBE experiment at the round
+barrier and only lets it run a round (TK_IO_PROGRESS_CBE) once the coordinator says every host has finished the
+previous one.
+
+It also carries the datagrams between hosts, so they are delayed in virtual time instead of wall time. A link
+(-l local_port,host,ip,port,latency_us) makes the agent listen on local_port: containers on this host send to it, and
+every datagram is delivered to ip:port on the given host. Delivery is quantized to rounds, not exact: datagrams are
+only moved between rounds, while the experiment is frozen, so a datagram is stamped with the virtual time its round
+started at and delivered at the first round barrier at or after that time plus the latency. The virtual delay a
+container sees is therefore within one round of the link latency, and a smaller round increment makes it finer. A
+latency of at least one round (the lookahead) keeps the delay from collapsing to the end of the sending round. Replies
+need a link the other way on the receiving host.
+
+	sudo ./tk_agent -i 0 -c 10.200.0.1:9950 -e 1 -l 7000,1,10.200.1.2,7000,1000
+***/
+
+#define MAX_LINKS 16
+
+struct agent_link {
+	int sock;
+	int local_port;
+	int dst_host;
+	struct in_addr dst_addr;
+	int dst_port;
+	long long latency;
+};
+
+/* a datagram waiting for the virtual time it arrives at */
+struct pending_data {
+	long long due;
+	struct sockaddr_in dst;
+	int len;
+	struct pending_data * next;
+	char payload[0];
+};
+
+static struct agent_link links[MAX_LINKS];
+static int n_links;
+static int host_id = -1;
+static int n_hosts;
+static int sock;
+static struct sockaddr_in coord_addr;
+static struct sockaddr_in host_addr[TK_DIST_MAX_HOSTS];
+
+static uint64_t sent[TK_DIST_MAX_HOSTS];
+static uint64_t received;
+static uint64_t lost;
+static struct pending_data * pending;
+
+/* virtual time of the experiment when the agent joined, every virtual time on the wire is relative to it */
+static long long origin;
+
+static long long now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000LL + ts.tv_nsec / 1000000;
+}
+
+static void send_coord(tk_dist_msg * msg) {
+	tk_dist_msg out = *msg;
+
+	out.host = host_id;
+	tk_dist_msg_hton(&out);
+	if (sendto(sock, &out, sizeof(out), 0, (struct sockaddr *)&coord_addr, sizeof(coord_addr)) < 0)
+		perror("tk_agent: sendto coordinator");
+}
+
+/***
+Queues a datagram from another host, ordered by the virtual time it arrives at
+***/
+static void queue_data(tk_dist_data * hdr, char * payload, int len) {
+	struct pending_data * p;
+	struct pending_data ** pos;
+
+	p = malloc(sizeof(struct pending_data) + len);
+	if (p == NULL)
+		return;
+	p->due = hdr->send_time + hdr->latency;
+	memset(&p->dst, 0, sizeof(p->dst));
+	p->dst.sin_family = AF_INET;
+	p->dst.sin_addr.s_addr = hdr->dst_addr;
+	p->dst.sin_port = hdr->dst_port;
+	p->len = len;
+	memcpy(p->payload, payload, len);
+
+	for (pos = &pending; *pos != NULL && (*pos)->due <= p->due; pos = &(*pos)->next)
+		;
+	p->next = *pos;
+	*pos = p;
+}
+
+/***
+Delivers every queued datagram that has arrived by the given virtual time
+***/
+static void deliver_data(long long virtual_time) {
+	struct pending_data * p;
+
+	while (pending != NULL && pending->due <= virtual_time) {
+		p = pending;
+		pending = p->next;
+		if (sendto(sock, p->payload, p->len, 0, (struct sockaddr *)&p->dst, sizeof(p->dst)) < 0)
+			perror("tk_agent: deliver");
+		free(p);
+	}
+}
+
+/***
+Reads one message from the agent socket. Returns its type, 0 if it was a datagram from another host or invalid
+***/
+static int receive(tk_dist_msg * msg) {
+	char buf[sizeof(tk_dist_data) + TK_DIST_MAX_PAYLOAD];
+	tk_dist_data * hdr = (tk_dist_data *)buf;
+	ssize_t len;
+
+	len = recv(sock, buf, sizeof(buf), 0);
+	if (len < (ssize_t)sizeof(uint32_t))
+		return 0;
+
+	if (ntohl(*(uint32_t *)buf) == TK_DIST_DATA) {
+		if (len < (ssize_t)sizeof(tk_dist_data))
+			return 0;
+		tk_dist_data_ntoh(hdr);
+		queue_data(hdr, buf + sizeof(tk_dist_data), len - sizeof(tk_dist_data));
+		received++;
+		return 0;
+	}
+
+	if (len < (ssize_t)sizeof(tk_dist_msg))
+		return 0;
+	memcpy(msg, buf, sizeof(tk_dist_msg));
+	tk_dist_msg_ntoh(msg);
+	return msg->type;
+}
+
+/***
+Waits for a message of the given type from the coordinator (or a STOP), resending msg every TK_DIST_RESEND_MS.
+Datagrams from the other hosts are queued in the meantime
+***/
+static int wait_for(int type, uint64_t round, tk_dist_msg * msg, tk_dist_msg * resend) {
+	struct pollfd pfd;
+	long long last_sent = now_ms();
+	int t;
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	while (1) {
+		if (poll(&pfd, 1, TK_DIST_RESEND_MS) > 0) {
+			t = receive(msg);
+			if (t == TK_DIST_STOP)
+				return t;
+			if (t == type && (type != TK_DIST_ADVANCE || msg->round == round))
+				return t;
+		}
+		if (now_ms() - last_sent >= TK_DIST_RESEND_MS) {
+			send_coord(resend);
+			last_sent = now_ms();
+		}
+	}
+}
+
+/***
+Waits until the datagrams the other hosts sent this host before the barrier have arrived. Gives up after
+TK_DIST_DATA_WAIT_MS, they were lost like any other datagram
+***/
+static void wait_for_data(uint64_t expected) {
+	struct pollfd pfd;
+	tk_dist_msg msg;
+	long long start = now_ms();
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	while (received < expected && now_ms() - start < TK_DIST_DATA_WAIT_MS) {
+		if (poll(&pfd, 1, TK_DIST_DATA_WAIT_MS) > 0)
+			receive(&msg);
+	}
+	if (received < expected) {
+		lost += expected - received;
+		received = expected;
+	}
+}
+
+/***
+Sends everything the containers wrote to the links during the last round to the hosts at the other end
+***/
+static void forward_links(long long send_time) {
+	char buf[sizeof(tk_dist_data) + TK_DIST_MAX_PAYLOAD];
+	tk_dist_data * hdr = (tk_dist_data *)buf;
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < n_links; i++) {
+		while ((len = recv(links[i].sock, buf + sizeof(tk_dist_data), TK_DIST_MAX_PAYLOAD, MSG_DONTWAIT)) >= 0) {
+			memset(hdr, 0, sizeof(tk_dist_data));
+			hdr->type = TK_DIST_DATA;
+			hdr->host = host_id;
+			hdr->dst_addr = links[i].dst_addr.s_addr;
+			hdr->dst_port = htons(links[i].dst_port);
+			hdr->send_time = send_time;
+			hdr->latency = links[i].latency;
+			tk_dist_data_hton(hdr);
+			if (sendto(sock, buf, sizeof(tk_dist_data) + len, 0, (struct sockaddr *)&host_addr[links[i].dst_host],
+				sizeof(struct sockaddr_in)) < 0)
+				perror("tk_agent: forward");
+			else
+				sent[links[i].dst_host]++;
+		}
+	}
+}
+
+static int parse_link(char * arg) {
+	struct agent_link * l;
+	char ip[64];
+	long long latency_us;
+	struct sockaddr_in addr;
+
+	if (n_links >= MAX_LINKS)
+		return -1;
+	l = &links[n_links];
+	if (sscanf(arg, "%d,%d,%63[^,],%d,%lld", &l->local_port, &l->dst_host, ip, &l->dst_port, &latency_us) != 5)
+		return -1;
+	if (inet_aton(ip, &l->dst_addr) == 0 || l->dst_host < 0 || l->dst_host >= TK_DIST_MAX_HOSTS)
+		return -1;
+	l->latency = latency_us * 1000;
+
+	l->sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(l->local_port);
+	if (l->sock < 0 || bind(l->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("tk_agent: link");
+		return -1;
+	}
+	n_links++;
+	return 0;
+}
+
+static void usage(char * prog) {
+	fprintf(stderr, "Usage: %s -i host_id -c coordinator_ip[:port] [-p port] [-e experiment]\n"
+		"\t[-l local_port,host,ip,port,latency_us]...\n", prog);
+	exit(1);
+}
+
+int main(int argc, char * argv[]) {
+	struct sockaddr_in addr;
+	tk_progress_args progress;
+	tk_dist_msg msg, resend;
+	char coord_ip[64];
+	int coord_port = TK_DIST_DEFAULT_PORT;
+	int port = 0;
+	int experiment = 0;
+	uint64_t round = 0;
+	uint64_t forwarded = 0;
+	long long round_start;
+	int opt, i;
+	int rcvbuf = 4 << 20;
+
+	coord_ip[0] = '\0';
+	while ((opt = getopt(argc, argv, "i:c:p:e:l:h")) != -1) {
+		switch (opt) {
+			case 'i': host_id = atoi(optarg); break;
+			case 'c':
+				if (sscanf(optarg, "%63[^:]:%d", coord_ip, &coord_port) < 1)
+					usage(argv[0]);
+				break;
+			case 'p': port = atoi(optarg); break;
+			case 'e': experiment = atoi(optarg); break;
+			case 'l':
+				if (parse_link(optarg) < 0) {
+					fprintf(stderr, "tk_agent: invalid link %s\n", optarg);
+					return 1;
+				}
+				break;
+			default: usage(argv[0]);
+		}
+	}
+	if (host_id < 0 || host_id >= TK_DIST_MAX_HOSTS || coord_ip[0] == '\0')
+		usage(argv[0]);
+
+	if (!is_root() || !isModuleLoaded()) {
+		fprintf(stderr, "tk_agent: needs root and the TimeKeeper module\n");
+		return 1;
+	}
+	selectExperiment(experiment);
+
+	memset(&coord_addr, 0, sizeof(coord_addr));
+	coord_addr.sin_family = AF_INET;
+	coord_addr.sin_port = htons(coord_port);
+	if (inet_aton(coord_ip, &coord_addr.sin_addr) == 0)
+		usage(argv[0]);
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("tk_agent: socket");
+		return 1;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	for (i = 0; i < n_links; i++)
+		setsockopt(links[i].sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	/* stop the experiment at the next round barrier, and wait until it has started and got there */
+	memset(&progress, 0, sizeof(progress));
+	if (progressExpCBEBarrier(&progress) < 0) {
+		fprintf(stderr, "tk_agent: experiment %d is not a CBE experiment\n", experiment);
+		return 1;
+	}
+	progress.n_rounds = 1;
+	if (progressExpCBEBarrier(&progress) < 0) {
+		fprintf(stderr, "tk_agent: experiment %d did not reach the round barrier\n", experiment);
+		return 1;
+	}
+	origin = progress.virtual_time;
+	printf("tk_agent: host %d holding experiment %d at virtual time %lld, %lld ns per round\n", host_id, experiment,
+		origin, progress.round_increase);
+
+	for (i = 0; i < n_links; i++) {
+		if (links[i].latency < progress.round_increase)
+			fprintf(stderr, "tk_agent: link %d latency %lld ns is shorter than a round (%lld ns), its datagrams arrive "
+				"up to a round late\n", links[i].local_port, links[i].latency, progress.round_increase);
+	}
+
+	memset(&resend, 0, sizeof(resend));
+	resend.type = TK_DIST_JOIN;
+	resend.virtual_time = progress.round_increase;
+	send_coord(&resend);
+	if (wait_for(TK_DIST_START, 0, &msg, &resend) == TK_DIST_STOP)
+		goto stop;
+	n_hosts = msg.n_hosts;
+	for (i = 0; i < n_hosts && i < TK_DIST_MAX_HOSTS; i++) {
+		memset(&host_addr[i], 0, sizeof(struct sockaddr_in));
+		host_addr[i].sin_family = AF_INET;
+		host_addr[i].sin_addr.s_addr = msg.addr[i];
+		host_addr[i].sin_port = msg.port[i];
+	}
+
+	while (1) {
+		/* round barrier: wait until every host has finished the last round */
+		if (wait_for(TK_DIST_ADVANCE, round + 1, &msg, &resend) == TK_DIST_STOP)
+			break;
+		wait_for_data(msg.expected);
+
+		/* everything that has arrived by now goes to the containers before they run again */
+		deliver_data(progress.virtual_time - origin);
+
+		round_start = progress.virtual_time - origin;
+		progress.n_rounds = 1;
+		if (progressExpCBEBarrier(&progress) < 0) {
+			fprintf(stderr, "tk_agent: experiment %d stopped\n", experiment);
+			break;
+		}
+		round++;
+
+		forward_links(round_start);
+
+		memset(&resend, 0, sizeof(resend));
+		resend.type = TK_DIST_ROUND_DONE;
+		resend.round = round;
+		resend.virtual_time = progress.virtual_time - origin;
+		memcpy(resend.sent, sent, sizeof(sent));
+		send_coord(&resend);
+	}
+
+stop:
+	/* let the experiment run on its own again */
+	resumeExpCBE();
+	for (i = 0; i < TK_DIST_MAX_HOSTS; i++)
+		forwarded += sent[i];
+	printf("tk_agent: host %d ran %llu rounds, forwarded %llu datagrams, lost %llu\n", host_id, (unsigned long long)round,
+		(unsigned long long)forwarded, (unsigned long long)lost);
+	close(sock);
+	return 0;
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "tk_dist.h"
+
+/***
+Coordinator of the distributed round barrier. Every TimeKeeper host runs its chains locally and holds its experiment at
+the round barrier between rounds (tk_agent). The coordinator waits until every host has completed round k, then lets
+all of them run round k+1, so the virtual clocks of all hosts move in lockstep like the chains of one host do.
+
+Every ROUND_DONE carries the number of data messages the agent has sent to every other agent. The ADVANCE of a host
+tells it how many it has to have received before it may run the next round, so a datagram cannot be overtaken by the
+barrier even if UDP reorders them.
+
+	./tk_coordinator -n 2 -p 9950 -r 10000
+***/
+
+struct coord_host {
+	int joined;
+	int done;
+	struct sockaddr_in addr;
+	int64_t round_increase;
+	uint64_t sent[TK_DIST_MAX_HOSTS];
+};
+
+static struct coord_host hosts[TK_DIST_MAX_HOSTS];
+static int n_hosts;
+static int sock;
+
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void send_msg(int host, tk_dist_msg * msg) {
+	tk_dist_msg out = *msg;
+
+	out.host = host;
+	tk_dist_msg_hton(&out);
+	if (sendto(sock, &out, sizeof(out), 0, (struct sockaddr *)&hosts[host].addr, sizeof(struct sockaddr_in)) < 0)
+		perror("tk_coordinator: sendto");
+}
+
+static void send_start(int host) {
+	tk_dist_msg msg;
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = TK_DIST_START;
+	msg.n_hosts = n_hosts;
+	for (i = 0; i < n_hosts; i++) {
+		msg.addr[i] = hosts[i].addr.sin_addr.s_addr;
+		msg.port[i] = hosts[i].addr.sin_port;
+	}
+	send_msg(host, &msg);
+}
+
+/***
+Sends the ADVANCE of a round to a host, with the number of data messages all the others have sent it until then
+***/
+static void send_advance(int host, uint64_t round) {
+	tk_dist_msg msg;
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = TK_DIST_ADVANCE;
+	msg.round = round;
+	for (i = 0; i < n_hosts; i++)
+		msg.expected += hosts[i].sent[host];
+	send_msg(host, &msg);
+}
+
+static void send_stop_all() {
+	tk_dist_msg msg;
+	int i, j;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = TK_DIST_STOP;
+
+	/* nobody acknowledges a STOP, so send it a few times */
+	for (j = 0; j < 3; j++) {
+		for (i = 0; i < n_hosts; i++) {
+			if (hosts[i].joined)
+				send_msg(i, &msg);
+		}
+		usleep(TK_DIST_RESEND_MS * 1000);
+	}
+}
+
+static void usage(char * prog) {
+	fprintf(stderr, "Usage: %s -n hosts [-p port] [-r rounds (0 = until interrupted)]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char * argv[]) {
+	struct sockaddr_in addr;
+	struct sockaddr_in from;
+	socklen_t from_len;
+	tk_dist_msg msg;
+	int port = TK_DIST_DEFAULT_PORT;
+	long long n_rounds = 0;
+	uint64_t round = 0;
+	int n_joined = 0;
+	int n_done = 0;
+	int opt, i, h;
+	long long round_start = 0, start = 0, barrier_total = 0, barrier_max = 0;
+
+	while ((opt = getopt(argc, argv, "n:p:r:h")) != -1) {
+		switch (opt) {
+			case 'n': n_hosts = atoi(optarg); break;
+			case 'p': port = atoi(optarg); break;
+			case 'r': n_rounds = atoll(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if (n_hosts < 1 || n_hosts > TK_DIST_MAX_HOSTS)
+		usage(argv[0]);
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("tk_coordinator: socket");
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("tk_coordinator: bind");
+		return 1;
+	}
+	printf("tk_coordinator: waiting for %d hosts on port %d\n", n_hosts, port);
+
+	while (1) {
+		from_len = sizeof(from);
+		if (recvfrom(sock, &msg, sizeof(msg), 0, (struct sockaddr *)&from, &from_len) < (ssize_t)sizeof(msg))
+			continue;
+		tk_dist_msg_ntoh(&msg);
+		h = msg.host;
+		if (h < 0 || h >= n_hosts) {
+			fprintf(stderr, "tk_coordinator: message from unknown host %d\n", h);
+			continue;
+		}
+
+		if (msg.type == TK_DIST_JOIN) {
+			if (hosts[h].joined) {
+				/* it missed the START or the first ADVANCE */
+				if (n_joined == n_hosts) {
+					send_start(h);
+					if (round == 1 && !hosts[h].done)
+						send_advance(h, round);
+				}
+				continue;
+			}
+			hosts[h].joined = 1;
+			hosts[h].addr = from;
+			hosts[h].round_increase = msg.virtual_time;
+			n_joined++;
+			printf("tk_coordinator: host %d joined from %s:%d, round increase %lld ns\n", h, inet_ntoa(from.sin_addr),
+				ntohs(from.sin_port), (long long)msg.virtual_time);
+			if (n_joined < n_hosts)
+				continue;
+
+			/* every host has to move by the same virtual time per round, otherwise the clocks drift apart */
+			for (i = 1; i < n_hosts; i++) {
+				if (hosts[i].round_increase != hosts[0].round_increase) {
+					fprintf(stderr, "tk_coordinator: host %d advances %lld ns per round, host 0 %lld ns. Give every host "
+						"the same timeslice and highest TDF\n", i, (long long)hosts[i].round_increase,
+						(long long)hosts[0].round_increase);
+					send_stop_all();
+					return 1;
+				}
+			}
+
+			round = 1;
+			start = round_start = now_ns();
+			for (i = 0; i < n_hosts; i++) {
+				send_start(i);
+				send_advance(i, round);
+			}
+		}
+		else if (msg.type == TK_DIST_ROUND_DONE) {
+			if (msg.round + 1 == round) {
+				/* it already finished the round and missed the ADVANCE of the next one */
+				send_advance(h, round);
+				continue;
+			}
+			if (msg.round != round || hosts[h].done)
+				continue;
+
+			hosts[h].done = 1;
+			memcpy(hosts[h].sent, msg.sent, sizeof(hosts[h].sent));
+			if (++n_done < n_hosts)
+				continue;
+
+			/* round barrier */
+			long long barrier = now_ns() - round_start;
+			barrier_total += barrier;
+			if (barrier > barrier_max)
+				barrier_max = barrier;
+
+			if (n_rounds > 0 && round >= (uint64_t)n_rounds)
+				break;
+
+			n_done = 0;
+			round++;
+			round_start = now_ns();
+			for (i = 0; i < n_hosts; i++) {
+				hosts[i].done = 0;
+				send_advance(i, round);
+			}
+		}
+	}
+
+	send_stop_all();
+	printf("tk_coordinator: %llu rounds in %lld ms, round wall time avg %lld us max %lld us\n", (unsigned long long)round,
+		(now_ns() - start) / 1000000, round ? barrier_total / (long long)round / 1000 : 0, barrier_max / 1000);
+	close(sock);
+	return 0;
+}
@@ -0,0 +1,110 @@
+#ifndef __TK_DIST_H__
+#define __TK_DIST_H__
+
+#include <stdint.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+/***
+Wire format of the distributed round barrier. One coordinator (tk_coordinator) and one agent (tk_agent) per TimeKeeper
+host exchange these over UDP. Every agent uses a single socket for the coordinator and for the data of the other agents,
+so the address a JOIN comes from is also the address the other agents send data to.
+
+	agent                         coordinator
+	JOIN (round increase)   ->
+	                        <-    START (addresses of all agents)
+	                        <-    ADVANCE 1
+	runs round 1
+	ROUND_DONE 1 (sent)     ->
+	                        <-    ADVANCE 2 (expected)
+	...
+	                        <-    STOP
+
+All fields are big endian on the wire. Virtual times are relative to the virtual time the host's experiment had reached
+when its agent joined, so they are comparable between hosts as long as every host advances by the same virtual time
+per round (checked by the coordinator).
+***/
+
+#define TK_DIST_MAX_HOSTS 32
+#define TK_DIST_MAX_PAYLOAD 1472
+#define TK_DIST_DEFAULT_PORT 9950
+
+/* message types */
+#define TK_DIST_JOIN 1
+#define TK_DIST_START 2
+#define TK_DIST_ROUND_DONE 3
+#define TK_DIST_ADVANCE 4
+#define TK_DIST_STOP 5
+#define TK_DIST_DATA 6
+
+/* how often an agent resends its JOIN/ROUND_DONE while it waits for the coordinator (ms) */
+#define TK_DIST_RESEND_MS 50
+
+/* how long an agent waits for data the coordinator says was sent to it before it gives up on it (ms) */
+#define TK_DIST_DATA_WAIT_MS 200
+
+typedef struct tk_dist_msg_struct {
+	uint32_t type;
+	uint32_t host;							// sender (agent) or receiver (coordinator) of the message
+	uint32_t n_hosts;						// START
+	uint32_t pad;
+	uint64_t round;							// ROUND_DONE: round completed, ADVANCE: round to run
+	int64_t virtual_time;					// JOIN: virtual time of one round, ROUND_DONE: virtual time reached
+	uint64_t expected;						// ADVANCE: data messages the host must have received before the round
+	uint64_t sent[TK_DIST_MAX_HOSTS];		// ROUND_DONE: data messages sent to every host so far
+	uint32_t addr[TK_DIST_MAX_HOSTS];		// START: address of every agent, already in network order
+	uint16_t port[TK_DIST_MAX_HOSTS];		// START: port of every agent, already in network order
+} tk_dist_msg;
+
+/* a DATA message is this header followed by the payload of one datagram */
+typedef struct tk_dist_data_struct {
+	uint32_t type;
+	uint32_t host;							// sending host
+	uint32_t dst_addr;						// where the receiving agent delivers the payload, network order
+	uint16_t dst_port;						// network order
+	uint16_t pad;
+	int64_t send_time;						// virtual time the round the datagram was sent in started at
+	int64_t latency;						// virtual time it spends on the link
+} tk_dist_data;
+
+static inline void tk_dist_msg_hton(tk_dist_msg * msg) {
+	int i;
+
+	msg->type = htonl(msg->type);
+	msg->host = htonl(msg->host);
+	msg->n_hosts = htonl(msg->n_hosts);
+	msg->round = htobe64(msg->round);
+	msg->virtual_time = (int64_t)htobe64((uint64_t)msg->virtual_time);
+	msg->expected = htobe64(msg->expected);
+	for (i = 0; i < TK_DIST_MAX_HOSTS; i++)
+		msg->sent[i] = htobe64(msg->sent[i]);
+}
+
+static inline void tk_dist_msg_ntoh(tk_dist_msg * msg) {
+	int i;
+
+	msg->type = ntohl(msg->type);
+	msg->host = ntohl(msg->host);
+	msg->n_hosts = ntohl(msg->n_hosts);
+	msg->round = be64toh(msg->round);
+	msg->virtual_time = (int64_t)be64toh((uint64_t)msg->virtual_time);
+	msg->expected = be64toh(msg->expected);
+	for (i = 0; i < TK_DIST_MAX_HOSTS; i++)
+		msg->sent[i] = be64toh(msg->sent[i]);
+}
+
+static inline void tk_dist_data_hton(tk_dist_data * data) {
+	data->type = htonl(data->type);
+	data->host = htonl(data->host);
+	data->send_time = (int64_t)htobe64((uint64_t)data->send_time);
+	data->latency = (int64_t)htobe64((uint64_t)data->latency);
+}
+
+static inline void tk_dist_data_ntoh(tk_dist_data * data) {
+	data->type = ntohl(data->type);
+	data->host = ntohl(data->host);
+	data->send_time = (int64_t)be64toh((uint64_t)data->send_time);
+	data->latency = (int64_t)be64toh((uint64_t)data->latency);
+}
+
+#endif
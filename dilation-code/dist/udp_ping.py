@@ -0,0 +1,48 @@
+#
+# File  : udp_ping.py
+#
+# Brief : UDP workload of netns_test.py. The client sends numbered datagrams to its agent's link port and prints the
+#         round trip time of the echoes, the server echoes everything it receives to its own agent's link port.
+#
+
+
+import sys
+import time
+import socket
+import argparse
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--server", dest="server", action="store_true", help="Echo instead of send")
+parser.add_argument("--port", dest="port", help="Port to receive on", required=True)
+parser.add_argument("--link", dest="link", help="Link port of the local agent", required=True)
+parser.add_argument("--count", dest="count", help="Datagrams to send", default="100")
+parser.add_argument("--interval", dest="interval", help="Seconds between datagrams", default="0.01")
+args = parser.parse_args()
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+sock.bind(('0.0.0.0', int(args.port)))
+link = ('127.0.0.1', int(args.link))
+
+if args.server :
+	while True :
+		data, addr = sock.recvfrom(2048)
+		sock.sendto(data, link)
+
+count = int(args.count)
+sock.settimeout(1.0)
+rtts = []
+for i in xrange(0, count) :
+	start = time.time()
+	sock.sendto(str(i) + "," + repr(start), link)
+	try :
+		data, addr = sock.recvfrom(2048)
+		seq, sent = data.split(",")
+		rtts.append(time.time() - float(sent))
+	except socket.timeout :
+		pass
+	time.sleep(float(args.interval))
+
+if len(rtts) > 0 :
+	print "udp_ping: %d/%d echoes, rtt avg %.1f us min %.1f us max %.1f us" % (len(rtts), count, sum(rtts) / len(rtts) * 1000000, min(rtts) * 1000000, max(rtts) * 1000000)
+else :
+	print "udp_ping: no echoes"
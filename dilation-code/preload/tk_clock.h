@@ -0,0 +1,66 @@
+#ifndef __TK_CLOCK_H__
+#define __TK_CLOCK_H__
+
+#include <stdint.h>
+
+/***
+Shared clock page of the userspace dilation mode. The controller (tk_controller) keeps one clock per container in it,
+with the same fields the patched kernel keeps in the container leader's task_struct, and the preloaded shim
+(libtkpreload.so) turns them into virtual time with vt_virtual_time, so reading the clock never leaves userspace.
+
+Each clock is protected by a sequence count: the controller makes it odd while it updates the clock, readers retry
+until they read the same even count before and after reading the fields.
+***/
+
+#define TK_CLOCK_PATH "/dev/shm/timekeeper_clock"
+#define TK_CLOCK_MAGIC 0x544b434cU
+#define TK_CLOCK_MAX 64
+
+/* environment of the processes the controller starts */
+#define TK_CLOCK_ENV_PATH "TK_CLOCK_PATH"
+#define TK_CLOCK_ENV_SLOT "TK_CLOCK_SLOT"
+
+struct tk_clock {
+	volatile uint32_t seq;
+	int32_t tdf;
+	int64_t virt_start_time;
+	int64_t freeze_time;
+	int64_t past_physical_time;
+	int64_t past_virtual_time;
+	char pad[24];
+} __attribute__((aligned(64)));
+
+struct tk_clock_page {
+	uint32_t magic;
+	uint32_t n_clocks;
+	int64_t realtime_offset;				// CLOCK_REALTIME - CLOCK_MONOTONIC when the controller started (ns)
+	char pad[48];
+	struct tk_clock clocks[TK_CLOCK_MAX];
+};
+
+static inline void tk_clock_write_begin(struct tk_clock * clock) {
+	clock->seq++;
+	__sync_synchronize();
+}
+
+static inline void tk_clock_write_end(struct tk_clock * clock) {
+	__sync_synchronize();
+	clock->seq++;
+}
+
+/***
+Consistent copy of a clock
+***/
+static inline void tk_clock_read(struct tk_clock * clock, struct tk_clock * copy) {
+	uint32_t seq;
+
+	do {
+		while ((seq = clock->seq) & 1)
+			;
+		__sync_synchronize();
+		*copy = *clock;
+		__sync_synchronize();
+	} while (clock->seq != seq);
+}
+
+#endif
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../src/vtcore/vt_math.h"
+#include "tk_clock.h"
+
+/***
+Userspace dilation mode, for stock kernels without the TimeKeeper module. Starts every container (a command, in its own
+process group) with libtkpreload.so preloaded and runs them in CBE rounds: in every round each container is thawed
+(SIGCONT) for the physical time it needs to advance its clock by the round's virtual time, then frozen (SIGSTOP)
+again. The clocks live in a shared page (tk_clock.h) the preloaded shim reads, so the containers see their virtual
+time without a syscall.
+
+	./tk_controller -t 1000 -r 5000 -c 2:"python ../tests/timeofday.py" -c 1:"./bin/app"
+
+-t is the timeslice of the container with the highest TDF in us, like SET_CBE_EXP_TIMESLICE. -r 0 runs until every
+container has exited. A container is done when the process it was started as exits, the rest of its process group
+is killed then.
+***/
+
+struct tk_container {
+	pid_t pid;
+	int tdf;
+	int exited;
+	char * cmd;
+	s64 run_until;
+	struct tk_clock * clock;
+};
+
+static struct tk_container containers[TK_CLOCK_MAX];
+static int n_containers;
+static struct tk_clock_page * page;
+
+static s64 now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(s64 t) {
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000000LL;
+	ts.tv_nsec = t % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* same conversion as fixDilation in timekeeper_functions.py: 2.0 -> 2000, 0.5 -> -2000, 1.0 -> 0 */
+static int fix_dilation(double dilation) {
+	if (dilation > 0.0 && dilation < 1.0)
+		return -(int)((1.0/dilation)*VT_PRECISION);
+	if (dilation == 1.0)
+		return 0;
+	return (int)(dilation*VT_PRECISION);
+}
+
+static s64 container_virtual_time(struct tk_container * c) {
+	struct tk_clock * clock = c->clock;
+
+	return vt_virtual_time(now_ns(), clock->virt_start_time, clock->freeze_time, clock->past_physical_time, clock->past_virtual_time, clock->tdf);
+}
+
+static void freeze_container(struct tk_container * c, s64 now) {
+	tk_clock_write_begin(c->clock);
+	c->clock->freeze_time = now;
+	tk_clock_write_end(c->clock);
+	killpg(c->pid, SIGSTOP);
+}
+
+static void unfreeze_container(struct tk_container * c, s64 now) {
+	tk_clock_write_begin(c->clock);
+	c->clock->past_physical_time += now - c->clock->freeze_time;
+	c->clock->freeze_time = 0;
+	tk_clock_write_end(c->clock);
+	killpg(c->pid, SIGCONT);
+}
+
+/***
+Forks a container. It stops itself before it execs the command, so it starts frozen like a container added with
+addToExp
+***/
+static int start_container(struct tk_container * c, int slot, char * lib, char * path) {
+	char env[PATH_MAX + 32];
+	char * preload;
+	int status;
+
+	c->pid = fork();
+	if (c->pid < 0)
+		return -1;
+	if (c->pid == 0) {
+		setpgid(0, 0);
+		preload = getenv("LD_PRELOAD");
+		if (preload != NULL && preload[0] != '\0')
+			snprintf(env, sizeof(env), "%s:%s", lib, preload);
+		else
+			snprintf(env, sizeof(env), "%s", lib);
+		setenv("LD_PRELOAD", env, 1);
+		setenv(TK_CLOCK_ENV_PATH, path, 1);
+		snprintf(env, sizeof(env), "%d", slot);
+		setenv(TK_CLOCK_ENV_SLOT, env, 1);
+		raise(SIGSTOP);
+		execl("/bin/sh", "sh", "-c", c->cmd, (char *)NULL);
+		_exit(127);
+	}
+	setpgid(c->pid, c->pid);
+	if (waitpid(c->pid, &status, WUNTRACED) < 0 || !WIFSTOPPED(status))
+		return -1;
+	c->clock = &page->clocks[slot];
+	return 0;
+}
+
+/***
+Reaps the containers whose command has exited. Returns the number still running
+***/
+static int reap_containers(void) {
+	int i, status, running = 0;
+
+	for (i = 0; i < n_containers; i++) {
+		if (containers[i].exited)
+			continue;
+		if (waitpid(containers[i].pid, &status, WNOHANG) == containers[i].pid && (WIFEXITED(status) || WIFSIGNALED(status))) {
+			containers[i].exited = 1;
+			killpg(containers[i].pid, SIGKILL);
+			killpg(containers[i].pid, SIGCONT);
+			printf("tk_controller: container %d (%s) exited at virtual time %lld ns\n", i, containers[i].cmd,
+				(long long)(container_virtual_time(&containers[i]) - containers[i].clock->virt_start_time));
+			continue;
+		}
+		running++;
+	}
+	return running;
+}
+
+static void usage(char * prog) {
+	fprintf(stderr, "Usage: %s [-t timeslice_us] [-r rounds] [-l libtkpreload.so] [-p clock_path] -c tdf:command...\n", prog);
+	exit(1);
+}
+
+int main(int argc, char * argv[]) {
+	char lib[PATH_MAX];
+	char * path = TK_CLOCK_PATH;
+	char * sep;
+	s64 quantum = 1000000;
+	s64 expected_increase, expected_time, start, now, runtime, overshoot;
+	s64 overshoot_total = 0, overshoot_max = 0;
+	long long n_freezes = 0;
+	long long n_rounds = 0, round;
+	int highest_dilation = -100000000;
+	int opt, i, fd, n_thawed;
+	ssize_t len;
+	struct timespec ts;
+
+	/* libtkpreload.so next to the controller by default */
+	len = readlink("/proc/self/exe", lib, sizeof(lib) - 32);
+	if (len < 0)
+		len = 0;
+	lib[len] = '\0';
+	sep = strrchr(lib, '/');
+	strcpy(sep != NULL ? sep + 1 : lib, "libtkpreload.so");
+
+	while ((opt = getopt(argc, argv, "t:r:l:p:c:h")) != -1) {
+		switch (opt) {
+			case 't': quantum = atoll(optarg) * 1000; break;
+			case 'r': n_rounds = atoll(optarg); break;
+			case 'l': realpath(optarg, lib); break;
+			case 'p': path = optarg; break;
+			case 'c':
+				sep = strchr(optarg, ':');
+				if (sep == NULL || n_containers >= TK_CLOCK_MAX)
+					usage(argv[0]);
+				*sep = '\0';
+				containers[n_containers].tdf = fix_dilation(atof(optarg));
+				containers[n_containers].cmd = sep + 1;
+				n_containers++;
+				break;
+			default: usage(argv[0]);
+		}
+	}
+	if (n_containers == 0 || quantum <= 0)
+		usage(argv[0]);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(struct tk_clock_page)) < 0) {
+		perror("tk_controller: clock page");
+		return 1;
+	}
+	page = mmap(NULL, sizeof(struct tk_clock_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		perror("tk_controller: mmap");
+		return 1;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	page->realtime_offset = (s64)ts.tv_sec*1000000000LL + ts.tv_nsec - now_ns();
+	page->n_clocks = n_containers;
+	page->magic = TK_CLOCK_MAGIC;
+
+	for (i = 0; i < n_containers; i++) {
+		page->clocks[i].tdf = containers[i].tdf;
+		if (start_container(&containers[i], i, lib, path) < 0) {
+			fprintf(stderr, "tk_controller: cannot start %s\n", containers[i].cmd);
+			return 1;
+		}
+		if (containers[i].tdf > highest_dilation)
+			highest_dilation = containers[i].tdf;
+	}
+
+	/* synchronize and freeze: every clock starts at the same virtual time, frozen */
+	start = now_ns();
+	for (i = 0; i < n_containers; i++) {
+		tk_clock_write_begin(containers[i].clock);
+		containers[i].clock->virt_start_time = start;
+		containers[i].clock->freeze_time = start;
+		tk_clock_write_end(containers[i].clock);
+	}
+	expected_increase = vt_expected_increase(quantum, highest_dilation);
+	expected_time = start;
+	printf("tk_controller: %d containers, highest TDF %d, %lld ns of virtual time per round\n", n_containers,
+		highest_dilation, (long long)expected_increase);
+
+	for (round = 0; n_rounds == 0 || round < n_rounds; round++) {
+		if (reap_containers() == 0)
+			break;
+		expected_time += expected_increase;
+
+		/* thaw every container for the physical time it needs to reach the round's virtual time */
+		now = now_ns();
+		n_thawed = 0;
+		for (i = 0; i < n_containers; i++) {
+			containers[i].run_until = 0;
+			if (containers[i].exited)
+				continue;
+			runtime = -vt_calculate_change(container_virtual_time(&containers[i]), expected_time, containers[i].tdf, 0);
+			if (runtime <= 0)
+				continue;
+			containers[i].run_until = now + runtime;
+			unfreeze_container(&containers[i], now);
+			n_thawed++;
+		}
+
+		/* and freeze them again in the order their slices end */
+		while (n_thawed > 0) {
+			struct tk_container * next = NULL;
+
+			for (i = 0; i < n_containers; i++) {
+				if (containers[i].run_until != 0 && (next == NULL || containers[i].run_until < next->run_until))
+					next = &containers[i];
+			}
+			sleep_until(next->run_until);
+			now = now_ns();
+			freeze_container(next, now);
+			overshoot = now - next->run_until;
+			overshoot_total += overshoot;
+			n_freezes++;
+			if (overshoot > overshoot_max)
+				overshoot_max = overshoot;
+			next->run_until = 0;
+			n_thawed--;
+		}
+	}
+
+	/* let whatever is left run on its own, still dilated */
+	now = now_ns();
+	for (i = 0; i < n_containers; i++) {
+		if (!containers[i].exited)
+			unfreeze_container(&containers[i], now);
+	}
+	printf("tk_controller: %lld rounds, virtual time %lld ns, freeze overshoot avg %lld ns max %lld ns\n", round,
+		(long long)(expected_time - start), n_freezes ? (long long)(overshoot_total / n_freezes) : 0,
+		(long long)overshoot_max);
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+	return 0;
+}
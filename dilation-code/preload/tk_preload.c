@@ -0,0 +1,426 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "../src/vtcore/vt_math.h"
+#include "tk_clock.h"
+
+/***
+Preloaded into the processes tk_controller starts (LD_PRELOAD=libtkpreload.so). It replaces the time related calls the
+patched kernel dilates with ones that read the container's clock from the shared clock page:
+
+	clock_gettime, gettimeofday, time	virtual time, computed in userspace from the clock page and the vDSO clock
+	nanosleep, clock_nanosleep, usleep, sleep, poll, select, epoll_wait
+										sleep until the virtual deadline, sleeping again if the container was frozen
+	timerfd_settime, timerfd_gettime	scaled by the TDF
+
+A timerfd keeps counting while its container is frozen, so it can expire up to one frozen period early in virtual
+time. Processes started without TK_CLOCK_SLOT, or before the clock has started, see physical time.
+***/
+
+#define TK_TIMERFD_MAX 1024
+
+static struct tk_clock_page * page;
+static struct tk_clock * clock_slot;
+
+/* clock each timerfd was created with, -1 if it is not a timerfd */
+static int timerfd_clock[TK_TIMERFD_MAX];
+
+static int (*real_clock_gettime)(clockid_t, struct timespec *);
+static int (*real_gettimeofday)(struct timeval *, void *);
+static int (*real_nanosleep)(const struct timespec *, struct timespec *);
+static int (*real_clock_nanosleep)(clockid_t, int, const struct timespec *, struct timespec *);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+static int (*real_select)(int, fd_set *, fd_set *, fd_set *, struct timeval *);
+static int (*real_epoll_wait)(int, struct epoll_event *, int, int);
+static int (*real_timerfd_create)(int, int);
+static int (*real_timerfd_settime)(int, int, const struct itimerspec *, struct itimerspec *);
+static int (*real_timerfd_gettime)(int, struct itimerspec *);
+
+#define TK_REAL(func) do { if (real_##func == NULL) real_##func = dlsym(RTLD_NEXT, #func); } while (0)
+
+static __attribute__((constructor)) void tk_preload_init(void) {
+	char * path;
+	char * slot;
+	int fd, i;
+	void * addr;
+
+	for (i = 0; i < TK_TIMERFD_MAX; i++)
+		timerfd_clock[i] = -1;
+
+	slot = getenv(TK_CLOCK_ENV_SLOT);
+	if (slot == NULL)
+		return;
+	path = getenv(TK_CLOCK_ENV_PATH);
+	if (path == NULL)
+		path = TK_CLOCK_PATH;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	addr = mmap(NULL, sizeof(struct tk_clock_page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return;
+	page = addr;
+	if (page->magic != TK_CLOCK_MAGIC || atoi(slot) < 0 || atoi(slot) >= TK_CLOCK_MAX) {
+		munmap(addr, sizeof(struct tk_clock_page));
+		page = NULL;
+		return;
+	}
+	clock_slot = &page->clocks[atoi(slot)];
+}
+
+/***
+Returns 1 if the clock is one the patched kernel dilates
+***/
+static int tk_dilated_clock(clockid_t clk) {
+	switch (clk) {
+		case CLOCK_REALTIME:
+		case CLOCK_REALTIME_COARSE:
+		case CLOCK_MONOTONIC:
+		case CLOCK_MONOTONIC_RAW:
+		case CLOCK_MONOTONIC_COARSE:
+		case CLOCK_BOOTTIME:
+			return 1;
+	}
+	return 0;
+}
+
+static int tk_realtime_clock(clockid_t clk) {
+	return clk == CLOCK_REALTIME || clk == CLOCK_REALTIME_COARSE;
+}
+
+static s64 tk_physical_now(void) {
+	struct timespec ts;
+
+	TK_REAL(clock_gettime);
+	real_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/***
+Virtual (monotonic) time of the container. Physical time if the process is not part of one or its clock has not
+started yet
+***/
+static s64 tk_virtual_now(void) {
+	struct tk_clock clock;
+	s64 now = tk_physical_now();
+
+	if (clock_slot == NULL)
+		return now;
+	tk_clock_read(clock_slot, &clock);
+	if (clock.virt_start_time == 0)
+		return now;
+	return vt_virtual_time(now, clock.virt_start_time, clock.freeze_time, clock.past_physical_time, clock.past_virtual_time, clock.tdf);
+}
+
+/***
+Physical time the container needs to advance its clock by the given virtual time, at least 1ns
+***/
+static s64 tk_physical_duration(s64 virtual_duration) {
+	s64 physical;
+	int tdf = clock_slot != NULL ? clock_slot->tdf : 0;
+
+	if (tdf > 0)
+		physical = virtual_duration * tdf / VT_PRECISION;
+	else if (tdf < 0)
+		physical = virtual_duration * VT_PRECISION / (tdf*-1);
+	else
+		physical = virtual_duration;
+	return physical > 0 ? physical : 1;
+}
+
+static s64 tk_virtual_duration(s64 physical_duration) {
+	int tdf = clock_slot != NULL ? clock_slot->tdf : 0;
+
+	if (tdf > 0)
+		return physical_duration * VT_PRECISION / tdf;
+	else if (tdf < 0)
+		return physical_duration * (tdf*-1) / VT_PRECISION;
+	return physical_duration;
+}
+
+static s64 tk_ts_to_ns(const struct timespec * ts) {
+	return (s64)ts->tv_sec*1000000000LL + ts->tv_nsec;
+}
+
+static void tk_ns_to_ts(s64 ns, struct timespec * ts) {
+	if (ns < 0)
+		ns = 0;
+	ts->tv_sec = ns / 1000000000LL;
+	ts->tv_nsec = ns % 1000000000LL;
+}
+
+/* poll/epoll timeout (ms) for the physical time the container needs to reach a virtual deadline, rounded up */
+static int tk_timeout_ms(s64 deadline) {
+	s64 physical = tk_physical_duration(deadline - tk_virtual_now());
+
+	if (physical > (s64)1000000 * 0x7fffffff)
+		return 0x7fffffff;
+	return (int)((physical + 999999) / 1000000);
+}
+
+/***
+Sleeps until the container's clock reaches deadline. Returns 0, or -1 with errno EINTR if a signal interrupted it
+***/
+static int tk_sleep_until(s64 deadline) {
+	struct timespec ts;
+	s64 now;
+
+	TK_REAL(nanosleep);
+	while ((now = tk_virtual_now()) < deadline) {
+		tk_ns_to_ts(tk_physical_duration(deadline - now), &ts);
+		if (real_nanosleep(&ts, NULL) < 0 && errno == EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+
+int clock_gettime(clockid_t clk, struct timespec * tp) {
+	s64 now;
+
+	if (clock_slot == NULL || !tk_dilated_clock(clk)) {
+		TK_REAL(clock_gettime);
+		return real_clock_gettime(clk, tp);
+	}
+	now = tk_virtual_now();
+	if (tk_realtime_clock(clk))
+		now += page->realtime_offset;
+	tk_ns_to_ts(now, tp);
+	return 0;
+}
+
+int gettimeofday(struct timeval * tv, void * tz) {
+	/* glibc declares tv nonnull, but NULL is valid: the volatile copy keeps the check from being optimized away */
+	struct timeval * volatile out = tv;
+	struct timespec ts;
+
+	/* the timezone is not dilated, and either argument may be NULL */
+	if (tz != NULL) {
+		TK_REAL(gettimeofday);
+		if (real_gettimeofday(NULL, tz) != 0)
+			return -1;
+	}
+	if (out == NULL)
+		return 0;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	out->tv_sec = ts.tv_sec;
+	out->tv_usec = ts.tv_nsec / 1000;
+	return 0;
+}
+
+time_t time(time_t * t) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (t != NULL)
+		*t = ts.tv_sec;
+	return ts.tv_sec;
+}
+
+int nanosleep(const struct timespec * req, struct timespec * rem) {
+	s64 deadline;
+
+	if (clock_slot == NULL) {
+		TK_REAL(nanosleep);
+		return real_nanosleep(req, rem);
+	}
+	if (req == NULL || req->tv_nsec < 0 || req->tv_nsec >= 1000000000L || req->tv_sec < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	deadline = tk_virtual_now() + tk_ts_to_ns(req);
+	if (tk_sleep_until(deadline) < 0) {
+		if (rem != NULL)
+			tk_ns_to_ts(deadline - tk_virtual_now(), rem);
+		return -1;
+	}
+	return 0;
+}
+
+int clock_nanosleep(clockid_t clk, int flags, const struct timespec * req, struct timespec * rem) {
+	s64 deadline;
+
+	if (clock_slot == NULL || !tk_dilated_clock(clk)) {
+		TK_REAL(clock_nanosleep);
+		return real_clock_nanosleep(clk, flags, req, rem);
+	}
+	if (req == NULL || req->tv_nsec < 0 || req->tv_nsec >= 1000000000L || req->tv_sec < 0)
+		return EINVAL;
+
+	if (flags & TIMER_ABSTIME) {
+		deadline = tk_ts_to_ns(req);
+		if (tk_realtime_clock(clk))
+			deadline -= page->realtime_offset;
+	}
+	else
+		deadline = tk_virtual_now() + tk_ts_to_ns(req);
+
+	if (tk_sleep_until(deadline) < 0) {
+		if (rem != NULL && !(flags & TIMER_ABSTIME))
+			tk_ns_to_ts(deadline - tk_virtual_now(), rem);
+		return EINTR;
+	}
+	return 0;
+}
+
+int usleep(useconds_t usec) {
+	struct timespec ts;
+
+	tk_ns_to_ts((s64)usec * 1000, &ts);
+	return nanosleep(&ts, NULL);
+}
+
+unsigned int sleep(unsigned int seconds) {
+	struct timespec ts, rem;
+
+	ts.tv_sec = seconds;
+	ts.tv_nsec = 0;
+	if (nanosleep(&ts, &rem) < 0)
+		return rem.tv_sec + (rem.tv_nsec > 0);
+	return 0;
+}
+
+int poll(struct pollfd * fds, nfds_t nfds, int timeout) {
+	s64 deadline;
+	int ret;
+
+	TK_REAL(poll);
+	if (clock_slot == NULL || timeout <= 0)
+		return real_poll(fds, nfds, timeout);
+
+	deadline = tk_virtual_now() + (s64)timeout * 1000000;
+	while (1) {
+		ret = real_poll(fds, nfds, tk_timeout_ms(deadline));
+		if (ret != 0 || tk_virtual_now() >= deadline)
+			return ret;
+	}
+}
+
+int select(int nfds, fd_set * readfds, fd_set * writefds, fd_set * exceptfds, struct timeval * timeout) {
+	fd_set r, w, e;
+	struct timeval tv;
+	s64 deadline, physical, now;
+	int ret;
+
+	TK_REAL(select);
+	if (clock_slot == NULL || timeout == NULL || (timeout->tv_sec == 0 && timeout->tv_usec == 0))
+		return real_select(nfds, readfds, writefds, exceptfds, timeout);
+
+	deadline = tk_virtual_now() + (s64)timeout->tv_sec*1000000000LL + (s64)timeout->tv_usec*1000;
+	while (1) {
+		/* select clears the sets on timeout, so every retry starts from the caller's sets */
+		if (readfds != NULL)
+			r = *readfds;
+		if (writefds != NULL)
+			w = *writefds;
+		if (exceptfds != NULL)
+			e = *exceptfds;
+
+		/* rounded up to whole microseconds, which may carry into the seconds */
+		physical = tk_physical_duration(deadline - tk_virtual_now()) + 999;
+		tv.tv_sec = physical / 1000000000LL;
+		tv.tv_usec = (physical % 1000000000LL) / 1000;
+		ret = real_select(nfds, readfds ? &r : NULL, writefds ? &w : NULL, exceptfds ? &e : NULL, &tv);
+
+		now = tk_virtual_now();
+		if (ret != 0 || now >= deadline) {
+			if (readfds != NULL)
+				*readfds = r;
+			if (writefds != NULL)
+				*writefds = w;
+			if (exceptfds != NULL)
+				*exceptfds = e;
+			if (now > deadline)
+				now = deadline;
+			timeout->tv_sec = (deadline - now) / 1000000000LL;
+			timeout->tv_usec = ((deadline - now) % 1000000000LL) / 1000;
+			return ret;
+		}
+	}
+}
+
+int epoll_wait(int epfd, struct epoll_event * events, int maxevents, int timeout) {
+	s64 deadline;
+	int ret;
+
+	TK_REAL(epoll_wait);
+	if (clock_slot == NULL || timeout <= 0)
+		return real_epoll_wait(epfd, events, maxevents, timeout);
+
+	deadline = tk_virtual_now() + (s64)timeout * 1000000;
+	while (1) {
+		ret = real_epoll_wait(epfd, events, maxevents, tk_timeout_ms(deadline));
+		if (ret != 0 || tk_virtual_now() >= deadline)
+			return ret;
+	}
+}
+
+int timerfd_create(int clk, int flags) {
+	int fd;
+
+	TK_REAL(timerfd_create);
+	fd = real_timerfd_create(clk, flags);
+	if (fd >= 0 && fd < TK_TIMERFD_MAX)
+		timerfd_clock[fd] = clk;
+	return fd;
+}
+
+/***
+Arms the timerfd with the physical time its container needs to reach the virtual expiration
+***/
+int timerfd_settime(int fd, int flags, const struct itimerspec * new_value, struct itimerspec * old_value) {
+	struct itimerspec physical;
+	s64 value;
+	int ret;
+
+	TK_REAL(timerfd_settime);
+	if (clock_slot == NULL || new_value == NULL || fd < 0 || fd >= TK_TIMERFD_MAX || !tk_dilated_clock(timerfd_clock[fd]))
+		return real_timerfd_settime(fd, flags, new_value, old_value);
+
+	physical = *new_value;
+	value = tk_ts_to_ns(&new_value->it_value);
+	if (value != 0) {
+		if (flags & TFD_TIMER_ABSTIME) {
+			if (tk_realtime_clock(timerfd_clock[fd]))
+				value -= page->realtime_offset;
+			value -= tk_virtual_now();
+		}
+		tk_ns_to_ts(tk_physical_duration(value), &physical.it_value);
+	}
+	if (tk_ts_to_ns(&new_value->it_interval) != 0)
+		tk_ns_to_ts(tk_physical_duration(tk_ts_to_ns(&new_value->it_interval)), &physical.it_interval);
+
+	ret = real_timerfd_settime(fd, flags & ~TFD_TIMER_ABSTIME, &physical, old_value);
+	if (ret == 0 && old_value != NULL) {
+		tk_ns_to_ts(tk_virtual_duration(tk_ts_to_ns(&old_value->it_value)), &old_value->it_value);
+		tk_ns_to_ts(tk_virtual_duration(tk_ts_to_ns(&old_value->it_interval)), &old_value->it_interval);
+	}
+	return ret;
+}
+
+int timerfd_gettime(int fd, struct itimerspec * curr_value) {
+	int ret;
+
+	TK_REAL(timerfd_gettime);
+	ret = real_timerfd_gettime(fd, curr_value);
+	if (ret == 0 && clock_slot != NULL && fd >= 0 && fd < TK_TIMERFD_MAX && tk_dilated_clock(timerfd_clock[fd])) {
+		tk_ns_to_ts(tk_virtual_duration(tk_ts_to_ns(&curr_value->it_value)), &curr_value->it_value);
+		tk_ns_to_ts(tk_virtual_duration(tk_ts_to_ns(&curr_value->it_interval)), &curr_value->it_interval);
+	}
+	return ret;
+}
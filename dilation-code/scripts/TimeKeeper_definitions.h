@@ -17,6 +17,17 @@
 #define RESET 'M'
 #define STOP_EXP 'N'
 #define SET_CBE_EXP_TIMESLICE 'T'
+#define SET_SCHED_GRANULARITY 'X'
+#define SET_GROUP_RUN 'Y'
+#define SET_EXP_CPUS 'Z'
+
+/* prefix of a command addressed to an experiment other than experiment 0: '@<id>,<command>' */
+#define EXPERIMENT_PREFIX '@'
+
+/* several commands can be written to /proc/dilation/status at once, one per line, up to TK_BATCH_MAXSIZE bytes
+(a longer write fails with EINVAL) */
+#define TK_BATCH_SEPARATOR '\n'
+#define TK_BATCH_MAXSIZE 65536
 
 #define DEBUG_PROC_INFO 'O'
 #define DEBUG_PROGRESS_EXP 'P'
@@ -27,6 +38,140 @@
 #define SET_NETDEVICE_OWNER 'U'
 #define PROGRESS_INTERVAL_CBE 'V'
 #define RESUME_CBE	'W'
+#define RESET_EXP 'a'
+#define SET_VT_COMPENSATION 'b'
+
+#ifndef __KERNEL__
+#include <sys/ioctl.h>
+#endif
+
+#define TK_IOC_MAGIC  'k'
+
+/* the original stats ioctl, fills a tk_legacy_stats_args for experiment 0. Kept for binaries built against it */
+#define TK_IO_GET_STATS _IOW(TK_IOC_MAGIC,  1, int)
+#define TK_IO_PROGRESS_CBE _IOWR(TK_IOC_MAGIC,  2, tk_progress_args)
+#define TK_IO_TIMELINE_HORIZON _IOWR(TK_IOC_MAGIC,  3, tk_horizon_args)
+#define TK_IO_ADD_BULK _IOWR(TK_IOC_MAGIC,  4, tk_bulk_args)
+#define TK_IO_GET_EXP_STATS _IOWR(TK_IOC_MAGIC,  5, ioctl_args)
+
+/* number of buckets in the log2 histograms. Bucket i counts values in [2^(i-1), 2^i) ns, bucket 0 counts values <= 0 */
+#define TK_HIST_BUCKETS 40
+
+/*
+Filled by TK_IO_GET_STATS: the original 24 byte layout
+*/
+typedef struct tk_legacy_stats_arg_struct {
+	long long round_error;
+	long long n_rounds;
+	long long round_error_sq;
+} tk_legacy_stats_args;
+
+/*
+Filled by TK_IO_GET_EXP_STATS on /proc/dilation/status. The first three fields are the ones of tk_legacy_stats_args; the
+rest are aggregated over all CPUs. experiment is set by the caller to the experiment to read the stats of.
+*/
+typedef struct ioctl_arg_struct {
+	long long round_error;
+	long long n_rounds;
+	long long round_error_sq;
+	long long n_timer_fires;
+	long long timer_lateness;
+	long long round_error_hist[TK_HIST_BUCKETS];
+	long long timer_lateness_hist[TK_HIST_BUCKETS];
+	long long experiment;
+} ioctl_args;
+
+/*
+Filled by TK_IO_PROGRESS_CBE: runs n_rounds rounds of a CBE experiment and holds it at the round barrier, n_rounds = 0
+only makes it stop at the next barrier. If until > 0, n_rounds is ignored and the experiment runs until its containers
+reach the virtual time until, the last round is shortened to end exactly there. virtual_time is the virtual time the
+experiment's containers have reached at the barrier and round_increase how far every round moves them.
+*/
+typedef struct tk_progress_arg_struct {
+	long long experiment;
+	long long n_rounds;
+	long long virtual_time;
+	long long round_increase;
+	long long until;
+} tk_progress_args;
+
+/*
+Filled by TK_IO_TIMELINE_HORIZON: lets a CS timeline advance on its own, window after window, up to safe_time + its
+lookahead. lookahead (ns) is set if >= 0, the horizon is moved if safe_time >= 0, and the call waits until the timeline
+has reached wait_time (or cannot get further) if wait_time >= 0. virtual_time is the virtual time every container of
+the timeline has reached. All virtual times are in ns since the experiment was synchronized.
+*/
+typedef struct tk_horizon_arg_struct {
+	long long experiment;
+	long long timeline;
+	long long lookahead;
+	long long safe_time;
+	long long wait_time;
+	long long virtual_time;
+} tk_horizon_args;
+
+
+/*
+One container of TK_IO_ADD_BULK. tdf is the TDF as fixDilation returns it (2.0 -> 2000, 0.5 -> -2000, 1.0 -> 0), the
+container and its children are dilated before it is added. timeline < 0 adds it to a CBE experiment spanning n_vcpus
+experiment CPUs, otherwise to that timeline of a CS experiment.
+*/
+typedef struct tk_bulk_entry_struct {
+	int pid;
+	int tdf;
+	int timeline;
+	int n_vcpus;
+} tk_bulk_entry;
+
+/* most containers a single TK_IO_ADD_BULK adds */
+#define TK_BULK_MAX 4096
+
+/*
+Filled by TK_IO_ADD_BULK: adds the n_entries containers of the array at entries (a pointer) to the experiment in one
+call. n_added is the number of containers that were actually added.
+*/
+typedef struct tk_bulk_arg_struct {
+	long long experiment;
+	long long entries;
+	long long n_entries;
+	long long n_added;
+} tk_bulk_args;
+
+/*
+Clock table the module exposes read-only at /proc/dilation/clocks (mmap it, see mapClockTable). Every container of every
+experiment has a slot with its pid, experiment, state, TDF and the virtual time it had the last time it was thawed or
+frozen. round counts the slices (CBE rounds, or CS progress windows) it has run. A slot is being written while seq is
+odd, a reader copies it until seq is the same even value before and after.
+*/
+#define TK_CLOCK_TABLE_NAME "clocks"
+#define TK_CLOCK_TABLE_FILE "/proc/dilation/clocks"
+#define TK_CLOCK_TABLE_MAGIC 0x544b4354
+#define TK_CLOCK_TABLE_SLOTS 512
+
+/* state of a clock table slot */
+#define TK_CLOCK_FREE 0
+#define TK_CLOCK_FROZEN 1
+#define TK_CLOCK_RUNNING 2
+#define TK_CLOCK_EXITED 3
+
+typedef struct tk_clock_entry_struct {
+	volatile unsigned int seq;
+	int pid;
+	int experiment;
+	int state;
+	int tdf;
+	int pad0;
+	long long virtual_time;
+	long long round;
+	long long updated;
+	char pad[16];
+} __attribute__((aligned(64))) tk_clock_entry;
 
+typedef struct tk_clock_table_struct {
+	unsigned int magic;
+	unsigned int n_slots;
+	char pad[56];
+	tk_clock_entry clocks[TK_CLOCK_TABLE_SLOTS];
+} tk_clock_table;
 
 #endif
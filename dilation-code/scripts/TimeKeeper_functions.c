@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/mman.h>
 #include "TimeKeeper_functions.h"
 #include "TimeKeeper_definitions.h"
 #include "utility_functions.h"
@@ -120,6 +121,59 @@ int addToExp(int pid, int timeline) {
         return -1;
 }
 
+/*
+Given a pid, add that container to a CBE experiment as a multi core container spanning n_vcpus experiment CPUs
+*/
+int addToExpMultiCore(int pid, int n_vcpus) {
+        if (is_root() && isModuleLoaded()) {
+                char command[100];
+                sprintf(command, "%c,%d,%d", ADD_TO_EXP_CBE, pid, n_vcpus);
+		if (send_to_timekeeper(command) == -1)
+			return -1;
+                return 0;
+        }
+        return -1;
+}
+
+/*
+Adds n containers in a single call: pids[i] gets the TDF dilations[i] (with all its children) and is added to a CBE
+experiment if timelines is NULL or timelines[i] < 0, to timeline timelines[i] of a CS experiment otherwise. The
+containers are set up in parallel by synchronizeAndFreeze. Returns the number of containers added, -1 on error
+*/
+int addToExpBulk(int n, int * pids, double * dilations, int * timelines) {
+	tk_bulk_args args;
+	tk_bulk_entry * entries;
+	int fd;
+	int ret;
+	int i;
+
+	if (!is_root() || !isModuleLoaded() || n <= 0 || n > TK_BULK_MAX)
+		return -1;
+	entries = malloc(n * sizeof(tk_bulk_entry));
+	if (entries == NULL)
+		return -1;
+	for (i = 0; i < n; i++) {
+		entries[i].pid = pids[i];
+		entries[i].tdf = fixDilation(dilations[i]);
+		entries[i].timeline = timelines != NULL ? timelines[i] : -1;
+		entries[i].n_vcpus = 1;
+	}
+
+	ret = -1;
+	fd = open("/proc/dilation/status", O_RDWR);
+	if (fd != -1) {
+		args.experiment = tk_experiment;
+		args.entries = (long long)(unsigned long)entries;
+		args.n_entries = n;
+		args.n_added = 0;
+		if (ioctl(fd, TK_IO_ADD_BULK, &args) == 0)
+			ret = (int)args.n_added;
+		close(fd);
+	}
+	free(entries);
+	return ret;
+}
+
 /*
 Starts a CBE Experiment
 */
@@ -147,6 +201,74 @@ int synchronizeAndFreeze() {
         return -1;
 }
 
+/*
+Sets the virtual time (nanoseconds) every container advances per round in a CBE experiment
+*/
+int setCBETimeslice(long timeslice) {
+        if (is_root() && isModuleLoaded()) {
+                char command[100];
+                sprintf(command, "%c,%ld", SET_CBE_EXP_TIMESLICE, timeslice);
+		if (send_to_timekeeper(command) == -1)
+			return -1;
+                return 0;
+        }
+        return -1;
+}
+
+/*
+Sets the physical time (nanoseconds, at TDF 1) a thread inside a container of the experiment runs for each time it is picked
+*/
+int setSchedGranularity(long granularity) {
+        if (is_root() && isModuleLoaded()) {
+                char command[100];
+                sprintf(command, "%c,%ld", SET_SCHED_GRANULARITY, granularity);
+		if (send_to_timekeeper(command) == -1)
+			return -1;
+                return 0;
+        }
+        return -1;
+}
+
+/*
+Given the pid of a container in the experiment, run all of its runnable threads at once for its whole turn (enable = 1)
+instead of one thread per slice (enable = 0)
+*/
+int setGroupRun(int pid, int enable) {
+        if (is_root() && isModuleLoaded()) {
+                char command[100];
+                sprintf(command, "%c,%d,%d", SET_GROUP_RUN, pid, enable);
+		if (send_to_timekeeper(command) == -1)
+			return -1;
+                return 0;
+        }
+        return -1;
+}
+
+/*
+Selects the experiment the following commands of this process are sent to. Experiment 0 is the default one
+*/
+int selectExperiment(int id) {
+	if (id < 0)
+		return -1;
+	tk_experiment = id;
+	return 0;
+}
+
+/*
+Sets the CPUs the containers of the selected experiment run on: n_cpus CPUs starting at first_cpu. Must be called before
+any container is added, and the CPUs must not be used by another experiment
+*/
+int setExperimentCpus(int first_cpu, int n_cpus) {
+        if (is_root() && isModuleLoaded()) {
+                char command[100];
+                sprintf(command, "%c,%d,%d", SET_EXP_CPUS, first_cpu, n_cpus);
+		if (send_to_timekeeper(command) == -1)
+			return -1;
+                return 0;
+        }
+        return -1;
+}
+
 /*
 Set the interval in which a pid in a given timeline should advance (microsends) (CS)
 */
@@ -246,6 +368,188 @@ int stopExp() {
         return -1;
 }
 
+/*
+Runs a CBE experiment for n_rounds more rounds, then holds it at the round barrier. Returns once the rounds are done
+*/
+int progressExpCBE(int n_rounds) {
+	if (is_root() && isModuleLoaded() && n_rounds > 0) {
+                char command[100];
+                sprintf(command, "%c,%d", PROGRESS_INTERVAL_CBE, n_rounds);
+		if (send_to_timekeeper(command) == -1)
+			return -1;
+                return 0;
+        }
+        return -1;
+}
+
+/*
+Lets a CBE experiment that was held by progressExpCBE run freely again
+*/
+int resumeExpCBE() {
+	if (is_root() && isModuleLoaded()) {
+                char command[100];
+                sprintf(command, "%c", RESUME_CBE);
+		if (send_to_timekeeper(command) == -1)
+			return -1;
+                return 0;
+        }
+        return -1;
+}
+
+/*
+Restarts a synchronized experiment at the current time without stopping it: the containers, sync threads and hooked system
+calls are kept. A CBE experiment must be frozen or held at the round barrier
+*/
+int resetExp() {
+	if (is_root() && isModuleLoaded()) {
+                char command[100];
+                sprintf(command, "%c", RESET_EXP);
+		if (send_to_timekeeper(command) == -1)
+			return -1;
+                return 0;
+        }
+        return -1;
+}
+
+/*
+Turns the overrun feedback of a CBE experiment on (1) or off (0). With it, a container that keeps running past the end
+of its slices gets them cut short by the overrun learned so far
+*/
+int setVTCompensation(int enable) {
+	if (is_root() && isModuleLoaded()) {
+                char command[100];
+                sprintf(command, "%c,%d", SET_VT_COMPENSATION, enable ? 1 : 0);
+		if (send_to_timekeeper(command) == -1)
+			return -1;
+                return 0;
+        }
+        return -1;
+}
+
+/*
+Runs a CBE experiment for args->n_rounds more rounds and holds it at the round barrier (n_rounds = 0 only makes it stop at
+the next barrier). On return, args holds the virtual time the containers reached and the virtual time of one round
+*/
+int progressExpCBEBarrier(tk_progress_args * args) {
+	int fd;
+	int ret;
+
+	if (is_root() && isModuleLoaded()) {
+		fd = open("/proc/dilation/status", O_RDWR);
+		if (fd == -1)
+			return -1;
+		args->experiment = tk_experiment;
+		ret = ioctl(fd, TK_IO_PROGRESS_CBE, args);
+		close(fd);
+		return ret;
+	}
+	return -1;
+}
+
+/*
+Runs a CBE experiment until its containers reach the virtual time until (in the units of tk_progress_args.virtual_time)
+and holds it at the round barrier, the last round is shortened so it ends exactly there. Returns the virtual time reached
+*/
+long long progressExpCBEUntil(long long until) {
+	tk_progress_args args;
+
+	memset(&args, 0, sizeof(args));
+	args.until = until;
+	if (until <= 0 || progressExpCBEBarrier(&args) < 0)
+		return -1;
+	return args.virtual_time;
+}
+
+/*
+Moves the horizon of a CS timeline, see setTimelineHorizon in TimeKeeper_functions.h
+*/
+long long setTimelineHorizon(int timeline, long long lookahead, long long safe_time, long long wait_time) {
+	tk_horizon_args args;
+	int fd;
+	int ret;
+
+	if (is_root() && isModuleLoaded()) {
+		fd = open("/proc/dilation/status", O_RDWR);
+		if (fd == -1)
+			return -1;
+		args.experiment = tk_experiment;
+		args.timeline = timeline;
+		args.lookahead = lookahead;
+		args.safe_time = safe_time;
+		args.wait_time = wait_time;
+		args.virtual_time = 0;
+		ret = ioctl(fd, TK_IO_TIMELINE_HORIZON, &args);
+		close(fd);
+		if (ret < 0)
+			return -1;
+		return args.virtual_time;
+	}
+	return -1;
+}
+
+/*
+Maps the clock table of the module (/proc/dilation/clocks) read-only. The mapping stays valid for as long as the module
+is loaded, readClockTable then copies the clocks out of it without a system call. Returns NULL on error
+*/
+tk_clock_table * mapClockTable() {
+	tk_clock_table * table;
+	int fd;
+
+	fd = open(TK_CLOCK_TABLE_FILE, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	table = mmap(NULL, sizeof(tk_clock_table), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (table == MAP_FAILED)
+		return NULL;
+	if (table->magic != TK_CLOCK_TABLE_MAGIC) {
+		munmap(table, sizeof(tk_clock_table));
+		return NULL;
+	}
+	return table;
+}
+
+/*
+Copies the clocks of every container in the table (at most max of them) into clocks, each one consistent. Returns
+the number of clocks copied
+*/
+int readClockTable(tk_clock_table * table, tk_clock_entry * clocks, int max) {
+	unsigned int seq;
+	int i, n = 0;
+
+	for (i = 0; i < TK_CLOCK_TABLE_SLOTS && n < max; i++) {
+		do {
+			while ((seq = table->clocks[i].seq) & 1)
+				;
+			__sync_synchronize();
+			clocks[n] = table->clocks[i];
+			__sync_synchronize();
+		} while (table->clocks[i].seq != seq);
+		if (clocks[n].state != TK_CLOCK_FREE)
+			n++;
+	}
+	return n;
+}
+
+/*
+Reads the experiment statistics (round error, hrtimer lateness and their histograms). The counters are reset by the read
+*/
+int getExpStats(ioctl_args * stats) {
+	int fd;
+	int ret;
+
+	if (is_root() && isModuleLoaded()) {
+		fd = open("/proc/dilation/status", O_RDWR);
+		if (fd == -1)
+			return -1;
+		stats->experiment = tk_experiment;
+		ret = ioctl(fd, TK_IO_GET_EXP_STATS, stats);
+		close(fd);
+		return ret;
+	}
+	return -1;
+}
+
 /*
 Sets the TDF of the given pid
 */
@@ -1,4 +1,5 @@
 #include <sys/time.h>
+#include "TimeKeeper_definitions.h"
 
 #define MAX_PAYLOAD 1024
 #define NETLINK_USER 31
@@ -62,12 +63,33 @@ else, it represents a specific timeline in a CS experiment
 */
 int addToExp(int pid, int timeline);
 
+//Given a pid, add that container to a CBE experiment as a multi core container spanning n_vcpus experiment CPUs
+int addToExpMultiCore(int pid, int n_vcpus);
+
+//Adds n containers with their TDFs at once, to timelines[i] of a CS experiment or to a CBE experiment if timelines is NULL. Returns the number added
+int addToExpBulk(int n, int * pids, double * dilations, int * timelines);
+
 //Given all Pids added to experiment, will set all their virtual times to be the same, then freeze them all (CBE and CS)
 int synchronizeAndFreeze();
 
 //Starts a CBE Experiment
 int startExp();
 
+//Sets the virtual time (nanoseconds) every container advances per round in a CBE experiment
+int setCBETimeslice(long timeslice);
+
+//Sets the physical time (nanoseconds, at TDF 1) a thread inside a container runs for each time it is picked
+int setSchedGranularity(long granularity);
+
+//Given the pid of a container in the experiment, run all of its runnable threads at once for its whole turn (enable = 1) instead of one thread per slice (enable = 0)
+int setGroupRun(int pid, int enable);
+
+//Selects the experiment the following commands of this process are sent to. Experiment 0 is the default one
+int selectExperiment(int id);
+
+//Sets the CPUs the containers of the selected experiment run on. Must be called before any container is added
+int setExperimentCpus(int first_cpu, int n_cpus);
+
 //Set the interval in which a pid in a given timeline should advance (microsends) (CS)
 int setInterval(int pid, int interval, int timeline);
 
@@ -82,6 +104,41 @@ int progress(int timeline, int force);
 //Reset all pre-specifed intervals for a given timeline (CS)
 int reset(int timeline);
 
+/*
+Lookahead based progress (CS): the timeline advances by its intervals on its own, up to safe_time + lookahead, while the
+caller goes on. lookahead is set if >= 0, the horizon moves if safe_time >= 0 and the call waits until the timeline has
+reached wait_time if wait_time >= 0. Times are in ns of virtual time since synchronizeAndFreeze. Returns the virtual time
+the timeline has reached, -1 on error
+*/
+long long setTimelineHorizon(int timeline, long long lookahead, long long safe_time, long long wait_time);
+
+//Runs a CBE experiment for n_rounds more rounds, then holds it at the round barrier (blocks until the rounds are done)
+int progressExpCBE(int n_rounds);
+
+//Lets a CBE experiment held by progressExpCBE run freely again
+int resumeExpCBE();
+
+//Restarts a synchronized experiment (frozen, or CBE held at the round barrier) at the current time, keeping its containers and sync threads. For back to back runs of a parameter sweep
+int resetExp();
+
+//Turns the overrun feedback of a CBE experiment on (1) or off (0), so larger timeslices keep the same accuracy. See the overshoot and residual columns of /proc/dilation/stats
+int setVTCompensation(int enable);
+
+//Runs args->n_rounds rounds of a CBE experiment and holds it at the round barrier, returning the virtual time reached (see tk_progress_args)
+int progressExpCBEBarrier(tk_progress_args * args);
+
+//Runs a CBE experiment until its containers reach the virtual time until, shortening the last round, and holds it at the barrier. Returns the virtual time reached
+long long progressExpCBEUntil(long long until);
+
+//Maps the container clock table of the module read-only (see tk_clock_table), NULL on error
+tk_clock_table * mapClockTable();
+
+//Copies a consistent snapshot of every container clock in the table (at most max), returns the number copied
+int readClockTable(tk_clock_table * table, tk_clock_entry * clocks, int max);
+
+//Reads (and resets) the experiment statistics, see ioctl_args in TimeKeeper_definitions.h
+int getExpStats(ioctl_args * stats);
+
 //Stop a running experiment (CBE or CS) **Do not call stopExp if you are waiting for a progress() to return!!**
 int stopExp();
 
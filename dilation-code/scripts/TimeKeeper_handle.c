@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "TimeKeeper_handle.h"
+#include "utility_functions.h"
+
+/* longest command the module parses, see STATUS_MAXSIZE in dilation_module.h */
+#define TK_MAX_COMMAND 1004
+
+/*
+Opens a handle on the TimeKeeper module. Commands of the handle are addressed to the given experiment
+*/
+tk_handle * tkOpen(int experiment) {
+	tk_handle * handle;
+
+	if (experiment < 0 || !is_root() || !isModuleLoaded())
+		return NULL;
+
+	handle = malloc(sizeof(tk_handle));
+	if (handle == NULL)
+		return NULL;
+	handle->fd = open(FILENAME, O_WRONLY);
+	if (handle->fd == -1) {
+		free(handle);
+		return NULL;
+	}
+	handle->experiment = experiment;
+	handle->batch_len = 0;
+	handle->n_queued = 0;
+	pthread_mutex_init(&handle->lock, NULL);
+	return handle;
+}
+
+/*
+Writes the batch to the module. Must hold the handle's lock
+*/
+static int tk_write_batch(tk_handle * handle) {
+	int n_queued = handle->n_queued;
+	int ret;
+
+	if (handle->batch_len == 0)
+		return 0;
+	do {
+		ret = write(handle->fd, handle->batch, handle->batch_len);
+	} while (ret == -1 && errno == EINTR);
+
+	handle->batch_len = 0;
+	handle->n_queued = 0;
+	if (ret == -1)
+		return -1;
+	return n_queued;
+}
+
+/*
+Appends a command to the batch, with the experiment prefix and the trailing comma send_to_timekeeper adds as well.
+Must hold the handle's lock
+*/
+static int tk_append(tk_handle * handle, const char * cmd) {
+	char line[TK_MAX_COMMAND];
+	int len;
+
+	if (handle->experiment != 0)
+		len = snprintf(line, sizeof(line), "%c%d,%s,%c", EXPERIMENT_PREFIX, handle->experiment, cmd, TK_BATCH_SEPARATOR);
+	else
+		len = snprintf(line, sizeof(line), "%s,%c", cmd, TK_BATCH_SEPARATOR);
+	if (len < 0 || len >= (int)sizeof(line))
+		return -1;
+
+	if (handle->batch_len + len > TK_BATCH_MAXSIZE && tk_write_batch(handle) == -1)
+		return -1;
+	memcpy(handle->batch + handle->batch_len, line, len);
+	handle->batch_len += len;
+	handle->n_queued++;
+	return 0;
+}
+
+int tkQueue(tk_handle * handle, const char * cmd) {
+	int ret;
+
+	pthread_mutex_lock(&handle->lock);
+	ret = tk_append(handle, cmd);
+	pthread_mutex_unlock(&handle->lock);
+	return ret;
+}
+
+int tkFlush(tk_handle * handle) {
+	int ret;
+
+	pthread_mutex_lock(&handle->lock);
+	ret = tk_write_batch(handle);
+	pthread_mutex_unlock(&handle->lock);
+	return ret;
+}
+
+/*
+Sends a command right away, together with whatever was queued before it. Blocking commands (progress, stopExp) return
+once the module is done with them, like with send_to_timekeeper
+*/
+int tkSend(tk_handle * handle, const char * cmd) {
+	int ret;
+
+	pthread_mutex_lock(&handle->lock);
+	ret = tk_append(handle, cmd);
+	if (ret == 0)
+		ret = tk_write_batch(handle) == -1 ? -1 : 0;
+	pthread_mutex_unlock(&handle->lock);
+	return ret;
+}
+
+int tkClose(tk_handle * handle) {
+	int ret;
+
+	ret = tkFlush(handle);
+	close(handle->fd);
+	pthread_mutex_destroy(&handle->lock);
+	free(handle);
+	return ret == -1 ? -1 : 0;
+}
+
+static int tk_dilate_command(tk_handle * handle, char command_char, int pid, double dilation) {
+	char command[100];
+	int dil;
+
+	if ((dil = fixDilation(dilation)) == -1)
+		return -1;
+	if (dil < 0)
+		sprintf(command, "%c,%d,1,%d", command_char, pid, dil*-1);
+	else
+		sprintf(command, "%c,%d,%d", command_char, pid, dil);
+	return tkQueue(handle, command);
+}
+
+int tkDilate(tk_handle * handle, int pid, double dilation) {
+	return tk_dilate_command(handle, DILATE, pid, dilation);
+}
+
+int tkDilateAll(tk_handle * handle, int pid, double dilation) {
+	return tk_dilate_command(handle, DILATE_ALL, pid, dilation);
+}
+
+int tkLeap(tk_handle * handle, int pid, int interval) {
+	char command[100];
+
+	if (interval <= 0)
+		return -1;
+	sprintf(command, "%c,%d,%d", LEAP, pid, interval);
+	return tkQueue(handle, command);
+}
+
+int tkAddToExp(tk_handle * handle, int pid, int timeline) {
+	char command[100];
+
+	if (timeline < 0)
+		sprintf(command, "%c,%d", ADD_TO_EXP_CBE, pid);
+	else
+		sprintf(command, "%c,%d,%d", ADD_TO_EXP_CS, pid, timeline);
+	return tkQueue(handle, command);
+}
+
+int tkAddToExpMultiCore(tk_handle * handle, int pid, int n_vcpus) {
+	char command[100];
+
+	sprintf(command, "%c,%d,%d", ADD_TO_EXP_CBE, pid, n_vcpus);
+	return tkQueue(handle, command);
+}
+
+int tkSetInterval(tk_handle * handle, int pid, int interval, int timeline) {
+	char command[100];
+
+	sprintf(command, "%c,%d,%d,%d", SET_INTERVAL, pid, interval, timeline);
+	return tkQueue(handle, command);
+}
+
+int tkSetGroupRun(tk_handle * handle, int pid, int enable) {
+	char command[100];
+
+	sprintf(command, "%c,%d,%d", SET_GROUP_RUN, pid, enable);
+	return tkQueue(handle, command);
+}
+
+int tkFreeze(tk_handle * handle, int pid) {
+	char command[100];
+
+	sprintf(command, "%c,%d,%d", FREEZE_OR_UNFREEZE, pid, SIGSTOP);
+	return tkQueue(handle, command);
+}
+
+int tkUnfreeze(tk_handle * handle, int pid) {
+	char command[100];
+
+	sprintf(command, "%c,%d,%d", FREEZE_OR_UNFREEZE, pid, SIGCONT);
+	return tkQueue(handle, command);
+}
+
+int tkResetExp(tk_handle * handle) {
+	char command[100];
+
+	sprintf(command, "%c", RESET_EXP);
+	return tkQueue(handle, command);
+}
+
+/*
+The queued commands go first, so containers dilated or configured by them are added afterwards
+*/
+int tkAddToExpBulk(tk_handle * handle, tk_bulk_entry * entries, int n) {
+	tk_bulk_args args;
+	int ret;
+
+	if (n <= 0 || n > TK_BULK_MAX)
+		return -1;
+	args.experiment = handle->experiment;
+	args.entries = (long long)(unsigned long)entries;
+	args.n_entries = n;
+	args.n_added = 0;
+
+	pthread_mutex_lock(&handle->lock);
+	ret = tk_write_batch(handle);
+	if (ret != -1)
+		ret = ioctl(handle->fd, TK_IO_ADD_BULK, &args);
+	pthread_mutex_unlock(&handle->lock);
+	if (ret == -1)
+		return -1;
+	return (int)args.n_added;
+}
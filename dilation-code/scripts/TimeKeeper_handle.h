@@ -0,0 +1,54 @@
+#ifndef __TIMEKEEPER_HANDLE__
+#define __TIMEKEEPER_HANDLE__
+
+#include <pthread.h>
+#include "TimeKeeper_definitions.h"
+
+/*
+A handle on the TimeKeeper module (libtimekeeper.so). It keeps /proc/dilation/status open and checks for root and the
+module only once, when it is opened. Commands are either sent right away (tkSend) or queued (tkQueue and the tk*
+helpers below) and written all at once, one per line, by tkFlush. A batch is flushed on its own when it is full, and
+before any command that is sent right away, so the module always sees the commands in the order they were given.
+Every call takes the handle's lock, so several threads can share one handle.
+*/
+typedef struct tk_handle_struct {
+	int fd;
+	int experiment;					// commands of the handle are addressed to this experiment
+	pthread_mutex_t lock;
+	char batch[TK_BATCH_MAXSIZE];
+	int batch_len;
+	int n_queued;
+} tk_handle;
+
+//Opens a handle whose commands go to the given experiment (0 is the default one). NULL if not root or the module is not loaded
+tk_handle * tkOpen(int experiment);
+
+//Flushes the queued commands and closes the handle
+int tkClose(tk_handle * handle);
+
+//Sends a command right away (after the queued ones), ie "H" for synchronizeAndFreeze
+int tkSend(tk_handle * handle, const char * cmd);
+
+//Queues a command, it is sent with the next tkFlush (or tkSend)
+int tkQueue(tk_handle * handle, const char * cmd);
+
+//Sends all queued commands in a single write. Returns the number of commands sent, -1 on error
+int tkFlush(tk_handle * handle);
+
+// Queued commands, same arguments as the functions of TimeKeeper_functions.h **********************
+
+int tkDilate(tk_handle * handle, int pid, double dilation);
+int tkDilateAll(tk_handle * handle, int pid, double dilation);
+int tkLeap(tk_handle * handle, int pid, int interval);
+int tkAddToExp(tk_handle * handle, int pid, int timeline);
+int tkAddToExpMultiCore(tk_handle * handle, int pid, int n_vcpus);
+int tkSetInterval(tk_handle * handle, int pid, int interval, int timeline);
+int tkSetGroupRun(tk_handle * handle, int pid, int enable);
+int tkFreeze(tk_handle * handle, int pid);
+int tkUnfreeze(tk_handle * handle, int pid);
+int tkResetExp(tk_handle * handle);
+
+//Adds n containers in one ioctl (TK_IO_ADD_BULK) after the queued commands, returns the number added or -1
+int tkAddToExpBulk(tk_handle * handle, tk_bulk_entry * entries, int n);
+
+#endif
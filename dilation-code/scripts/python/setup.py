@@ -0,0 +1,11 @@
+#
+# Builds _timekeeper, the native Python binding of libtimekeeper: python setup.py build_ext --inplace
+#
+
+from distutils.core import setup, Extension
+
+setup(name = "timekeeper",
+	ext_modules = [Extension("_timekeeper",
+		sources = ["timekeeper_module.c", "../TimeKeeper_handle.c", "../utility_functions.c"],
+		include_dirs = [".."],
+		libraries = ["pthread"])])
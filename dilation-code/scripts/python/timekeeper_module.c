@@ -0,0 +1,413 @@
+#include <Python.h>
+#include "../TimeKeeper_handle.h"
+#include "../utility_functions.h"
+
+/***
+Native Python binding of libtimekeeper (TimeKeeper_handle.h), built with setup.py next to this file:
+
+	import _timekeeper
+	tk = _timekeeper.Handle(0)
+	for pid in pids :
+		tk.dilate(pid, 2.0)
+		tk.add_to_exp(pid)
+	tk.flush()
+	tk.send("H")
+
+The GIL is released around every call that uses the handle, since even a queued call writes the batch to the module
+when it is full, and that can block (progress, stopExp).
+***/
+
+typedef struct {
+	PyObject_HEAD
+	tk_handle * handle;
+	tk_handle * closing;			// closed handle some calls still use, the last one of them closes it
+	int users;						// calls using the handle with the GIL released
+} HandleObject;
+
+static PyObject * handle_closed(void) {
+	PyErr_SetString(PyExc_ValueError, "TimeKeeper handle is closed");
+	return NULL;
+}
+
+static PyObject * handle_result(int ret) {
+	if (ret < 0) {
+		PyErr_SetString(PyExc_IOError, "TimeKeeper command failed");
+		return NULL;
+	}
+	return PyLong_FromLong(ret);
+}
+
+/*
+Takes the handle for a call that releases the GIL, NULL if it is closed. Must hold the GIL
+*/
+static tk_handle * handle_acquire(HandleObject * self) {
+	if (self->handle != NULL)
+		self->users++;
+	return self->handle;
+}
+
+/*
+Gives the handle back after the call (GIL held again), and closes it if close() was called meanwhile
+*/
+static PyObject * handle_release(HandleObject * self, tk_handle * handle, int ret) {
+	if (--self->users == 0 && self->closing == handle) {
+		self->closing = NULL;
+		Py_BEGIN_ALLOW_THREADS
+		tkClose(handle);
+		Py_END_ALLOW_THREADS
+	}
+	return handle_result(ret);
+}
+
+static int Handle_init(HandleObject * self, PyObject * args, PyObject * kwds) {
+	int experiment = 0;
+
+	if (!PyArg_ParseTuple(args, "|i", &experiment))
+		return -1;
+	self->closing = NULL;
+	self->users = 0;
+	self->handle = tkOpen(experiment);
+	if (self->handle == NULL) {
+		PyErr_SetString(PyExc_IOError, "cannot open /proc/dilation/status (not root, or the module is not loaded)");
+		return -1;
+	}
+	return 0;
+}
+
+static void Handle_dealloc(HandleObject * self) {
+	if (self->handle != NULL)
+		tkClose(self->handle);
+	if (self->closing != NULL)
+		tkClose(self->closing);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject * Handle_close(HandleObject * self) {
+	tk_handle * handle = self->handle;
+	int ret = 0;
+
+	/* detached while the GIL is held, so no other thread can take it once it is being closed */
+	self->handle = NULL;
+	if (handle == NULL)
+		return handle_result(0);
+	if (self->users > 0) {
+		self->closing = handle;
+		return handle_result(0);
+	}
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkClose(handle);
+	Py_END_ALLOW_THREADS
+	return handle_result(ret);
+}
+
+static PyObject * Handle_flush(HandleObject * self) {
+	tk_handle * handle;
+	int ret;
+
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkFlush(handle);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_send(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	const char * cmd;
+	int ret;
+
+	if (!PyArg_ParseTuple(args, "s", &cmd))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkSend(handle, cmd);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+/* tkQueue flushes a full batch on its own, which can block on a command in it, so the GIL is released for it too */
+static PyObject * Handle_queue(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	const char * cmd;
+	int ret;
+
+	if (!PyArg_ParseTuple(args, "s", &cmd))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkQueue(handle, cmd);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_dilate(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	int ret;
+	int pid;
+	double dilation;
+
+	if (!PyArg_ParseTuple(args, "id", &pid, &dilation))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkDilate(handle, pid, dilation);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_dilate_all(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	int ret;
+	int pid;
+	double dilation;
+
+	if (!PyArg_ParseTuple(args, "id", &pid, &dilation))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkDilateAll(handle, pid, dilation);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_leap(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	int ret;
+	int pid, interval;
+
+	if (!PyArg_ParseTuple(args, "ii", &pid, &interval))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkLeap(handle, pid, interval);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_add_to_exp(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	int ret;
+	int pid, n_vcpus = 1;
+
+	if (!PyArg_ParseTuple(args, "i|i", &pid, &n_vcpus))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	if (n_vcpus > 1)
+		ret = tkAddToExpMultiCore(handle, pid, n_vcpus);
+	else
+		ret = tkAddToExp(handle, pid, -1);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_add_to_cs_exp(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	int ret;
+	int pid, timeline;
+
+	if (!PyArg_ParseTuple(args, "ii", &pid, &timeline))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkAddToExp(handle, pid, timeline);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_set_interval(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	int ret;
+	int pid, interval, timeline;
+
+	if (!PyArg_ParseTuple(args, "iii", &pid, &interval, &timeline))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkSetInterval(handle, pid, interval, timeline);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_set_group_run(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	int ret;
+	int pid, enable;
+
+	if (!PyArg_ParseTuple(args, "ii", &pid, &enable))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkSetGroupRun(handle, pid, enable);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_freeze(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	int ret;
+	int pid;
+
+	if (!PyArg_ParseTuple(args, "i", &pid))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkFreeze(handle, pid);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_unfreeze(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	int ret;
+	int pid;
+
+	if (!PyArg_ParseTuple(args, "i", &pid))
+		return NULL;
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkUnfreeze(handle, pid);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_reset_exp(HandleObject * self) {
+	tk_handle * handle;
+	int ret;
+
+	if ((handle = handle_acquire(self)) == NULL)
+		return handle_closed();
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkResetExp(handle);
+	Py_END_ALLOW_THREADS
+	return handle_release(self, handle, ret);
+}
+
+static PyObject * Handle_add_bulk(HandleObject * self, PyObject * args) {
+	tk_handle * handle;
+	PyObject * containers, * seq;
+	tk_bulk_entry * entries;
+	Py_ssize_t i, n;
+	int ret;
+
+	if (!PyArg_ParseTuple(args, "O", &containers))
+		return NULL;
+	seq = PySequence_Fast(containers, "add_bulk expects a list of (pid, tdf[, timeline])");
+	if (seq == NULL)
+		return NULL;
+	n = PySequence_Fast_GET_SIZE(seq);
+	if (n == 0) {
+		Py_DECREF(seq);
+		return PyLong_FromLong(0);
+	}
+	entries = PyMem_Malloc(n * sizeof(tk_bulk_entry));
+	if (entries == NULL) {
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+	for (i = 0; i < n; i++) {
+		double dilation;
+
+		entries[i].timeline = -1;
+		entries[i].n_vcpus = 1;
+		if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "id|i", &entries[i].pid, &dilation, &entries[i].timeline)) {
+			PyMem_Free(entries);
+			Py_DECREF(seq);
+			return NULL;
+		}
+		entries[i].tdf = fixDilation(dilation);
+	}
+	Py_DECREF(seq);
+
+	if ((handle = handle_acquire(self)) == NULL) {
+		PyMem_Free(entries);
+		return handle_closed();
+	}
+	Py_BEGIN_ALLOW_THREADS
+	ret = tkAddToExpBulk(handle, entries, (int)n);
+	Py_END_ALLOW_THREADS
+	PyMem_Free(entries);
+	return handle_release(self, handle, ret);
+}
+
+static PyMethodDef Handle_methods[] = {
+	{"close", (PyCFunction)Handle_close, METH_NOARGS, "Flushes the queued commands and closes the handle"},
+	{"flush", (PyCFunction)Handle_flush, METH_NOARGS, "Sends the queued commands in one write, returns how many were sent"},
+	{"send", (PyCFunction)Handle_send, METH_VARARGS, "send(cmd): sends a command right away, after the queued ones"},
+	{"queue", (PyCFunction)Handle_queue, METH_VARARGS, "queue(cmd): queues a raw command"},
+	{"dilate", (PyCFunction)Handle_dilate, METH_VARARGS, "dilate(pid, tdf)"},
+	{"dilate_all", (PyCFunction)Handle_dilate_all, METH_VARARGS, "dilate_all(pid, tdf)"},
+	{"leap", (PyCFunction)Handle_leap, METH_VARARGS, "leap(pid, interval)"},
+	{"add_to_exp", (PyCFunction)Handle_add_to_exp, METH_VARARGS, "add_to_exp(pid, n_vcpus = 1): adds a container to a CBE experiment"},
+	{"add_to_cs_exp", (PyCFunction)Handle_add_to_cs_exp, METH_VARARGS, "add_to_cs_exp(pid, timeline)"},
+	{"set_interval", (PyCFunction)Handle_set_interval, METH_VARARGS, "set_interval(pid, interval, timeline)"},
+	{"set_group_run", (PyCFunction)Handle_set_group_run, METH_VARARGS, "set_group_run(pid, enable)"},
+	{"freeze", (PyCFunction)Handle_freeze, METH_VARARGS, "freeze(pid)"},
+	{"unfreeze", (PyCFunction)Handle_unfreeze, METH_VARARGS, "unfreeze(pid)"},
+	{"reset_exp", (PyCFunction)Handle_reset_exp, METH_NOARGS, "reset_exp(): restarts the synchronized experiment at the current time"},
+	{"add_bulk", (PyCFunction)Handle_add_bulk, METH_VARARGS, "add_bulk(containers): adds a list of (pid, tdf[, timeline]) in one call, returns how many were added"},
+	{NULL}
+};
+
+static PyTypeObject HandleType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"_timekeeper.Handle",
+	sizeof(HandleObject),
+};
+
+static PyMethodDef module_methods[] = {
+	{NULL}
+};
+
+static int setup_types(void) {
+	HandleType.tp_flags = Py_TPFLAGS_DEFAULT;
+	HandleType.tp_doc = "Handle(experiment = 0): persistent handle on the TimeKeeper module with command batching";
+	HandleType.tp_new = PyType_GenericNew;
+	HandleType.tp_init = (initproc)Handle_init;
+	HandleType.tp_dealloc = (destructor)Handle_dealloc;
+	HandleType.tp_methods = Handle_methods;
+	return PyType_Ready(&HandleType);
+}
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef timekeeper_module = {
+	PyModuleDef_HEAD_INIT, "_timekeeper", "Native TimeKeeper API", -1, module_methods,
+};
+
+PyMODINIT_FUNC PyInit__timekeeper(void) {
+	PyObject * m;
+
+	if (setup_types() < 0)
+		return NULL;
+	m = PyModule_Create(&timekeeper_module);
+	if (m == NULL)
+		return NULL;
+	Py_INCREF(&HandleType);
+	PyModule_AddObject(m, "Handle", (PyObject *)&HandleType);
+	return m;
+}
+#else
+PyMODINIT_FUNC init_timekeeper(void) {
+	PyObject * m;
+
+	if (setup_types() < 0)
+		return;
+	m = Py_InitModule3("_timekeeper", module_methods, "Native TimeKeeper API");
+	if (m == NULL)
+		return;
+	Py_INCREF(&HandleType);
+	PyModule_AddObject(m, "Handle", (PyObject *)&HandleType);
+}
+#endif
@@ -5,6 +5,7 @@
 #include "utility_functions.h"
 
 const char *FILENAME = "/proc/dilation/status"; //where TimeKeeper LKM is reading commands
+int tk_experiment = 0; //the experiment commands are sent to, see selectExperiment
 
 /*
 Sends a specific command to the TimeKeeper Kernel Module. To communicate with the TLKM, you send messages to the location specified by FILENAME
@@ -16,6 +17,8 @@ int send_to_timekeeper(char * cmd) {
         //printf("Error communicating with TimeKeeper\n");
         return -1;
     }
+    if (tk_experiment != 0)
+        fprintf(fp, "@%d,", tk_experiment); //experiment prefix, experiment 0 needs none
     fprintf(fp, "%s,", cmd); //add comma to act as last character
     fclose(fp);
     return 0;
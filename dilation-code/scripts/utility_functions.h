@@ -1,3 +1,5 @@
+extern const char *FILENAME;
+extern int tk_experiment;
 int send_to_timekeeper(char * cmd);
 int gettid();
 int is_root();
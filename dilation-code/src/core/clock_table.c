@@ -0,0 +1,164 @@
+#include "dilation_module.h"
+#include <linux/mm.h>
+
+extern s64 get_virtual_time_task(struct task_struct* task, s64 now);
+
+/***
+Read-only table of the container clocks, mmap'ed by controllers from /proc/dilation/clocks (tk_clock_table in
+TimeKeeper_definitions.h). Every container gets a slot when it is added to an experiment. Its sync thread publishes the
+container's virtual time, round and state when the container is thawed and again when its slice is over, so a
+controller can read the clocks of all containers with a few memory reads instead of one gettimepid per container.
+
+Each slot is protected by a sequence count: it is odd while the slot is written, readers retry until they read the
+same even count before and after copying the slot. A slot only has one writer at a time (the sync thread owning the
+container, or whoever adds or removes it while it is not running).
+***/
+
+static tk_clock_table * clock_table;
+static struct proc_dir_entry * clock_table_file;
+static DECLARE_BITMAP(clock_slots, TK_CLOCK_TABLE_SLOTS);
+static DEFINE_SPINLOCK(clock_slots_lock);
+
+static void clock_entry_write_begin(tk_clock_entry * entry) {
+	entry->seq++;
+	smp_wmb();
+}
+
+static void clock_entry_write_end(tk_clock_entry * entry) {
+	smp_wmb();
+	entry->seq++;
+}
+
+/***
+Maps the table read-only into the caller
+***/
+static int clock_table_mmap(struct file * file, struct vm_area_struct * vma) {
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_ALIGN(sizeof(tk_clock_table)))
+		return -EINVAL;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, clock_table, 0);
+}
+
+static const struct file_operations clock_table_fops = {
+	.mmap = clock_table_mmap,
+	.owner = THIS_MODULE,
+};
+
+/***
+Allocates the table and creates /proc/dilation/clocks. Called when the module is loaded
+***/
+int tk_clock_table_init(struct proc_dir_entry * dir) {
+
+	clock_table = vmalloc_user(PAGE_ALIGN(sizeof(tk_clock_table)));
+	if (clock_table == NULL)
+		return -ENOMEM;
+	clock_table->n_slots = TK_CLOCK_TABLE_SLOTS;
+	clock_table->magic = TK_CLOCK_TABLE_MAGIC;
+
+	clock_table_file = proc_create(TK_CLOCK_TABLE_NAME, 0444, dir, &clock_table_fops);
+	if (clock_table_file == NULL) {
+		vfree(clock_table);
+		clock_table = NULL;
+		return -ENOMEM;
+	}
+	PDEBUG_A(" /proc/%s/%s created\n", DILATION_DIR, TK_CLOCK_TABLE_NAME);
+	return 0;
+}
+
+void tk_clock_table_exit(struct proc_dir_entry * dir) {
+
+	if (clock_table_file != NULL)
+		remove_proc_entry(TK_CLOCK_TABLE_NAME, dir);
+	/* a controller that still has the table mapped holds a reference on the pages */
+	vfree(clock_table);
+	clock_table = NULL;
+}
+
+/***
+Gives a new container a slot in the table. The container is left without one (clock_slot = -1) if the table is full,
+its clock then simply is not published
+***/
+void tk_clock_table_add(struct dilation_task_struct * lxc) {
+	tk_clock_entry * entry;
+	int slot;
+
+	lxc->clock_slot = -1;
+	lxc->clock_round = 0;
+	if (clock_table == NULL)
+		return;
+
+	spin_lock(&clock_slots_lock);
+	slot = find_first_zero_bit(clock_slots, TK_CLOCK_TABLE_SLOTS);
+	if (slot < TK_CLOCK_TABLE_SLOTS)
+		set_bit(slot, clock_slots);
+	spin_unlock(&clock_slots_lock);
+
+	if (slot >= TK_CLOCK_TABLE_SLOTS) {
+		PDEBUG_E("Clock Table: No free slot for container %d\n", lxc->linux_task->pid);
+		return;
+	}
+
+	lxc->clock_slot = slot;
+	entry = &clock_table->clocks[slot];
+	clock_entry_write_begin(entry);
+	entry->pid = lxc->linux_task->pid;
+	entry->experiment = lxc->exp->id;
+	entry->state = TK_CLOCK_FROZEN;
+	entry->tdf = lxc->linux_task->dilation_factor;
+	entry->virtual_time = 0;
+	entry->round = 0;
+	entry->updated = 0;
+	clock_entry_write_end(entry);
+}
+
+/***
+Frees the slot of a container that is removed from its experiment
+***/
+void tk_clock_table_remove(struct dilation_task_struct * lxc) {
+	tk_clock_entry * entry;
+
+	if (clock_table == NULL || lxc->clock_slot < 0)
+		return;
+
+	entry = &clock_table->clocks[lxc->clock_slot];
+	clock_entry_write_begin(entry);
+	entry->state = TK_CLOCK_FREE;
+	entry->pid = 0;
+	clock_entry_write_end(entry);
+
+	spin_lock(&clock_slots_lock);
+	clear_bit(lxc->clock_slot, clock_slots);
+	spin_unlock(&clock_slots_lock);
+	lxc->clock_slot = -1;
+}
+
+/***
+Publishes the clock of a container: TK_CLOCK_RUNNING when its slice starts, TK_CLOCK_FROZEN when it is over (its round
+goes up then) or when the experiment is synchronized. The virtual time is the one the container had at that moment
+***/
+void tk_clock_table_publish(struct dilation_task_struct * lxc, int state) {
+	tk_clock_entry * entry;
+	struct timeval ktv;
+	s64 now;
+
+	if (clock_table == NULL || lxc->clock_slot < 0)
+		return;
+
+	do_gettimeofday(&ktv);
+	now = timeval_to_ns(&ktv);
+	entry = &clock_table->clocks[lxc->clock_slot];
+	if (state == TK_CLOCK_FROZEN && entry->state == TK_CLOCK_RUNNING)
+		lxc->clock_round++;
+
+	clock_entry_write_begin(entry);
+	entry->state = lxc->stopped == -1 ? TK_CLOCK_EXITED : state;
+	entry->tdf = lxc->linux_task->dilation_factor;
+	entry->virtual_time = get_virtual_time_task(lxc->linux_task, now);
+	entry->round = lxc->clock_round;
+	entry->updated = now;
+	clock_entry_write_end(entry);
+}
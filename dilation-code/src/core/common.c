@@ -25,7 +25,6 @@ void send_a_message_proc(char * write_buffer);
 void send_a_message(int pid);
 
 extern s64 Sim_time_scale;
-extern struct list_head exp_list;
 //struct poll_list;
 extern struct poll_list {
     struct poll_list *next;
@@ -399,85 +398,27 @@ int find_in_schedule_list(struct dilation_task_struct * lxc, int pid) {
 	return 0;
 }
 
-/*** 
-Add to tail of schedule queue 
+/***
+Makes the task of an element a member of the container: copies the container's clock into it, pins it to the
+container's CPU and appends the element to the tail of the schedule queue. The element must already be indexed
+(tk_member_add)
 ***/
-int add_to_schedule_list(struct dilation_task_struct * lxc, struct task_struct *new_task, s64 FREEZE_QUANTUM, s64 highest_dilation){
+static void schedule_list_insert(struct dilation_task_struct * lxc, lxc_schedule_elem * new_element){
 
-
-
-	int dilation_factor;
-	int dil;
-    s64 temp_proc;
-    s64 temp_high;
-    s32 rem;
+	struct task_struct *new_task = new_element->curr_task;
 	struct task_struct *me;
-    struct task_struct *t;
-	s64 window_duration;
-	s64 expected_increase;
+	struct task_struct *t;
+	struct sched_param sp;
 	int n_threads = 0;
-	s64 base_time_quanta;
 	unsigned long flags;
 
-
-
-	if(new_task == NULL || lxc == NULL)
-		return -1;
-
-	/* child already exists. don't add */
-	if(hmap_get_abs(&lxc->valid_children,new_task->pid) != NULL) 
-	{	
-		if(find_in_schedule_list(lxc,new_task->pid) == 0)
-			PDEBUG_E("Add to Schedule List Error: Found in map but not in list. Pid = %d\n", new_task->pid);
-		return 0;
-	}
-
-
-	lxc_schedule_elem * new_element = (lxc_schedule_elem *)kmalloc(sizeof(lxc_schedule_elem), GFP_KERNEL);
-	if(new_element == NULL)
-		return -1;
-
-
-	new_element->static_priority = new_task->static_prio;
-	
-
-    /* temp_proc and temp_high are temporary dilations for the container and leader respectively.
-    this is done just to make sure the Math works (no divide by 0 errors if the TDF is 0, by making the temp TDF 1) */
-    temp_proc = 0;
-    temp_high = 0;
-
-    if (highest_dilation == 0)
-            temp_high = 1;
-    else if (highest_dilation < 0)
-            temp_high = highest_dilation*-1;
-
-
-	acquire_irq_lock(&new_task->dialation_lock,flags);
+    acquire_irq_lock(&new_task->dialation_lock,flags);
 
 	new_task->dilation_factor = lxc->linux_task->dilation_factor;
-	
-	/*if(lxc->last_run != NULL && find_task_by_pid(lxc->last_run->pid) != NULL) {
-	   	new_task->freeze_time = lxc->last_run->curr_task->freeze_time;
-    	new_task->past_physical_time = lxc->last_run->curr_task->past_physical_time;
-    	new_task->past_virtual_time = lxc->last_run->curr_task->past_virtual_time;
-    	new_task->virt_start_time = lxc->last_run->curr_task->virt_start_time;
-    }
-    else{*/
-        new_task->virt_start_time = lxc->linux_task->virt_start_time;
-    	new_task->freeze_time = lxc->linux_task->freeze_time;
-    	new_task->past_physical_time = lxc->linux_task->past_physical_time;
-    	new_task->past_virtual_time = lxc->linux_task->past_virtual_time;
-    //}
-	
-	
-
-    dil = new_task->dilation_factor;
-
-    if (dil == 0)
-       temp_proc = 1;
-    else if (dil < 0)
-       temp_proc = dil*-1;
-
+	new_task->virt_start_time = lxc->linux_task->virt_start_time;
+	new_task->freeze_time = lxc->linux_task->freeze_time;
+	new_task->past_physical_time = lxc->linux_task->past_physical_time;
+	new_task->past_virtual_time = lxc->linux_task->past_virtual_time;
 
 	me = new_task;
 	t = me;
@@ -489,69 +430,92 @@ int add_to_schedule_list(struct dilation_task_struct * lxc, struct task_struct *
 		n_threads++;
 	} while_each_thread(me, t);
 
+	/* weighted by static priority, starts at the container's min_vruntime */
+	vt_sched_entity_init(&new_element->se, new_task->static_prio, lxc->min_vruntime);
+	lxc->rr_run_time += 1;
 
+	PDEBUG_A("Add To Schedule List: PID : %d, LXC: %d, Weight : %lld. N_threads : %d\n", new_task->pid, lxc->linux_task->pid, new_element->se.weight, n_threads);
+	release_irq_lock(&new_task->dialation_lock,flags);
 
-	if(dil == 0){
-		base_time_quanta = 1*Sim_time_scale;
-	}
-	else{
-		base_time_quanta = div_s64_rem(new_task->dilation_factor,1000,&rem)*Sim_time_scale;
-	}
+	/* append to tail of schedule queue */
+	llist_append(&lxc->schedule_queue, new_element);
 
-	
-	if(new_element->static_priority  <= 120){
+	bitmap_zero((&new_task->cpus_allowed)->bits, 8);
+    cpumask_set_cpu(lxc->cpu_assignment,&new_task->cpus_allowed);
 
-		/* In ms- Normal Process allotted 200 us vt quanta. Quanta of higher priority processes scaled according to linux spec*/
+	sp.sched_priority = 99;
+	sched_setscheduler(new_task, SCHED_RR, &sp);
+	hmap_put_abs(&lxc->valid_children,new_element->pid, new_element);
+}
 
-        if(new_task->pid == lxc->linux_task->pid)
-            base_time_quanta = base_time_quanta*100000;
-        else {
-    		//base_time_quanta = base_time_quanta*200000;
-    		base_time_quanta = base_time_quanta*(140 - new_element->static_priority)* 10000; 
-    		
-    	}
-    		
-		lxc->rr_run_time += 1;
-	}
-	else{
-
-		/* 200 us for now for all lower priority process. TODO */		
-		if(new_task->pid == lxc->linux_task->pid)
-            base_time_quanta = base_time_quanta*100000;
-        else
-    		base_time_quanta = base_time_quanta*200000; 
-		lxc->rr_run_time += 1;
+/*** 
+Add to tail of schedule queue 
+***/
+int add_to_schedule_list(struct dilation_task_struct * lxc, struct task_struct *new_task, s64 FREEZE_QUANTUM, s64 highest_dilation){
+
+	lxc_schedule_elem * new_element;
+
+	if(new_task == NULL || lxc == NULL)
+		return -1;
+
+	/* child already exists. don't add */
+	if(hmap_get_abs(&lxc->valid_children,new_task->pid) != NULL) 
+	{	
+		if(find_in_schedule_list(lxc,new_task->pid) == 0)
+			PDEBUG_E("Add to Schedule List Error: Found in map but not in list. Pid = %d\n", new_task->pid);
+		return 0;
 	}
-	
-	
-	PDEBUG_A("Add To Schedule List: PID : %d, LXC: %d, Base Quanta : %lld. N_threads : %d. Expected_increase : %lld\n", new_task->pid, lxc->linux_task->pid, base_time_quanta, n_threads, expected_increase);
-	release_irq_lock(&new_task->dialation_lock,flags);
 
-	new_element->share_factor = base_time_quanta;
+
+	new_element = (lxc_schedule_elem *)kmalloc(sizeof(lxc_schedule_elem), GFP_KERNEL);
+	if(new_element == NULL)
+		return -1;
+
+	get_task_struct(new_task);
 	new_element->curr_task = new_task;
 	new_element->pid = new_task->pid;
-	new_element->duration_left = base_time_quanta;
+	new_element->exited = 0;
+	new_element->clock_epoch = -1;
+	new_element->group_exec_start = -1;
+	new_element->queued = 1;
+	INIT_LIST_HEAD(&new_element->pending_node);
 
-	/* append to tail of schedule queue */
-	llist_append(&lxc->schedule_queue, new_element); 
+	tk_member_add(lxc, new_element);
+	schedule_list_insert(lxc, new_element);
 
+	return 0;
 
-	bitmap_zero((&new_task->cpus_allowed)->bits, 8);
-    cpumask_set_cpu(lxc->cpu_assignment,&new_task->cpus_allowed);
 
-	struct sched_param sp;
-	sp.sched_priority = 99;
-	sched_setscheduler(new_task, SCHED_RR, &sp);
-	hmap_put_abs(&lxc->valid_children,new_element->pid, new_element);
-	
+}
 
-	return 0;
+/***
+Adds an element the fork probe created (tk_members_apply). Returns -1, and leaves the element to the caller, if its task
+already has one or has exited since
+***/
+int schedule_list_add_member(struct dilation_task_struct * lxc, lxc_schedule_elem * elem){
 
+	if(schedule_elem_exited(elem) || hmap_get_abs(&lxc->valid_children, elem->pid) != NULL)
+		return -1;
+	schedule_list_insert(lxc, elem);
+	return 0;
+}
 
+/***
+Removes an element from the schedule queue and frees it
+***/
+void schedule_list_remove(struct dilation_task_struct * lxc, lxc_schedule_elem * elem){
+
+	llist_remove(&lxc->schedule_queue, elem);
+	hmap_remove_abs(&lxc->valid_children, elem->pid);
+	tk_member_del(elem);
+	if (lxc->last_run == elem)
+		lxc->last_run = NULL;
+	tk_member_free(elem);
 }
 
 /*** 
-Remove head of schedule queue and return the task_struct of the head element 
+Remove head of schedule queue and return the task_struct of the head element. The element's task reference is dropped,
+so the returned pointer must not be dereferenced
 ***/
 struct task_struct * pop_schedule_list(struct dilation_task_struct * lxc){
 
@@ -565,7 +529,10 @@ struct task_struct * pop_schedule_list(struct dilation_task_struct * lxc){
 	if(head != NULL){
 		curr_task = head->curr_task;
 		hmap_remove_abs(&lxc->valid_children, head->pid);
-		kfree(head);
+		tk_member_del(head);
+		if (lxc->last_run == head)
+			lxc->last_run = NULL;
+		tk_member_free(head);
 		return curr_task;
 	}
 
@@ -606,13 +573,42 @@ void requeue_schedule_list(struct dilation_task_struct * lxc){
 
 }
 
+/***
+Remove every element whose task exited from the schedule queue
+***/
+void prune_schedule_list(struct dilation_task_struct * lxc){
+
+	llist_elem * curr;
+	lxc_schedule_elem * elem;
+
+	if(lxc == NULL)
+		return;
+
+	curr = lxc->schedule_queue.head;
+	while(curr != NULL){
+		elem = curr->item;
+		curr = curr->next;
+		if(!schedule_elem_exited(elem))
+			continue;
+
+		PDEBUG_I("Prune Schedule List: Task %d no longer running. Removing from schedule queue\n", elem->pid);
+		schedule_list_remove(lxc, elem);
+	}
+}
+
 void clean_up_schedule_list(struct dilation_task_struct * lxc){
 
-	struct task_struct * curr_task = pop_schedule_list(lxc);
+	struct task_struct * curr_task;
+
+	curr_task = pop_schedule_list(lxc);
 	while(curr_task != NULL){
 		curr_task = pop_schedule_list(lxc);
 	}
 
+	/* members the fork probe created that never made it into the queue. Once the queue is empty, no member is
+	left that could fork another one */
+	tk_members_drop(lxc);
+
 	hmap_destroy(&lxc->valid_children);
 	llist_destroy(&lxc->schedule_queue);	
 
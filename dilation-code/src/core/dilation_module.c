@@ -17,22 +17,6 @@ extern asmlinkage int (*ref_sys_clock_gettime)(const clockid_t which_clock, stru
 
 
 
-extern int proc_num; // number of LXCs in the experiment
-extern struct mutex exp_mutex; // experiment mutex to prevent race conditions
-extern struct task_struct *catchup_task; // the main synchronization kernel thread for CBE experiments
-extern struct dilation_task_struct *leader_task; // the leader task of the experiment
-extern int experiment_stopped; // flag to determine state of the experiment
-extern struct list_head exp_list; // linked list of all tasks in the experiment
-extern s64 chainlength[EXP_CPUS]; // maintains the runtime of each CPU within a round
-
-extern struct timeline* timelineHead[EXP_CPUS]; // an array of timelines (for S3F (CS))
-
-//for CS, per CPU synchronization variables
-extern spinlock_t cpuLock[EXP_CPUS];
-extern int cpuIdle[EXP_CPUS];
-extern struct list_head cpuWorkList[EXP_CPUS];
-
-
 extern hashmap poll_process_lookup;
 extern hashmap select_process_lookup;
 extern hashmap sleep_process_lookup;
@@ -58,10 +42,6 @@ extern struct task_struct *loop_task;
 
 
 
-s64 round_error = 0;
-s64 n_rounds = 0;
-s64 round_error_sq = 0;
-
 /***
 Gets the PID of our spinner task (only in 64 bit)
 ***/
@@ -87,23 +67,25 @@ int call_usermodehelper_dil(char *path, char **argv, char **envp, int wait)
 }
 
 
+/*
+Arguments of the ioctls. ioctl_args is too large for the stack, so one of these is allocated for every call
+*/
+union tk_ioctl_arg {
+	ioctl_args stats;
+	tk_progress_args progress;
+	tk_horizon_args horizon;
+	tk_bulk_args bulk;
+};
+
 long tk_ioctl(struct file *filp, unsigned int cmd, unsigned long arg){
 
 	int err = 0;
-	int retval = 0;
-    int i = 0;
-	uint8_t mask = 0;
-	unsigned long flags;
-	ioctl_args * args;
-	ioctl_args tmp;
-	char write_buffer[STATUS_MAXSIZE];
-	char * ptr;
+	long retval = 0;
+	void __user * uarg = (void __user *)arg;
+	union tk_ioctl_arg * args;
+	struct tk_experiment * exp;
 	int ret;
 
-	for(i = 0; i < STATUS_MAXSIZE; i++)
-		write_buffer[i] = '\0';
-
-
 	PDEBUG_I("Got ioctl from : %d\n", current->pid);
 
 	/*
@@ -111,7 +93,8 @@ long tk_ioctl(struct file *filp, unsigned int cmd, unsigned long arg){
 	 * wrong cmds: return ENOTTY (inappropriate ioctl) before access_ok()
 	 */
 	if (_IOC_TYPE(cmd) != TK_IOC_MAGIC) return -ENOTTY;
-	
+	if (!uarg) return -EFAULT;
+
 	/*
 	 * the direction is a bitmask, and VERIFY_WRITE catches R/W
 	 * transfers. `Type' is user-oriented, while
@@ -119,130 +102,282 @@ long tk_ioctl(struct file *filp, unsigned int cmd, unsigned long arg){
 	 * "write" is reversed
 	 */
 	if (_IOC_DIR(cmd) & _IOC_READ)
-		err = !access_ok(VERIFY_WRITE, (void __user *)arg, _IOC_SIZE(cmd));
+		err = !access_ok(VERIFY_WRITE, uarg, _IOC_SIZE(cmd));
 	else if (_IOC_DIR(cmd) & _IOC_WRITE)
-		err =  !access_ok(VERIFY_WRITE, (void __user *)arg, _IOC_SIZE(cmd));
+		err =  !access_ok(VERIFY_WRITE, uarg, _IOC_SIZE(cmd));
 
 	if (err) return -EFAULT;
 
+	args = kmalloc(sizeof(union tk_ioctl_arg), GFP_KERNEL);
+	if (!args)
+		return -ENOMEM;
+
+	/* the arguments of every ioctl but the original stats one are given by the caller, their size is in cmd */
+	if (cmd != TK_IO_GET_STATS) {
+		if (_IOC_SIZE(cmd) > sizeof(union tk_ioctl_arg)) {
+			retval = -ENOTTY;
+			goto out;
+		}
+		if (copy_from_user(args, uarg, _IOC_SIZE(cmd))) {
+			retval = -EFAULT;
+			goto out;
+		}
+	}
+
 	switch(cmd) {
 
 			case TK_IO_GET_STATS	:
-										args = (ioctl_args *) arg;
-										if(!args)
-											return -EFAULT;
-
-										mutex_lock(&exp_mutex);
-										tmp.round_error = round_error;
-										tmp.round_error_sq = round_error_sq;
-										tmp.n_rounds = n_rounds;
-										mutex_unlock(&exp_mutex);
+			case TK_IO_GET_EXP_STATS	:
+										/* the original stats ioctl always reads experiment 0 */
+										if (cmd == TK_IO_GET_STATS)
+											args->stats.experiment = 0;
+										exp = tk_experiment_lookup((int)args->stats.experiment);
+										if(exp == NULL) {
+											retval = -EINVAL;
+											break;
+										}
+
+										mutex_lock(&exp->exp_mutex);
+										tk_stats_get(exp, &args->stats);
+										tk_stats_reset(exp);
+										mutex_unlock(&exp->exp_mutex);
+										args->stats.experiment = exp->id;
+
+										PDEBUG_I("IOCTL: Round Error: %llu, Round Error Sq: %llu, N Rounds: %llu\n", args->stats.round_error, args->stats.round_error_sq, args->stats.n_rounds);
+
+										if(copy_to_user(uarg, args, cmd == TK_IO_GET_STATS ? sizeof(tk_legacy_stats_args) : sizeof(ioctl_args)))
+											retval = -EFAULT;
+										break;
+
+			case TK_IO_PROGRESS_CBE	:
+										exp = tk_experiment_lookup((int)args->progress.experiment);
+										if(exp == NULL) {
+											retval = -EINVAL;
+											break;
+										}
+
+										if(args->progress.until > 0)
+											ret = progress_exp_cbe_until(exp, args->progress.until);
+										else if(args->progress.n_rounds > 0)
+											ret = progress_exp_cbe_rounds(exp, (int)args->progress.n_rounds);
+										else
+											ret = hold_exp_cbe(exp);
+										if(ret) {
+											retval = -EINVAL;
+											break;
+										}
+
+										args->progress.round_increase = exp->expected_increase;
+										args->progress.virtual_time = cbe_reached_time(exp);
+
+										if(copy_to_user(uarg, args, sizeof(tk_progress_args)))
+											retval = -EFAULT;
+										break;
+
+			case TK_IO_TIMELINE_HORIZON	:
+										exp = tk_experiment_lookup((int)args->horizon.experiment);
+										if(exp == NULL) {
+											retval = -EINVAL;
+											break;
+										}
+
+										retval = s3f_timeline_horizon(exp, &args->horizon);
+										if(retval)
+											break;
+
+										if(copy_to_user(uarg, args, sizeof(tk_horizon_args)))
+											retval = -EFAULT;
+										break;
+
+			case TK_IO_ADD_BULK	:
+										exp = tk_experiment_lookup((int)args->bulk.experiment);
+										if(exp == NULL) {
+											retval = -EINVAL;
+											break;
+										}
+
+										ret = add_to_exp_bulk(exp, &args->bulk);
+										if(ret < 0) {
+											retval = ret;
+											break;
+										}
+										args->bulk.n_added = ret;
+
+										if(copy_to_user(uarg, args, sizeof(tk_bulk_args)))
+											retval = -EFAULT;
+										break;
+
+			default: retval = -ENOTTY;
+	}
 
-										PDEBUG_I("IOCTL: Round Error: %llu, Round Error Sq: %llu, N Rounds: %llu\n", round_error, round_error_sq, n_rounds);
+out:
+	kfree(args);
+	return retval;
 
-										round_error = 0;
-										round_error_sq = 0;
-										n_rounds = 0;
+}
 
-										if(copy_to_user(args, &tmp, sizeof(ioctl_args)))
-											return -EFAULT;
+/***
+Runs one command written to /proc/dilation/status, ie 'W', which will tell the kernel module to call the sec_clean_exp()
+function. A command can be addressed to an experiment other than experiment 0 by prefixing it with '@<id>,' ie '@2,I'.
+Returns 255 if a progress request did not start the timeline (see s3f_progress_timeline)
+***/
+static int status_command(char * write_buffer)
+{
+	char * cmd = write_buffer;
+	struct tk_experiment * exp;
+	int ret = 0;
+	int id = 0;
 
-										return 0;
-			default: return -ENOTTY;
+	/* the optional experiment prefix */
+	if (write_buffer[0] == EXPERIMENT_PREFIX) {
+		id = atoi(write_buffer + 1);
+		cmd = write_buffer + 1 + get_next_value(write_buffer + 1);
 	}
+	/* only setting the CPUs of an experiment sets it up, any other command needs an existing one */
+	if (cmd[0] == SET_EXP_CPUS)
+		exp = tk_experiment_get(id);
+	else
+		exp = tk_experiment_lookup(id);
+	if (exp == NULL)
+		return -EINVAL;
 
-	return retval;
+	/* Use +2 to skip over the first two characters (i.e. the switch and the ,) */
+	if (cmd[0] == FREEZE_OR_UNFREEZE)
+                yield_proc(cmd+2);
+	else if (cmd[0] == FREEZE_OR_UNFREEZE_ALL)
+		yield_proc_recurse(cmd+2);
+	else if (cmd[0] == DILATE)
+		dilate_proc(cmd+2);
+	else if (cmd[0] == DILATE_ALL)
+		dilate_proc_recurse(cmd+2);
+	else if (cmd[0] == ADD_TO_EXP_CBE)
+		add_to_exp_proc(exp, cmd+2);
+	else if (cmd[0] == STOP_EXP)
+                set_clean_exp(exp);
+	else if (cmd[0] == LEAP)
+                leap_proc(cmd+2);
+	else if (cmd[0] == START_EXP)
+		core_sync_exp(exp);
+	else if (cmd[0] == PROGRESS){
+		//PDEBUG_A(" Received new progress request. Buffer = %s\n", cmd + 2);
+		ret = s3f_progress_timeline(exp, cmd+2);
+	}
+	else if (cmd[0] == ADD_TO_EXP_CS)
+		s3f_add_to_exp_proc(exp, cmd+2);
+	else if (cmd[0] == RESET)
+		s3f_reset(exp, cmd+2);
+	else if (cmd[0] == SET_INTERVAL)
+		s3f_set_interval(exp, cmd+2);
+	else if (cmd[0] == SYNC_AND_FREEZE)
+		sync_and_freeze(exp);
+	else if (cmd[0] == FIX_TIMELINE)
+		fix_timeline_proc(exp, cmd+2);
+	else if (cmd[0] == DEBUG_PROC_INFO)
+		print_proc_info(cmd+2);
+	else if (cmd[0] == DEBUG_SEND_MESSAGE)
+		send_a_message_proc(cmd+2);
+	else if (cmd[0] == DEBUG_CHILDREN_INFO)
+		print_children_info_proc(cmd+2);
+	else if (cmd[0] == DEBUG_THREAD_INFO)
+		print_threads_proc(cmd+2);
+    	else if (cmd[0] == DEBUG_PROGRESS_EXP)
+        	progress_exp(exp);
+	else if (cmd[0] == SET_CBE_EXP_TIMESLICE)
+		set_cbe_exp_timeslice(exp, cmd + 2);
+	else if (cmd[0] == SET_SCHED_GRANULARITY)
+		set_sched_granularity(exp, cmd + 2);
+	else if (cmd[0] == SET_GROUP_RUN)
+		set_group_run_proc(exp, cmd + 2);
+	else if (cmd[0] == SET_NETDEVICE_OWNER)
+		set_netdevice_owner(cmd + 2);
+	else if (cmd[0] == PROGRESS_INTERVAL_CBE)
+		progress_exp_cbe(exp, cmd + 2);
+	else if (cmd[0] == RESUME_CBE)
+		resume_exp_cbe(exp);
+	else if (cmd[0] == SET_EXP_CPUS)
+		set_exp_cpus(exp, cmd + 2);
+	else if (cmd[0] == RESET_EXP)
+		reset_exp(exp);
+	else if (cmd[0] == SET_VT_COMPENSATION)
+		set_vt_compensation(exp, cmd + 2);
+	else
+		PDEBUG_E("Dilation Module Write: Invalid Write Command: %s\n", write_buffer);
 
+	return ret;
 }
 
 /***
 This handles how a process from userland communicates with the kernel module. The process basically writes to:
-/proc/dilation/status with a command ie, 'W', which will tell the kernel module to call the sec_clean_exp() function
+/proc/dilation/status with a command (see status_command). Several commands can be written at once, separated by
+TK_BATCH_SEPARATOR, they are then run one after the other in the order they were written. A batch is at most
+TK_BATCH_MAXSIZE bytes long, a longer write is rejected as a whole. Every command of a batch is run, the result of the
+first one that did not succeed is returned
 ***/
 ssize_t status_write(struct file *file, const char __user *buffer, size_t count, loff_t *data)
 {
 	char write_buffer[STATUS_MAXSIZE];
+	char * batch;
+	char * cmd;
+	char * next;
 	unsigned long buffer_size;
-	int i = 0;
-	int ret = 0;
-
- 	if(count > STATUS_MAXSIZE)
-	{
-    		buffer_size = STATUS_MAXSIZE;
-  	}
-	else
-	{
-		buffer_size = count;
+	unsigned long len;
+	int ret;
+	int first_ret = 0;
 
-	}
+	buffer_size = count;
+	if (buffer_size > TK_BATCH_MAXSIZE)
+		return -EINVAL;
 
-	for(i = 0; i < STATUS_MAXSIZE; i++)
-		write_buffer[i] = '\0';
+	/* a single command fits in a page, only a large batch is too big to ask for physically contiguous pages */
+	if (buffer_size < PAGE_SIZE)
+		batch = kmalloc(buffer_size + 1, GFP_KERNEL);
+	else
+		batch = vmalloc(buffer_size + 1);
+	if (batch == NULL)
+		return -ENOMEM;
 
-  	if(copy_from_user(write_buffer, buffer, buffer_size))
+  	if(copy_from_user(batch, buffer, buffer_size))
 	{
-	    return -EFAULT;
+		ret = -EFAULT;
+		goto out;
 	}
-
-	/* Use +2 to skip over the first two characters (i.e. the switch and the ,) */
-	if (write_buffer[0] == FREEZE_OR_UNFREEZE)
-                yield_proc(write_buffer+2);
-	else if (write_buffer[0] == FREEZE_OR_UNFREEZE_ALL)
-		yield_proc_recurse(write_buffer+2);
-	else if (write_buffer[0] == DILATE)
-		dilate_proc(write_buffer+2);
-	else if (write_buffer[0] == DILATE_ALL)
-		dilate_proc_recurse(write_buffer+2);
-	else if (write_buffer[0] == ADD_TO_EXP_CBE)
-		add_to_exp_proc(write_buffer+2);
-	else if (write_buffer[0] == STOP_EXP)
-                set_clean_exp();
-	else if (write_buffer[0] == LEAP)
-                leap_proc(write_buffer+2);
-	else if (write_buffer[0] == START_EXP)
-		core_sync_exp();
-	else if (write_buffer[0] == PROGRESS){
-		//PDEBUG_A(" Received new progress request. Buffer = %s\n", write_buffer + 2);
-		ret = s3f_progress_timeline(write_buffer+2);
+	batch[buffer_size] = '\0';
+
+	for (cmd = batch; cmd != NULL && *cmd != '\0'; cmd = next) {
+		next = strchr(cmd, TK_BATCH_SEPARATOR);
+		len = next != NULL ? next - cmd : strlen(cmd);
+		if (next != NULL)
+			next++;
+		if (len == 0)
+			continue;
+		if (len >= STATUS_MAXSIZE)
+			len = STATUS_MAXSIZE - 1;
+
+		/* the commands parse their arguments from a zero padded buffer, as if each one had been written on its own */
+		memset(write_buffer, 0, STATUS_MAXSIZE);
+		memcpy(write_buffer, cmd, len);
+		ret = status_command(write_buffer);
+		if (ret != 0 && first_ret == 0)
+			first_ret = ret;
 	}
-	else if (write_buffer[0] == ADD_TO_EXP_CS)
-		s3f_add_to_exp_proc(write_buffer+2);
-	else if (write_buffer[0] == RESET)
-		s3f_reset(write_buffer+2);
-	else if (write_buffer[0] == SET_INTERVAL)
-		s3f_set_interval(write_buffer+2);
-	else if (write_buffer[0] == SYNC_AND_FREEZE)
-		sync_and_freeze();
-	else if (write_buffer[0] == FIX_TIMELINE)
-		fix_timeline_proc(write_buffer+2);
-	else if (write_buffer[0] == DEBUG_PROC_INFO)
-		print_proc_info(write_buffer+2);
-	else if (write_buffer[0] == DEBUG_SEND_MESSAGE)
-		send_a_message_proc(write_buffer+2);
-	else if (write_buffer[0] == DEBUG_CHILDREN_INFO)
-		print_children_info_proc(write_buffer+2);
-	else if (write_buffer[0] == DEBUG_THREAD_INFO)
-		print_threads_proc(write_buffer+2);
-    	else if (write_buffer[0] == DEBUG_PROGRESS_EXP)
-        	progress_exp();
-	else if (write_buffer[0] == SET_CBE_EXP_TIMESLICE)
-		set_cbe_exp_timeslice(write_buffer + 2);
-	else if (write_buffer[0] == SET_NETDEVICE_OWNER)
-		set_netdevice_owner(write_buffer + 2);
-	else if (write_buffer[0] == PROGRESS_INTERVAL_CBE)
-		progress_exp_cbe(write_buffer + 2);
-	else if (write_buffer[0] == RESUME_CBE)
-		resume_exp_cbe();
+	ret = 0;
+
+out:
+	if (buffer_size < PAGE_SIZE)
+		kfree(batch);
 	else
-		PDEBUG_E("Dilation Module Write: Invalid Write Command: %s\n", write_buffer);
+		vfree(batch);
+	if (ret != 0)
+		return ret;
 
-	if(ret != 255)
-		return count;
-	else{
+	if (first_ret == 255) {
 		PDEBUG_A("Dilation Module Write: Returned special value\n");
 		/* special return value when progress timeline thread is not called in s3f_progress_timeline */
-		return -10;	
+		return -10;
 	}
+	if (first_ret < 0)
+		return -EINVAL;
+	return count;
 }
 
 /***
@@ -252,6 +387,7 @@ sets up mutexes, timers, and hooks the system call table.
 int __init my_module_init(void)
 {
 	int i;
+	int ret;
 
    	PDEBUG_A(" Loading TimeKeeper MODULE\n");
 
@@ -273,6 +409,9 @@ int __init my_module_init(void)
   	}
 	PDEBUG_A(" /proc/%s/%s created\n", DILATION_DIR, DILATION_FILE);
 
+	if (tk_clock_table_init(dilation_dir))
+		PDEBUG_E("Error: Could not initialize /proc/%s/%s, container clocks are not published\n", DILATION_DIR, TK_CLOCK_TABLE_NAME);
+
 	/* If it is 64-bit, initialize the looping script */
 	#ifdef __x86_64
 		char *argv[] = { "/bin/x64_synchronizer", NULL };
@@ -289,7 +428,8 @@ int __init my_module_init(void)
     	if (!nl_sk)
     	{
         	PDEBUG_E("Error creating socket.\n");
-        	return -10;
+        	ret = -10;
+        	goto out_proc;
     	}
 
 	/* Acquire number of CPUs on system */
@@ -300,31 +440,26 @@ int __init my_module_init(void)
 		PDEBUG_A(" WARNING -- EXP_CPUS LARGER THAN TOTAL_CPUS! FIX IN dilation_module.h\n");
 	}
 
-	/* Initialize experiment specific variables */
-	for (i =0; i<EXP_CPUS; i++) {
-		timelineHead[i] = NULL;
-		chainlength[i] = 0;
-		cpuIdle[i] = 0;
-		spin_lock_init(&cpuLock[i]);
-		INIT_LIST_HEAD(&cpuWorkList[i]);
+	/* Acquire sys_call_table, hook system calls */
+    	if(!(sys_call_table = aquire_sys_call_table())) {
+		ret = -1;
+		goto out_socket;
 	}
-	leader_task = NULL;
-	experiment_stopped = NOTRUNNING;
-	proc_num = 0;
-	INIT_LIST_HEAD(&exp_list);
-	mutex_init(&exp_mutex);
 
-
-	catchup_task = kthread_create(&catchup_func, NULL, "catchup_task");
-	if(!IS_ERR(catchup_task)) {
-	    //kthread_bind(catchup_task,0);
-	    wake_up_process(catchup_task);
+	/* Set up experiment 0, the one commands without an experiment prefix go to. Its catchup task is only started once
+	the module is sure to load */
+	if (tk_experiment_get(0) == NULL) {
+		ret = -ENOMEM;
+		goto out_socket;
 	}
 
-	/* Acquire sys_call_table, hook system calls */
-    	if(!(sys_call_table = aquire_sys_call_table()))
-          return -1;
+	/* the sleepers of the hooked system calls, kept until the module is unloaded */
+	hmap_init( &poll_process_lookup,"int",0);
+	hmap_init( &select_process_lookup,"int",0);
+	hmap_init( &sleep_process_lookup,"int",0);
 
+	/* registered once nothing can fail any more, the probes must not outlive a module that did not load */
+	tk_task_events_init();
 
 	original_cr0 = read_cr0();
 	write_cr0(original_cr0 & ~0x00010000);
@@ -350,6 +485,14 @@ int __init my_module_init(void)
 	#endif
 
   	return 0;
+
+out_socket:
+	netlink_kernel_release(nl_sk);
+out_proc:
+	tk_clock_table_exit(dilation_dir);
+	remove_proc_entry(DILATION_FILE, dilation_dir);
+	remove_proc_entry(DILATION_DIR, NULL);
+	return ret;
 }
 
 /***
@@ -358,48 +501,39 @@ the system call table.
 ***/
 void __exit my_module_exit(void)
 {
-	s64 i;
-
-	set_clean_exp();
+	tk_experiments_cleanup();
+	tk_task_events_exit();
 	netlink_kernel_release(nl_sk);
 
+	tk_clock_table_exit(dilation_dir);
 	remove_proc_entry(DILATION_FILE, dilation_dir);
    	PDEBUG_A(" /proc/%s/%s deleted\n", DILATION_DIR, DILATION_FILE);
    	remove_proc_entry(DILATION_DIR, NULL);
    	PDEBUG_A(" /proc/%s deleted\n", DILATION_DIR);
 
-	hmap_destroy(&poll_process_lookup);
-	hmap_destroy(&select_process_lookup);
-	hmap_destroy(&sleep_process_lookup);
-
-
 	/* Fix sys_call_table */
-       if(!sys_call_table)
-                return;
-
-	/* Busy wait briefly for tasks to finish -Not the best approach */
-	for (i = 0; i < 1000000000; i++) {}
-
-	if ( kthread_stop(catchup_task) )
-    {
-         PDEBUG_E(" Stopping catchup_task error\n");
-    }
-	
-
-	/* Resetting just in case experiment does not finish properly */
-	original_cr0 = read_cr0();
-	write_cr0(original_cr0 & ~0x00010000);
-	sys_call_table[__NR_nanosleep] = (unsigned long *)ref_sys_sleep;
-	sys_call_table[__NR_clock_gettime] = (unsigned long *) ref_sys_clock_gettime;
-	sys_call_table[__NR_clock_nanosleep] = (unsigned long *) ref_sys_clock_nanosleep;
-	sys_call_table[__NR_poll] = (unsigned long *)ref_sys_poll;	
-	sys_call_table[NR_select] = (unsigned long *)ref_sys_select;
-	write_cr0(original_cr0 | 0x00010000);
-
+	if (sys_call_table) {
+
+		/* Resetting just in case experiment does not finish properly */
+		original_cr0 = read_cr0();
+		write_cr0(original_cr0 & ~0x00010000);
+		sys_call_table[__NR_nanosleep] = (unsigned long *)ref_sys_sleep;
+		sys_call_table[__NR_clock_gettime] = (unsigned long *) ref_sys_clock_gettime;
+		sys_call_table[__NR_clock_nanosleep] = (unsigned long *) ref_sys_clock_nanosleep;
+		sys_call_table[__NR_poll] = (unsigned long *)ref_sys_poll;	
+		sys_call_table[NR_select] = (unsigned long *)ref_sys_select;
+		write_cr0(original_cr0 | 0x00010000);
+
+		/* no new call gets into the hooks now, wait for the ones still in them */
+		tk_wait_hooked_calls();
+	}
 
-	/* Busy wait briefly for tasks to finish -Not the best approach */
-	for (i = 0; i < 1000000000; i++) {}
+	/* every experiment is cleaned up, so the sync threads are idle */
+	tk_experiments_exit();
 
+	hmap_destroy(&poll_process_lookup);
+	hmap_destroy(&select_process_lookup);
+	hmap_destroy(&sleep_process_lookup);
 
 	/* Kill the looping task */
 	#ifdef __x86_64
@@ -409,12 +543,6 @@ void __exit my_module_exit(void)
    	PDEBUG_A(" MP2 MODULE UNLOADED\n");
 }
 
-/* needs to be defined, but we do not read from /proc/dilation/status so we do not do anything here */
-ssize_t status_read(struct file *pfil, char __user *pBuf, size_t len, loff_t *p_off)
-{
-        return 0;
-}
-
 /* Register the init and exit functions here so insmod can run them */
 module_init(my_module_init);
 module_exit(my_module_exit);
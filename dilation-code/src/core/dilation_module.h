@@ -3,37 +3,95 @@
 
 #include "includes.h"
 
-typedef struct ioctl_arg_struct {
-	s64 round_error;
-	s64 n_rounds;
-	s64 round_error_sq;
-} ioctl_args;
-
 /***
-The callback functions for the TimeKeeper status file
+The callback functions for the TimeKeeper status file. Reads are served by a seq_file (see stats.c)
 ***/
-ssize_t status_read(struct file *pfil, char __user *pBuf, size_t len, loff_t *p_off);
+int status_open(struct inode *inode, struct file *file);
 ssize_t status_write(struct file *file, const char __user *buffer, size_t count, loff_t *data);
 long tk_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 static const struct file_operations proc_file_fops = {
- .read = status_read,
+ .open = status_open,
+ .read = seq_read,
+ .llseek = seq_lseek,
+ .release = single_release,
  .write = status_write,
  .unlocked_ioctl = tk_ioctl,
  .owner = THIS_MODULE,
 };
 
+/***
+Per-CPU counters. Every field is only updated by the CPU it belongs to (through this_cpu_* operations), so the
+hot paths never take a lock. Readers sum the counters over all possible CPUs.
+***/
+struct tk_cpu_stats {
+	s64 n_rounds;								// number of per-container round errors recorded
+	s64 round_error;							// sum of the absolute virtual time errors at round boundaries
+	s64 round_error_sq;							// sum of the squared round errors
+	s64 n_timer_fires;							// number of slice hrtimers that fired
+	s64 timer_lateness;							// sum of hrtimer lateness (fire time - programmed expiry)
+	s64 round_error_hist[TK_HIST_BUCKETS];
+	s64 timer_lateness_hist[TK_HIST_BUCKETS];
+};
+
+
+/***
+Per-container counters. Only the sync thread owning the container's chain writes to them.
+***/
+struct lxc_stats {
+	s64 lag;								// expected virtual time - actual virtual time at the last round boundary
+	s64 n_overruns;							// rounds in which the container ended up ahead of the expected virtual time
+	s64 n_freezes;
+	s64 n_thaws;
+	s64 n_sleeper_wakeups;					// sleeping/polling/selecting tasks woken up when the container was thawed
+	s64 last_target;						// expected virtual time the container was given in the previous round
+	s64 overrun;							// how long it kept running past the requested end of its last turn, -1 if it did not run
+	s64 overshoot;							// learned overrun its slices are shortened by (vt_compensate)
+	s64 residual;							// overrun of the last turn minus the overshoot its slice was shortened by
+	s64 residual_abs_sum;					// sum of the absolute residuals, for the mean residual
+	s64 n_residuals;
+};
+
+/***
+Per-chain counters, written only by the chain's sync thread
+***/
+struct chain_stats {
+	s64 n_rounds;
+	s64 last_round_time;						// wall clock time the chain needed to run all its containers in the last round
+	s64 total_round_time;
+	s64 max_round_time;
+};
+
+
+struct dilation_task_struct;
+struct tk_experiment;
 
 typedef struct sched_queue_element{
 
-	s64 share_factor;
-	int static_priority;
-	s64 duration_left;
+	struct vt_sched_entity se;	// vruntime, weight and slice of the thread in its container (vtcore/vt_sched.h), must stay first
 	int pid;
-	struct task_struct * curr_task;
+	struct task_struct * curr_task;		// pinned with get_task_struct for as long as the element exists
+	int exited;							// set by the exit probe, the task must not be run anymore
+	s64 clock_epoch;					// clock epoch of the container the task's own clock fields were last copied at
+	s64 group_exec_start;				// sum_exec_runtime of the task when a group run of its container started, -1 if it did not run
+	struct dilation_task_struct * lxc;	// the container this element belongs to
+	struct tk_experiment * exp;			// the experiment of the container, read by the syscall hooks
+	struct task_struct * clock_task;	// the container leader holding the authoritative clock, pinned as well
+	struct hlist_node member_node;		// membership index entry (task_events.c)
+	int queued;							// 0 while the element the fork probe created waits on members_added
+	struct list_head pending_node;		// on the container's members_added or members_exited list (task_events.c)
+	struct rcu_head rcu;
 	
 
 }lxc_schedule_elem;
 
+/***
+Liveness of a schedule queue element: a flag test on the pinned task instead of a pid lookup. PF_EXITING covers the
+case where the exit probes could not be registered
+***/
+static inline int schedule_elem_exited(lxc_schedule_elem * elem) {
+	return elem->exited || (elem->curr_task->flags & PF_EXITING);
+}
+
 
 /***
 This structure maintains additional info to support TimeKeeper functionality. A dilation_task_struct gets created for every process in an experiment.
@@ -42,6 +100,7 @@ TODO: Some of the defined fields are currently unused. Need to clean up.
 struct dilation_task_struct
 {
 	struct task_struct *linux_task; 	// the corresponding task_struct this task is associated with
+	struct tk_experiment *exp;			// the experiment the container is part of
 	struct list_head list; 				// the linked list
 	struct dilation_task_struct *next; 	// the next dilation_task_struct in the per cpu chain
 	struct dilation_task_struct *prev; 	// the prev dilation_task_struct in the per cpu chain
@@ -59,12 +118,26 @@ struct dilation_task_struct
 	hashmap valid_children;
 	lxc_schedule_elem * last_run;
 	int rr_run_time;
+	s64 min_vruntime;					// vruntime new and waking threads of the container are placed at, never decreases
+	short group_run;					// run all runnable threads at once for the whole turn instead of one slice at a time
+	int n_vcpus;						// experiment CPUs the container spans, multi core containers always run as a group
+	cpumask_t cpus;						// the CPUs of a multi core container
 	s64 last_timer_fire_time;
 	s64 last_timer_duration;
+	atomic_t members_changed;			// set when the process tree of the container has to be walked again
+	struct list_head members_added;		// elements of forked members, not in the schedule queue yet (task_events.c)
+	struct list_head members_exited;	// elements of exited members, still in the schedule queue
+	s64 clock_epoch;					// bumped every time the container's clock is thawed or frozen
+	short round_prepared;				// set if the sync thread already refreshed the schedule queue for the coming round
+	struct lxc_stats stats;
+	int clock_slot;						// slot of the container in the clock table (clock_table.c), -1 if none
+	s64 clock_round;					// slices the container has run, published in the clock table
+	struct rb_node tdf_node;			// CBE: node in the experiment's tree of containers ordered by TDF
+	int tdf;							// the TDF the container is ordered by in that tree
+	struct list_head dilation_node;		// on the experiment's dilation_changes while a TDF change is pending
 
 	s64 increment; 						// CS: the increment it should advance in the next round
 	struct timeline* tl; 				// the timeline it is associated with
-    struct list_head cpuList; 			//for CS synchronization among specific cpus
 	
 };
 
@@ -79,7 +152,7 @@ struct poll_helper_struct
 	int err;
 	wait_queue_head_t w_queue;
 	atomic_t done;
-
+	atomic64_t rebase;			// virtual time shift of the container since the call started, see reset_exp
 };
 
 struct select_helper_struct
@@ -91,6 +164,7 @@ struct select_helper_struct
 	wait_queue_head_t w_queue;
 	int ret;
 	atomic_t done;
+	atomic64_t rebase;			// virtual time shift of the container since the call started, see reset_exp
 };
 
 struct sleep_helper_struct
@@ -98,6 +172,7 @@ struct sleep_helper_struct
 	pid_t process_pid;
 	wait_queue_head_t w_queue;
 	atomic_t done;
+	atomic64_t rebase;			// virtual time shift of the container since the call started, see reset_exp
 };
 
 /***
@@ -106,23 +181,25 @@ An additional structure necessary to provide integration of TimeKeeper with S3F.
 struct timeline
 {
     int number; 						// the unique timeline id ( >= 0)
+    struct tk_experiment* exp;			// the experiment the timeline is part of
     struct dilation_task_struct* head;  // the head of a doubly-linked list that has all the containers associated with the timeline
 	spinlock_t tl_lock; 				// timeline lock
     int cpu_assignment; 				// the specific CPU this timeline is assigned to
     struct timeline* next; 				// points to the next timeline assigned to this cpu
     struct task_struct* user_proc; 		// the task_struct to send the 'finished' message to when the timeline has finished advaincing in time
-  	wait_queue_head_t w_queue;
-  	wait_queue_head_t pthread_queue;
-  	wait_queue_head_t progress_thread_queue;
-  	wait_queue_head_t unfreeze_proc_queue;
-  	atomic_t stop_thread;
+  	wait_queue_head_t w_queue;				// the progressing process waits here until the timeline's containers have run
+  	wait_queue_head_t unfreeze_proc_queue;	// the chain's worker waits here for the running container's slice to end
   	atomic_t done;
-  	atomic_t pthread_done;
-  	atomic_t progress_thread_done;
   	atomic_t hrtimer_done;
 	int force; 								// a flag to determine if the virtual time should be forced to be exact as the user expects or not
-	struct task_struct* thread; 			// the kernel thread associated with this timeline
-	struct task_struct* run_timeline_thread;// the kernel thread associated with this timeline
+	struct list_head work_node;				// entry in the chain's work_list while the timeline is waiting for its worker
+	struct hlist_node hash_node;			// entry in the experiment's timeline index
+	s64 load;								// physical time its containers ran per progress window (moving average, ns)
+	int migrate_to;							// chain the timeline moves to the next time it is progressed, -1 if none
+	s64 lookahead;							// lookahead declared by the simulator (ns of virtual time)
+	s64 horizon;							// virtual time the timeline may advance to on its own, 0 if it is progressed window by window
+	int async_busy;							// 1 while a window of a timeline advancing on its own is queued or running
+	s64 reached;							// virtual time every container has run up to, set by the worker after each window
 };
 
 
@@ -155,7 +232,116 @@ This needs to be >= 2 and your system needs to have at least 4 vCPUs
 #define NOFORCE 0
 #define FORCE 1
 
-void progress_exp(void);
+/***
+Round state of one chain (the containers assigned to one experiment CPU). Every chain's sync thread, hrtimer and
+container tasks write their own entry on every slice, so each entry is cacheline aligned, and the fields written every
+slice are kept apart from the ones that are only set when the experiment is set up, so chains never invalidate each
+other's lines and the slice flags do not bounce the lines read when walking the chain
+***/
+struct chain_state {
+	/* written on every slice */
+	int curr_process_finished;					// set by the container's hrtimer when its slice is over
+	int curr_sync_task_finished;				// set when the chain's sync thread finished its round
+	atomic_t wake_up_signal;
+	atomic_t wake_up_signal_sync_drift;
+	struct dilation_task_struct* pending;		// next container whose round bookkeeping has not been done yet (CBE)
+	wait_queue_head_t wait_queue;				// the sync thread waits here for the running container's slice to end
+	struct chain_stats stats;
+
+	/* set when the experiment is set up */
+	struct dilation_task_struct* head ____cacheline_aligned_in_smp;	// the 'head' container of the chain
+	s64 length;									// how long the containers of the chain run in each round (CBE), or number of timelines (CS)
+	struct dilation_task_struct* reserved_by;	// multi core container that owns this chain's CPU, no other container is placed here (CBE)
+	struct task_struct* sync_task;				// pool thread of the chain, runs calculate_sync_drift (CBE) or cs_timeline_worker (CS)
+	int id;
+	struct tk_experiment* exp;					// the experiment the chain belongs to
+	wait_queue_head_t sync_task_queue;
+
+	/* sync thread pool, see experiment.c */
+	int pool_job;								// TK_POOL_IDLE, or the experiment_type the pool thread is running for
+	int pool_release;							// set to make the pool thread leave its job
+	wait_queue_head_t pool_queue;
+	struct completion pool_done;				// completed when the pool thread is back to idle
+
+	/* CS */
+	spinlock_t cpu_lock ____cacheline_aligned_in_smp;
+	struct list_head work_list;					// progressed timelines waiting for the chain's worker
+	struct timeline* timeline_head;				// the timelines assigned to the chain
+} ____cacheline_aligned_in_smp;
+
+/* CS: size of the timeline index (2^bits buckets) */
+#define TK_TIMELINE_HASH_BITS 8
+
+/* CS: timelines are rebalanced between the chains every that many progressed timelines */
+#define TK_CS_REBALANCE_WINDOWS 64
+
+/* pool_job of a chain whose pool thread has nothing to run */
+#define TK_POOL_IDLE 0
+
+/* how long module unload waits for calls on their way in or out of a hooked system call, once none is counted anymore */
+#define TK_HOOK_GRACE_MS 100
+
+/* maximum number of experiments that can exist side by side */
+#define TK_MAX_EXPERIMENTS 8
+
+/***
+One experiment: its containers, the experiment CPUs its chains run on, its sync threads and its statistics.
+Experiments are independent of each other, so several of them can run side by side on disjoint sets of CPUs.
+Commands are addressed to an experiment with a '@id,' prefix, to experiment 0 otherwise. The entries of the
+experiment table live as long as the module, so a pointer to one never becomes invalid
+***/
+struct tk_experiment {
+	int id;
+	int initialized;
+	int cpu_base;								// first experiment CPU, chain i runs on cpu_base + i
+	int n_cpus;									// number of experiment CPUs (chains), at most EXP_CPUS. 0 if not set yet
+
+	int experiment_type;						// CBE for ns-3/core, CS for S3F
+	int experiment_stopped;						// NOTRUNNING, RUNNING, FROZEN or STOPPING
+	short syscalls_hooked;						// set while the experiment holds a reference on the hooked syscalls
+	s64 freeze_quantum;							// how far the leader advances in virtual time every round (CBE)
+	s64 sched_granularity;						// physical time a thread runs for when it is picked inside its container, scaled by its TDF
+	int vt_compensate;							// CBE: shorten every container's slices by its learned overshoot (vt_overshoot_update)
+	int proc_num;								// the number of containers in the experiment
+	struct list_head exp_list;					// all containers of the experiment
+	struct mutex exp_mutex;						// protects exp_list
+	struct dilation_task_struct *leader_task;	// the container with the highest TDF
+	int exp_highest_dilation;					// TDF of the leader
+	s64 actual_time;							// the virtual time every container should be at at the end of the round
+	s64 expected_increase;						// how far virtual time increases every round
+	int number_of_heads;						// number of chains in use, at most n_cpus
+	int dilation_change;						// set if the TDF of a container changed while the experiment was running
+	struct list_head dilation_changes;			// containers with a pending TDF change (newDilation)
+	spinlock_t dilation_changes_lock;			// protects dilation_changes and the newDilation of the containers on it
+	struct rb_root tdf_tree;					// CBE: the containers ordered by TDF, the leader is the last one
+	int stopped_change;
+
+	struct task_struct *catchup_task;			// catchup_func thread of the experiment
+	wait_queue_head_t wq;						// catchup_func waits here for the sync threads of the round
+	atomic_t n_active_syscalls;
+	atomic_t experiment_stopping;
+	atomic_t worker_count;
+	atomic_t running_done;
+	atomic_t start_count;
+	atomic_t progress_cbe_rounds;
+	atomic_t progress_cbe_enabled;
+	s64 progress_cbe_target;					// virtual time a progress_exp_cbe_until run stops at, 0 if none
+	wait_queue_head_t progress_cbe_wait_queue;
+	wait_queue_head_t progress_cbe_catchup_tsk;
+	wait_queue_head_t cbe_exp_stop_queue;
+
+	/* CS */
+	DECLARE_HASHTABLE(timelines, TK_TIMELINE_HASH_BITS);	// every timeline of the experiment, by number
+	spinlock_t timelines_lock;					// protects the timelines of the chains, their load and migrate_to
+	atomic_t cs_windows;						// timelines progressed since the last rebalance
+	atomic_t n_tl_waiters;						// callers sleeping on a timeline's w_queue, clean_exp frees the timelines once it is 0
+
+	struct tk_cpu_stats __percpu *stats;
+	struct tk_cpu_stats stats_base;				// sum of the per-CPU counters at the last reset (tk_stats_reset)
+	struct chain_state chains[EXP_CPUS];
+};
+
+void progress_exp(struct tk_experiment *exp);
 
 /* general_commands.c */
 extern void freeze_proc(struct task_struct *aTask);
@@ -174,43 +360,75 @@ extern void set_netdevice_owner(char * write_buffer);
 
 /* sync_experiment.c */
 extern int catchup_func(void *data);
-extern void core_sync_exp(void);
-extern void set_clean_exp(void);
-extern void add_to_exp(int pid);
-extern void add_to_exp_proc(char *write_buffer);
-extern void add_sim_to_exp_proc(char *write_buffer);
-extern void sync_and_freeze(void);
-extern void progress_exp(void);
-extern void set_cbe_exp_timeslice(char *write_buffer);
-extern int progress_exp_cbe(char * write_buffer);
-extern void resume_exp_cbe();
-
-extern void add_to_exp(int pid);
+extern void core_sync_exp(struct tk_experiment *exp);
+extern void set_clean_exp(struct tk_experiment *exp);
+extern void add_to_exp(struct tk_experiment *exp, int pid, int n_vcpus);
+extern void add_to_exp_proc(struct tk_experiment *exp, char *write_buffer);
+extern void add_sim_to_exp_proc(struct tk_experiment *exp, char *write_buffer);
+extern void sync_and_freeze(struct tk_experiment *exp);
+extern void progress_exp(struct tk_experiment *exp);
+extern void set_cbe_exp_timeslice(struct tk_experiment *exp, char *write_buffer);
+extern void set_sched_granularity(struct tk_experiment *exp, char *write_buffer);
+extern void set_group_run_proc(struct tk_experiment *exp, char *write_buffer);
+extern int progress_exp_cbe(struct tk_experiment *exp, char * write_buffer);
+extern int progress_exp_cbe_rounds(struct tk_experiment *exp, int progress_rounds);
+extern int progress_exp_cbe_until(struct tk_experiment *exp, s64 target);
+extern int add_to_exp_bulk(struct tk_experiment *exp, tk_bulk_args *args);
+extern s64 cbe_reached_time(struct tk_experiment *exp);
+extern int hold_exp_cbe(struct tk_experiment *exp);
+extern void resume_exp_cbe(struct tk_experiment *exp);
+extern void reset_exp(struct tk_experiment *exp);
+extern void set_vt_compensation(struct tk_experiment *exp, char *write_buffer);
+
 extern void addToChain(struct dilation_task_struct *task);
 extern void assign_to_cpu(struct dilation_task_struct *task);
-extern void printChainInfo(void);
-extern void clean_exp(void);
-extern void set_children_time(struct task_struct *aTask, s64 time);
+extern void printChainInfo(struct tk_experiment *exp);
+extern void clean_exp(struct tk_experiment *exp);
+extern void set_children_time(struct tk_experiment *exp, struct task_struct *aTask, s64 time);
 extern int resume_all(struct task_struct *aTask,struct dilation_task_struct * lxc) ;
 extern int freeze_proc_exp_recurse(struct dilation_task_struct *aTask);
 extern int unfreeze_proc_exp_recurse(struct dilation_task_struct *aTask, s64 expected_time);
 extern void set_children_policy(struct task_struct *aTask, int policy, int priority);
 extern void set_children_cpu(struct task_struct *aTask, int cpu);
-extern void clean_stopped_containers(void);
+extern void clean_stopped_containers(struct tk_experiment *exp);
 extern void dilate_proc_recurse_exp(int pid, int new_dilation);
-extern void change_containers_dilation(void);
+extern void change_containers_dilation(struct tk_experiment *exp);
+extern void thaw_container_clock(struct dilation_task_struct * lxc, s64 time);
+extern void freeze_container_clock(struct dilation_task_struct * lxc, s64 freeze_time);
+extern void materialize_task_clock(struct dilation_task_struct * lxc, lxc_schedule_elem * elem);
 extern void calculate_virtual_time_difference(struct dilation_task_struct* task, s64 now, s64 expected_time);
 extern s64 calculate_change(struct dilation_task_struct* task, s64 virt_time, s64 expected_time);
 extern s64 get_virtual_time(struct dilation_task_struct* task, s64 now);
-
+extern void prepare_container_round(struct dilation_task_struct *task, s64 expected_time);
+extern void prepare_pending_container(struct chain_state *chain);
+
+
+/* experiment.c */
+extern struct tk_experiment experiments[TK_MAX_EXPERIMENTS];
+extern struct tk_experiment * tk_experiment_get(int id);
+extern struct tk_experiment * tk_experiment_lookup(int id);
+extern void tk_experiments_cleanup(void);
+extern void tk_experiments_exit(void);
+extern int tk_experiment_cpus_free(struct tk_experiment *exp);
+extern int tk_sync_cpu(int i);
+extern void set_exp_cpus(struct tk_experiment *exp, char *write_buffer);
+extern void tk_hook_syscalls(struct tk_experiment *exp);
+extern void tk_unhook_syscalls(struct tk_experiment *exp);
+extern int tk_pool_dispatch(struct chain_state *chain, int job, int cpu);
+extern void tk_pool_release(struct chain_state *chain);
+extern int tk_pool_released(struct chain_state *chain);
+extern void tk_wait_hooked_calls(void);
 
 
 /* s3f_sync_experiment.c */
-extern void s3f_add_to_exp_proc(char *write_buffer);
-extern void s3f_set_interval(char *write_buffer);
-extern int s3f_progress_timeline(char *write_buffer);
-extern void s3f_reset(char *write_buffer);
-extern void fix_timeline_proc(char *write_buffer);
+extern void s3f_add_to_exp_proc(struct tk_experiment *exp, char *write_buffer);
+extern void s3f_add_to_exp(struct tk_experiment *exp, int pid, int timeline);
+extern void s3f_set_interval(struct tk_experiment *exp, char *write_buffer);
+extern int s3f_progress_timeline(struct tk_experiment *exp, char *write_buffer);
+extern void s3f_reset(struct tk_experiment *exp, char *write_buffer);
+extern void fix_timeline_proc(struct tk_experiment *exp, char *write_buffer);
+extern int s3f_timeline_horizon(struct tk_experiment *exp, tk_horizon_args *args);
+extern void s3f_wait_timeline_waiters(struct tk_experiment *exp);
 
 /* hooked_functions.c */
 extern unsigned long **aquire_sys_call_table(void);
@@ -227,6 +445,38 @@ extern int run_head_process(struct dilation_task_struct * lxc, lxc_schedule_elem
 extern int unfreeze_proc_vt_advance(struct dilation_task_struct *aTask, s64 expected_time) ;
 
 
+/* stats.c */
+extern void tk_stats_reset(struct tk_experiment * exp);
+extern void tk_stats_reset_all(struct tk_experiment * exp);
+extern void tk_stats_get(struct tk_experiment * exp, ioctl_args * args);
+extern void tk_stats_record_round_error(struct tk_experiment * exp, s64 err);
+extern void tk_stats_record_timer_lateness(struct tk_experiment * exp, struct hrtimer * timer);
+extern void tk_stats_record_chain_round(struct chain_state * chain, s64 round_time);
+extern int status_show(struct seq_file *m, void *v);
+
+
+/* clock_table.c */
+extern int tk_clock_table_init(struct proc_dir_entry * dir);
+extern void tk_clock_table_exit(struct proc_dir_entry * dir);
+extern void tk_clock_table_add(struct dilation_task_struct * lxc);
+extern void tk_clock_table_remove(struct dilation_task_struct * lxc);
+extern void tk_clock_table_publish(struct dilation_task_struct * lxc, int state);
+
+
+/* task_events.c */
+extern int tk_task_events_enabled;
+extern void tk_task_events_init(void);
+extern void tk_task_events_exit(void);
+extern void tk_member_add(struct dilation_task_struct * lxc, lxc_schedule_elem * elem);
+extern void tk_member_del(lxc_schedule_elem * elem);
+extern void tk_member_free(lxc_schedule_elem * elem);
+extern void tk_members_apply(struct dilation_task_struct * lxc);
+extern void tk_members_drop(struct dilation_task_struct * lxc);
+extern s64 tk_task_virtual_time(struct task_struct * task, s64 now);
+extern int tk_task_frozen(struct task_struct * task);
+extern struct tk_experiment * tk_task_experiment(struct task_struct * task);
+
+
 /* common.c */
 extern void send_a_message(int pid);
 extern void send_a_message_proc(char * write_buffer);
@@ -246,6 +496,9 @@ extern int add_to_schedule_list(struct dilation_task_struct * lxc, struct task_s
 extern struct task_struct * pop_schedule_list(struct dilation_task_struct * lxc);
 extern lxc_schedule_elem * schedule_list_get_head(struct dilation_task_struct * lxc);
 extern void requeue_schedule_list(struct dilation_task_struct * lxc);
+extern void prune_schedule_list(struct dilation_task_struct * lxc);
+extern int schedule_list_add_member(struct dilation_task_struct * lxc, lxc_schedule_elem * elem);
+extern void schedule_list_remove(struct dilation_task_struct * lxc, lxc_schedule_elem * elem);
 extern void clean_up_schedule_list(struct dilation_task_struct * lxc);
 extern int schedule_list_size(struct dilation_task_struct * lxc);
 
@@ -0,0 +1,456 @@
+#include "dilation_module.h"
+
+/***
+The experiment table. Every experiment has its own containers, chains, sync threads and statistics, and runs its
+containers on its own range of experiment CPUs, so several experiments can run side by side on one machine as long as
+their CPU ranges are disjoint. Experiment 0 exists from the moment the module is loaded and uses the last EXP_CPUS CPUs,
+like the single experiment of older versions. Every other experiment is only set up by SET_EXP_CPUS, which gives it
+its CPUs, every other command addressed to an experiment that was never set up is ignored.
+
+The hooked system calls are shared: they are installed when the first experiment is synchronized and restored when the
+last one is cleaned up. A hooked call finds the experiment of the calling task through the membership index.
+
+Every chain has a pool thread that lives as long as the module. sync_and_freeze hands it the chain's job
+(calculate_sync_drift for CBE, cs_timeline_worker for CS) and clean_exp takes it back, so experiments run back to back
+do not create and stop kernel threads every time. reset_exp restarts an experiment without cleaning it up at all.
+***/
+
+struct tk_experiment experiments[TK_MAX_EXPERIMENTS];
+
+/* serializes setting up experiments, changing their CPUs and hooking the system calls */
+static DEFINE_MUTEX(tk_experiments_mutex);
+
+/* number of experiments holding a reference on the hooked system calls */
+static int tk_n_hooked = 0;
+
+extern int TOTAL_CPUS;
+extern int calculate_sync_drift(void *data);
+extern int cs_timeline_worker(void *data);
+
+extern unsigned long **sys_call_table;
+extern asmlinkage int (*ref_sys_poll)(struct pollfd __user * ufds, unsigned int nfds, int timeout_msecs);
+extern asmlinkage long (*ref_sys_select)(int n, fd_set __user *inp, fd_set __user *outp, fd_set __user *exp, struct timeval __user *tvp);
+extern asmlinkage long (*ref_sys_sleep)(struct timespec __user *rqtp, struct timespec __user *rmtp);
+extern asmlinkage long (*ref_sys_clock_nanosleep)(const clockid_t which_clock, int flags, const struct timespec __user * rqtp, struct timespec __user * rmtp);
+extern asmlinkage int (*ref_sys_clock_gettime)(const clockid_t which_clock, struct timespec __user * tp);
+
+unsigned long orig_cr0;
+
+
+/***
+Initializes an entry of the experiment table and starts its catchup task. Must hold tk_experiments_mutex
+***/
+static int tk_experiment_init(struct tk_experiment *exp, int id) {
+	int i;
+
+	memset(exp, 0, sizeof(struct tk_experiment));
+	exp->id = id;
+	exp->freeze_quantum = 300000000;
+	exp->sched_granularity = 100000;
+	exp->experiment_stopped = NOTRUNNING;
+	exp->experiment_type = NOTSET;
+	exp->exp_highest_dilation = -100000000;
+	exp->leader_task = NULL;
+	INIT_LIST_HEAD(&exp->exp_list);
+	INIT_LIST_HEAD(&exp->dilation_changes);
+	spin_lock_init(&exp->dilation_changes_lock);
+	exp->tdf_tree = RB_ROOT;
+	mutex_init(&exp->exp_mutex);
+	init_waitqueue_head(&exp->wq);
+	init_waitqueue_head(&exp->progress_cbe_wait_queue);
+	init_waitqueue_head(&exp->progress_cbe_catchup_tsk);
+	init_waitqueue_head(&exp->cbe_exp_stop_queue);
+	hash_init(exp->timelines);
+	spin_lock_init(&exp->timelines_lock);
+	atomic_set(&exp->cs_windows, 0);
+	atomic_set(&exp->n_tl_waiters, 0);
+
+	/* experiment 0 keeps the CPUs of the single experiment of older versions */
+	if (id == 0) {
+		exp->cpu_base = TOTAL_CPUS - EXP_CPUS;
+		exp->n_cpus = EXP_CPUS;
+	}
+
+	for (i = 0; i < EXP_CPUS; i++) {
+		exp->chains[i].id = i;
+		exp->chains[i].exp = exp;
+		exp->chains[i].timeline_head = NULL;
+		exp->chains[i].length = 0;
+		exp->chains[i].reserved_by = NULL;
+		spin_lock_init(&exp->chains[i].cpu_lock);
+		INIT_LIST_HEAD(&exp->chains[i].work_list);
+		init_waitqueue_head(&exp->chains[i].sync_task_queue);
+		exp->chains[i].sync_task = NULL;
+		exp->chains[i].pool_job = TK_POOL_IDLE;
+		init_waitqueue_head(&exp->chains[i].pool_queue);
+		init_completion(&exp->chains[i].pool_done);
+	}
+
+	exp->stats = alloc_percpu(struct tk_cpu_stats);
+	if (exp->stats == NULL)
+		return -ENOMEM;
+
+	exp->catchup_task = kthread_create(&catchup_func, exp, "catchup_task/%d", id);
+	if (IS_ERR(exp->catchup_task)) {
+		PDEBUG_E("Experiment %d: Cannot create catchup task\n", id);
+		exp->catchup_task = NULL;
+		free_percpu(exp->stats);
+		exp->stats = NULL;
+		return -ENOMEM;
+	}
+	wake_up_process(exp->catchup_task);
+
+	exp->initialized = 1;
+	PDEBUG_A("Experiment %d: Initialized\n", id);
+	return 0;
+}
+
+/***
+Returns the experiment with the given id, setting it up on first use. NULL if the id is invalid or it cannot be set up
+***/
+struct tk_experiment * tk_experiment_get(int id) {
+	struct tk_experiment *exp;
+
+	if (id < 0 || id >= TK_MAX_EXPERIMENTS) {
+		PDEBUG_E("Experiment: Invalid experiment id %d\n", id);
+		return NULL;
+	}
+
+	exp = &experiments[id];
+	mutex_lock(&tk_experiments_mutex);
+	if (!exp->initialized && tk_experiment_init(exp, id) != 0)
+		exp = NULL;
+	mutex_unlock(&tk_experiments_mutex);
+	return exp;
+}
+
+/***
+Returns the experiment with the given id if it was set up, NULL otherwise. Unlike tk_experiment_get, it never sets up
+an experiment (and starts its catchup task) because of a command addressed to an unknown id
+***/
+struct tk_experiment * tk_experiment_lookup(int id) {
+	struct tk_experiment *exp = NULL;
+
+	if (id < 0 || id >= TK_MAX_EXPERIMENTS) {
+		PDEBUG_E("Experiment: Invalid experiment id %d\n", id);
+		return NULL;
+	}
+
+	mutex_lock(&tk_experiments_mutex);
+	if (experiments[id].initialized)
+		exp = &experiments[id];
+	mutex_unlock(&tk_experiments_mutex);
+	if (exp == NULL)
+		PDEBUG_E("Experiment: Experiment %d was not set up, set its CPUs first\n", id);
+	return exp;
+}
+
+/***
+Cleans up every experiment. Called when the module is unloaded
+***/
+void tk_experiments_cleanup(void) {
+	int id;
+
+	for (id = 0; id < TK_MAX_EXPERIMENTS; id++) {
+		if (experiments[id].initialized)
+			set_clean_exp(&experiments[id]);
+	}
+}
+
+/***
+Stops the catchup tasks and the pool threads and frees the statistics of every experiment. Called when the module is
+unloaded, after tk_experiments_cleanup
+***/
+void tk_experiments_exit(void) {
+	int id;
+	int i;
+	struct tk_experiment *exp;
+
+	for (id = 0; id < TK_MAX_EXPERIMENTS; id++) {
+		exp = &experiments[id];
+		if (!exp->initialized)
+			continue;
+		if (kthread_stop(exp->catchup_task))
+			PDEBUG_E("Experiment %d: Stopping catchup_task error\n", id);
+		for (i = 0; i < EXP_CPUS; i++) {
+			if (exp->chains[i].sync_task == NULL)
+				continue;
+			tk_pool_release(&exp->chains[i]);
+			if (kthread_stop(exp->chains[i].sync_task))
+				PDEBUG_E("Experiment %d: Stopping pool thread %d error\n", id, i);
+			exp->chains[i].sync_task = NULL;
+		}
+		free_percpu(exp->stats);
+		exp->initialized = 0;
+	}
+}
+
+/***
+Waits until no task of any experiment is inside a hooked system call. Called when the module is unloaded, once the
+system call table has been restored
+***/
+void tk_wait_hooked_calls(void) {
+	int id;
+	int n_active;
+	int waited = 0;
+
+	do {
+		n_active = 0;
+		for (id = 0; id < TK_MAX_EXPERIMENTS; id++) {
+			if (experiments[id].initialized)
+				n_active += atomic_read(&experiments[id].n_active_syscalls);
+		}
+		if (n_active == 0)
+			break;
+		if (waited++ % 100 == 0)
+			PDEBUG_A("Tk Wait Hooked Calls: %d tasks still in a hooked system call\n", n_active);
+		msleep(10);
+	} while (1);
+
+	/* a call that did not reach its counter yet, or is on its way out of the hook */
+	msleep(TK_HOOK_GRACE_MS);
+}
+
+/***
+The pool thread of a chain. It waits for sync_and_freeze to hand it a job, runs it until clean_exp releases it and
+goes back to waiting. Only stopped when the module is unloaded
+***/
+static int tk_pool_worker(void *data) {
+	struct chain_state *chain = (struct chain_state *)data;
+	int job;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(chain->pool_queue, chain->pool_job != TK_POOL_IDLE || kthread_should_stop());
+		job = chain->pool_job;
+		if (job == TK_POOL_IDLE)
+			continue;
+
+		PDEBUG_V("Pool Worker: Experiment %d chain %d starts job %d\n", chain->exp->id, chain->id, job);
+		if (job == CBE)
+			calculate_sync_drift(chain);
+		else if (job == CS)
+			cs_timeline_worker(chain);
+
+		/* a CBE job returns on its own when the experiment is stopping, it is only idle again once it is released */
+		wait_event_interruptible(chain->pool_queue, chain->pool_release || kthread_should_stop());
+		__set_current_state(TASK_RUNNING);
+		chain->pool_job = TK_POOL_IDLE;
+		complete(&chain->pool_done);
+	}
+	return 0;
+}
+
+/***
+Hands a job (CBE or CS) to the pool thread of a chain, starting the thread the first time the chain is used. The
+thread is moved to the given CPU, the one tk_sync_cpu picks for the chain
+***/
+int tk_pool_dispatch(struct chain_state *chain, int job, int cpu) {
+	struct task_struct *task;
+
+	if (chain->pool_job != TK_POOL_IDLE) {
+		PDEBUG_E("Tk Pool Dispatch: Experiment %d chain %d is still busy\n", chain->exp->id, chain->id);
+		return -EBUSY;
+	}
+
+	if (chain->sync_task == NULL) {
+		task = kthread_create(&tk_pool_worker, chain, "tk_worker/%d/%d", chain->exp->id, chain->id);
+		if (IS_ERR(task)) {
+			PDEBUG_E("Tk Pool Dispatch: Cannot create the pool thread of chain %d\n", chain->id);
+			return -ENOMEM;
+		}
+		kthread_bind(task, cpu);
+		chain->sync_task = task;
+		wake_up_process(task);
+	}
+	else if (set_cpus_allowed_ptr(chain->sync_task, cpumask_of(cpu)))
+		PDEBUG_E("Tk Pool Dispatch: Cannot move the pool thread of chain %d to CPU %d\n", chain->id, cpu);
+
+	init_completion(&chain->pool_done);
+	chain->pool_release = 0;
+	smp_wmb();
+	chain->pool_job = job;
+	wake_up_interruptible(&chain->pool_queue);
+	return 0;
+}
+
+/***
+Takes the job back from the pool thread of a chain and waits until the thread is idle again. The caller must have
+made sure the job can return, ie woken the CS worker's timelines
+***/
+void tk_pool_release(struct chain_state *chain) {
+
+	if (chain->sync_task == NULL || chain->pool_job == TK_POOL_IDLE)
+		return;
+
+	chain->pool_release = 1;
+	smp_mb();
+	wake_up_interruptible(&chain->sync_task_queue);
+	wake_up_interruptible(&chain->pool_queue);
+	wake_up_process(chain->sync_task);
+	wait_for_completion(&chain->pool_done);
+	chain->pool_release = 0;
+}
+
+/***
+Whether the job of a pool thread has to return, checked by calculate_sync_drift and cs_timeline_worker in place of
+kthread_should_stop
+***/
+int tk_pool_released(struct chain_state *chain) {
+	return chain->pool_release || kthread_should_stop();
+}
+
+/***
+Returns 1 if an experiment other than except has containers on the given CPU
+***/
+static int tk_cpu_in_use(int cpu, struct tk_experiment *except) {
+	int id;
+	struct tk_experiment *exp;
+
+	for (id = 0; id < TK_MAX_EXPERIMENTS; id++) {
+		exp = &experiments[id];
+		if (exp == except || !exp->initialized || exp->n_cpus == 0)
+			continue;
+		if (exp->proc_num == 0 && exp->experiment_stopped == NOTRUNNING)
+			continue;
+		if (cpu >= exp->cpu_base && cpu < exp->cpu_base + exp->n_cpus)
+			return 1;
+	}
+	return 0;
+}
+
+/***
+Returns 1 if none of the experiment's CPUs is used by another experiment. Checked when the first container is added
+***/
+int tk_experiment_cpus_free(struct tk_experiment *exp) {
+	int cpu;
+	int ret = 1;
+
+	if (exp->n_cpus == 0)
+		return 0;
+
+	mutex_lock(&tk_experiments_mutex);
+	for (cpu = exp->cpu_base; cpu < exp->cpu_base + exp->n_cpus; cpu++) {
+		if (tk_cpu_in_use(cpu, exp))
+			ret = 0;
+	}
+	mutex_unlock(&tk_experiments_mutex);
+	return ret;
+}
+
+/***
+The CPU the i-th sync thread of an experiment is bound to: sync threads are spread over the CPUs no experiment
+runs containers on
+***/
+int tk_sync_cpu(int i) {
+	int cpu;
+	int n_free = 0;
+
+	for (cpu = 0; cpu < TOTAL_CPUS; cpu++) {
+		if (!tk_cpu_in_use(cpu, NULL))
+			n_free++;
+	}
+	if (n_free == 0) {
+		PDEBUG_E("Tk Sync Cpu: Every CPU runs containers, binding sync thread %d to CPU 0\n", i);
+		return 0;
+	}
+
+	i = i % n_free;
+	for (cpu = 0; cpu < TOTAL_CPUS; cpu++) {
+		if (tk_cpu_in_use(cpu, NULL))
+			continue;
+		if (i-- == 0)
+			return cpu;
+	}
+	return 0;
+}
+
+/***
+Sets the experiment CPUs of an experiment: 'first_cpu,n_cpus'. Only allowed before any container is added, and the
+CPUs must not be used by another experiment. CPU 0 is never an experiment CPU, it is left to the sync threads and the
+rest of the system
+***/
+void set_exp_cpus(struct tk_experiment *exp, char *write_buffer) {
+	int first_cpu, n_cpus, value, cpu;
+
+	first_cpu = atoi(write_buffer);
+	value = get_next_value(write_buffer);
+	n_cpus = atoi(write_buffer + value);
+
+	if (n_cpus < 1 || n_cpus > EXP_CPUS || first_cpu < 1 || first_cpu + n_cpus > TOTAL_CPUS) {
+		PDEBUG_E("Set Exp Cpus: Experiment %d: Invalid CPUs %d-%d, at most %d CPUs out of %d\n", exp->id, first_cpu, first_cpu + n_cpus - 1, EXP_CPUS, TOTAL_CPUS);
+		return;
+	}
+
+	mutex_lock(&tk_experiments_mutex);
+	if (exp->proc_num != 0 || exp->experiment_stopped != NOTRUNNING) {
+		PDEBUG_E("Set Exp Cpus: Experiment %d already has containers\n", exp->id);
+		goto out;
+	}
+	for (cpu = first_cpu; cpu < first_cpu + n_cpus; cpu++) {
+		if (tk_cpu_in_use(cpu, exp)) {
+			PDEBUG_E("Set Exp Cpus: Experiment %d: CPU %d is used by another experiment\n", exp->id, cpu);
+			goto out;
+		}
+	}
+
+	exp->cpu_base = first_cpu;
+	exp->n_cpus = n_cpus;
+	PDEBUG_A("Set Exp Cpus: Experiment %d runs on CPUs %d-%d\n", exp->id, first_cpu, first_cpu + n_cpus - 1);
+out:
+	mutex_unlock(&tk_experiments_mutex);
+}
+
+/***
+Takes a reference on the hooked system calls for an experiment, hooking them if it is the first one
+***/
+void tk_hook_syscalls(struct tk_experiment *exp) {
+
+	mutex_lock(&tk_experiments_mutex);
+	if (exp->syscalls_hooked) {
+		mutex_unlock(&tk_experiments_mutex);
+		return;
+	}
+	exp->syscalls_hooked = 1;
+
+	if (tk_n_hooked++ == 0) {
+		PDEBUG_V("Tk Hook Syscalls: Hooking system calls\n");
+		orig_cr0 = read_cr0();
+		write_cr0(orig_cr0 & ~0x00010000);
+
+		sys_call_table[NR_select] = (unsigned long *)sys_select_new;
+		sys_call_table[__NR_poll] = (unsigned long *) sys_poll_new;
+		sys_call_table[__NR_nanosleep] = (unsigned long *)sys_sleep_new;
+		sys_call_table[__NR_clock_gettime] = (unsigned long *) sys_clock_gettime_new;
+		sys_call_table[__NR_clock_nanosleep] = (unsigned long *) sys_clock_nanosleep_new;
+
+		write_cr0(orig_cr0 | 0x00010000 );
+	}
+	mutex_unlock(&tk_experiments_mutex);
+}
+
+/***
+Drops the experiment's reference on the hooked system calls, restoring them when no experiment uses them anymore
+***/
+void tk_unhook_syscalls(struct tk_experiment *exp) {
+
+	mutex_lock(&tk_experiments_mutex);
+	if (!exp->syscalls_hooked) {
+		mutex_unlock(&tk_experiments_mutex);
+		return;
+	}
+	exp->syscalls_hooked = 0;
+
+	if (--tk_n_hooked == 0) {
+		PDEBUG_A("Tk Unhook Syscalls: Resetting Sys Call table\n");
+		orig_cr0 = read_cr0();
+		write_cr0(orig_cr0 & ~0x00010000);
+		sys_call_table[__NR_poll] = (unsigned long *)ref_sys_poll;
+		sys_call_table[NR_select] = (unsigned long *)ref_sys_select;
+		sys_call_table[__NR_nanosleep] = (unsigned long *)ref_sys_sleep;
+		sys_call_table[__NR_clock_gettime] = (unsigned long *) ref_sys_clock_gettime;
+		sys_call_table[__NR_clock_nanosleep] = (unsigned long *) ref_sys_clock_nanosleep;
+		write_cr0(orig_cr0 | 0x00010000);
+		PDEBUG_A("Tk Unhook Syscalls: Sys Call table Updated\n");
+	}
+	mutex_unlock(&tk_experiments_mutex);
+}
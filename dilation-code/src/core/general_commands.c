@@ -18,12 +18,7 @@ void leap_proc(char *write_buffer);
 void leap(int pid, int interval);
 s64 get_virtual_time_task(struct task_struct* task, s64 now);
 
-/* variables needed to be able to change dilations in a synchronized experiment */
-extern int experiment_stopped;
-extern struct list_head exp_list;
-extern struct mutex exp_mutex;
-extern int dilation_change;
-extern void force_virtual_time(struct task_struct* aTask, s64 time);
+extern void force_virtual_time(struct tk_experiment *exp, struct task_struct* aTask, s64 time);
 extern s64 PRECISION;
 
 
@@ -113,47 +108,8 @@ Returns the current virtual time given a task struct, and the current system tim
 ***/
 s64 get_virtual_time_task(struct task_struct* task_arg, s64 now)
 {
-        s64 real_running_time;
-        s64 temp_past_physical_time;
-        s64 dilated_running_time;
-        s32 rem;
-        s64 virt_time;
-		struct task_struct * task = task_arg;
-
-		/* get current virtual time of a task */
-
-		if (task->group_leader != task) { 
-           	task = task->group_leader;
-        }
-        
-		
-        real_running_time = now - task->virt_start_time;
-
-		if (task->freeze_time != 0)
-			temp_past_physical_time = task->past_physical_time + (now - task->freeze_time);
-		else
-			temp_past_physical_time = task->past_physical_time;
-
-        
-        if (task->dilation_factor > 0)
-        {
-		      dilated_running_time = div_s64_rem( (real_running_time - temp_past_physical_time)*PRECISION ,task->dilation_factor,&rem) + task->past_virtual_time;
-              virt_time = dilated_running_time + task->virt_start_time;
-        }
-        else if (task->dilation_factor < 0)
-        {
-		      dilated_running_time = div_s64_rem( (real_running_time - temp_past_physical_time)*(task->dilation_factor*-1), PRECISION, &rem) + task->past_virtual_time;
-              virt_time =  dilated_running_time + task->virt_start_time;
-        }
-        else
-        {
-              dilated_running_time = (real_running_time - temp_past_physical_time) + task->past_virtual_time;
-              virt_time = dilated_running_time + task->virt_start_time;
-        }
-
-        
-        return virt_time;
-
+		/* get current virtual time of a task, from its container's (or its leader's) clock */
+        return tk_task_virtual_time(task_arg, now);
 }
 
 
@@ -184,7 +140,7 @@ void leap(int pid, int interval)
 	do_gettimeofday(&ktv);
 	curr_time = timeval_to_ns(&ktv); 
 	curr_time = get_virtual_time_task(task, curr_time);
-	force_virtual_time(task, curr_time + jump);
+	force_virtual_time(tk_task_experiment(task), task, curr_time + jump);
 }
 
 /***
@@ -370,34 +326,44 @@ void change_dilation(int pid, int new_dilation) {
 }
 
 /***
-set dilation factor of all tasks in experiment list starting with the main task whose pid is given. If the exp is not running, recursilvely change the dilation factor of all children of the given pid.
+set dilation factor of all tasks in experiment list starting with the main task whose pid is given. If the task is not part of a running experiment, recursilvely change the dilation factor of all children of the given pid.
 ***/
 void dilate_recurse(int pid, int new_dilation) {
 	struct task_struct *aTask;
 	struct dilation_task_struct* list_node;
+	struct tk_experiment *exp;
 	struct list_head *pos;
     struct list_head *n;
+	int id;
+	int found = 0;
 	aTask = find_task_by_pid(pid);
     if (aTask != NULL)
 	{
-		
-		if (experiment_stopped == RUNNING)
-		{ 	
+		for (id = 0; id < TK_MAX_EXPERIMENTS; id++) {
+			exp = &experiments[id];
+			if (!exp->initialized || exp->experiment_stopped != RUNNING)
+				continue;
+
 			/* if the experiment is running */
-			mutex_lock(&exp_mutex);
-			list_for_each_safe(pos, n, &exp_list)
+			mutex_lock(&exp->exp_mutex);
+			list_for_each_safe(pos, n, &exp->exp_list)
         	{
         		list_node = list_entry(pos, struct dilation_task_struct, list);
 				if (list_node->linux_task->pid == pid)
 				{ 	
-					/* we found that the task is running in the experiment */
+					/* we found that the task is running in the experiment, catchup_func applies the change before the next round */
+					spin_lock(&exp->dilation_changes_lock);
 					list_node->newDilation = new_dilation;
-					dilation_change = 1;
+					if (list_empty(&list_node->dilation_node))
+						list_add_tail(&list_node->dilation_node, &exp->dilation_changes);
+					exp->dilation_change = 1;
+					spin_unlock(&exp->dilation_changes_lock);
+					found = 1;
 				}
 			}
-			mutex_unlock(&exp_mutex);
+			mutex_unlock(&exp->exp_mutex);
 		}
-		else {
+		if (!found) {
         		change_dilation(pid, new_dilation);
         		perform_on_children(aTask, change_dilation, new_dilation);
 		}
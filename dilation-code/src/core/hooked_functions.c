@@ -17,7 +17,6 @@ asmlinkage int (*ref_sys_select)(int n, fd_set __user *inp, fd_set __user *outp,
 asmlinkage int (*ref_sys_select_dialated)(int n, fd_set __user *inp, fd_set __user *outp, fd_set __user *exp, struct timeval __user *tvp);
 
 
-extern struct list_head exp_list;
 //struct poll_list;
 extern struct poll_list {
     struct poll_list *next;
@@ -33,12 +32,7 @@ extern hashmap sleep_process_lookup;
 
 extern int find_children_info(struct task_struct* aTask, int pid);
 extern int kill(struct task_struct *killTask, int sig, struct dilation_task_struct* dilation_task);
-extern int experiment_stopped;
-extern int experiment_type;
 extern s64 Sim_time_scale;
-extern s64 expected_increase;
-extern atomic_t n_active_syscalls;
-extern atomic_t experiment_stopping;
 
 
 extern int do_dialated_poll(unsigned int nfds,  struct poll_list *list, struct poll_wqueues *wait,struct task_struct * tsk);
@@ -46,45 +40,14 @@ extern int do_dialated_select(int n, fd_set_bits *fds,struct task_struct * tsk);
 
 s64 get_dilated_time(struct task_struct * task)
 {
-	s64 temp_past_physical_time;
 	struct timeval tv;
 	do_gettimeofday(&tv);
 	s64 now = timeval_to_ns(&tv);
 
 	if(task->virt_start_time != 0){
 
-		/* use virtual time of the leader thread */
-		if (task->group_leader != task) { 
-           	task = task->group_leader;
-        }
-	
-		s32 rem;
-		s64 real_running_time;
-		s64 dilated_running_time;
-		
-		real_running_time = now - task->virt_start_time;
-		
-		if (task->freeze_time != 0) {
-			temp_past_physical_time = task->past_physical_time + (now - task->freeze_time);		
-		}
-		else{
-		    temp_past_physical_time = task->past_physical_time;
-		    
-		}
-
-		if (task->dilation_factor > 0) {
-			dilated_running_time = div_s64_rem( (real_running_time - temp_past_physical_time)*1000 ,task->dilation_factor,&rem) + task->past_virtual_time;
-			now = dilated_running_time + task->virt_start_time;
-		}
-		else if (task->dilation_factor < 0) {
-			dilated_running_time = div_s64_rem( (real_running_time - temp_past_physical_time)*(task->dilation_factor*-1),1000,&rem) + task->past_virtual_time;
-			now =  dilated_running_time + task->virt_start_time;
-		}
-		else {
-			dilated_running_time = (real_running_time - temp_past_physical_time) + task->past_virtual_time;
-			now = dilated_running_time + task->virt_start_time;
-		}
-	
+		/* use the clock of the task's container (or of its leader thread) */
+		now = tk_task_virtual_time(task, now);
 	}
 
 	return now;
@@ -96,6 +59,7 @@ Hooks the sleep system call, so the process will wake up when it reaches the exp
 not the system time
 ***/
 asmlinkage long sys_sleep_new(struct timespec __user *rqtp, struct timespec __user *rmtp) {
+	struct tk_experiment *experiment;
 	struct list_head *pos;
 	struct list_head *n;
 	struct dilation_task_struct* task;
@@ -123,10 +87,14 @@ asmlinkage long sys_sleep_new(struct timespec __user *rqtp, struct timespec __us
 		return -EFAULT;
 	
 
+	/* the membership lookup walks the task's ancestors, only pay for it if the task is dilated at all */
+	experiment = NULL;
+	if (current->virt_start_time != NOTSET)
+		experiment = tk_task_experiment(current);
 	acquire_irq_lock(&current->dialation_lock,flags);
-	if (experiment_stopped == RUNNING && current->virt_start_time != 0 && atomic_read(&experiment_stopping) == 0)
+	if (experiment != NULL && experiment->experiment_stopped == RUNNING && current->virt_start_time != 0 && atomic_read(&experiment->experiment_stopping) == 0)
 	{		
-		atomic_inc(&n_active_syscalls);
+		atomic_inc(&experiment->n_active_syscalls);
 		is_dialated = 1;
     	do_gettimeofday(&ktv);
 		now = timeval_to_ns(&ktv);			
@@ -134,6 +102,7 @@ asmlinkage long sys_sleep_new(struct timespec __user *rqtp, struct timespec __us
 
 		init_waitqueue_head(&sleep_helper->w_queue);
 		atomic_set(&sleep_helper->done,0);
+		atomic64_set(&sleep_helper->rebase,0);
 		hmap_put_abs(&sleep_process_lookup,current->pid,sleep_helper);
 		release_irq_lock(&current->dialation_lock,flags);
 		
@@ -146,9 +115,11 @@ asmlinkage long sys_sleep_new(struct timespec __user *rqtp, struct timespec __us
 			set_current_state(TASK_RUNNING);
 			atomic_set(&sleep_helper->done,0);
 			
+			/* reset_exp moved the container's virtual time, the deadline moves with it */
+			wakeup_time += atomic64_xchg(&sleep_helper->rebase, 0);
 			now_new = get_dilated_time(current);
 			if(now_new < wakeup_time){  			
-			    if(current->freeze_time == 0 && atomic_read(&experiment_stopping) == 0){
+			    if(!tk_task_frozen(current) && atomic_read(&experiment->experiment_stopping) == 0){
 					kill(current,SIGCONT,NULL);
 					list_for_each(list, &current->children)
  		   			{
@@ -165,7 +136,7 @@ asmlinkage long sys_sleep_new(struct timespec __user *rqtp, struct timespec __us
 			}
 
 		    
-		    if(atomic_read(&experiment_stopping) == 1 || experiment_stopped != RUNNING)
+		    if(atomic_read(&experiment->experiment_stopping) == 1 || experiment->experiment_stopped != RUNNING)
 		    	break;
 		    
 			
@@ -178,12 +149,12 @@ asmlinkage long sys_sleep_new(struct timespec __user *rqtp, struct timespec __us
 		diff = now_new - wakeup_time;
 		PDEBUG_I("Sys Sleep: Resumed Sleep Process Expiry %d. Resume time = %llu. Difference = %llu\n",current->pid, now_new,diff );
 		
-		atomic_dec(&n_active_syscalls);
+		atomic_dec(&experiment->n_active_syscalls);
 		return 0; 
 		
 		revert_sleep:
 		release_irq_lock(&current->dialation_lock,flags);
-		atomic_dec(&n_active_syscalls);
+		atomic_dec(&experiment->n_active_syscalls);
 		
 		return 0;
 	} 
@@ -198,6 +169,7 @@ asmlinkage long sys_sleep_new(struct timespec __user *rqtp, struct timespec __us
 asmlinkage int sys_select_new(int k, fd_set __user *inp, fd_set __user *outp, fd_set __user *exp, struct timeval __user *tvp){
 
 
+	struct tk_experiment *experiment;
 	struct list_head *pos;
 	struct list_head *n;
 	struct dilation_task_struct* task;
@@ -245,15 +217,18 @@ asmlinkage int sys_select_new(int k, fd_set __user *inp, fd_set __user *outp, fd
 		k = max_fds;
 
 	
+	experiment = NULL;
+	if (current->virt_start_time != NOTSET)
+		experiment = tk_task_experiment(current);
 	acquire_irq_lock(&current->dialation_lock,flags);
-	if(experiment_stopped == RUNNING && current->virt_start_time != 0 && time_to_sleep > 0 && atomic_read(&experiment_stopping) == 0){	
+	if(experiment != NULL && experiment->experiment_stopped == RUNNING && current->virt_start_time != 0 && time_to_sleep > 0 && atomic_read(&experiment->experiment_stopping) == 0){	
 
-		atomic_inc(&n_active_syscalls);	
+		atomic_inc(&experiment->n_active_syscalls);	
 		is_dialated = 1;
 		if (copy_from_user(&tv, tvp, sizeof(tv)))
 			goto revert_select;
 
-		if(experiment_type != CS && time_to_sleep < expected_increase)
+		if(experiment->experiment_type != CS && time_to_sleep < experiment->expected_increase)
 			goto revert_select;
 
 		
@@ -266,6 +241,7 @@ asmlinkage int sys_select_new(int k, fd_set __user *inp, fd_set __user *outp, fd
 		select_helper->bits = stack_fds;
 		init_waitqueue_head(&select_helper->w_queue);
 		atomic_set(&select_helper->done,0);
+		atomic64_set(&select_helper->rebase,0);
 		select_helper->ret = -EFAULT;
 
 
@@ -323,7 +299,7 @@ asmlinkage int sys_select_new(int k, fd_set __user *inp, fd_set __user *outp, fd
 				if(atomic_read(&select_helper->done) != 0) {							
 					atomic_set(&select_helper->done,0);	
 					ret = do_dialated_select(select_helper->n,&select_helper->fds,current);
-					if(ret || select_helper->ret == FINISHED || atomic_read(&experiment_stopping) == 1){
+					if(ret || select_helper->ret == FINISHED || atomic_read(&experiment->experiment_stopping) == 1){
 						select_helper->ret = ret;
 						break;
 					}
@@ -334,11 +310,11 @@ asmlinkage int sys_select_new(int k, fd_set __user *inp, fd_set __user *outp, fd
 
 			}
 			
-			
+			wakeup_time += atomic64_xchg(&select_helper->rebase, 0);
 			now_new = get_dilated_time(current);
 			if(now_new < wakeup_time) {
 				acquire_irq_lock(&current->dialation_lock,flags);	
-			    if(current->freeze_time == 0 && atomic_read(&experiment_stopping) == 0) {
+			    if(!tk_task_frozen(current) && atomic_read(&experiment->experiment_stopping) == 0) {
 			        kill(current,SIGCONT,NULL);
 			        list_for_each(list, &current->children)
  		   			{
@@ -395,12 +371,12 @@ asmlinkage int sys_select_new(int k, fd_set __user *inp, fd_set __user *outp, fd
 
 		out_nofds:
 		PDEBUG_V("Sys Select: Select finished PID %d\n",current->pid);
-		atomic_dec(&n_active_syscalls);
+		atomic_dec(&experiment->n_active_syscalls);
 		return ret;
 		
 		revert_select:
 		release_irq_lock(&current->dialation_lock,flags);	
-		atomic_dec(&n_active_syscalls);
+		atomic_dec(&experiment->n_active_syscalls);
 		
 		return ref_sys_select(k,inp,outp,exp,tvp);
 	}
@@ -411,6 +387,7 @@ asmlinkage int sys_select_new(int k, fd_set __user *inp, fd_set __user *outp, fd
 
 asmlinkage int sys_poll_new(struct pollfd __user * ufds, unsigned int nfds, int timeout_msecs){
 
+	struct tk_experiment *experiment;
 	struct list_head *pos;
 	struct list_head *n;
 	struct dilation_task_struct* task;
@@ -443,16 +420,19 @@ asmlinkage int sys_poll_new(struct pollfd __user * ufds, unsigned int nfds, int
     }
 
 	
+	experiment = NULL;
+	if (current->virt_start_time != NOTSET)
+		experiment = tk_task_experiment(current);
 	acquire_irq_lock(&current->dialation_lock,flags);
-	if(experiment_stopped == RUNNING && current->virt_start_time != 0 && timeout_msecs > 0 && atomic_read(&experiment_stopping) == 0){
+	if(experiment != NULL && experiment->experiment_stopped == RUNNING && current->virt_start_time != 0 && timeout_msecs > 0 && atomic_read(&experiment->experiment_stopping) == 0){
 	
-		atomic_inc(&n_active_syscalls);
+		atomic_inc(&experiment->n_active_syscalls);
 		is_dialated = 1;
 
 		secs_to_sleep = timeout_msecs / MSEC_PER_SEC;
 		nsecs_to_sleep = (timeout_msecs % MSEC_PER_SEC) * NSEC_PER_MSEC;
 		time_to_sleep = (secs_to_sleep*1000000000) + nsecs_to_sleep;
-		if(experiment_type != CS && time_to_sleep < expected_increase)
+		if(experiment->experiment_type != CS && time_to_sleep < experiment->expected_increase)
 	        goto revert_poll;
 		    
 		if (nfds > RLIMIT_NOFILE){
@@ -478,6 +458,7 @@ asmlinkage int sys_poll_new(struct pollfd __user * ufds, unsigned int nfds, int
 		head = poll_helper->head;	
 		poll_helper->err = -EFAULT;
 		atomic_set(&poll_helper->done,0);
+		atomic64_set(&poll_helper->rebase,0);
 		poll_helper->walk = head;
 		poll_helper->nfds = nfds;
 		walk = head;
@@ -532,7 +513,7 @@ asmlinkage int sys_poll_new(struct pollfd __user * ufds, unsigned int nfds, int
 				if(atomic_read(&poll_helper->done) != 0){
 		            atomic_set(&poll_helper->done,0);	
 				    err = do_dialated_poll(poll_helper->nfds, poll_helper->head,poll_helper->table,current);
-				    if(err || poll_helper->err == FINISHED || atomic_read(&experiment_stopping) == 1){
+				    if(err || poll_helper->err == FINISHED || atomic_read(&experiment->experiment_stopping) == 1){
 					    poll_helper->err = err; 
 					    break;
 				    }
@@ -543,11 +524,11 @@ asmlinkage int sys_poll_new(struct pollfd __user * ufds, unsigned int nfds, int
 
 			}
 		
-			
+			wakeup_time += atomic64_xchg(&poll_helper->rebase, 0);
 			now_new = get_dilated_time(current);
 			if(now_new < wakeup_time) {
 				acquire_irq_lock(&current->dialation_lock,flags);
-			    if(current->freeze_time == 0 && atomic_read(&experiment_stopping) == 0) {
+			    if(!tk_task_frozen(current) && atomic_read(&experiment->experiment_stopping) == 0) {
 			        kill(current,SIGCONT,NULL);
 					list_for_each(list, &current->children)
  		   			{
@@ -608,13 +589,13 @@ asmlinkage int sys_poll_new(struct pollfd __user * ufds, unsigned int nfds, int
 		kfree(head);
 		kfree(poll_helper->table);		
 		PDEBUG_I("Sys Poll: Poll Process Finished %d",current->pid);
-		atomic_dec(&n_active_syscalls);			
+		atomic_dec(&experiment->n_active_syscalls);			
 		return err;
 		
 		
 		revert_poll:
 		release_irq_lock(&current->dialation_lock,flags);	
-		atomic_dec(&n_active_syscalls);
+		atomic_dec(&experiment->n_active_syscalls);
    			
    		return ref_sys_poll(ufds,nfds,timeout_msecs);
 
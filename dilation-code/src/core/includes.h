@@ -35,10 +35,18 @@
 #include <linux/fdtable.h>
 #include <linux/string.h>
 #include <linux/delay.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/completion.h>
+#include <linux/rbtree.h>
+#include <linux/tick.h>
 
 /* user defined headers */
 #include "../utils/linkedlist.h"
 #include "../utils/hashmap.h"
+#include "../vtcore/vt_math.h"
+#include "../vtcore/vt_sched.h"
 #include "../../scripts/TimeKeeper_definitions.h"
 
 /* Define this macro to enable debug kernel logging in INFO mode*/
@@ -51,9 +59,6 @@
 #define DEBUG_LEVEL_INFO 1
 #define DEBUG_LEVEL_VERBOSE 2
 
-#define TK_IOC_MAGIC  'k'
-
-#define TK_IO_GET_STATS _IOW(TK_IOC_MAGIC,  1, int)
 
 
 
@@ -11,14 +11,10 @@ Defined in hooked_functions.c
 ***/
 extern s64 get_dilated_time(struct task_struct * task);
 
-extern int experiment_stopped;
 extern s64 Sim_time_scale;
-extern struct list_head exp_list;
 extern hashmap sleep_process_lookup;
 extern s64 boottime;
 extern atomic_t is_boottime_set;
-extern atomic_t n_active_syscalls;
-extern atomic_t experiment_stopping;
 
 asmlinkage long sys_clock_nanosleep_new(const clockid_t which_clock, int flags, const struct timespec __user * rqtp, struct timespec __user * rmtp);
 asmlinkage int sys_clock_gettime_new(const clockid_t which_clock, struct timespec __user * tp);
@@ -31,6 +27,7 @@ Hook for system call clock nanosleep
 ***/
 asmlinkage long sys_clock_nanosleep_new(const clockid_t which_clock, int flag, const struct timespec __user * rqtp, struct timespec __user * rmtp) {
 
+	struct tk_experiment *experiment;
 	struct list_head *pos;
 	struct list_head *n;
 	struct dilation_task_struct* task;
@@ -59,10 +56,14 @@ asmlinkage long sys_clock_nanosleep_new(const clockid_t which_clock, int flag, c
 		return -EFAULT;
 
 
+	/* only dilated tasks are looked up, other processes on the host go straight to the original call */
+	experiment = NULL;
+	if (current->virt_start_time != NOTSET)
+		experiment = tk_task_experiment(current);
 	acquire_irq_lock(&current->dialation_lock,flags);
-	if (experiment_stopped == RUNNING && current->virt_start_time != NOTSET && atomic_read(&experiment_stopping) == 0)
+	if (experiment != NULL && experiment->experiment_stopped == RUNNING && current->virt_start_time != NOTSET && atomic_read(&experiment->experiment_stopping) == 0)
 	{		
-		atomic_inc(&n_active_syscalls);
+		atomic_inc(&experiment->n_active_syscalls);
 		is_dialated = 1;
     	do_gettimeofday(&ktv);
 		now = timeval_to_ns(&ktv);			
@@ -70,6 +71,7 @@ asmlinkage long sys_clock_nanosleep_new(const clockid_t which_clock, int flag, c
 
 		init_waitqueue_head(&sleep_helper->w_queue);
 		atomic_set(&sleep_helper->done,0);
+		atomic64_set(&sleep_helper->rebase,0);
 		hmap_put_abs(&sleep_process_lookup,current->pid,sleep_helper);
 		release_irq_lock(&current->dialation_lock,flags);
 		
@@ -82,9 +84,11 @@ asmlinkage long sys_clock_nanosleep_new(const clockid_t which_clock, int flag, c
 			set_current_state(TASK_RUNNING);
 			atomic_set(&sleep_helper->done,0);
 			
+			/* moved by reset_exp together with the container's virtual time */
+			wakeup_time += atomic64_xchg(&sleep_helper->rebase, 0);
 			now_new = get_dilated_time(current);
 			if(now_new < wakeup_time){  			
-			    if(current->freeze_time == 0 && atomic_read(&experiment_stopping) == 0){
+			    if(!tk_task_frozen(current) && atomic_read(&experiment->experiment_stopping) == 0){
 					kill(current,SIGCONT,NULL);
 					list_for_each(list, &current->children)
  		   			{
@@ -101,7 +105,7 @@ asmlinkage long sys_clock_nanosleep_new(const clockid_t which_clock, int flag, c
 			}
 
 		    
-		    if(atomic_read(&experiment_stopping) == 1 || experiment_stopped != RUNNING)
+		    if(atomic_read(&experiment->experiment_stopping) == 1 || experiment->experiment_stopped != RUNNING)
 		    	break;
 		    
 			
@@ -114,12 +118,12 @@ asmlinkage long sys_clock_nanosleep_new(const clockid_t which_clock, int flag, c
 		diff = now_new - wakeup_time;
 		PDEBUG_I("Sys Nano Sleep: Resumed Sleep Process Expiry %d. Resume time = %llu. Difference = %llu\n",current->pid, now_new,diff );
 		
-		atomic_dec(&n_active_syscalls);
+		atomic_dec(&experiment->n_active_syscalls);
 		return 0; 
 		
 		revert_nano_sleep:
 		release_irq_lock(&current->dialation_lock,flags);
-		atomic_dec(&n_active_syscalls);
+		atomic_dec(&experiment->n_active_syscalls);
 		
 		return 0;
 	} 
@@ -177,6 +181,7 @@ Hook for system call clock_gettime
 ***/
 asmlinkage int sys_clock_gettime_new(const clockid_t which_clock, struct timespec __user * tp){
 
+	struct tk_experiment *experiment;
 	struct list_head *pos;
 	struct list_head *n;
 	struct dilation_task_struct* task;
@@ -215,13 +220,16 @@ asmlinkage int sys_clock_gettime_new(const clockid_t which_clock, struct timespe
 		boottime = undialated_time_ns - mono_time;
 	}
 
+	experiment = NULL;
+	if (current->virt_start_time != NOTSET)
+		experiment = tk_task_experiment(current);
 	acquire_irq_lock(&current->dialation_lock,flags);
-	if (experiment_stopped == RUNNING && current->virt_start_time != NOTSET)
+	if (experiment != NULL && experiment->experiment_stopped == RUNNING && current->virt_start_time != NOTSET)
 	{	
 
 		
 		release_irq_lock(&current->dialation_lock,flags);
-        list_for_each_safe(pos, n, &exp_list)
+        list_for_each_safe(pos, n, &experiment->exp_list)
         {
             task = list_entry(pos, struct dilation_task_struct, list);
 			if (find_children_info(task->linux_task, current->pid) == 1) { 
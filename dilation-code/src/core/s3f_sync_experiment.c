@@ -9,65 +9,40 @@ Developed to support S3F integration with TimeKeeper. These additional functions
 /* S3F Specific Functions and variables (CS) */
 void s3fCalcTaskRuntime(struct dilation_task_struct * task);
 enum hrtimer_restart s3f_hrtimer_callback( struct hrtimer *timer);
-void s3f_add_to_exp(int pid, int increment);
-void s3f_add_to_exp_proc(char *write_buffer);
-void s3f_progress_exp(void);
-struct timeline* doesTimelineExist(int timeline);
+void s3f_add_to_exp(struct tk_experiment *exp, int pid, int timeline);
+void s3f_add_to_exp_proc(struct tk_experiment *exp, char *write_buffer);
+struct timeline* doesTimelineExist(struct tk_experiment *exp, int timeline);
 void assign_timeline_to_cpu(struct timeline* tl);
 void s3f_add_user_proc(char *write_buffer);
 struct dilation_task_struct * s3fGetNextRunnableTask(struct dilation_task_struct * task);
-void force_virtual_time(struct task_struct* aTask, s64 time);
+void force_virtual_time(struct tk_experiment *exp, struct task_struct* aTask, s64 time);
 int is_off(struct dilation_task_struct *task);
-void fix_timeline(int timeline);
-void fix_timeline_proc(char *write_buffer);
-struct timeline* timelineHead[EXP_CPUS];
-int progress_timeline_thread(void *data);
-int run_timeline_processes(void * data);
+void fix_timeline(struct tk_experiment *exp, int timeline);
+void fix_timeline_proc(struct tk_experiment *exp, char *write_buffer);
+void s3f_queue_timeline(struct timeline* tl);
+void s3f_migrate_timeline(struct timeline* tl);
+int cs_timeline_worker(void *data);
 
 /* Functions and variables reused by CBE Implementation */
-extern void printChainInfo(void);
-extern void set_children_time(struct task_struct *aTask, s64 time);
+extern void printChainInfo(struct tk_experiment *exp);
+extern void set_children_time(struct tk_experiment *exp, struct task_struct *aTask, s64 time);
 extern void set_children_policy(struct task_struct *aTask, int policy, int priority);
 extern void freeze_children(struct task_struct *aTask, s64 time);
 extern int freeze_proc_exp_recurse(struct dilation_task_struct *aTask);
 extern void unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,struct dilation_task_struct * lxc);
 extern int unfreeze_proc_exp_recurse(struct dilation_task_struct *aTask, s64 expected_time);
 extern void set_children_cpu(struct task_struct *aTask, int cpu);
-extern void clean_exp(void);
+extern void clean_exp(struct tk_experiment *exp);
 extern void calculate_virtual_time_difference(struct dilation_task_struct* task, s64 now, s64 expected_time);
-extern struct dilation_task_struct* initialize_node(struct task_struct* aTask);
+extern struct dilation_task_struct* initialize_node(struct tk_experiment *exp, struct task_struct* aTask);
 extern void send_a_message(int pid);
 extern s64 get_virtual_time(struct dilation_task_struct* task, s64 now);
 
 extern int TOTAL_CPUS;
-extern int experiment_type;
-extern struct list_head exp_list;
 
 /* Doing floating point division in the kernel is HARD, therefore, I convert fractions to negative numbers. The Precision specifies how far I scale the number: aka a TDF of 2 is converted to 2000 */
 extern s64 PRECISION;   
 
-/* the number of containers in the experiment */
-extern int proc_num; 	
-
-/* if == -1 then the experiment is not started yet, if == 0 then the experiment is currently running, if == 1 then the experiment is set to be stopped at the end of the current round */
-extern int experiment_stopped; 	
-
-/* for every cpu, this represents how many timeline are currently assigned to it */
-extern s64 chainlength[EXP_CPUS]; 
-extern struct task_struct* chaintask[EXP_CPUS];
-
-
-/* specifies how many head containers are in the experiment. This number will most often be equal to EXP_CPUS. Handles the special case if containers < EXP_CPUS so we do not have an array index out of bounds error */
-extern int number_of_heads; 	
-
-extern struct mutex exp_mutex;
-
-spinlock_t cpuLock[EXP_CPUS];
-
-/* 0 means it is idle, 1 means not idle */
-int cpuIdle[EXP_CPUS]; 			
-struct list_head cpuWorkList[EXP_CPUS];
-
 /* general_commands.c */
 extern void perform_on_children(struct task_struct *aTask, void(*action)(int,int), int val);
 extern void change_dilation(int pid, int new_dilation);
@@ -76,17 +51,17 @@ extern void change_dilation(int pid, int new_dilation);
 Reads a PID from the buffer, and adds the corresponding task to the experiment (i believe this does not support the adding
 of processes if the experiment has alreaded started)
 ***/
-void s3f_add_to_exp_proc(char *write_buffer) {
+void s3f_add_to_exp_proc(struct tk_experiment *exp, char *write_buffer) {
         int pid, value, timeline;
 
-	if (experiment_type == CBE) {
+	if (exp->experiment_type == CBE) {
           	PDEBUG_E("S3F Add to Exp Proc: Trying to add to wrong experiment type.. exiting\n");
     }
-	else if (experiment_stopped == NOTRUNNING) {
+	else if (exp->experiment_stopped == NOTRUNNING) {
 	        pid = atoi(write_buffer);
         	value = get_next_value(write_buffer);
 	        timeline = atoi(write_buffer + value);
-        	s3f_add_to_exp(pid, timeline);
+        	s3f_add_to_exp(exp, pid, timeline);
 	}
 	else {
 		PDEBUG_E("S3F Add to Exp Proc: Trying to add a LXC to S3F experiment that is already running\n");
@@ -96,16 +71,16 @@ void s3f_add_to_exp_proc(char *write_buffer) {
 /***
 Reset all specified intervals for a given timeline
 ****/
-void s3f_reset(char *write_buffer) {
+void s3f_reset(struct tk_experiment *exp, char *write_buffer) {
 	int timeline;
 	struct timeline* tl;
 	struct dilation_task_struct* task;
-	if (experiment_type == CBE) {
+	if (exp->experiment_type == CBE) {
 		PDEBUG_E("S3f Reset: Trying to mix CBE and CS commands.. exiting\n");
 	}
-	else if (experiment_stopped != NOTRUNNING) {
+	else if (exp->experiment_stopped != NOTRUNNING) {
 		timeline = atoi(write_buffer);
-		tl = doesTimelineExist(timeline);
+		tl = doesTimelineExist(exp, timeline);
 		if (tl != NULL) {
 			task = tl->head;
 			while (task != NULL) {
@@ -119,17 +94,185 @@ void s3f_reset(char *write_buffer) {
 	}
 }
 
+/***
+Moves the expected time of every container of a timeline on by its interval and works out how long it has to run for it.
+With a limit, containers whose next interval would take them past it stay where they are. Returns 1 if any container
+has to run
+***/
+static int s3f_prepare_window(struct timeline* tl, s64 limit) {
+	struct dilation_task_struct * lxc;
+	struct timeval ktv;
+	s64 now;
+
+	do_gettimeofday(&ktv);
+	now = timeval_to_ns(&ktv);
+	for (lxc = tl->head; lxc != NULL; lxc = lxc->next) {
+		if (lxc->increment <= 0)
+			continue;
+		if (limit > 0 && lxc->expected_time + lxc->increment > limit) {
+			lxc->running_time = 0;
+			continue;
+		}
+		lxc->expected_time += lxc->increment;
+		calculate_virtual_time_difference(lxc,now,lxc->expected_time);
+		if (lxc->running_time > 1000000 || lxc->running_time < 10000 ) {
+			PDEBUG_V("Prepare Window: On timeline %d, LXC: %d should run for %lld if %lld is > 0\n",tl->number, lxc->linux_task->pid, lxc->running_time, lxc->increment);
+		}
+	}
+	return s3fGetNextRunnableTask(tl->head) != NULL;
+}
+
+/***
+Virtual time (since the experiment was synchronized) the last prepared window takes every container of the timeline
+to. It only becomes the time the timeline has reached once the worker has run that window (tl->reached)
+***/
+static s64 s3f_timeline_expected(struct timeline* tl) {
+	struct dilation_task_struct * lxc;
+	s64 reached = 0;
+
+	for (lxc = tl->head; lxc != NULL; lxc = lxc->next) {
+		if (lxc == tl->head || lxc->expected_time < reached)
+			reached = lxc->expected_time;
+	}
+
+	/* for CS, actual_time stays the virtual time the experiment was synchronized at */
+	return tl->head != NULL ? reached - tl->exp->actual_time : 0;
+}
+
+/***
+Queues the next window of a timeline that advances on its own, unless all of its containers have reached its horizon.
+Called by the chain's worker when a window is over, and when the simulator moves the horizon of an idle timeline
+***/
+static void s3f_continue_timeline(struct timeline* tl) {
+	s64 horizon;
+	unsigned long flags;
+
+	while (1) {
+		spin_lock_irqsave(&tl->tl_lock, flags);
+		horizon = tl->horizon;
+		spin_unlock_irqrestore(&tl->tl_lock, flags);
+
+		if (s3f_prepare_window(tl, horizon + tl->exp->actual_time)) {
+			if (tl->migrate_to >= 0)
+				s3f_migrate_timeline(tl);
+			s3f_queue_timeline(tl);
+			return;
+		}
+
+		/* the horizon may have moved while the window was being prepared */
+		spin_lock_irqsave(&tl->tl_lock, flags);
+		if (tl->horizon == horizon) {
+			tl->async_busy = 0;
+			spin_unlock_irqrestore(&tl->tl_lock, flags);
+			return;
+		}
+		spin_unlock_irqrestore(&tl->tl_lock, flags);
+	}
+}
+
+/***
+A caller that is going to sleep on a timeline's w_queue registers itself first, so clean_exp does not free the timeline
+under it. Returns 0 (and does not register) if the experiment is stopping already
+***/
+static int s3f_waiter_enter(struct tk_experiment *exp) {
+
+	atomic_inc(&exp->n_tl_waiters);
+	smp_mb();
+	if (exp->experiment_stopped == NOTRUNNING || exp->experiment_stopped == STOPPING) {
+		atomic_dec(&exp->n_tl_waiters);
+		return 0;
+	}
+	return 1;
+}
+
+static void s3f_waiter_exit(struct tk_experiment *exp) {
+	atomic_dec(&exp->n_tl_waiters);
+}
+
+/***
+Waits until no caller sleeps on a timeline's w_queue anymore. Called by clean_exp after it has woken them all up and
+before it frees the timelines
+***/
+void s3f_wait_timeline_waiters(struct tk_experiment *exp) {
+	int waited = 0;
+
+	smp_mb();
+	while (atomic_read(&exp->n_tl_waiters) > 0) {
+		if (waited++ % 100 == 0)
+			PDEBUG_A("S3F Wait Timeline Waiters: %d callers still waiting on a timeline\n", atomic_read(&exp->n_tl_waiters));
+		msleep(10);
+	}
+}
+
+/***
+Lookahead based progress (TK_IO_TIMELINE_HORIZON). Instead of progressing a timeline window by window and waiting for
+every window, the simulator declares the timeline's lookahead once and then only tells it up to which virtual time it
+has processed its events (safe_time). The timeline runs window after window on its own up to safe_time + lookahead
+while the simulator goes on, and the simulator waits only when it needs a timeline to have reached some virtual time
+(wait_time). All virtual times are relative to the virtual time the experiment was synchronized at. Returns the virtual
+time the timeline has reached
+***/
+int s3f_timeline_horizon(struct tk_experiment *exp, tk_horizon_args *args) {
+	struct timeline* tl;
+	int start = 0;
+	int ret = 0;
+	unsigned long flags;
+
+	/* registered as a waiter, clean_exp does not free the timeline until this returns */
+	if (exp->experiment_type != CS || !s3f_waiter_enter(exp)) {
+		PDEBUG_E("Timeline Horizon: Experiment %d is not a running CS experiment\n", exp->id);
+		return -EINVAL;
+	}
+	tl = doesTimelineExist(exp, (int)args->timeline);
+	if (tl == NULL) {
+		PDEBUG_E("Timeline Horizon: Timeline %lld does not exist\n", args->timeline);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	spin_lock_irqsave(&tl->tl_lock, flags);
+	if (args->lookahead >= 0)
+		tl->lookahead = args->lookahead;
+	if (args->safe_time >= 0 && args->safe_time + tl->lookahead > tl->horizon) {
+		tl->horizon = args->safe_time + tl->lookahead;
+		if (!tl->async_busy) {
+			tl->async_busy = 1;
+			start = 1;
+		}
+	}
+	spin_unlock_irqrestore(&tl->tl_lock, flags);
+
+	if (start) {
+		tl->force = 0;
+		s3f_continue_timeline(tl);
+	}
+
+	if (args->wait_time >= 0) {
+		wait_event_interruptible(tl->w_queue, exp->experiment_stopped != RUNNING ||
+			tl->reached >= args->wait_time || !tl->async_busy);
+	}
+	if (exp->experiment_stopped != RUNNING) {
+		ret = -EINVAL;
+		goto out;
+	}
+	spin_lock_irqsave(&tl->tl_lock, flags);
+	args->virtual_time = tl->reached;
+	spin_unlock_irqrestore(&tl->tl_lock, flags);
+
+out:
+	s3f_waiter_exit(exp);
+	return ret;
+}
+
 /***
 Progress every container in a timeline by the prespecified intervals
 order of arguments: pid, timeline, force
 ***/
-int s3f_progress_timeline(char *write_buffer) {
+int s3f_progress_timeline(struct tk_experiment *exp, char *write_buffer) {
 	int timeline, pid, value, force;
 	struct timeline* tl;
 	struct task_struct* task;
-	struct timeval ktv;
 	int ret = 0;
-	s64 now;
 	struct dilation_task_struct * lxc = NULL;
 	timeline = atoi(write_buffer);
 
@@ -138,60 +281,48 @@ int s3f_progress_timeline(char *write_buffer) {
 	value += get_next_value(write_buffer + value);
     force = atoi(write_buffer + value);
 
-	if (experiment_type == CBE) {
+	if (exp->experiment_type == CBE) {
 		PDEBUG_E("Progress: Error: Trying to mix CBE and CS commands.. exiting\n");
 	}
-	else if (experiment_stopped != NOTRUNNING) {
+	else if (s3f_waiter_enter(exp)) {
+		/* registered as a waiter, clean_exp does not free the timeline until this returns */
 		task = find_task_by_pid(pid);
-		tl = doesTimelineExist(timeline);
+		tl = doesTimelineExist(exp, timeline);
 		if (tl != NULL) {
 			tl->user_proc = task;
 			tl->force = force;
 
-			do_gettimeofday(&ktv);
-            now = timeval_to_ns(&ktv);
-			lxc = tl->head;
-			ret = 0;
-            while (lxc != NULL) {
-              	if (lxc->increment > 0) {
-                    lxc->expected_time += lxc->increment;
-                    calculate_virtual_time_difference(lxc,now,lxc->expected_time);            	    
-                }
-                if (lxc->running_time > 1000000 || lxc->running_time < 10000 ) {
-					PDEBUG_V("Progress: On timeline %d, LXC: %d should run for %lld if %lld is > 0\n",tl->number, lxc->linux_task->pid, lxc->running_time, lxc->increment);
-                }
-                lxc = lxc->next;
-            }
-			lxc = tl->head;
-			lxc = s3fGetNextRunnableTask(lxc);
+			if (tl->horizon > 0) {
+				PDEBUG_E("Progress: Timeline %d advances on its own up to its horizon\n", timeline);
+				ret = -1;
+				goto out;
+			}
+			s3f_prepare_window(tl, 0);
+			lxc = s3fGetNextRunnableTask(tl->head);
 			if(lxc == NULL){
-				PDEBUG_V("Progress: For timeline %d, No tasks to run. No need to wake progress timeline thread\n", timeline);	
-				return 255;
+				PDEBUG_V("Progress: For timeline %d, No tasks to run. No need to queue it\n", timeline);	
+				ret = 255;
+				goto out;
 			}
 			else{
-				ret = 0;
-
 				atomic_set(&tl->done,0);
-				atomic_set(&tl->progress_thread_done,1);
-				PDEBUG_V("Progress: For timeline %d, waking up progress timeline thread\n", timeline);
-				set_current_state(TASK_INTERRUPTIBLE);
-				wake_up_interruptible_sync(&tl->progress_thread_queue);
+				if (tl->migrate_to >= 0)
+					s3f_migrate_timeline(tl);
+				s3f_queue_timeline(tl);
 				do{
-					ret = wait_event_interruptible_timeout(tl->w_queue,atomic_dec_and_test(&tl->done),HZ);
-					if(ret == 0)
-						set_current_state(TASK_INTERRUPTIBLE);
-					else
-						set_current_state(TASK_RUNNING);
-
-				}while(ret == 0 || experiment_stopped != RUNNING);
+					ret = wait_event_interruptible_timeout(tl->w_queue,atomic_read(&tl->done) == 1,HZ);
+				}while(ret == 0 && exp->experiment_stopped == RUNNING);
+				ret = 0;
 				PDEBUG_V("Progress: For timeline %d, Resumed user process\n", timeline);
 
 			}
-			return 0;
 		}
 		else {
 			PDEBUG_E("Progress: Timeline does not exist..\n");
 		}
+out:
+		s3f_waiter_exit(exp);
+		return ret;
 	}
 	else {
 
@@ -206,7 +337,7 @@ int s3f_progress_timeline(char *write_buffer) {
 /***
 Set the interval for a container on a timeline
 ***/
-void s3f_set_interval(char *write_buffer) {
+void s3f_set_interval(struct tk_experiment *exp, char *write_buffer) {
 	int pid, timeline, value;
 	s64 interval;
 	struct dilation_task_struct* list_node;
@@ -219,11 +350,11 @@ void s3f_set_interval(char *write_buffer) {
 
 	value += get_next_value(write_buffer + value);
 	timeline = atoi(write_buffer + value);
-	if (experiment_type == CBE) {
+	if (exp->experiment_type == CBE) {
 		PDEBUG_E("Set Interval: Error: Trying to mix CBE and CS commands.. exiting\n");
 	}
-	else if (experiment_stopped != NOTRUNNING) {
-        list_for_each_safe(pos, n, &exp_list)
+	else if (exp->experiment_stopped != NOTRUNNING) {
+        list_for_each_safe(pos, n, &exp->exp_list)
         {
 			list_node = list_entry(pos, struct dilation_task_struct, list);
 			if (list_node->linux_task->pid == pid) {
@@ -247,57 +378,165 @@ void s3f_set_interval(char *write_buffer) {
 }
 
 /***
-Check to see if the timeline with a given exists or not. Will return NULL if timeline does not exist
+Check to see if the timeline with a given exists or not. Will return NULL if timeline does not exist. Timelines are
+only added before the experiment starts, so the index is read without a lock
 ****/
-struct timeline* doesTimelineExist(int timeline) {
-	int i;
+struct timeline* doesTimelineExist(struct tk_experiment *exp, int timeline) {
 	struct timeline* tempTimeline;
-	for (i=0; i< number_of_heads; i++) {
-		tempTimeline = timelineHead[i];
-		while (tempTimeline != NULL) {
-			if (tempTimeline->number == timeline) {
-				return tempTimeline;
-			}
-			tempTimeline = tempTimeline->next;
+
+	hash_for_each_possible(exp->timelines, tempTimeline, hash_node, timeline) {
+		if (tempTimeline->number == timeline) {
+			return tempTimeline;
 		}
 	}
 	return NULL;
 }
 
 /***
-Assigns a timeline to a specific CPU on the system. Timeline is assigned to CPU with min chainlength
+Sum of the measured loads of the timelines on a chain. Must hold timelines_lock
+***/
+static s64 chain_timeline_load(struct chain_state *chain) {
+	struct timeline *walk;
+	s64 load = 0;
+
+	for (walk = chain->timeline_head; walk != NULL; walk = walk->next)
+		load += walk->load;
+	return load;
+}
+
+/***
+Appends a timeline to a chain's list of timelines. Must hold timelines_lock
+***/
+static void chain_add_timeline(struct chain_state *chain, struct timeline *tl) {
+	struct timeline **walk;
+
+	for (walk = &chain->timeline_head; *walk != NULL; walk = &(*walk)->next)
+		;
+	tl->next = NULL;
+	*walk = tl;
+	chain->length += 1;
+}
+
+/***
+Assigns a timeline to a specific CPU on the system. Timeline is assigned to the CPU whose timelines have the least
+measured load, and among equally loaded ones (nothing has run yet before the experiment starts) the one with the fewest
+timelines
 ***/
 void assign_timeline_to_cpu(struct timeline* tl) {
-    int i;
-    int index;
-    s64 min;
-    struct timeline *walk;
-    index = 0;
-    min = chainlength[index];
-
-    for (i=1; i<number_of_heads; i++)
-    {
-            if (chainlength[i] < min)
-            {
-                    min = chainlength[i];
-                    index = i;
-            }
-    }
-	PDEBUG_I("Assign Timeline To Cpu: Index is %d, number of heads %d\n", index, number_of_heads);
-    walk = timelineHead[index];
-    if (walk == NULL) {
-            timelineHead[index] = tl;
-    }
-    else {
-            while (walk->next != NULL)
-            {
-                    walk = walk->next;
-            }
-            walk->next = tl;
-    }
-    chainlength[index] += 1;
-	tl->cpu_assignment = index+(TOTAL_CPUS - EXP_CPUS);
-	PDEBUG_I("Assign Timeline to Cpu: Adding timeline %d to index: %d\n",tl->number, index);
+	struct tk_experiment *exp = tl->exp;
+	int i;
+	int index;
+	s64 load, min_load;
+	unsigned long flags;
+
+	spin_lock_irqsave(&exp->timelines_lock, flags);
+	index = 0;
+	min_load = chain_timeline_load(&exp->chains[0]);
+	for (i = 1; i < exp->number_of_heads; i++) {
+		load = chain_timeline_load(&exp->chains[i]);
+		if (load < min_load || (load == min_load && exp->chains[i].length < exp->chains[index].length)) {
+			min_load = load;
+			index = i;
+		}
+	}
+	chain_add_timeline(&exp->chains[index], tl);
+	tl->cpu_assignment = index+exp->cpu_base;
+	spin_unlock_irqrestore(&exp->timelines_lock, flags);
+
+	PDEBUG_I("Assign Timeline to Cpu: Adding timeline %d to index: %d, number of heads %d\n",tl->number, index, exp->number_of_heads);
+}
+
+/***
+Picks a timeline to move from the most to the least loaded chain, based on the physical time the timelines' containers
+ran per progress window. The timeline whose load is closest to half the difference evens the two chains out best; one
+with a load above the difference would only swap their roles. The move itself happens the next time the timeline is
+progressed, when none of its containers run (s3f_migrate_timeline)
+***/
+static void s3f_rebalance_timelines(struct tk_experiment *exp) {
+	struct timeline *walk;
+	struct timeline *best = NULL;
+	s64 load[EXP_CPUS];
+	s64 gap;
+	int i, max = 0, min = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&exp->timelines_lock, flags);
+	for (i = 0; i < exp->number_of_heads; i++) {
+		load[i] = 0;
+		for (walk = exp->chains[i].timeline_head; walk != NULL; walk = walk->next) {
+			load[i] += walk->load;
+
+			/* a move that has not happened yet is replaced by the new plan */
+			walk->migrate_to = -1;
+		}
+		if (load[i] > load[max])
+			max = i;
+		if (load[i] < load[min])
+			min = i;
+	}
+
+	/* not worth moving for less than an eighth of the busiest chain's load */
+	gap = load[max] - load[min];
+	if (max != min && gap > (load[max] >> 3)) {
+		for (walk = exp->chains[max].timeline_head; walk != NULL; walk = walk->next) {
+			if (walk->load <= 0 || walk->load >= gap)
+				continue;
+			if (best == NULL || abs64((gap >> 1) - walk->load) < abs64((gap >> 1) - best->load))
+				best = walk;
+		}
+		if (best != NULL) {
+			best->migrate_to = min;
+			PDEBUG_I("Rebalance Timelines: Moving timeline %d (load %lld) from chain %d (load %lld) to chain %d (load %lld)\n",
+				best->number, best->load, max, load[max], min, load[min]);
+		}
+	}
+	spin_unlock_irqrestore(&exp->timelines_lock, flags);
+}
+
+/***
+Moves a timeline to the chain picked by s3f_rebalance_timelines. Called when the timeline is progressed, before it is
+queued, so none of its containers is running. After an interrupted progress the timeline can still be on the old
+chain's work_list, it is taken off it so the caller queues it on the new chain, where cpu_assignment says it is
+***/
+void s3f_migrate_timeline(struct timeline* tl) {
+	struct tk_experiment *exp = tl->exp;
+	struct dilation_task_struct* lxc;
+	struct timeline **walk;
+	int from, to;
+	unsigned long flags;
+
+	spin_lock_irqsave(&exp->timelines_lock, flags);
+	from = tl->cpu_assignment - exp->cpu_base;
+	to = tl->migrate_to;
+	tl->migrate_to = -1;
+	if (to < 0 || to == from || to >= exp->number_of_heads) {
+		spin_unlock_irqrestore(&exp->timelines_lock, flags);
+		return;
+	}
+	spin_lock(&exp->chains[from].cpu_lock);
+	if (!list_empty(&tl->work_node)) {
+		list_del_init(&tl->work_node);
+		PDEBUG_V("Migrate Timeline: Timeline %d was still queued on chain %d\n", tl->number, from);
+	}
+	spin_unlock(&exp->chains[from].cpu_lock);
+	for (walk = &exp->chains[from].timeline_head; *walk != NULL; walk = &(*walk)->next) {
+		if (*walk == tl) {
+			*walk = tl->next;
+			break;
+		}
+	}
+	exp->chains[from].length -= 1;
+	chain_add_timeline(&exp->chains[to], tl);
+	tl->cpu_assignment = to + exp->cpu_base;
+	spin_unlock_irqrestore(&exp->timelines_lock, flags);
+
+	for (lxc = tl->head; lxc != NULL; lxc = lxc->next) {
+		lxc->cpu_assignment = tl->cpu_assignment;
+		bitmap_zero((&lxc->linux_task->cpus_allowed)->bits, 8);
+		cpumask_set_cpu(lxc->cpu_assignment, &lxc->linux_task->cpus_allowed);
+		set_children_cpu(lxc->linux_task, lxc->cpu_assignment);
+	}
+	PDEBUG_I("Migrate Timeline: Timeline %d moved from CPU %d to CPU %d\n", tl->number, from + exp->cpu_base, tl->cpu_assignment);
 }
 
 /***
@@ -339,7 +578,7 @@ struct dilation_task_struct * s3fGetNextRunnableTask(struct dilation_task_struct
 /***
 Gets called by add_to_exp_proc(). Initiazes a containers timer, sets scheduling policy.
 ***/
-void s3f_add_to_exp(int pid, int timeline) {
+void s3f_add_to_exp(struct tk_experiment *exp, int pid, int timeline) {
     struct task_struct* aTask;
     struct dilation_task_struct* list_node;
 	struct timeline* targetTimeline;
@@ -351,319 +590,159 @@ void s3f_add_to_exp(int pid, int timeline) {
             return;
     }
 
-	mutex_lock(&exp_mutex);
-    proc_num++;
-	experiment_type = CS;
+	if (exp->proc_num == 0 && !tk_experiment_cpus_free(exp)) {
+		PDEBUG_E("S3f Add to Exp: Experiment %d has no CPUs of its own, set them first\n", exp->id);
+		return;
+	}
+
+	mutex_lock(&exp->exp_mutex);
+    exp->proc_num++;
+	exp->experiment_type = CS;
 
 
 
 	/* see if the timeline exists yet, if not, add it */
-	targetTimeline = doesTimelineExist(timeline);
+	targetTimeline = doesTimelineExist(exp, timeline);
 	if (targetTimeline == NULL) {
-		struct sched_param sp;
-		
 		printk(KERN_INFO "TimeKeeper: S3F Add to Exp: Timeline %d does not exist, creating it\n", timeline);
 	    targetTimeline = (struct timeline *)kmalloc(sizeof(struct timeline), GFP_KERNEL);
 		targetTimeline->number = timeline;
+		targetTimeline->exp = exp;
+		targetTimeline->load = 0;
+		targetTimeline->migrate_to = -1;
+		targetTimeline->lookahead = 0;
+		targetTimeline->horizon = 0;
+		targetTimeline->async_busy = 0;
+		targetTimeline->reached = 0;
 		targetTimeline->next = NULL;
 		targetTimeline->head = NULL;
 		targetTimeline->user_proc = NULL;
 		spin_lock_init(&targetTimeline->tl_lock);
 		atomic_set(&targetTimeline->done,0);
 		init_waitqueue_head(&targetTimeline->w_queue);
-		atomic_set(&targetTimeline->pthread_done,0);
-		atomic_set(&targetTimeline->progress_thread_done,0);
-		atomic_set(&targetTimeline->stop_thread,0);
 		atomic_set(&targetTimeline->hrtimer_done,0);
-		init_waitqueue_head(&targetTimeline->pthread_queue);
 		init_waitqueue_head(&targetTimeline->unfreeze_proc_queue);
-		init_waitqueue_head(&targetTimeline->progress_thread_queue);
-		targetTimeline->thread = kthread_run(&progress_timeline_thread, targetTimeline, "worker");
-		sp.sched_priority = 99; //some RT priority
-		targetTimeline->run_timeline_thread = kthread_run(&run_timeline_processes, targetTimeline, "workertimeline");
+		INIT_LIST_HEAD(&targetTimeline->work_node);
+		hash_add(exp->timelines, &targetTimeline->hash_node, timeline);
 
-		number_of_heads++;
+		exp->number_of_heads++;
 
-		if (number_of_heads > EXP_CPUS)
-        	       	number_of_heads = EXP_CPUS;
+		if (exp->number_of_heads > exp->n_cpus)
+        	       	exp->number_of_heads = exp->n_cpus;
 		assign_timeline_to_cpu(targetTimeline);
 	}
 
 
-	list_node = initialize_node(aTask);
+	list_node = initialize_node(exp, aTask);
 
 	list_node->cpu_assignment = targetTimeline->cpu_assignment;
 	list_node->tl = targetTimeline;
 	list_node->timer.function = &s3f_hrtimer_callback;
 	add_proc_to_timeline(targetTimeline, list_node);
 
-    list_add(&(list_node->list), &exp_list);
-	mutex_unlock(&exp_mutex);
+    list_add(&(list_node->list), &exp->exp_list);
+	mutex_unlock(&exp->exp_mutex);
 }
 
-int run_timeline_processes(void * data){
-
+/***
+Queues a progressed timeline on the worker of its chain. Timelines sharing a chain are advanced one after the other, in
+the order they were progressed
+***/
+void s3f_queue_timeline(struct timeline* tl) {
+	struct chain_state *chain = &tl->exp->chains[tl->cpu_assignment - tl->exp->cpu_base];
+	unsigned long flags;
+
+	spin_lock_irqsave(&chain->cpu_lock, flags);
+	if (list_empty(&tl->work_node))
+		list_add_tail(&tl->work_node, &chain->work_list);
+	else
+		PDEBUG_V("Queue Timeline: timeline %d is already queued\n", tl->number);
+	spin_unlock_irqrestore(&chain->cpu_lock, flags);
+	wake_up_interruptible(&chain->sync_task_queue);
+}
 
-	struct timeval ktv;
+/***
+Runs every container of a timeline that has an interval left for its running time, one after the other
+***/
+static void s3f_run_timeline(struct timeline* tl) {
+	struct tk_experiment *exp = tl->exp;
 	struct dilation_task_struct* task;
+	struct timeval ktv;
 	s64 now;
-	ktime_t ktime;
-    int round = 0;
-	struct timeline* tl = (struct timeline *)data;
-	struct timeline * ntl = NULL;
-	int startJob = 0;
-
-	if (round == 0) {
-		goto noWork;
-	}
-	set_current_state(TASK_INTERRUPTIBLE);
-    while (!kthread_should_stop())
-    {
 
-	    if (tl != NULL) 
-	    {
-
-	    	if(atomic_read(&tl->stop_thread) > 0){
-	    		PDEBUG_I("Run Timeline Processes: Stopped timeline thread %d\n", tl->number);
-	    		if(atomic_dec_and_test(&tl->stop_thread))
-	    			kfree(tl);
-	    		return 0;
-	    	}
-			int index = tl->cpu_assignment - (TOTAL_CPUS - EXP_CPUS);
-			int isEmpty = 0;
-			startJob = 0;
-			task = tl->head;
-            task = s3fGetNextRunnableTask(task);
-            ntl = NULL;
-            PDEBUG_V("Run Timeline Processes: Resumed timeline thread for timeline %d\n",tl->number);
-			if (task == NULL) {
-                PDEBUG_I("Run Timeline Processes: Task is null?? No running tasks for timeline %d\n", tl->number);
-				/* Sending a message doesnt always work. Sometimes user process misses the message */               
-				//send_a_message(tl->user_proc->pid);
-            }
-            else {
-				
-				PDEBUG_V("Run Timeline Processes: Starting unfreeze_proc for %d, on timeline %d\n", task->linux_task->pid, tl->number);
-				unfreeze_proc_exp_recurse(task, task->expected_time);
-				PDEBUG_V("Run Timeline Processes: Finished unfreeze_proc for %d, on timeline %d\n", task->linux_task->pid, tl->number);
-
-				//if (tl->force == FORCE || ( (get_virtual_time(task, now) - task->expected_time) > task->increment) ) { 
-				if (tl->force == FORCE && get_virtual_time(task, now) != task->expected_time) {
-
-					/* force the vt to be what you expect */
-					force_virtual_time(task->linux_task, task->expected_time);
-				}
-				
-				while (task->next != NULL)
-			        {
-			        	task = task->next;
-		                if (task->running_time > 0 && task->increment > 0 && task->stopped != -1)
-		                {
-			                	PDEBUG_V("Run Timeline Processes: Starting unfreeze_proc for %d, on timeline %d\n", task->linux_task->pid, tl->number);
-		                        unfreeze_proc_exp_recurse(task, task->expected_time);
-		                        PDEBUG_V("Run Timeline Processes: Finished unfreeze_proc for %d, on timeline %d\n", task->linux_task->pid, tl->number);
-				       			//startJob = 1;
-								if (tl->force == FORCE && get_virtual_time(task, now) != task->expected_time ) 									{ 
-									/* force the vt to be what you expect */
-									force_virtual_time(task->linux_task, task->expected_time);
-								}
-                    	}
-						startJob = 0;
-			        }
-
-			}
-
-				
-			/* if no more tasks need to run, send a message to userspace letting them know */
-		    if (startJob == 0)
-		    {
-				index = tl->cpu_assignment - (TOTAL_CPUS - EXP_CPUS);
-
-				/* see if there is more work to do */
-				int isSet = 0;
-				spin_lock(&cpuLock[index]);
-
-				if(!list_empty(&cpuWorkList[index])){
-
-					task = list_first_entry(&cpuWorkList[index], struct dilation_task_struct, cpuList);
-					if(task != NULL){
-						PDEBUG_V("Run Timeline Processes: Cpu list : %d not empty. Current timeline = %d, Running next timeline : %d\n", index, tl->number, task->tl->number);
-						if(tl->number == task->tl->number){
-							PDEBUG_E("Run Timeline Processes: Thats weird\n");
-							ntl = tl;
-						}
-						else
-							ntl = task->tl;
-					}
-
-					/* this moves on to the queued progress of the next timeline on the same cpu chain. This way the timelines on the same cpu chain are advanced one after the other */
-					list_del((&cpuWorkList[index])->next); 															
-					set_current_state(TASK_INTERRUPTIBLE);
-					
-				}
-				else{
-					set_current_state(TASK_INTERRUPTIBLE);				
-					cpuIdle[index] = 0;	
-				}				
+	for (task = s3fGetNextRunnableTask(tl->head); task != NULL; task = s3fGetNextRunnableTask(task->next)) {
+		PDEBUG_V("Run Timeline: Starting unfreeze_proc for %d, on timeline %d\n", task->linux_task->pid, tl->number);
+		unfreeze_proc_exp_recurse(task, task->expected_time);
+		PDEBUG_V("Run Timeline: Finished unfreeze_proc for %d, on timeline %d\n", task->linux_task->pid, tl->number);
 
-				PDEBUG_V("Run Timeline Processes: Send a message called from run timeline processes for timeline %d\n",tl->number);
+		do_gettimeofday(&ktv);
+		now = timeval_to_ns(&ktv);
+		if (tl->force == FORCE && get_virtual_time(task, now) != task->expected_time) {
 
-				/* Sending message to user proc doesn't always work */
-				//send_a_message(tl->user_proc->pid); 
-		
-				spin_unlock(&cpuLock[index]);
-				atomic_set(&tl->done,1);
-				wake_up_interruptible_sync(&tl->w_queue);
-				PDEBUG_V("Run Timeline Processes: Sent msg to user proc for timeline %d\n",tl->number);				
-			}			
-
-	    }
-	    else {
-			PDEBUG_E("Run Timeline Processes: BIG BUG, the timeline in the timeline thread should never be null...\n");
-	    }
-	    round++;
-	    noWork:
-		
-        set_current_state(TASK_INTERRUPTIBLE);
-        if(ntl == NULL || ntl != tl){
-        	if(round > 0 && ntl != NULL){
-				atomic_set(&ntl->pthread_done,1);
-				wake_up_interruptible_sync(&ntl->pthread_queue);			
-        	}
-            wait_event_interruptible(tl->pthread_queue,atomic_read(&tl->pthread_done) == 1);
-		
-    	}
-    	else{
-    		if(ntl == tl){
-    			PDEBUG_V("Run Timeline Processes: ntl == tl. continue\n");
-    		}
-    		else{
-    			PDEBUG_V("Run Timeline Processes: Finished timeline thread for timeline %d\n",tl->number);
-    			wait_event_interruptible(tl->pthread_queue,atomic_read(&tl->pthread_done) == 1);
-    		}
-    	}
-
-    	set_current_state(TASK_RUNNING);
-    	atomic_set(&tl->pthread_done,0);
+			/* force the vt to be what you expect */
+			force_virtual_time(exp, task->linux_task, task->expected_time);
+		}
 	}
-	return 0;
 }
 
 /***
-The main worker thread for each timeline. Whenever a user calls 'progress', the corresponding worker thread will wake up, determine how long each container in the timeline should run, then start the chain of running containers on the CPU (if the CPU is idle). If the CPU is already running containers of a different timeline, then add the containers to a wait queue
+Worker of one chain of a CS experiment, bound next to the chain's CPU like the CBE sync threads. Whenever a timeline
+assigned to the chain is progressed it gets queued on the chain, the worker runs its containers and then wakes the
+process waiting in s3f_progress_timeline directly. One worker per experiment CPU replaces the two kernel threads every
+timeline used to have. It runs on the chain's pool thread until clean_exp releases it
 ***/
-int progress_timeline_thread(void *data)
-{
+int cs_timeline_worker(void *data) {
+	struct chain_state *chain = (struct chain_state *)data;
+	struct tk_experiment *exp = chain->exp;
+	struct timeline* tl;
 	struct timeval ktv;
-	struct dilation_task_struct* task;
-	s64 now;
-	ktime_t ktime;
-    int round = 0;
-    int send_message = 0;
-	struct timeline* tl = (struct timeline *)data;
-	if (round == 0) {
-		goto noWork;
-	}
-	set_current_state(TASK_INTERRUPTIBLE);
-    while (!kthread_should_stop())
-    {
-    	send_message = 0;
-		if (tl != NULL) {
+	s64 start;
+	unsigned long flags;
 
-		if(atomic_read(&tl->stop_thread) > 0){
-    		PDEBUG_I("Progress Timeline Thread: Stopped progress timeline thread %d\n", tl->number);
-    		if(atomic_dec_and_test(&tl->stop_thread))
-    			kfree(tl);
-    		return 0;
-    	}
+	while (!tk_pool_released(chain)) {
+		wait_event_interruptible(chain->sync_task_queue, !list_empty(&chain->work_list) || tk_pool_released(chain));
 
-		PDEBUG_V("Progress Timeline Thread: Resumed progress timeline thread for timeline %d\n",tl->number);
-		do_gettimeofday(&ktv);
-        now = timeval_to_ns(&ktv);
-		
-		task = tl->head;
-        task = s3fGetNextRunnableTask(task);
-
-		/* if cpu is idle, unfreeze n go, if it is not idle, add to a queue */
-		if (task == NULL) {
-            set_current_state(TASK_INTERRUPTIBLE);
-            PDEBUG_V("Progress Timeline Thread: Send a message called from progress timeline thread for timeline %d\n",tl->number);
-            send_message = 1;
-            //send_a_message(tl->user_proc->pid);
-           
-        }
-        else {
-        	task->tl->user_proc->pid = tl->user_proc->pid;
-			int index = tl->cpu_assignment - (TOTAL_CPUS - EXP_CPUS);
-			int isEmpty = 0;
-			int is_found = 0;
-
-			/* START CRITICAL REGION */
-			preempt_disable();
-			local_irq_disable();
-			spin_lock(&cpuLock[index]);
-
-			if (cpuIdle[index] == 0) { 
+		tl = NULL;
+		spin_lock_irqsave(&chain->cpu_lock, flags);
+		if (!list_empty(&chain->work_list)) {
+			tl = list_first_entry(&chain->work_list, struct timeline, work_node);
+			list_del_init(&tl->work_node);
+		}
+		spin_unlock_irqrestore(&chain->cpu_lock, flags);
+		if (tl == NULL)
+			continue;
 
-				/* the cpu is idle, so we can start ours */
-				isEmpty = 1;
+		PDEBUG_V("CS Worker %d: Running timeline %d\n", chain->id, tl->number);
+		if (!tk_pool_released(chain)) {
+			do_gettimeofday(&ktv);
+			start = timeval_to_ns(&ktv);
+			s3f_run_timeline(tl);
+			spin_lock_irqsave(&tl->tl_lock, flags);
+			tl->reached = s3f_timeline_expected(tl);
+			spin_unlock_irqrestore(&tl->tl_lock, flags);
+			do_gettimeofday(&ktv);
 
-				/* set it to busy */
-				cpuIdle[index] = 1; 
-			}
-			else { 
-
-				/* add to the work queue */
-				struct list_head *  ptr;
-				struct dilation_task_struct * temp = NULL;
-				list_for_each(ptr, &cpuWorkList[index]) {
-					 temp = list_entry(ptr, struct dilation_task_struct, cpuList);
-					 if( temp != NULL){
-					 	if(temp->tl == task->tl){
-					 		is_found = 1;
-					 	}
-					 }
-				}
-				if(is_found == 0){
+			/* moving average of the physical time the timeline keeps its chain busy per progress window */
+			spin_lock_irqsave(&exp->timelines_lock, flags);
+			tl->load += (timeval_to_ns(&ktv) - start - tl->load) >> 2;
+			spin_unlock_irqrestore(&exp->timelines_lock, flags);
 
-					/* This will probably happen if two timelines are assigned the same cpu. When they both call progress, one of them will be queued */
-					list_add_tail(&(task->cpuList), &cpuWorkList[index]); 
-					PDEBUG_V("Progress Timeline Thread: queued new job for timeline %d\n",task->tl->number);
-				}
-				else{
-					PDEBUG_V("Progress Timeline Thread: did not queue job. timeline %d already exists\n", task->tl->number);
-				}
-			}
-			spin_unlock(&cpuLock[index]);
-			local_irq_enable();
-			preempt_enable();
-
-			/* END CRITICAL REGION */
-			if (isEmpty == 1) { 
-				PDEBUG_V("Progress Timeline Thread: Run timeline thread wake up sent to timeline %d\n",tl->number);
-				set_current_state(TASK_INTERRUPTIBLE);
-				atomic_set(&tl->pthread_done,1);
-				wake_up_interruptible_sync(&tl->pthread_queue);
+			if (atomic_inc_return(&exp->cs_windows) >= TK_CS_REBALANCE_WINDOWS && exp->number_of_heads > 1) {
+				atomic_set(&exp->cs_windows, 0);
+				s3f_rebalance_timelines(exp);
 			}
-        }
-		round++;
 		}
-		else {
-			PDEBUG_E("Progress Timeline Thread: BIG BUG, the timeline in the timeline thread should never be null...\n");
+
+		/* a timeline advancing on its own goes on with its next window right away */
+		if (tl->horizon > 0) {
+			if (!tk_pool_released(chain))
+				s3f_continue_timeline(tl);
+			wake_up_interruptible(&tl->w_queue);
+			continue;
 		}
-		noWork:
-            set_current_state(TASK_INTERRUPTIBLE);
-            PDEBUG_V("Progress Timeline Thread: Finished progress timeline thread for timeline %d\n",tl->number);
-			if(send_message){
-				if(tl != NULL){
-					////send_a_message(tl->user_proc->pid); // ** modified
-					atomic_set(&tl->done,1);
-					wake_up_interruptible_sync(&tl->w_queue);
-				}
-			}
-			
-			wait_event_interruptible(tl->progress_thread_queue,atomic_read(&tl->progress_thread_done) == 1);
-			atomic_set(&tl->progress_thread_done,0);
+
+		atomic_set(&tl->done,1);
+		wake_up_interruptible_sync(&tl->w_queue);
 	}
 	return 0;
 }
@@ -707,7 +786,8 @@ enum hrtimer_restart s3f_hrtimer_callback( struct hrtimer *timer )
     ktime_t ktime;
 	do_gettimeofday(&ktv);
     now = timeval_to_ns(&ktv);
-    task = container_of(timer, struct dilation_task_struct, timer);
+	task = container_of(timer, struct dilation_task_struct, timer);
+	tk_stats_record_timer_lateness(task->exp, timer);
 	if (task == NULL) {
 		PDEBUG_E("S3F Hrtimer: This should never be null... task in hrtimer\n");
 		return HRTIMER_NORESTART;
@@ -729,7 +809,7 @@ enum hrtimer_restart s3f_hrtimer_callback( struct hrtimer *timer )
 }
 
 /* Forces the virtual time of a task. This is a user specified option */
-void force_virtual_time(struct task_struct* aTask, s64 time) {
+void force_virtual_time(struct tk_experiment *exp, struct task_struct* aTask, s64 time) {
     struct list_head *list;
     struct task_struct *taskRecurse;
     struct task_struct *me;
@@ -771,21 +851,21 @@ void force_virtual_time(struct task_struct* aTask, s64 time) {
             if (taskRecurse->pid == 0) {
                     return;
             }
-            set_children_time(taskRecurse, time);
+            set_children_time(exp, taskRecurse, time);
     }
 }
 
 /* Wrapper function for fix_timeline, will simply extract necessary arguments */
-void fix_timeline_proc(char *write_buffer) {
+void fix_timeline_proc(struct tk_experiment *exp, char *write_buffer) {
 	int timeline;
 	timeline = atoi(write_buffer);
-	fix_timeline(timeline);
+	fix_timeline(exp, timeline);
 	return;
 }
 
 /* Will get called if the virtual time of a timeline gets way out of whack, will try to fix it */
-void fix_timeline(int timeline) {
-	struct timeline* tl = doesTimelineExist(timeline);
+void fix_timeline(struct tk_experiment *exp, int timeline) {
+	struct timeline* tl = doesTimelineExist(exp, timeline);
     struct dilation_task_struct* tmp;
 
 	if (tl != NULL) {
@@ -796,7 +876,7 @@ void fix_timeline(int timeline) {
         	}
 			PDEBUG_V("Calling Fix timeline\n");
 	        while (tmp != NULL) {
-				force_virtual_time(tmp->linux_task, tmp->expected_time);
+				force_virtual_time(exp, tmp->linux_task, tmp->expected_time);
         	    tmp = tmp->next;
         	}
 	}
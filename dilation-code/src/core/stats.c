@@ -0,0 +1,240 @@
+#include "dilation_module.h"
+
+/***
+Statistics gathered while an experiment is running. Round error and hrtimer lateness are kept in per-CPU
+counters, per-container counters live in the dilation_task_struct and per-chain counters are only written by the
+chain's sync thread, so none of the hot paths take a lock. Every experiment has its own set of counters. Everything is
+readable at any time through /proc/dilation/status (seq_file) or the TK_IO_GET_EXP_STATS ioctl.
+
+The per-CPU counters are never written by anyone but their CPU: a reset only takes a snapshot of them (stats_base) and
+the stats that are read are the difference to it.
+***/
+
+extern int TOTAL_CPUS;
+
+/***
+Returns the log2 histogram bucket of a value
+***/
+static int tk_hist_bucket(s64 val) {
+	int bucket;
+
+	if (val <= 0)
+		return 0;
+	bucket = fls64((u64)val);
+	if (bucket >= TK_HIST_BUCKETS)
+		bucket = TK_HIST_BUCKETS - 1;
+	return bucket;
+}
+
+/***
+Sums the per-CPU counters into sum
+***/
+static void tk_stats_sum(struct tk_experiment * exp, struct tk_cpu_stats * sum) {
+	int cpu;
+	int i;
+	struct tk_cpu_stats * st;
+
+	memset(sum, 0, sizeof(struct tk_cpu_stats));
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(exp->stats, cpu);
+		sum->n_rounds += st->n_rounds;
+		sum->round_error += st->round_error;
+		sum->round_error_sq += st->round_error_sq;
+		sum->n_timer_fires += st->n_timer_fires;
+		sum->timer_lateness += st->timer_lateness;
+		for (i = 0; i < TK_HIST_BUCKETS; i++) {
+			sum->round_error_hist[i] += st->round_error_hist[i];
+			sum->timer_lateness_hist[i] += st->timer_lateness_hist[i];
+		}
+	}
+}
+
+/***
+Resets the per-CPU statistics, safe while the experiment runs. Called after the stats are read through the ioctl. Must
+hold exp_mutex
+***/
+void tk_stats_reset(struct tk_experiment * exp) {
+	tk_stats_sum(exp, &exp->stats_base);
+}
+
+/***
+Resets all statistics, the per-chain ones as well. Called when an experiment is started or reset, while its sync threads
+are not running. Must hold exp_mutex
+***/
+void tk_stats_reset_all(struct tk_experiment * exp) {
+	int i;
+
+	tk_stats_reset(exp);
+	for (i = 0; i < EXP_CPUS; i++)
+		memset(&exp->chains[i].stats, 0, sizeof(struct chain_stats));
+}
+
+/***
+Records the virtual time error of a container at a round boundary (virtual time - target of the previous round)
+***/
+void tk_stats_record_round_error(struct tk_experiment * exp, s64 err) {
+	if (err < 0)
+		err = -err;
+
+	this_cpu_inc(exp->stats->n_rounds);
+	this_cpu_add(exp->stats->round_error, err);
+	this_cpu_add(exp->stats->round_error_sq, err*err);
+	this_cpu_inc(exp->stats->round_error_hist[tk_hist_bucket(err)]);
+}
+
+/***
+Records how late a slice hrtimer fired compared to its programmed expiry. Called from the hrtimer callbacks
+***/
+void tk_stats_record_timer_lateness(struct tk_experiment * exp, struct hrtimer * timer) {
+	s64 lateness;
+
+	lateness = ktime_to_ns(ktime_sub(hrtimer_cb_get_time(timer), hrtimer_get_expires(timer)));
+	if (lateness < 0)
+		lateness = 0;
+
+	this_cpu_inc(exp->stats->n_timer_fires);
+	this_cpu_add(exp->stats->timer_lateness, lateness);
+	this_cpu_inc(exp->stats->timer_lateness_hist[tk_hist_bucket(lateness)]);
+}
+
+/***
+Records the wall clock time a chain needed to run all of its containers in one round
+***/
+void tk_stats_record_chain_round(struct chain_state * chain, s64 round_time) {
+	struct chain_stats * cs = &chain->stats;
+
+	cs->n_rounds++;
+	cs->last_round_time = round_time;
+	cs->total_round_time += round_time;
+	if (round_time > cs->max_round_time)
+		cs->max_round_time = round_time;
+}
+
+/***
+Sums the per-CPU counters into args, minus their value at the last reset. Must hold exp_mutex
+***/
+void tk_stats_get(struct tk_experiment * exp, ioctl_args * args) {
+	int cpu;
+	int i;
+	struct tk_cpu_stats * st;
+	struct tk_cpu_stats * base = &exp->stats_base;
+
+	memset(args, 0, sizeof(ioctl_args));
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(exp->stats, cpu);
+		args->n_rounds += st->n_rounds;
+		args->round_error += st->round_error;
+		args->round_error_sq += st->round_error_sq;
+		args->n_timer_fires += st->n_timer_fires;
+		args->timer_lateness += st->timer_lateness;
+		for (i = 0; i < TK_HIST_BUCKETS; i++) {
+			args->round_error_hist[i] += st->round_error_hist[i];
+			args->timer_lateness_hist[i] += st->timer_lateness_hist[i];
+		}
+	}
+	args->n_rounds -= base->n_rounds;
+	args->round_error -= base->round_error;
+	args->round_error_sq -= base->round_error_sq;
+	args->n_timer_fires -= base->n_timer_fires;
+	args->timer_lateness -= base->timer_lateness;
+	for (i = 0; i < TK_HIST_BUCKETS; i++) {
+		args->round_error_hist[i] -= base->round_error_hist[i];
+		args->timer_lateness_hist[i] -= base->timer_lateness_hist[i];
+	}
+}
+
+/***
+Prints the non empty buckets of a log2 histogram
+***/
+static void tk_stats_show_hist(struct seq_file *m, const char * name, s64 * hist) {
+	int i;
+
+	seq_printf(m, "%s:", name);
+	for (i = 0; i < TK_HIST_BUCKETS; i++) {
+		if (hist[i] == 0)
+			continue;
+		if (i == 0)
+			seq_printf(m, " [0]=%lld", hist[i]);
+		else
+			seq_printf(m, " [%llu,%llu)=%lld", 1ULL << (i - 1), 1ULL << i, hist[i]);
+	}
+	seq_puts(m, "\n");
+}
+
+/***
+Prints the state, containers, chains and counters of one experiment
+***/
+static void tk_stats_show_exp(struct seq_file *m, struct tk_experiment * exp, ioctl_args * args, s64 now) {
+	struct dilation_task_struct * task;
+	struct list_head * pos;
+	int i;
+
+	mutex_lock(&exp->exp_mutex);
+	tk_stats_get(exp, args);
+
+	seq_printf(m, "experiment: %d cpus: %d-%d\n", exp->id, exp->cpu_base, exp->cpu_base + exp->n_cpus - 1);
+	seq_printf(m, "experiment_type: %d state: %d actual_time: %lld expected_increase: %lld\n",
+		exp->experiment_type, exp->experiment_stopped, exp->actual_time, exp->expected_increase);
+
+	seq_puts(m, "containers:\n");
+	seq_printf(m, "vt_compensate: %d\n", exp->vt_compensate);
+	seq_puts(m, "pid cpu tdf virtual_time lag overruns freezes thaws sleeper_wakeups overshoot residual avg_residual\n");
+	list_for_each(pos, &exp->exp_list) {
+		task = list_entry(pos, struct dilation_task_struct, list);
+		seq_printf(m, "%d %d %d %lld %lld %lld %lld %lld %lld %lld %lld %lld\n",
+			task->linux_task->pid, task->cpu_assignment, task->linux_task->dilation_factor,
+			get_virtual_time(task, now), task->stats.lag, task->stats.n_overruns,
+			task->stats.n_freezes, task->stats.n_thaws, task->stats.n_sleeper_wakeups,
+			task->stats.overshoot, task->stats.residual,
+			task->stats.n_residuals ? div64_s64(task->stats.residual_abs_sum, task->stats.n_residuals) : 0);
+	}
+
+	seq_puts(m, "chains:\n");
+	seq_puts(m, "chain rounds last_round_time avg_round_time max_round_time\n");
+	for (i = 0; i < exp->number_of_heads && i < EXP_CPUS; i++) {
+		struct chain_stats * cs = &exp->chains[i].stats;
+
+		seq_printf(m, "%d %lld %lld %lld %lld\n", i, cs->n_rounds, cs->last_round_time,
+			cs->n_rounds ? div64_s64(cs->total_round_time, cs->n_rounds) : 0, cs->max_round_time);
+	}
+	mutex_unlock(&exp->exp_mutex);
+
+	seq_printf(m, "round_error: n %lld sum %lld sum_sq %lld\n", args->n_rounds, args->round_error, args->round_error_sq);
+	seq_printf(m, "timer_lateness: n %lld sum %lld\n", args->n_timer_fires, args->timer_lateness);
+	tk_stats_show_hist(m, "round_error_hist", args->round_error_hist);
+	tk_stats_show_hist(m, "timer_lateness_hist", args->timer_lateness_hist);
+}
+
+/***
+Output of /proc/dilation/status: one section per experiment. Experiment 0 is always shown, the others once they have
+CPUs. Does not interfere with the running experiments, exp_mutex only keeps the container list from being freed while
+it is printed
+***/
+int status_show(struct seq_file *m, void *v) {
+	ioctl_args * args;
+	struct tk_experiment * exp;
+	struct timeval tv;
+	s64 now;
+	int id;
+
+	args = kmalloc(sizeof(ioctl_args), GFP_KERNEL);
+	if (!args)
+		return -ENOMEM;
+
+	do_gettimeofday(&tv);
+	now = timeval_to_ns(&tv);
+
+	for (id = 0; id < TK_MAX_EXPERIMENTS; id++) {
+		exp = &experiments[id];
+		if (!exp->initialized || (id != 0 && exp->n_cpus == 0))
+			continue;
+		tk_stats_show_exp(m, exp, args, now);
+	}
+
+	kfree(args);
+	return 0;
+}
+
+int status_open(struct inode *inode, struct file *file) {
+	return single_open(file, status_show, NULL);
+}
@@ -13,46 +13,56 @@ Basic Flow of Functions for a synchronized experiment:
 	-When the end of the round is reached, catchup_func will call clean_exp and stop the experiment.
 */
 
-void calcExpectedIncrease(void);
+void calcExpectedIncrease(struct tk_experiment *exp);
 void calcTaskRuntime(struct dilation_task_struct * task);
 struct dilation_task_struct * getNextRunnableTask(struct dilation_task_struct * task);
 int catchup_func(void *data);
 int calculate_sync_drift(void *data);
+extern int cs_timeline_worker(void *data);
 enum hrtimer_restart exp_hrtimer_callback( struct hrtimer *timer);
 enum hrtimer_restart alt_hrtimer_callback( struct hrtimer * timer );
 
 
 /* Local Functions */
-void add_to_exp(int pid);
+void add_to_exp(struct tk_experiment *exp, int pid, int n_vcpus);
 void addToChain(struct dilation_task_struct *task);
 void assign_to_cpu(struct dilation_task_struct *task);
-void printChainInfo(void);
-void add_to_exp_proc(char *write_buffer);
-void clean_exp(void);
-void set_clean_exp(void);
-void set_cbe_exp_timeslice(char *write_buffer);
-void set_children_time(struct task_struct *aTask, s64 time);
+void printChainInfo(struct tk_experiment *exp);
+void add_to_exp_proc(struct tk_experiment *exp, char *write_buffer);
+void clean_exp(struct tk_experiment *exp);
+void set_clean_exp(struct tk_experiment *exp);
+void set_cbe_exp_timeslice(struct tk_experiment *exp, char *write_buffer);
+void set_vt_compensation(struct tk_experiment *exp, char *write_buffer);
+void set_sched_granularity(struct tk_experiment *exp, char *write_buffer);
+void set_group_run_proc(struct tk_experiment *exp, char *write_buffer);
+void set_children_time(struct tk_experiment *exp, struct task_struct *aTask, s64 time);
 int freeze_children(struct task_struct *aTask, s64 time);
 int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,struct dilation_task_struct *lxc);
 int resume_all(struct task_struct *aTask,struct dilation_task_struct * lxc) ;
 int freeze_proc_exp_recurse(struct dilation_task_struct *aTask);
 int unfreeze_proc_exp_recurse(struct dilation_task_struct *aTask, s64 expected_time);
-void core_sync_exp(void);
+void core_sync_exp(struct tk_experiment *exp);
 void set_children_policy(struct task_struct *aTask, int policy, int priority);
 void set_children_cpu(struct task_struct *aTask, int cpu);
-void add_sim_to_exp_proc(char *write_buffer);
-void clean_stopped_containers(void);
+void add_sim_to_exp_proc(struct tk_experiment *exp, char *write_buffer);
+void clean_stopped_containers(struct tk_experiment *exp);
 void dilate_proc_recurse_exp(int pid, int new_dilation);
-void change_containers_dilation(void);
-void sync_and_freeze(void);
+void change_containers_dilation(struct tk_experiment *exp);
+void sync_and_freeze(struct tk_experiment *exp);
 void calculate_virtual_time_difference(struct dilation_task_struct* task, s64 now, s64 expected_time);
 s64 calculate_change(struct dilation_task_struct* task, s64 virt_time, s64 expected_time);
 s64 get_virtual_time(struct dilation_task_struct* task, s64 now);
 int run_head_process(struct dilation_task_struct * lxc, lxc_schedule_elem * head, s64 start_time, s64 vt_advance);
 int unfreeze_proc_vt_advance(struct dilation_task_struct *aTask, s64 expected_time) ;
-void set_all_freeze_times_recurse(struct task_struct * aTask, s64 freeze_time,s64 last_ppp, int max_no_recursions);
-void set_all_past_physical_times_recurse(struct task_struct * aTask, s64 time, int max_no_of_recursions, struct dilation_task_struct * lxc);
+void stop_container_processes(struct task_struct * aTask, int max_no_of_recursions);
+void refresh_lxc_schedule_queue(struct dilation_task_struct *aTask,s64 window_duration, s64 expected_inc);
+void prepare_container_round(struct dilation_task_struct *task, s64 expected_time);
+void prepare_pending_container(struct chain_state *chain);
 extern void unfreeze_all(struct task_struct *aTask);
+static void tk_tdf_insert(struct tk_experiment *exp, struct dilation_task_struct *task);
+static int tk_leader_refresh(struct tk_experiment *exp);
+static void reset_container_time(struct tk_experiment *exp, struct dilation_task_struct *lxc, s64 now);
+static void rebase_sleeper(void *item, void *arg);
 
 
 void print_schedule_list(struct dilation_task_struct * lxc)
@@ -72,7 +82,6 @@ void print_schedule_list(struct dilation_task_struct * lxc)
 /* Local Variables */
 
 s64 PRECISION = 1000;  
-s64 FREEZE_QUANTUM = 300000000;
 s64 Sim_time_scale = 1;
 s64 boottime;
 atomic_t is_boottime_set = ATOMIC_INIT(0);
@@ -80,79 +89,7 @@ hashmap poll_process_lookup;
 hashmap select_process_lookup;
 hashmap sleep_process_lookup;
 
-/* the number of containers in the experiment */
-int proc_num = 0;                           
-
-/* the task that calls the synchronization function (catchup_func) */
-struct task_struct *catchup_task;           
-
-/* the leader task, aka the task with the highest dilation factor */
-struct dilation_task_struct *leader_task;   
-
-/* represents the highest dilation factor in the experiment (aka the TDF of the leader) */
-int exp_highest_dilation = -100000000;      
-
-/* the linked list of all containers in the experiment */
-struct list_head exp_list; 
-
-/* the mutex for exp_list to ensure we do not have race conditions */
-struct mutex exp_mutex; 
-
-/* if == -1 then the experiment is not started yet, if == 0 then the experiment is currently running, if == 1 then the experiment is set to be stopped at the end of the current round. */
-int experiment_stopped; 
-
-/* every CPU has a linked list of containers assinged to that CPU. This variable specifies the 'head' container for each CPU */
-struct dilation_task_struct* chainhead[EXP_CPUS]; 
-
-/* for every cpu, this value represents how long every container for that CPU will need to run in each round (TimeKeeper will assign a new container to the CPU with the lowest value) */
-s64 chainlength[EXP_CPUS]; 
-
-struct task_struct* chaintask[EXP_CPUS];
-int values[EXP_CPUS];
-
-/* The virtual time that every container should be at (or at least close to) at the end of every round */
-s64 actual_time; 
-
-/* specifies how many head containers are in the experiment. This number will most often be equal to EXP_CPUS. Handles the special case if containers < EXP_CPUS so we do not have an array index out of bounds error */
-int number_of_heads = 0; 
-
-/* How much virtual time should increase at each round */
-s64 expected_increase; 
-
-/* flag if dilation of a container has changed in the experiment. 0 means no changes, 1 means change */
-int dilation_change = 0; 
-
-/* CBE for ns-3/core, CS for S3F (CS) */
-int experiment_type = NOTSET; 
-int stopped_change = 0;
-
-extern s64 round_error;
-extern s64 n_rounds;
-extern s64 round_error_sq;
-
-
-/* synchronization variables to support parallelization */
-
-static DECLARE_WAIT_QUEUE_HEAD(wq);
-atomic_t n_active_syscalls = ATOMIC_INIT(0);
-atomic_t experiment_stopping = ATOMIC_INIT(0);
-atomic_t worker_count = ATOMIC_INIT(0);
-atomic_t running_done = ATOMIC_INIT(0);
-atomic_t start_count = ATOMIC_INIT(0);
-atomic_t catchup_Task_finished = ATOMIC_INIT(0); 
-atomic_t woke_up_catchup_Task = ATOMIC_INIT(0);	
-atomic_t wake_up_signal[EXP_CPUS];
-atomic_t wake_up_signal_sync_drift[EXP_CPUS];
-atomic_t progress_cbe_rounds = ATOMIC_INIT(0);
-atomic_t progress_cbe_enabled = ATOMIC_INIT(0);
-
-int curr_process_finished_flag[EXP_CPUS];
-static int curr_sync_task_finished_flag[EXP_CPUS];
-static wait_queue_head_t per_cpu_wait_queue[EXP_CPUS];
-static wait_queue_head_t per_cpu_sync_task_queue[EXP_CPUS];
-static wait_queue_head_t progress_cbe_wait_queue;
-static wait_queue_head_t progress_cbe_catchup_tsk;
-static wait_queue_head_t cbe_exp_stop_queue;
+/* everything else about an experiment (its containers, chains, sync threads and round state) lives in its struct tk_experiment, see experiment.c */
 
 // externs
 extern struct poll_list {
@@ -164,63 +101,209 @@ extern int do_dialated_poll(unsigned int nfds,  struct poll_list *list, struct p
 extern int do_dialated_select(int n, fd_set_bits *fds,struct task_struct * tsk);
 extern struct task_struct *loop_task;
 extern int TOTAL_CPUS;
-extern struct timeline* timelineHead[EXP_CPUS];
 extern void perform_on_children(struct task_struct *aTask, void(*action)(int,int), int val);
 extern void change_dilation(int pid, int new_dilation);
 extern s64 get_virtual_time_task(struct task_struct* task, s64 now);
 
-// system call orig function pointers
-extern asmlinkage int (*ref_sys_poll)(struct pollfd __user * ufds, unsigned int nfds, int timeout_msecs);
-extern asmlinkage long (*ref_sys_select)(int n, fd_set __user *inp, fd_set __user *outp, fd_set __user *exp, struct timeval __user *tvp);
-extern asmlinkage long (*ref_sys_sleep)(struct timespec __user *rqtp, struct timespec __user *rmtp);
-extern asmlinkage long (*ref_sys_clock_nanosleep)(const clockid_t which_clock, int flags, const struct timespec __user * rqtp, struct timespec __user * rmtp);
-extern asmlinkage int (*ref_sys_clock_gettime)(const clockid_t which_clock, struct timespec __user * tp);
-
-
-extern unsigned long **sys_call_table; //address of the sys_call_table, so we can hijack certain system calls
-unsigned long orig_cr0;
 
 
-int progress_exp_cbe(char * write_buffer){
+/***
+Runs a CBE experiment for progress_rounds more rounds, then holds it at the round barrier. Blocks until the rounds are done,
+catchup_func wakes us up at the barrier (or when the experiment is being stopped)
+***/
+int progress_exp_cbe_rounds(struct tk_experiment *exp, int progress_rounds){
 
-	int progress_rounds = 0;
-	int ret = 0;
-	if(experiment_type != CBE)
+	if(exp->experiment_type != CBE)
 		return -1;
 	
-	set_current_state(TASK_INTERRUPTIBLE);	
-	progress_rounds = atoi(write_buffer);
+	/* exp_mutex keeps reset_exp from seeing the experiment half way into a progress */
+	mutex_lock(&exp->exp_mutex);
+	exp->progress_cbe_target = 0;
 	if(progress_rounds > 0 )
-		atomic_set(&progress_cbe_rounds,progress_rounds);
+		atomic_set(&exp->progress_cbe_rounds,progress_rounds);
 	else
-		atomic_set(&progress_cbe_rounds,1);	
+		atomic_set(&exp->progress_cbe_rounds,1);	
 		
-	atomic_set(&progress_cbe_enabled,1);
+	atomic_set(&exp->progress_cbe_enabled,1);
+	mutex_unlock(&exp->exp_mutex);
 	PDEBUG_V("Progress CBE - initiated. Number of Progress rounds = %d\n", progress_rounds);
-	wake_up_interruptible(&progress_cbe_catchup_tsk);
-	do{
-			ret = wait_event_interruptible_timeout(progress_cbe_wait_queue,atomic_read(&progress_cbe_rounds) == 0,HZ);
-			if(ret == 0)
-				set_current_state(TASK_INTERRUPTIBLE);
-			else
-				set_current_state(TASK_RUNNING);
-
-	}while(ret == 0);
+	wake_up_interruptible(&exp->progress_cbe_catchup_tsk);
+	wait_event_interruptible(exp->progress_cbe_wait_queue, atomic_read(&exp->progress_cbe_rounds) == 0 || atomic_read(&exp->experiment_stopping) == 1);
 	
 	return 0;
 }
 
-void resume_exp_cbe(){
+/***
+Runs a CBE experiment until its containers have reached the virtual time target (in the units of actual_time), then holds it
+at the round barrier. The last round is shortened so the experiment does not overshoot the target. Returns immediately if
+the target has already been reached.
+***/
+int progress_exp_cbe_until(struct tk_experiment *exp, s64 target){
+
+	if(exp->experiment_type != CBE)
+		return -1;
+
+	if(target <= cbe_reached_time(exp))
+		return 0;
+
+	/* rounds only count down as a fallback, catchup_func ends the run when the target is reached */
+	mutex_lock(&exp->exp_mutex);
+	exp->progress_cbe_target = target;
+	atomic_set(&exp->progress_cbe_rounds,INT_MAX);
+	atomic_set(&exp->progress_cbe_enabled,1);
+	mutex_unlock(&exp->exp_mutex);
+	PDEBUG_V("Progress CBE - initiated. Running until virtual time %lld\n", target);
+	wake_up_interruptible(&exp->progress_cbe_catchup_tsk);
+	wait_event_interruptible(exp->progress_cbe_wait_queue, atomic_read(&exp->progress_cbe_rounds) == 0 || atomic_read(&exp->experiment_stopping) == 1);
+
+	return 0;
+}
+
+/***
+The virtual time the containers of a CBE experiment have reached. Once it is running, catchup_func has already moved
+actual_time to the end of the round about to run when it holds the experiment at the barrier
+***/
+s64 cbe_reached_time(struct tk_experiment *exp){
+
+	if(exp->experiment_stopped == RUNNING)
+		return exp->actual_time - exp->expected_increase;
+	return exp->actual_time;
+}
+
+int progress_exp_cbe(struct tk_experiment *exp, char * write_buffer){
+	return progress_exp_cbe_rounds(exp, atoi(write_buffer));
+}
+
+/***
+Makes a CBE experiment stop at the next round barrier without waiting for it, the experiment is then moved forward with
+progress_exp_cbe_rounds. Used by the distributed barrier (dist/) before the first round
+***/
+int hold_exp_cbe(struct tk_experiment *exp){
+
+	if(exp->experiment_type != CBE)
+		return -1;
+
+	mutex_lock(&exp->exp_mutex);
+	atomic_set(&exp->progress_cbe_rounds,0);
+	atomic_set(&exp->progress_cbe_enabled,1);
+	mutex_unlock(&exp->exp_mutex);
+	PDEBUG_V("Hold CBE: Experiment %d held at the next round barrier\n", exp->id);
+	return 0;
+}
+
+void resume_exp_cbe(struct tk_experiment *exp){
 
-	if(atomic_read(&progress_cbe_enabled) == 1 && atomic_read(&progress_cbe_rounds) <= 0 && experiment_type == CBE) {
-		atomic_set(&progress_cbe_enabled,0);
-		atomic_set(&progress_cbe_rounds,0);
-		wake_up_interruptible(&progress_cbe_catchup_tsk);
+	mutex_lock(&exp->exp_mutex);
+	if(atomic_read(&exp->progress_cbe_enabled) == 1 && atomic_read(&exp->progress_cbe_rounds) <= 0 && exp->experiment_type == CBE) {
+		exp->progress_cbe_target = 0;
+		atomic_set(&exp->progress_cbe_enabled,0);
+		atomic_set(&exp->progress_cbe_rounds,0);
+		wake_up_interruptible(&exp->progress_cbe_catchup_tsk);
 	
 	}
+	mutex_unlock(&exp->exp_mutex);
+
+}
+
+
+/***
+Warm restart of a synchronized experiment: every container is set back to a fresh start at the current time, like
+sync_and_freeze does, but the containers keep their chains and CPUs, the pool threads keep their jobs and the system
+calls stay hooked. A parameter sweep can then run one short experiment after the other on the same containers. A CBE
+experiment must be frozen or held at the round barrier (after a progress returned), a CS experiment must have no
+timeline progressing. Tasks sleeping in a hooked call keep the virtual time they have left to sleep
+***/
+void reset_exp(struct tk_experiment *exp) {
+	struct dilation_task_struct *lxc;
+	struct list_head *pos;
+	struct timeval ktv;
+	s64 now;
+	s64 shift;
+	int i;
+
+	/* a progress or stop cannot start while the experiment is checked and reset */
+	mutex_lock(&exp->exp_mutex);
+	if (exp->experiment_stopped != FROZEN && exp->experiment_stopped != RUNNING) {
+		PDEBUG_E("Reset Exp: Experiment %d is not synchronized\n", exp->id);
+		goto out;
+	}
+	if (atomic_read(&exp->experiment_stopping) == 1) {
+		PDEBUG_E("Reset Exp: Experiment %d is being stopped\n", exp->id);
+		goto out;
+	}
+	if (exp->experiment_type == CBE && exp->experiment_stopped == RUNNING &&
+		(atomic_read(&exp->progress_cbe_enabled) != 1 || atomic_read(&exp->progress_cbe_rounds) != 0)) {
+		PDEBUG_E("Reset Exp: Experiment %d is running, it can only be reset at the round barrier\n", exp->id);
+		goto out;
+	}
+	if (exp->experiment_type == CS) {
+		for (i = 0; i < exp->number_of_heads; i++) {
+			if (!list_empty(&exp->chains[i].work_list)) {
+				PDEBUG_E("Reset Exp: Experiment %d has timelines progressing\n", exp->id);
+				goto out;
+			}
+		}
+	}
+
+	do_gettimeofday(&ktv);
+	now = timeval_to_ns(&ktv);
 
+	list_for_each(pos, &exp->exp_list) {
+		lxc = list_entry(pos, struct dilation_task_struct, list);
+		if (lxc->stopped == -1)
+			continue;
+
+		/* the container's virtual time jumps to now, the deadlines of its sleepers move with it */
+		shift = now - get_virtual_time_task(lxc->linux_task, now);
+		llist_iterate(&lxc->schedule_queue, rebase_sleeper, &shift);
+
+		reset_container_time(exp, lxc, now);
+		set_children_time(exp, lxc->linux_task, now);
+
+		lxc->clock_round = 0;
+		lxc->stats.last_target = 0;
+		tk_clock_table_publish(lxc, TK_CLOCK_FROZEN);
+	}
+	tk_stats_reset_all(exp);
+
+	/* held at the barrier, catchup_func has already moved actual_time to the end of the round about to run */
+	exp->actual_time = now;
+	if (exp->experiment_type == CBE && exp->experiment_stopped == RUNNING)
+		exp->actual_time += exp->expected_increase;
+	exp->progress_cbe_target = 0;
+
+	PDEBUG_A("Reset Exp: Experiment %d restarted at %lld\n", exp->id, now);
+out:
+	mutex_unlock(&exp->exp_mutex);
 }
 
+/***
+Moves the wakeup time of a task sleeping in a hooked nanosleep, select or poll by the virtual time shift of its
+container, the sleeper applies it the next time it wakes up (llist_iterate callback)
+***/
+static void rebase_sleeper(void *item, void *arg) {
+	lxc_schedule_elem *elem = (lxc_schedule_elem *)item;
+	s64 shift = *(s64 *)arg;
+	struct sleep_helper_struct *sleep_helper;
+	struct select_helper_struct *select_helper;
+	struct poll_helper_struct *poll_helper;
+	unsigned long flags;
+
+	if (elem == NULL || schedule_elem_exited(elem))
+		return;
+
+	acquire_irq_lock(&elem->curr_task->dialation_lock,flags);
+	sleep_helper = hmap_get_abs(&sleep_process_lookup, elem->pid);
+	if (sleep_helper != NULL)
+		atomic64_add(shift, &sleep_helper->rebase);
+	select_helper = hmap_get_abs(&select_process_lookup, elem->pid);
+	if (select_helper != NULL)
+		atomic64_add(shift, &select_helper->rebase);
+	poll_helper = hmap_get_abs(&poll_process_lookup, elem->pid);
+	if (poll_helper != NULL)
+		atomic64_add(shift, &poll_helper->rebase);
+	release_irq_lock(&elem->curr_task->dialation_lock,flags);
+}
 
 /***
 Given a pid and a new dilation, dilate it and all of it's children
@@ -246,48 +329,136 @@ s64 get_virtual_time(struct dilation_task_struct* task, s64 now) {
 
 
 /*
-Changes the FREEZE_QUANTUM for a CBE experiment
+Changes the freeze quantum of a CBE experiment
 */
-void set_cbe_exp_timeslice(char *write_buffer){
+void set_cbe_exp_timeslice(struct tk_experiment *exp, char *write_buffer){
 
 	s64 timeslice;
 	timeslice = atoi(write_buffer);
-	if(experiment_type == CBE){
-		FREEZE_QUANTUM = timeslice;
-		FREEZE_QUANTUM = FREEZE_QUANTUM*Sim_time_scale;
-		PDEBUG_A("Set CBE Exp Timeslice: Set Freeze Quantum : %lld\n", FREEZE_QUANTUM);
+	if(exp->experiment_type == CBE){
+		exp->freeze_quantum = timeslice;
+		exp->freeze_quantum = exp->freeze_quantum*Sim_time_scale;
+		PDEBUG_A("Set CBE Exp Timeslice: Set Freeze Quantum : %lld\n", exp->freeze_quantum);
 	}
 
 }
 
+/*
+Turns the overrun feedback of a CBE experiment on (1) or off (0). With it, every container learns how far it
+systematically keeps running past the end of its slice (hrtimer lateness, signal latency) and its slices are cut short
+by that much, so it gets the physical time it is charged for. Turning it off forgets what was learned
+*/
+void set_vt_compensation(struct tk_experiment *exp, char *write_buffer){
+	struct dilation_task_struct *lxc;
+	struct list_head *pos;
+
+	if (exp->experiment_type != CBE)
+		return;
+	exp->vt_compensate = atoi(write_buffer) != 0;
+	if (!exp->vt_compensate) {
+		mutex_lock(&exp->exp_mutex);
+		list_for_each(pos, &exp->exp_list) {
+			lxc = list_entry(pos, struct dilation_task_struct, list);
+			lxc->stats.overshoot = 0;
+		}
+		mutex_unlock(&exp->exp_mutex);
+	}
+	PDEBUG_A("Set Vt Compensation: Experiment %d: %s\n", exp->id, exp->vt_compensate ? "on" : "off");
+}
+
+/*
+Changes the slice granularity (ns) of the threads inside the containers of an experiment. Their weights are not affected
+*/
+void set_sched_granularity(struct tk_experiment *exp, char *write_buffer){
+
+	s64 granularity;
+	granularity = atoi(write_buffer);
+	if(granularity <= 0){
+		PDEBUG_E("Set Sched Granularity: Invalid granularity : %lld\n", granularity);
+		return;
+	}
+	exp->sched_granularity = granularity;
+	PDEBUG_A("Set Sched Granularity: Experiment %d: Set Sched Granularity : %lld\n", exp->id, exp->sched_granularity);
+
+}
+
+/*
+Switches a container of the experiment between running one thread per slice (0) and group runs (1). Takes effect at
+the container's next turn
+*/
+void set_group_run_proc(struct tk_experiment *exp, char *write_buffer){
+
+	int pid, value, group_run;
+	int found = 0;
+	struct list_head *pos;
+	struct list_head *n;
+	struct dilation_task_struct* task;
+
+	pid = atoi(write_buffer);
+	value = get_next_value(write_buffer);
+	group_run = atoi(write_buffer + value);
+
+	mutex_lock(&exp->exp_mutex);
+	list_for_each_safe(pos, n, &exp->exp_list)
+	{
+		task = list_entry(pos, struct dilation_task_struct, list);
+		if (task->linux_task->pid == pid) {
+			task->group_run = group_run ? 1 : 0;
+			found = 1;
+		}
+	}
+	mutex_unlock(&exp->exp_mutex);
+
+	if (found)
+		PDEBUG_A("Set Group Run: Container %d group run : %d\n", pid, group_run ? 1 : 0);
+	else
+		PDEBUG_E("Set Group Run: Container %d is not part of the experiment\n", pid);
+}
+
 
 /***
 Adds the simulator pid to the experiment - might be deprecated.
 ***/
-void add_sim_to_exp_proc(char *write_buffer) {
+void add_sim_to_exp_proc(struct tk_experiment *exp, char *write_buffer) {
 	int pid;
     pid = atoi(write_buffer);
-	add_to_exp(pid);
+	add_to_exp(exp, pid, 1);
 }
 
 /*
-Creates and initializes dilation_task_struct given a task_struct.
+Creates and initializes dilation_task_struct given a task_struct of the experiment.
 */
-struct dilation_task_struct* initialize_node(struct task_struct* aTask) {
+struct dilation_task_struct* initialize_node(struct tk_experiment *exp, struct task_struct* aTask) {
 	struct dilation_task_struct* list_node;
-	PDEBUG_A("Initialize Node: Adding a pid: %d Num of Nodes in experiment so Far: %d, Number of CPUS used so Far: %d\n", aTask->pid, proc_num, number_of_heads);
+	PDEBUG_A("Initialize Node: Adding a pid: %d Num of Nodes in experiment so Far: %d, Number of CPUS used so Far: %d\n", aTask->pid, exp->proc_num, exp->number_of_heads);
 	list_node = (struct dilation_task_struct *)kmalloc(sizeof(struct dilation_task_struct), GFP_KERNEL);
 	list_node->linux_task = aTask;
+	list_node->exp = exp;
 	list_node->stopped = 0;
 	list_node->next = NULL;
 	list_node->prev = NULL;
 	list_node->wake_up_time = 0;
 	list_node->newDilation = -1;
+	INIT_LIST_HEAD(&list_node->dilation_node);
+	RB_CLEAR_NODE(&list_node->tdf_node);
+	list_node->tdf = 0;
 	list_node->increment = 0;
 	list_node->cpu_assignment = -1;
 	list_node->rr_run_time = 0;
+	list_node->min_vruntime = 0;
+	list_node->group_run = 0;
+	list_node->n_vcpus = 1;
+	cpumask_clear(&list_node->cpus);
 	list_node->last_timer_fire_time = 0;
 	list_node->last_timer_duration = 0;
+	list_node->round_prepared = 0;
+	list_node->clock_epoch = 0;
+	atomic_set(&list_node->members_changed, 1);
+	INIT_LIST_HEAD(&list_node->members_added);
+	INIT_LIST_HEAD(&list_node->members_exited);
+	memset(&list_node->stats, 0, sizeof(struct lxc_stats));
+	list_node->stats.overrun = -1;
+	tk_clock_table_add(list_node);
 	
 	list_node->last_run = NULL;
 	llist_init(&list_node->schedule_queue);
@@ -300,23 +471,29 @@ struct dilation_task_struct* initialize_node(struct task_struct* aTask) {
 /***
 wake_up_process returns 1 if it was stopped and gets woken up, 0 if it is dead OR already running. Used with CS experiments.
 ***/
-void progress_exp(void) {
-        wake_up_process(catchup_task);
+void progress_exp(struct tk_experiment *exp) {
+        wake_up_process(exp->catchup_task);
 }
 
 /***
 Reads a PID from the buffer, and adds the corresponding task to the experiment (i believe this does not support the adding
 of processes if the experiment has alreaded started)
 ***/
-void add_to_exp_proc(char *write_buffer) {
-    int pid;
+void add_to_exp_proc(struct tk_experiment *exp, char *write_buffer) {
+    int pid, value;
+    int n_vcpus = 1;
     pid = atoi(write_buffer);
 
-	if (experiment_type == CS) {
+	/* optional number of vCPUs: 'pid,n_vcpus' */
+	value = get_next_value(write_buffer);
+	if (write_buffer[value - 1] == ',')
+		n_vcpus = atoi(write_buffer + value);
+
+	if (exp->experiment_type == CS) {
 		PDEBUG_A("Add To Exp Proc: Trying to add to wrong experiment type.. exiting\n");
 	}
-	else if (experiment_stopped == NOTRUNNING) {
-        add_to_exp(pid);
+	else if (exp->experiment_stopped == NOTRUNNING) {
+        add_to_exp(exp, pid, n_vcpus);
 	}
 	else {
 		PDEBUG_A("Add to Exp Proc: Trying to add a LXC to experiment that is already running\n");
@@ -324,13 +501,14 @@ void add_to_exp_proc(char *write_buffer) {
 }
 
 /***
-Gets called by add_to_exp_proc(). Initiazes a containers timer, sets scheduling policy.
+Gets called by add_to_exp_proc(). Initiazes a containers timer, sets scheduling policy. A container with more than one
+vCPU spans that many experiment CPUs of the experiment.
 ***/
-void add_to_exp(int pid) {
+void add_to_exp(struct tk_experiment *exp, int pid, int n_vcpus) {
         struct task_struct* aTask;
         struct dilation_task_struct* list_node;
         aTask = find_task_by_pid(pid);
-        experiment_stopped = NOTRUNNING;
+        exp->experiment_stopped = NOTRUNNING;
 
         /* maybe I should just skip this pid instead of completely dropping out? */
         if (aTask == NULL)
@@ -339,210 +517,350 @@ void add_to_exp(int pid) {
                 return;
         }
 
-        proc_num++;
-		experiment_type = CBE;
-        if (EXP_CPUS < proc_num)
-                number_of_heads = EXP_CPUS;
+        /* the first container claims the experiment CPUs */
+        if (exp->proc_num == 0 && !tk_experiment_cpus_free(exp))
+        {
+                PDEBUG_E("Add to Exp: Experiment %d has no CPUs set or they are used by another experiment, Dropping out\n", exp->id);
+                return;
+        }
+
+        exp->proc_num++;
+		exp->experiment_type = CBE;
+        if (exp->n_cpus < exp->proc_num)
+                exp->number_of_heads = exp->n_cpus;
         else
-                number_of_heads = proc_num;
+                exp->number_of_heads = exp->proc_num;
 
-		list_node = initialize_node(aTask);
+		list_node = initialize_node(exp, aTask);
         list_node->timer.function = &exp_hrtimer_callback;
+		if (n_vcpus > exp->n_cpus) {
+			PDEBUG_E("Add to Exp: Pid %d asked for %d vCPUs, only %d experiment CPUs\n", pid, n_vcpus, exp->n_cpus);
+			n_vcpus = exp->n_cpus;
+		}
+		list_node->n_vcpus = n_vcpus > 1 ? n_vcpus : 1;
 
-        mutex_lock(&exp_mutex);
-        list_add(&(list_node->list), &exp_list);
-        mutex_unlock(&exp_mutex);
-        if (exp_highest_dilation < list_node->linux_task->dilation_factor)
+        mutex_lock(&exp->exp_mutex);
+        list_add(&(list_node->list), &exp->exp_list);
+        mutex_unlock(&exp->exp_mutex);
+        if (exp->exp_highest_dilation < list_node->linux_task->dilation_factor)
         {
-                exp_highest_dilation = list_node->linux_task->dilation_factor;
-                leader_task = list_node;
+                exp->exp_highest_dilation = list_node->linux_task->dilation_factor;
+                exp->leader_task = list_node;
         }
 }
 
+/***
+Adds a whole array of containers in one call (TK_IO_ADD_BULK). Every container and its children get their TDF first, then
+it is added to the CBE experiment, or to its timeline of the CS experiment, like add_to_exp_proc and s3f_add_to_exp_proc
+would. Returns the number of containers added, or a negative error
+***/
+int add_to_exp_bulk(struct tk_experiment *exp, tk_bulk_args *args) {
+	tk_bulk_entry *entries;
+	int n_entries;
+	int n_added = 0;
+	int before;
+	int i;
+
+	n_entries = (int)args->n_entries;
+	if (n_entries <= 0 || n_entries > TK_BULK_MAX)
+		return -EINVAL;
+
+	entries = vmalloc(n_entries * sizeof(tk_bulk_entry));
+	if (entries == NULL)
+		return -ENOMEM;
+	if (copy_from_user(entries, (void __user *)(unsigned long)args->entries, n_entries * sizeof(tk_bulk_entry))) {
+		vfree(entries);
+		return -EFAULT;
+	}
+
+	for (i = 0; i < n_entries; i++) {
+		if (exp->experiment_stopped != NOTRUNNING) {
+			PDEBUG_E("Add To Exp Bulk: Experiment %d is already running, %d containers not added\n", exp->id, n_entries - i);
+			break;
+		}
+		if ((entries[i].timeline < 0 && exp->experiment_type == CS) || (entries[i].timeline >= 0 && exp->experiment_type == CBE)) {
+			PDEBUG_E("Add To Exp Bulk: Pid %d does not match the experiment type, skipped\n", entries[i].pid);
+			continue;
+		}
+
+		dilate_proc_recurse_exp(entries[i].pid, entries[i].tdf);
+		before = exp->proc_num;
+		if (entries[i].timeline < 0)
+			add_to_exp(exp, entries[i].pid, entries[i].n_vcpus);
+		else
+			s3f_add_to_exp(exp, entries[i].pid, entries[i].timeline);
+		if (exp->proc_num > before)
+			n_added++;
+	}
+	vfree(entries);
+
+	PDEBUG_A("Add To Exp Bulk: Added %d of %d containers to experiment %d\n", n_added, n_entries, exp->id);
+	return n_added;
+}
+
+/***
+Work of one sync_and_freeze_worker: every n_workers-th container of the experiment, starting at the worker's id
+***/
+struct sync_and_freeze_work {
+	struct tk_experiment *exp;
+	struct dilation_task_struct **lxcs;
+	int n_lxcs;
+	int id;
+	int n_workers;
+	s64 now;
+	struct completion done;
+};
+
+/***
+Sets the clock of a container's task back to a fresh start at now, frozen. Used by sync_and_freeze and reset_exp, the
+container's other tasks are set by set_children_time
+***/
+static void reset_container_time(struct tk_experiment *exp, struct dilation_task_struct *lxc, s64 now) {
+	unsigned long flags;
+
+	if (exp->experiment_type == CS) {
+		lxc->expected_time = now;
+		lxc->running_time = 0;
+	}
+
+	acquire_irq_lock(&lxc->linux_task->dialation_lock,flags);
+	lxc->linux_task->past_physical_time = 0;
+	lxc->linux_task->past_virtual_time = 0;
+	lxc->linux_task->wakeup_time = 0;
+	lxc->linux_task->freeze_time = now;
+	lxc->linux_task->virt_start_time = now;
+	release_irq_lock(&lxc->linux_task->dialation_lock,flags);
+}
+
+/***
+Sets a container (and all its children) to the experiment's start time, freezes it and sets its scheduling policy and,
+for CS, its CPU. Containers are independent of each other, so this runs in parallel for all containers of the experiment
+***/
+static void sync_and_freeze_container(struct tk_experiment *exp, struct dilation_task_struct *list_node, s64 now) {
+	struct sched_param sp;
+
+	sp.sched_priority = 99;
+	if (exp->experiment_type == CBE)
+		calcTaskRuntime(list_node);
+
+	/* consistent time */
+	reset_container_time(exp, list_node, now);
+
+	/* freeze all children */
+	freeze_proc_exp_recurse(list_node); 
+	tk_clock_table_publish(list_node, TK_CLOCK_FROZEN);
+
+	/* the experiment is cleaned up once every container is done */
+	if (list_node->stopped == -1)
+		return;
+
+	/* set priority and scheduling policy */
+	if (sched_setscheduler(list_node->linux_task, SCHED_RR, &sp) == -1 )
+		PDEBUG_A("Sync And Freeze: Error setting SCHED_RR %d\n",list_node->linux_task->pid);
+	set_children_time(exp, list_node->linux_task, now);
+	set_children_policy(list_node->linux_task, SCHED_RR, sp.sched_priority);
+
+	if (exp->experiment_type == CS) {
+		bitmap_zero((&list_node->linux_task->cpus_allowed)->bits, 8);
+		cpumask_set_cpu(list_node->cpu_assignment, &list_node->linux_task->cpus_allowed);
+		set_children_cpu(list_node->linux_task, list_node->cpu_assignment);
+	}
+
+	PDEBUG_V("Sync And Freeze: Task running time: %lld\n", list_node->running_time);
+}
+
+static int sync_and_freeze_worker(void *data) {
+	struct sync_and_freeze_work *work = (struct sync_and_freeze_work *)data;
+	int i;
+
+	for (i = work->id; i < work->n_lxcs; i += work->n_workers)
+		sync_and_freeze_container(work->exp, work->lxcs[i], work->now);
+	complete(&work->done);
+	return 0;
+}
+
+/***
+Runs sync_and_freeze_container for every container of the experiment, spread over one thread per experiment CPU (the
+containers are all frozen, so those CPUs are idle). Falls back to doing it from the calling thread if the threads
+cannot be created. Returns -1 if one of the containers no longer exists
+***/
+static int sync_and_freeze_containers(struct tk_experiment *exp, s64 now) {
+	struct dilation_task_struct **lxcs;
+	struct sync_and_freeze_work *works;
+	struct task_struct *worker;
+	struct list_head *pos;
+	int n_workers;
+	int n_lxcs = 0;
+	int ret = 0;
+	int i;
+
+	n_workers = exp->n_cpus < exp->proc_num ? exp->n_cpus : exp->proc_num;
+	if (n_workers < 1)
+		n_workers = 1;
+	lxcs = kmalloc(exp->proc_num * sizeof(struct dilation_task_struct *), GFP_KERNEL);
+	works = kmalloc(n_workers * sizeof(struct sync_and_freeze_work), GFP_KERNEL);
+	if (lxcs == NULL || works == NULL) {
+		kfree(lxcs);
+		kfree(works);
+		lxcs = NULL;
+		works = NULL;
+	}
+
+	if (lxcs == NULL) {
+		list_for_each(pos, &exp->exp_list)
+			sync_and_freeze_container(exp, list_entry(pos, struct dilation_task_struct, list), now);
+	}
+	else {
+		list_for_each(pos, &exp->exp_list) {
+			if (n_lxcs < exp->proc_num)
+				lxcs[n_lxcs++] = list_entry(pos, struct dilation_task_struct, list);
+		}
+
+		for (i = 0; i < n_workers; i++) {
+			works[i].exp = exp;
+			works[i].lxcs = lxcs;
+			works[i].n_lxcs = n_lxcs;
+			works[i].id = i;
+			works[i].n_workers = n_workers;
+			works[i].now = now;
+			init_completion(&works[i].done);
+
+			worker = kthread_create(&sync_and_freeze_worker, &works[i], "tk_sync/%d", exp->id);
+			if (IS_ERR(worker)) {
+				sync_and_freeze_worker(&works[i]);
+				continue;
+			}
+			kthread_bind(worker, exp->cpu_base + i);
+			wake_up_process(worker);
+		}
+		for (i = 0; i < n_workers; i++)
+			wait_for_completion(&works[i].done);
+		kfree(works);
+		kfree(lxcs);
+	}
+
+	list_for_each(pos, &exp->exp_list) {
+		if (list_entry(pos, struct dilation_task_struct, list)->stopped == -1)
+			ret = -1;
+	}
+	return ret;
+}
+
 /*
 Sets all nodes added to the experiment to the same point in time, and freezes them
 */
-void sync_and_freeze() {
+void sync_and_freeze(struct tk_experiment *exp) {
 	struct timeval now_timeval;
 	s64 now;
 	struct dilation_task_struct* list_node;
 	struct list_head *pos;
 	struct list_head *n;
+	struct rb_node *node;
 	int i;
 	int j;
-	struct sched_param sp;
 	int placed_lxcs;
 	placed_lxcs = 0;
-	unsigned long flags;
 
 	PDEBUG_A("Sync And Freeze: ** Starting Experiment Synchronization **\n");
 
-	if (proc_num == 0) {
+	if (exp->proc_num == 0) {
 		PDEBUG_A("Sync And Freeze: Nothing added to experiment, dropping out\n");
 		return;
 	}
 
-	if (experiment_stopped != NOTRUNNING) {
+	if (exp->experiment_stopped != NOTRUNNING) {
         PDEBUG_A("Sync And Freeze: Trying to StartExp when an experiment is already running!\n");
         return;
     }
 
 
-	hmap_init( &poll_process_lookup,"int",0);
-	hmap_init( &select_process_lookup,"int",0);
-	hmap_init( &sleep_process_lookup,"int",0);
-
-	round_error = 0;
-	round_error_sq = 0;
-	n_rounds = 0;
+	mutex_lock(&exp->exp_mutex);
+	tk_stats_reset_all(exp);
+	mutex_unlock(&exp->exp_mutex);
 
 	PDEBUG_V("Sync and Freeze: Hooking system calls\n");
-	PDEBUG_V("Catchup Task: Pid = %d\n", catchup_task->pid);
-
-	orig_cr0 = read_cr0();
-	write_cr0(orig_cr0 & ~0x00010000);
-
-	sys_call_table[NR_select] = (unsigned long *)sys_select_new;	
-	sys_call_table[__NR_poll] = (unsigned long *) sys_poll_new;
-	sys_call_table[__NR_nanosleep] = (unsigned long *)sys_sleep_new;
-	sys_call_table[__NR_clock_gettime] = (unsigned long *) sys_clock_gettime_new;
-	sys_call_table[__NR_clock_nanosleep] = (unsigned long *) sys_clock_nanosleep_new;
+	PDEBUG_V("Catchup Task: Pid = %d\n", exp->catchup_task->pid);
+	tk_hook_syscalls(exp);
 
-	write_cr0(orig_cr0 | 0x00010000 );
 
-
-	for (j = 0; j < number_of_heads; j++) {
-        values[j] = j;
-	}
-    
-	sp.sched_priority = 99;
-	
-	if(experiment_type == CBE) {
-		init_waitqueue_head(&progress_cbe_wait_queue);
-		init_waitqueue_head(&progress_cbe_catchup_tsk);	
-		init_waitqueue_head(&cbe_exp_stop_queue);
+	for (j = 0; j < exp->number_of_heads; j++) {
+        exp->chains[j].id = j;
 	}
 
-	/* Create the threads for parallel computing */
-	for (i = 0; i < number_of_heads; i++)
+	/* Hand the chains to their pool threads, they are only created the first time a chain is used. The wait queues
+	were set up with the experiment and are reused */
+	for (i = 0; i < exp->number_of_heads; i++)
 	{
-		PDEBUG_A("Sync And Freeze: Adding Worker Thread %d\n", i);
-		chainhead[i] = NULL;
-		chainlength[i] = 0;
-		if (experiment_type == CBE){
-			init_waitqueue_head(&per_cpu_sync_task_queue[i]);
-			curr_sync_task_finished_flag[i] = 0;
-			//chaintask[i] = kthread_run(&calculate_sync_drift, &values[i], "worker");
-			chaintask[i] = kthread_create(&calculate_sync_drift, &values[i], "worker");
-			if(!IS_ERR(chaintask[i])) {
-	            kthread_bind(chaintask[i],i % (TOTAL_CPUS - EXP_CPUS));
-	            wake_up_process(chaintask[i]);
-	            PDEBUG_A("Chain Task %d: Pid = %d\n", i, chaintask[i]->pid);
-	        }
-
-
+		PDEBUG_A("Sync And Freeze: Starting Worker Thread %d\n", i);
+		exp->chains[i].head = NULL;
+		exp->chains[i].pending = NULL;
+		exp->chains[i].length = 0;
+		exp->chains[i].reserved_by = NULL;
+		if (exp->experiment_type == CBE)
+			exp->chains[i].curr_sync_task_finished = 0;
+		if (tk_pool_dispatch(&exp->chains[i], exp->experiment_type, tk_sync_cpu(exp->id * EXP_CPUS + i)) != 0) {
+			/* a chain without a worker would never reach the round barrier, give the jobs back and give up */
+			PDEBUG_E("Sync And Freeze: Chain %d of experiment %d has no pool thread.. exiting experiment\n", i, exp->id);
+			for (j = 0; j <= i; j++)
+				tk_pool_release(&exp->chains[j]);
+			clean_exp(exp);
+			return;
 		}
+		PDEBUG_A("Chain Task %d: Pid = %d\n", i, exp->chains[i].sync_task->pid);
 	}
 
-	/* If in CBE mode, find the leader task (highest TDF) */
-	if (experiment_type == CBE) {
-		list_for_each_safe(pos, n, &exp_list)
+	/* If in CBE mode, order the containers by TDF, the leader task is the one with the highest */
+	if (exp->experiment_type == CBE) {
+		exp->tdf_tree = RB_ROOT;
+		list_for_each_safe(pos, n, &exp->exp_list)
         	{
         		list_node = list_entry(pos, struct dilation_task_struct, list);
-				if (list_node->linux_task->dilation_factor > exp_highest_dilation) {
-                       		leader_task = list_node;
-                        	exp_highest_dilation = list_node->linux_task->dilation_factor;
-               	}
+				tk_tdf_insert(exp, list_node);
 		}
+		tk_leader_refresh(exp);
 	}
 
 	/* calculate how far virtual time should advance every round */
-    calcExpectedIncrease(); 
+    calcExpectedIncrease(exp); 
 
     do_gettimeofday(&now_timeval);
     now = timeval_to_ns(&now_timeval);
-    actual_time = now;
-    PDEBUG_A("Sync And Freeze: Setting the virtual start time of all tasks to be: %lld\n", actual_time);
+    exp->actual_time = now;
+    PDEBUG_A("Sync And Freeze: Setting the virtual start time of all tasks to be: %lld\n", exp->actual_time);
 
     /* for every container in the experiment, set the virtual_start_time (so it starts at the same time), calculate
-    how long each task should be allowed to run in each round, and freeze the container */
-    list_for_each_safe(pos, n, &exp_list)
-    {
-        list_node = list_entry(pos, struct dilation_task_struct, list);
-        if (experiment_type == CBE)
-			calcTaskRuntime(list_node);
-
-		/* consistent time */
-        list_node->linux_task->virt_start_time = now; 
-		if (experiment_type == CS) {
-			list_node->expected_time = now;
-			list_node->running_time = 0;
-		}
-
-	
-		acquire_irq_lock(&list_node->linux_task->dialation_lock,flags);
-		list_node->linux_task->past_physical_time = 0;
-		list_node->linux_task->past_virtual_time = 0;
-		list_node->linux_task->wakeup_time = 0;
-		list_node->linux_task->freeze_time = now;
-		list_node->linux_task->virt_start_time = now;
-		release_irq_lock(&list_node->linux_task->dialation_lock,flags);
-	
-		/* freeze all children */
-		freeze_proc_exp_recurse(list_node); 
-
-		/* set priority and scheduling policy */
-        if (list_node->stopped == -1) {
-            PDEBUG_A("Sync And Freeze: One of the LXCs no longer exist.. exiting experiment\n");
-            clean_exp();
-            return;
-        }
-
-       	if (sched_setscheduler(list_node->linux_task, SCHED_RR, &sp) == -1 )
-           	PDEBUG_A("Sync And Freeze: Error setting SCHED_RR %d\n",list_node->linux_task->pid);
-        set_children_time(list_node->linux_task, now);
-		set_children_policy(list_node->linux_task, SCHED_RR, sp.sched_priority);
-
-		if (experiment_type == CS) {
-				PDEBUG_A("Sync And Freeze: Cpus allowed! : %d \n", list_node->linux_task->cpus_allowed);
-     			bitmap_zero((&list_node->linux_task->cpus_allowed)->bits, 8);
-	        	cpumask_set_cpu(list_node->cpu_assignment, &list_node->linux_task->cpus_allowed);
-				set_children_cpu(list_node->linux_task, list_node->cpu_assignment);
-		}
-
-		PDEBUG_A("Sync And Freeze: Task running time: %lld\n", list_node->running_time);
+    how long each task should be allowed to run in each round, and freeze the container. This is done in parallel */
+	if (sync_and_freeze_containers(exp, now)) {
+		PDEBUG_A("Sync And Freeze: One of the LXCs no longer exist.. exiting experiment\n");
+		clean_exp(exp);
+		return;
 	}
 
-	/* If in CBE mode, assign all tasks to a specfic CPU (this has already been done if in CS mode) */
-	if (experiment_type == CBE) {
-		while (placed_lxcs < proc_num) {
-			int highest_tdf;
-			struct dilation_task_struct* task_to_assign;
-			highest_tdf = -100000000;
-			task_to_assign = NULL;
-			list_for_each_safe(pos, n, &exp_list)
-			{
-				list_node = list_entry(pos, struct dilation_task_struct, list);
-				if (list_node->cpu_assignment == -1 && list_node->linux_task->dilation_factor > highest_tdf) {
-					task_to_assign = list_node;
-					highest_tdf = list_node->linux_task->dilation_factor;
-				}
+	/* If in CBE mode, assign all tasks to a specfic CPU (this has already been done if in CS mode), highest TDF first.
+	Multi core containers are placed first, so they can still reserve empty chains for their extra vCPUs */
+	if (exp->experiment_type == CBE) {
+		for (node = rb_last(&exp->tdf_tree); node != NULL; node = rb_prev(node)) {
+			list_node = rb_entry(node, struct dilation_task_struct, tdf_node);
+			if (list_node->cpu_assignment == -1 && list_node->n_vcpus > 1) {
+				assign_to_cpu(list_node);
+				placed_lxcs++;
 			}
-			if (task_to_assign->linux_task->dilation_factor > exp_highest_dilation) {
-				leader_task = task_to_assign;
-				exp_highest_dilation = task_to_assign->linux_task->dilation_factor;
+		}
+		for (node = rb_last(&exp->tdf_tree); node != NULL; node = rb_prev(node)) {
+			list_node = rb_entry(node, struct dilation_task_struct, tdf_node);
+			if (list_node->cpu_assignment == -1) {
+				assign_to_cpu(list_node);
+				placed_lxcs++;
 			}
-			assign_to_cpu(task_to_assign);
-			placed_lxcs++;
 		}
 	}
-    printChainInfo();
+    printChainInfo(exp);
 
 	/* Set what mode experiment is in, depending on experiment_type (CBE or CS) */
-	if (experiment_type == CS)
-		experiment_stopped = RUNNING;
+	if (exp->experiment_type == CS)
+		exp->experiment_stopped = RUNNING;
 	else
-		experiment_stopped = FROZEN;
+		exp->experiment_stopped = FROZEN;
 
 //if its 64-bit, start the busy loop task to fix the weird bug
 #ifdef __x86_64
@@ -555,134 +873,164 @@ void sync_and_freeze() {
 /***
 Specifies the start of the experiment (if in CBE mode)
 ***/
-void core_sync_exp() {
+void core_sync_exp(struct tk_experiment *exp) {
 	struct dilation_task_struct* list_node;
 	int i;
 	ktime_t ktime;
 
-	if (experiment_type == CS) {
+	if (exp->experiment_type == CS) {
 		PDEBUG_A("Core Sync Exp: Trying to start wrong type of experiment.. exiting\n");
 		return;
 	}
-	if (experiment_stopped != FROZEN) {
+	if (exp->experiment_stopped != FROZEN) {
 		PDEBUG_A("Core Sync Exp: Experiment is not ready to commence, must run synchronizeAndFreeze\n");
 		return;
 	}
 
 	/* for every 'head' container, unfreeze it and set its timer to fire at some point in the future (based off running_time) */
 	PDEBUG_A("Core Sync Exp: Freezing all nodes\n");
-	for (i=0; i<number_of_heads; i++)
+	for (i=0; i<exp->number_of_heads; i++)
 	{
-	    list_node = chainhead[i];
+	    list_node = exp->chains[i].head;
 	 	freeze_proc_exp_recurse(list_node);
 
 	}
 
 	PDEBUG_A("Core Sync Exp: Waking up catchup task\n");
-	experiment_stopped = RUNNING;
-	while(wake_up_process(catchup_task) != 1);
+	exp->experiment_stopped = RUNNING;
+	while(wake_up_process(exp->catchup_task) != 1);
 	
 	PDEBUG_A("Core Sync Exp: Woke up catchup task\n");
 }
 
 /***
 If we know the process with the highest TDF in the experiment, we can calculate how far it should progress in virtual time,
-and set the global variable 'expected_increase' accordingly.
+and set the experiment's expected_increase accordingly.
 ***/
-void calcExpectedIncrease() {
-        s32 rem;
-        if (exp_highest_dilation > 0)
-        {
-                expected_increase = div_s64_rem(FREEZE_QUANTUM*PRECISION,exp_highest_dilation,&rem);
-                expected_increase += rem;
-        }
-        else if (exp_highest_dilation == 0)
-                expected_increase = FREEZE_QUANTUM;
-        else {
-                expected_increase = div_s64_rem(FREEZE_QUANTUM*(exp_highest_dilation*-1), PRECISION, &rem);
-        }
-        return;
+void calcExpectedIncrease(struct tk_experiment *exp) {
+	exp->expected_increase = vt_expected_increase(exp->freeze_quantum, exp->exp_highest_dilation);
 }
 
 /***
 Given a task with a TDF, determine how long it should be allowed to run in each round, stored in running_time field
 ***/
 void calcTaskRuntime(struct dilation_task_struct * task) {
-        int dil;
-        s64 temp_proc;
-        s64 temp_high;
-        s32 rem;
-
-        /* temp_proc and temp_high are temporary dilations for the container and leader respectively.
-        this is done just to make sure the Math works (no divide by 0 errors if the TDF is 0, by making the temp TDF 1) */
-        temp_proc = 0;
-        temp_high = 0;
-        if (exp_highest_dilation == 0)
-                temp_high = 1;
-        else if (exp_highest_dilation < 0)
-                temp_high = exp_highest_dilation*-1;
-
-        dil = task->linux_task->dilation_factor;
-
-        if (dil == 0)
-                temp_proc = 1;
-        else if (dil < 0)
-                temp_proc = dil*-1;
-        if (exp_highest_dilation == dil) {
-        		/* if the leaders' TDF and the containers TDF are the same, let it run for the full amount (do not need to scale) */
-                task->running_time = FREEZE_QUANTUM;
-        }
-        else if (exp_highest_dilation > 0 && dil > 0) {
-        		/* if both the leaders' TDF and the containers TDF are > 0, scale running time */
-                task->running_time = (div_s64_rem(FREEZE_QUANTUM,exp_highest_dilation,&rem) + rem)*dil;
-        }
-        else if (exp_highest_dilation > 0 && dil == 0) {
-                task->running_time = (div_s64_rem(FREEZE_QUANTUM*PRECISION,exp_highest_dilation,&rem) + rem);
-		}
-        else if (exp_highest_dilation > 0 && dil < 0) { 
-                task->running_time = (div_s64_rem(FREEZE_QUANTUM*PRECISION*PRECISION,exp_highest_dilation*temp_proc,&rem) + rem);
+	struct tk_experiment *exp = task->exp;
+	s64 running_time;
 
-        }
-        else if (exp_highest_dilation == 0 && dil < 0) { 
-                task->running_time = (div_s64_rem(FREEZE_QUANTUM*PRECISION,temp_proc,&rem) + rem);
-        }
-        else if (exp_highest_dilation < 0 && dil < 0){ 
-                task->running_time = (div_s64_rem(FREEZE_QUANTUM,temp_proc,&rem) + rem)*temp_high;
-        }
-	else {
+	running_time = vt_task_runtime(exp->freeze_quantum, exp->exp_highest_dilation, task->linux_task->dilation_factor);
+	if (running_time < 0) {
 		PDEBUG_I("Calc Task Runtime: Should be fixed when highest dilation is updated\n");
+		return;
 	}
-        return;
+	task->running_time = running_time;
+}
+
+/***
+The containers of a CBE experiment are kept in a red-black tree ordered by TDF, so the leader (highest TDF) is always
+the last node. A TDF change or a stopped container only moves or removes its own node instead of having the whole
+experiment scanned again
+***/
+static void tk_tdf_insert(struct tk_experiment *exp, struct dilation_task_struct *task) {
+	struct rb_node **link = &exp->tdf_tree.rb_node;
+	struct rb_node *parent = NULL;
+	struct dilation_task_struct *entry;
+
+	task->tdf = task->linux_task->dilation_factor;
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct dilation_task_struct, tdf_node);
+
+		/* equal TDFs go left, so walking down from the last node visits them in the order they were inserted */
+		if (task->tdf > entry->tdf)
+			link = &parent->rb_right;
+		else
+			link = &parent->rb_left;
+	}
+	rb_link_node(&task->tdf_node, parent, link);
+	rb_insert_color(&task->tdf_node, &exp->tdf_tree);
+}
+
+static void tk_tdf_erase(struct tk_experiment *exp, struct dilation_task_struct *task) {
+
+	if (RB_EMPTY_NODE(&task->tdf_node))
+		return;
+	rb_erase(&task->tdf_node, &exp->tdf_tree);
+	RB_CLEAR_NODE(&task->tdf_node);
+}
+
+/***
+Makes the last container of the TDF tree the leader. If the highest TDF changed, the expected increase of a round is
+worked out again. The running time of the other containers is left alone: every round derives it from the virtual time
+they have to reach (calculate_virtual_time_difference), so it follows the new leader without being rewritten here.
+Returns 1 if the highest TDF changed
+***/
+static int tk_leader_refresh(struct tk_experiment *exp) {
+	struct rb_node *last = rb_last(&exp->tdf_tree);
+	struct dilation_task_struct *leader = NULL;
+	int highest = -99999;
+
+	if (last != NULL) {
+		leader = rb_entry(last, struct dilation_task_struct, tdf_node);
+		highest = leader->tdf;
+	}
+	exp->leader_task = leader;
+	if (highest == exp->exp_highest_dilation)
+		return 0;
+
+	exp->exp_highest_dilation = highest;
+	if (leader != NULL) {
+		calcExpectedIncrease(exp);
+		PDEBUG_I("Leader Refresh: New highest dilation is: %d new expected_increase: %lld\n", exp->exp_highest_dilation, exp->expected_increase);
+	}
+	return 1;
+}
+
+/***
+Drops a container's pending TDF change, if it has one. Called before the container is freed
+***/
+static void tk_dilation_change_drop(struct tk_experiment *exp, struct dilation_task_struct *task) {
+
+	spin_lock(&exp->dilation_changes_lock);
+	if (!list_empty(&task->dilation_node))
+		list_del_init(&task->dilation_node);
+	spin_unlock(&exp->dilation_changes_lock);
 }
 
 /***
 Function that determines what CPU a particular task should be assigned to. It simply finds the current CPU with the
 smallest aggregated running time of all currently assigned containers. All containers that are assigned to the same
-CPU are connected as a list, hence I call it a 'chain'
+CPU are connected as a list, hence I call it a 'chain'. The extra vCPUs of a multi core container are reserved: they
+are taken from empty chains, which then get no container of their own, so the container never competes with another
+chain's containers and is charged for CPUs that were its own
 ***/
 void assign_to_cpu(struct dilation_task_struct* task) {
+	struct tk_experiment *exp = task->exp;
 	int i;
 	int index;
+	int n_vcpus;
 	s64 min;
 	struct dilation_task_struct *walk;
-	index = 0;
-	min = chainlength[index];
+	index = -1;
+	min = 0;
 
-	for (i=1; i<number_of_heads; i++)
+	for (i=0; i<exp->number_of_heads; i++)
 	{
-	    if (chainlength[i] < min)
+		if (exp->chains[i].reserved_by != NULL)
+			continue;
+	    if (index == -1 || exp->chains[i].length < min)
 	    {
-		    min = chainlength[i];
+		    min = exp->chains[i].length;
 		    index = i;
 	    }
 	}
 
-	walk = chainhead[index];
+	walk = exp->chains[index].head;
 	if (walk == NULL) {
-		chainhead[index] = task;
-		init_waitqueue_head(&per_cpu_wait_queue[index]);	
-		curr_process_finished_flag[index] = 0;			
-		atomic_set(&wake_up_signal_sync_drift[index],0);	
+		exp->chains[index].head = task;
+		init_waitqueue_head(&exp->chains[index].wait_queue);	
+		exp->chains[index].curr_process_finished = 0;			
+		atomic_set(&exp->chains[index].wake_up_signal_sync_drift,0);	
 	}
 	else {
 
@@ -697,25 +1045,43 @@ void assign_to_cpu(struct dilation_task_struct* task) {
 
 
 	/* set CPU mask */
-	chainlength[index] = chainlength[index] + task->running_time;
+	exp->chains[index].length = exp->chains[index].length + task->running_time;
    	bitmap_zero((&task->linux_task->cpus_allowed)->bits, 8);
-    cpumask_set_cpu(index+(TOTAL_CPUS - EXP_CPUS),&task->linux_task->cpus_allowed);
-	task->cpu_assignment = index+(TOTAL_CPUS - EXP_CPUS);
+    cpumask_set_cpu(index+exp->cpu_base,&task->linux_task->cpus_allowed);
+	task->cpu_assignment = index+exp->cpu_base;
    	set_children_cpu(task->linux_task, task->cpu_assignment);
+
+	/* a multi core container also runs on the empty chains after its own, its threads are moved there when it runs */
+	cpumask_clear(&task->cpus);
+	cpumask_set_cpu(task->cpu_assignment, &task->cpus);
+	n_vcpus = 1;
+	for (i = 1; i < exp->number_of_heads && n_vcpus < task->n_vcpus; i++) {
+		int chain = (index + i) % exp->number_of_heads;
+		if (exp->chains[chain].head != NULL || exp->chains[chain].reserved_by != NULL)
+			continue;
+		exp->chains[chain].reserved_by = task;
+		exp->chains[chain].length = task->running_time;
+		cpumask_set_cpu(chain + exp->cpu_base, &task->cpus);
+		n_vcpus++;
+	}
+	if (n_vcpus < task->n_vcpus) {
+		PDEBUG_E("Assign to CPU: Only %d free experiment CPUs for the %d vCPUs of lxc %d\n", n_vcpus, task->n_vcpus, task->linux_task->pid);
+		task->n_vcpus = n_vcpus;
+	}
 	return;
 }
 
 /***
 Just debug function for containers being mapped to specific CPUs
 ***/
-void printChainInfo() {
+void printChainInfo(struct tk_experiment *exp) {
     int i;
-    s64 max = chainlength[0];
-    for (i=0; i<number_of_heads; i++)
+    s64 max = exp->chains[0].length;
+    for (i=0; i<exp->number_of_heads; i++)
     {
-    	PDEBUG_I("Print Chain Info: Length of chain %d is %lld\n", i, chainlength[i]);
-        if (chainlength[i] > max)
-            max = chainlength[i];
+    	PDEBUG_I("Print Chain Info: Length of chain %d is %lld\n", i, exp->chains[i].length);
+        if (exp->chains[i].length > max)
+            max = exp->chains[i].length;
     }
 }
 
@@ -739,125 +1105,98 @@ struct dilation_task_struct * getNextRunnableTask(struct dilation_task_struct *
 
 
 /***
-Set's the past physical times of the process and all it's children to the specified argument 
+Copy the container's clock into every thread group leader of the container. The patched kernel (sys_time, timerfd,
+eventpoll, sch_api, af_packet) computes the virtual time of a task from its group leader's own fields, so they are
+written at every thaw and freeze, like set_all_past_physical_times_recurse and set_all_freeze_times_recurse did. Other
+threads are only brought up to date when they are dispatched (materialize_task_clock)
 ***/
-void set_all_ppp_freeze_times_recurse(struct task_struct * aTask, s64 freeze_time, struct dilation_task_struct * lxc){
-
-	struct list_head *list;
-	struct task_struct *taskRecurse;
-	struct dilation_task_struct *dilTask;
-	struct task_struct *me;
-	struct task_struct *t;
+static void sync_group_leader_clocks(struct dilation_task_struct * lxc){
+	struct task_struct * clock = lxc->linux_task;
+	struct task_struct * t;
+	llist_elem * curr;
+	lxc_schedule_elem * elem;
 	unsigned long flags;
 
-	if (aTask == NULL) {
-		PDEBUG_E("Set all past physical times: Task does not exist\n");
-		return;
-	}
-
-	if (aTask->pid == 0) {
-		return;
-	}
-	
-
-	me = aTask;
-	t = me;
-	s64 temp;
-	do {
+	for(curr = lxc->schedule_queue.head; curr != NULL; curr = curr->next){
+		elem = curr->item;
+		t = elem->curr_task;
+		if(t == clock || !thread_group_leader(t) || schedule_elem_exited(elem))
+			continue;
 		acquire_irq_lock(&t->dialation_lock,flags);
-		t->past_physical_time = lxc->linux_task->past_physical_time;
-		t->freeze_time = freeze_time;
+		t->virt_start_time = clock->virt_start_time;
+		t->freeze_time = clock->freeze_time;
+		t->past_physical_time = clock->past_physical_time;
+		t->past_virtual_time = clock->past_virtual_time;
+		t->dilation_factor = clock->dilation_factor;
 		release_irq_lock(&t->dialation_lock,flags);
-		
-	} while_each_thread(me, t);
-
-	int i = 0;
-    list_for_each(list, &aTask->children)
-    {
-
-        taskRecurse = list_entry(list, struct task_struct, sibling);
-        if (taskRecurse->pid == 0) {
-                continue;
-        }
-
-        set_all_ppp_freeze_times_recurse(taskRecurse,freeze_time,lxc);
-		i++;
-
-    }
+	}
 }
 
-s64 set_all_process_virtual_times(s64 start_ns){
-
-    struct dilation_task_struct * task = NULL;
-    struct list_head *pos;
-	struct list_head *n;
-	
+/***
+Thaw a container's clock: the time it spent frozen since its freeze time is added to its past physical time. The
+container leader holds the clock of every process in the container (see tk_task_virtual_time), the thread group
+leaders get a copy
+***/
+void thaw_container_clock(struct dilation_task_struct * lxc, s64 time){
+	unsigned long flags;
 
-    if(experiment_stopped == RUNNING){
-		list_for_each_safe(pos, n, &exp_list)
-		{
-			task = list_entry(pos, struct dilation_task_struct, list);
-			
-			if(task != NULL) {
-			
-			    if(task->linux_task->freeze_time > 0){
-			    
-			        s64 temp = task->linux_task->freeze_time;
-            	    task->linux_task->freeze_time = task->wake_up_time + task->running_time;
-            	    task->linux_task->past_physical_time = task->linux_task->past_physical_time + (task->wake_up_time - temp);
-            	}
-    		    set_all_ppp_freeze_times_recurse(task->linux_task,task->wake_up_time + task->running_time,task);
-    		}
-		}
+	acquire_irq_lock(&lxc->linux_task->dialation_lock,flags);
+	if(lxc->linux_task->freeze_time > 0){
+	    lxc->linux_task->past_physical_time = lxc->linux_task->past_physical_time + (time - lxc->linux_task->freeze_time);
+	    lxc->linux_task->freeze_time = 0;
 	}
+	release_irq_lock(&lxc->linux_task->dialation_lock,flags);
+	sync_group_leader_clocks(lxc);
+	lxc->clock_epoch++;
+}
+
+/***
+Freeze a container's clock at the given time
+***/
+void freeze_container_clock(struct dilation_task_struct * lxc, s64 freeze_time){
+	unsigned long flags;
 
+	acquire_irq_lock(&lxc->linux_task->dialation_lock,flags);
+	lxc->linux_task->freeze_time = freeze_time;
+	release_irq_lock(&lxc->linux_task->dialation_lock,flags);
+	sync_group_leader_clocks(lxc);
+	lxc->clock_epoch++;
 }
 
 /***
-Calculate the amount by which the task should advance to reach the expected virtual time
- ***/
-s64 calculate_change(struct dilation_task_struct* task, s64 virt_time, s64 expected_time) {
-    s64 change;
-	s32 rem;
-	change = 0;
+Copy the container's clock into the clock fields of a thread that is about to run, if they were last copied at an older
+epoch. Thread group leaders are kept current by sync_group_leader_clocks, this only covers the other threads for
+anything reading their own fields directly.
+***/
+void materialize_task_clock(struct dilation_task_struct * lxc, lxc_schedule_elem * elem){
+	struct task_struct * clock = lxc->linux_task;
+	struct task_struct * t = elem->curr_task;
 	unsigned long flags;
 
-	acquire_irq_lock(&task->linux_task->dialation_lock,flags);
+	if(elem->clock_epoch == lxc->clock_epoch)
+		return;
 
-	if (expected_time - virt_time < 0)
-        {
-            if (task->linux_task->dilation_factor > 0)
-                    change = div_s64_rem( ((expected_time - virt_time)*-1)*task->linux_task->dilation_factor, PRECISION, &rem);
-            else if (task->linux_task->dilation_factor < 0)
-            {
-                    change = div_s64_rem( ((expected_time - virt_time)*-1)*PRECISION, task->linux_task->dilation_factor*-1,&rem);
-                    change += rem;
-            }
-            else if (task->linux_task->dilation_factor == 0)
-                    change = (expected_time - virt_time)*-1;
-			if (experiment_type == CS) {
-        		change *= -1;
-			}
-        }
-        else
-        {
-            if (task->linux_task->dilation_factor > 0)
-                    change = div_s64_rem( (expected_time - virt_time)*task->linux_task->dilation_factor, PRECISION, &rem);
-            else if (task->linux_task->dilation_factor < 0)
-            {
-                    change = div_s64_rem((expected_time - virt_time)*PRECISION, task->linux_task->dilation_factor*-1,&rem);
-                    change += rem;
-            }
-            else if (task->linux_task->dilation_factor == 0)
-            {
-                    change = (expected_time - virt_time);
-            }
-			if (experiment_type == CBE) {
-            	change *= -1;
-			}
-        }
+	if(t != clock && !thread_group_leader(t)){
+		acquire_irq_lock(&t->dialation_lock,flags);
+		t->virt_start_time = clock->virt_start_time;
+		t->freeze_time = clock->freeze_time;
+		t->past_physical_time = clock->past_physical_time;
+		t->past_virtual_time = clock->past_virtual_time;
+		t->dilation_factor = clock->dilation_factor;
+		release_irq_lock(&t->dialation_lock,flags);
+	}
+	elem->clock_epoch = lxc->clock_epoch;
+}
 
+/***
+Calculate the amount by which the task should advance to reach the expected virtual time
+ ***/
+s64 calculate_change(struct dilation_task_struct* task, s64 virt_time, s64 expected_time) {
+    s64 change;
+	unsigned long flags;
 
+	acquire_irq_lock(&task->linux_task->dialation_lock,flags);
+	change = vt_calculate_change(virt_time, expected_time, task->linux_task->dilation_factor, task->exp->experiment_type == CS);
 	release_irq_lock(&task->linux_task->dialation_lock,flags);
 	
 	return change;
@@ -877,85 +1216,144 @@ void calculate_virtual_time_difference(struct dilation_task_struct* task, s64 no
 	s64 change_vt = 0;
 	s32 rem;
 	s64 diff;
+	s64 slice;
+	int tdf;
 
     start_change:
     
 	virt_time = get_virtual_time(task, now);
 	change = 0;
 	change = calculate_change(task, virt_time, expected_time);
+	tdf = task->linux_task->dilation_factor;
+
+	/* round error: how far the container ended up from the target it was given in the previous round */
+	if (task->stats.last_target != 0) {
+		diff = virt_time - task->stats.last_target;
+		tk_stats_record_round_error(task->exp, diff);
+		if (diff > 0)
+			task->stats.n_overruns++;
+	}
+	task->stats.lag = expected_time - virt_time;
+	task->stats.last_target = expected_time;
+
+	/* residual of its last turn: how far past the end of the slice it was meant to have it kept running. A container that
+	was ahead did not run, so there is nothing to learn from and the estimate is left alone */
+	if (task->stats.overrun >= 0) {
+		diff = task->stats.overrun - task->stats.overshoot;
+		task->stats.residual = diff;
+		task->stats.residual_abs_sum += diff < 0 ? -diff : diff;
+		task->stats.n_residuals++;
+		if (task->exp->vt_compensate)
+			task->stats.overshoot = vt_overshoot_update(task->stats.overshoot, diff, vt_slice_runtime(0, task->exp->expected_increase, tdf));
+		task->stats.overrun = -1;
+	}
+
+	/* how long the container has to run to catch up with expected_time, 0 if it is already ahead. With compensation the
+	slice is cut short by the overrun it is expected to have, and that overrun is charged when it is frozen (turn_charge) */
+	slice = vt_slice_runtime(virt_time, expected_time, tdf);
+	ktime = ktime_set(0, slice > task->stats.overshoot ? slice - task->stats.overshoot : 0);
 
-	if (experiment_type == CS) {
+    task->stopped = 0;
+    task->running_time = ktime_to_ns(ktime);
+    return;
+}
 
-			/*
-	        if (change < 0)
-        	{
-	        	ktime = ktime_set(0, 0);
-	        }
-        	else
-	        {
-        		ktime = ktime_set(0, change);
-				
-	        }*/
-			if(virt_time > expected_time){
-	        
-	            ktime = ktime_set(0,0);
-	        }
-	        else{
-	        
-	           
-	           if(task->linux_task->dilation_factor > 0)
-    	            diff = div_s64_rem( (expected_time - virt_time)*task->linux_task->dilation_factor, PRECISION, &rem);
-	           else
-	                diff = expected_time - virt_time;
-	                    
-	           ktime = ktime_set(0,diff);
-	           
-	        }
+/***
+Next round bookkeeping for a container (CBE specific): how long it should run, and adding any new processes to its schedule queue.
+The container is frozen until its turn, so its virtual time does not move and this can be done ahead of the dispatch.
+***/
+void prepare_container_round(struct dilation_task_struct *task, s64 expected_time)
+{
+	struct timeval ktv;
 
-	}
-	if (experiment_type == CBE) {
-	
-	        if(virt_time > expected_time){
-	        
-	            ktime = ktime_set(0,0);
-	        }
-	        else{
-	        
-	           
-	           if(task->linux_task->dilation_factor > 0)
-    	            diff = div_s64_rem( (expected_time - virt_time)*task->linux_task->dilation_factor, PRECISION, &rem);
-	           else
-	                diff = expected_time - virt_time;
-	                    
-	           ktime = ktime_set(0,diff);
-	           
-	        }
+	do_gettimeofday(&ktv);
+	calculate_virtual_time_difference(task, timeval_to_ns(&ktv), expected_time);
 
+	if (task->running_time > 0) {
+		refresh_lxc_schedule_queue(task, task->running_time, expected_time);
+		task->round_prepared = 1;
 	}
-	
-    task->stopped = 0;
-    task->running_time = ktime_to_ns(ktime);
-    return;
 }
 
 /***
-The function called by each synchronization thread (CBE specific). For every process it is in charge of
-it will see how long it should run, then start running the process at the head of the chain.
+Prepare the pending container of a chain, if it has not been prepared yet. Called by the chain's sync thread while it waits
+on the running container's hrtimer (it is bound to a non experiment CPU, so this overlaps with the container's execution).
+***/
+void prepare_pending_container(struct chain_state *chain)
+{
+	struct dilation_task_struct *task = chain->pending;
+
+	if (task == NULL)
+		return;
+
+	chain->pending = NULL;
+	prepare_container_round(task, chain->exp->actual_time);
+}
+
+/***
+Physical time a turn that was asked to run for run_time is charged when the container is frozen. With vt_compensate the
+slice was cut short by the container's learned overrun, which it is expected to run past the end of the slice, so that is
+charged as well and its virtual time still lands on the round target
+***/
+static s64 turn_charge(struct dilation_task_struct *lxc, s64 run_time)
+{
+	return run_time + lxc->stats.overshoot;
+}
+
+/***
+Record how long the container kept running past the requested end of its turn (CBE specific): the hrtimer lateness, the
+sync thread's wakeup and the time it takes to stop its processes. calculate_virtual_time_difference learns the overshoot from it
+***/
+static void record_turn_overrun(struct dilation_task_struct *lxc, s64 requested_end)
+{
+	struct timeval now;
+	s64 overrun;
+
+	do_gettimeofday(&now);
+	overrun = timeval_to_ns(&now) - requested_end;
+	lxc->stats.overrun = overrun > 0 ? overrun : 0;
+}
+
+/***
+Start the container's hrtimer and sleep until it fires (CBE specific). The pending container of the chain gets prepared in between.
+***/
+static void wait_on_lxc_timer(struct dilation_task_struct *lxc, s64 duration, int CPUID)
+{
+	struct chain_state *chain = &lxc->exp->chains[CPUID];
+
+	chain->curr_process_finished = 0;
+	hrtimer_start(&lxc->timer,ns_to_ktime(ktime_to_ns(ktime_get()) + duration) ,HRTIMER_MODE_ABS);
+
+	prepare_pending_container(chain);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	if (chain->curr_process_finished == 0)
+		schedule();
+	set_current_state(TASK_RUNNING);
+}
+
+/***
+The function called by each synchronization thread (CBE specific), data is its chain. For every process it is in charge of
+it will see how long it should run, then run the containers of the chain one after the other. The bookkeeping
+for a container is done while the container before it in the chain is running.
 ***/
 int calculate_sync_drift(void *data)
 {
 	int round = 0;
-	int cpuID = *((int *)data);
+	struct chain_state *chain = (struct chain_state *)data;
+	struct tk_experiment *exp = chain->exp;
+	int cpuID = chain->id;
 	struct dilation_task_struct *task;
-	s64 now;
 	struct timeval ktv;
 	ktime_t ktime;
 	int run_cpu;
+	s64 round_start;
+	int n_run;
 
 	set_current_state(TASK_INTERRUPTIBLE);
 
-	if(atomic_read(&wake_up_signal_sync_drift[cpuID]) != 1)
-		atomic_set(&wake_up_signal_sync_drift[cpuID],0);
+	if(atomic_read(&chain->wake_up_signal_sync_drift) != 1)
+		atomic_set(&chain->wake_up_signal_sync_drift,0);
 		
 	PDEBUG_I("#### Calculate Sync Drift: Started Sync drift Thread for lxcs on CPU = %d\n",cpuID);
 
@@ -964,75 +1362,74 @@ int calculate_sync_drift(void *data)
 	if (round == 0)
 		goto startWork;
 	
-	while (!kthread_should_stop())
+	while (!tk_pool_released(chain))
 	{
 		
-        if(experiment_stopped == STOPPING) {
+        if(exp->experiment_stopped == STOPPING) {
         
             set_current_state(TASK_INTERRUPTIBLE);
-		    atomic_dec(&worker_count);
-		    atomic_set(&wake_up_signal_sync_drift[cpuID],0);
+		    atomic_dec(&exp->worker_count);
+		    atomic_set(&chain->wake_up_signal_sync_drift,0);
 		    run_cpu = get_cpu();   
 			PDEBUG_V("#### Calculate Sync Drift: Sending wake up from Sync drift Thread for lxcs on CPU = %d. My Run cpu = %d\n",cpuID,run_cpu);
-		    wake_up_interruptible(&wq);
+		    wake_up_interruptible(&exp->wq);
         	return 0;
         }
 
-		task = chainhead[cpuID];
-	    
-
-		/* for every task it is responsible for, determine how long it should run */
-		while (task != NULL) {
-		    do_gettimeofday(&ktv);
-    	    now = timeval_to_ns(&ktv);
-			calculate_virtual_time_difference(task, now, actual_time);
-			task = task->next;
-		}
-
-		/* find the first task to run, then run it */
-        task = chainhead[cpuID];
+		task = chain->head;
+		do_gettimeofday(&ktv);
+		round_start = timeval_to_ns(&ktv);
 
 		if (task == NULL) {
 
 	
 			PDEBUG_V("Calculate Sync Drift: No Tasks in chain %d \n", cpuID);				
-			atomic_inc(&running_done);
-			atomic_inc(&start_count);
+			atomic_inc(&exp->running_done);
+			atomic_inc(&exp->start_count);
 		}
 		else {
-			do{
-		        task = getNextRunnableTask(task);
-    	       	if (task != NULL)
+			/* only the head has to be prepared before the first dispatch. Every other container gets prepared while the one before it is running */
+			prepare_container_round(task, exp->actual_time);
+			n_run = 0;
+
+			while (task != NULL) {
+				chain->pending = task->next;
+
+    	       	if (task->running_time > 0 && task->stopped != -1)
     	       	{
 					PDEBUG_V("Calculate Sync Drift: Called  UnFreeze Proc Recurse on CPU: %d\n", cpuID);					
-    				unfreeze_proc_exp_recurse(task, actual_time);
+    				unfreeze_proc_exp_recurse(task, exp->actual_time);
  					PDEBUG_V("Calculate Sync Drift: Finished Unfreeze Proc on CPU: %d\n", cpuID);
-    	           	task = task->next;
-				
-               	}
-               	else
-               	{
-               		PDEBUG_I("Calculate Sync Drift: %d chain %d has nothing to run\n",round,cpuID);
-					break;
+					n_run++;
                	}
-			
 
-			}while(task != NULL);
+				/* the container did not run (or never waited on its timer), so the next one is still pending */
+				prepare_pending_container(chain);
+
+				task = task->next;
+			}
+
+			if (n_run == 0)
+           		PDEBUG_I("Calculate Sync Drift: %d chain %d has nothing to run\n",round,cpuID);
 		}
 
+		do_gettimeofday(&ktv);
+		tk_stats_record_chain_round(chain, timeval_to_ns(&ktv) - round_start);
+
 		PDEBUG_V("Calculate Sync Drift: Thread done with on %d\n",cpuID);
 		/* when the first task has started running, signal you are done working, and sleep */
 		round++;
 		set_current_state(TASK_INTERRUPTIBLE);
-		atomic_dec(&worker_count);
-		atomic_set(&wake_up_signal_sync_drift[cpuID],0);
+		atomic_dec(&exp->worker_count);
+		atomic_set(&chain->wake_up_signal_sync_drift,0);
 		run_cpu = get_cpu();
 		PDEBUG_V("#### Calculate Sync Drift: Sending wake up from Sync drift Thread for lxcs on CPU = %d. My Run cpu = %d\n",cpuID,run_cpu);
-		wake_up_interruptible(&wq);
+		wake_up_interruptible(&exp->wq);
 		
 
 	startWork:
-		schedule();
+		if (!tk_pool_released(chain))
+			schedule();
 		set_current_state(TASK_RUNNING);
 		run_cpu = get_cpu();
 		PDEBUG_V("~~~~ Calculate Sync Drift: I am woken up for lxcs on CPU =  %d. My Run cpu = %d\n",cpuID,run_cpu);
@@ -1042,12 +1439,13 @@ int calculate_sync_drift(void *data)
 }
 
 /***
-The main synchronization thread (For CBE mode). When all tasks in a round have completed, this will get
+The main synchronization thread of an experiment (For CBE mode), data is the experiment. When all tasks in a round have completed, this will get
 woken up, increment the experiment virtual time,  and then wake up every other synchronization thread 
 to have it do work
 ***/
 int catchup_func(void *data)
 {
+        struct tk_experiment *exp = (struct tk_experiment *)data;
         int round_count;
         struct timeval ktv;
         int i;
@@ -1058,7 +1456,7 @@ int catchup_func(void *data)
 	    s64 start_ns;
 	
 	 	set_current_state(TASK_INTERRUPTIBLE);
-	 	PDEBUG_I("Catchup Func: started.\n");
+	 	PDEBUG_I("Catchup Func: started for experiment %d.\n", exp->id);
                 
 		while (!kthread_should_stop())
         {
@@ -1066,63 +1464,75 @@ int catchup_func(void *data)
 			redo_count = 0;
             redo:
 
-            if (experiment_stopped == STOPPING)
+            if (exp->experiment_stopped == STOPPING)
             {
 
 					PDEBUG_I("Catchup Func: Cleaning experiment via catchup task\n");
-                    clean_exp();
+                    clean_exp(exp);
 					set_current_state(TASK_INTERRUPTIBLE);	
 					schedule();
 					continue;
 
             }
 
-            actual_time += expected_increase;
+            exp->actual_time += exp->expected_increase;
 
 			/* clean up any stopped containers, alter TDFs if necessary */
-			//clean_stopped_containers();
-			if (dilation_change)
-				change_containers_dilation();
+			//clean_stopped_containers(exp);
+			if (exp->dilation_change)
+				change_containers_dilation(exp);
 				
-			if(atomic_read(&experiment_stopping) == 1 && atomic_read(&n_active_syscalls) == 0){
-				experiment_stopped = STOPPING;
+			if(atomic_read(&exp->experiment_stopping) == 1 && atomic_read(&exp->n_active_syscalls) == 0){
+				exp->experiment_stopped = STOPPING;
 				continue;
 			}
-			else if(atomic_read(&experiment_stopping) == 1) {
-				PDEBUG_I("Catchup Func: Stopping. NActive syscalls = %d\n", atomic_read(&n_active_syscalls));
+			else if(atomic_read(&exp->experiment_stopping) == 1) {
+				PDEBUG_I("Catchup Func: Stopping. NActive syscalls = %d\n", atomic_read(&exp->n_active_syscalls));
 			}
 
-			if(atomic_read(&progress_cbe_enabled) == 1 && atomic_read(&progress_cbe_rounds) > 0){
-				atomic_dec(&progress_cbe_rounds);
-				if(atomic_read(&progress_cbe_rounds) == 0) {
+			if(atomic_read(&exp->progress_cbe_enabled) == 1 && atomic_read(&exp->progress_cbe_rounds) > 0){
+				/* a run until a virtual time ends when the round that was shortened to it is done */
+				if(exp->progress_cbe_target != 0 && exp->actual_time - exp->expected_increase >= exp->progress_cbe_target) {
+					exp->progress_cbe_target = 0;
+					atomic_set(&exp->progress_cbe_rounds,0);
+				}
+				else
+					atomic_dec(&exp->progress_cbe_rounds);
+				if(atomic_read(&exp->progress_cbe_rounds) == 0) {
 					PDEBUG_V("Waking up Progress CBE Process\n");
-					wake_up_interruptible(&progress_cbe_wait_queue);
+					wake_up_interruptible(&exp->progress_cbe_wait_queue);
 				}
 			}
 
-			wait_event_interruptible(progress_cbe_catchup_tsk, (atomic_read(&progress_cbe_enabled) == 1 && atomic_read(&progress_cbe_rounds) > 0) || atomic_read(&progress_cbe_enabled) == 0);
+			wait_event_interruptible(exp->progress_cbe_catchup_tsk, (atomic_read(&exp->progress_cbe_enabled) == 1 && atomic_read(&exp->progress_cbe_rounds) > 0) || atomic_read(&exp->progress_cbe_enabled) == 0 || atomic_read(&exp->experiment_stopping) == 1);
+
+			/* shorten the last round of a run until a virtual time, every container then stops exactly at the target */
+			if(exp->progress_cbe_target != 0 && exp->actual_time > exp->progress_cbe_target) {
+				PDEBUG_V("Catchup Func: Last round shortened by %lld ns\n", exp->actual_time - exp->progress_cbe_target);
+				exp->actual_time = exp->progress_cbe_target;
+			}
 			
             do_gettimeofday(&ktv);
-			atomic_set(&start_count, 0);
+			atomic_set(&exp->start_count, 0);
 
 			/* wait up each synchronization worker thread, then wait til they are all done */
-			if (number_of_heads > 0) {
+			if (exp->number_of_heads > 0) {
 
 				PDEBUG_V("Catchup Func: Round finished. Waking up worker threads to calculate next round time\n");
-				PDEBUG_V("Catchup Func: Current FREEZE_QUANTUM : %d\n", FREEZE_QUANTUM);
-				atomic_set(&worker_count, number_of_heads);
+				PDEBUG_V("Catchup Func: Current FREEZE_QUANTUM : %lld\n", exp->freeze_quantum);
+				atomic_set(&exp->worker_count, exp->number_of_heads);
 			
-				for (i=0; i<number_of_heads; i++) {
-					curr_sync_task_finished_flag[i] = 1;
-					atomic_set(&wake_up_signal_sync_drift[i],1);	
+				for (i=0; i<exp->number_of_heads; i++) {
+					exp->chains[i].curr_sync_task_finished = 1;
+					atomic_set(&exp->chains[i].wake_up_signal_sync_drift,1);	
 	
 					/* chaintask refers to calculate_sync_drift thread */
 					if(DEBUG_LEVEL == DEBUG_LEVEL_INFO || DEBUG_LEVEL == DEBUG_LEVEL_VERBOSE) {			
-						if(wake_up_process(chaintask[i]) == 1){ 
+						if(wake_up_process(exp->chains[i].sync_task) == 1){ 
 							PDEBUG_V("Catchup Func: Sync thread %d wake up\n",i);
 						}
 						else{
-						    while(wake_up_process(chaintask[i]) != 1);
+						    while(wake_up_process(exp->chains[i].sync_task) != 1);
 							PDEBUG_V("Catchup Func: Sync thread %d already running\n",i);
 						}
 					}
@@ -1135,38 +1545,33 @@ int catchup_func(void *data)
                 do_gettimeofday(&now);
                 start_ns = timeval_to_ns(&now);
     
-				wait_event_interruptible(wq, atomic_read(&worker_count) == 0);
+				wait_event_interruptible(exp->wq, atomic_read(&exp->worker_count) == 0);
 				set_current_state(TASK_INTERRUPTIBLE);
 
 				PDEBUG_V("Catchup Func: All sync drift thread finished\n");	
-				if(experiment_type != CS) {
-					#ifdef MULTI_CORE_NODES
-						set_all_process_virtual_times(start_ns);		
-					#endif
-				}
 			}
 
 			/* if there are no continers in the experiment, then stop the experiment */
-			if (proc_num == 0 && experiment_stopped == RUNNING) {
+			if (exp->proc_num == 0 && exp->experiment_stopped == RUNNING) {
 				PDEBUG_I("Catchup Func: Cleaning experiment via catchup task because no tasks left\n");
-           		clean_exp();	
+           		clean_exp(exp);	
 				set_current_state(TASK_INTERRUPTIBLE);	
 				schedule();
 				continue;
 	  		
 			}
-		    else if ((number_of_heads > 0 && atomic_read(&start_count) == number_of_heads) || (number_of_heads > 0 && atomic_read(&running_done) == number_of_heads))
+		    else if ((exp->number_of_heads > 0 && atomic_read(&exp->start_count) == exp->number_of_heads) || (exp->number_of_heads > 0 && atomic_read(&exp->running_done) == exp->number_of_heads))
 		    { 	/* something bad happened, because not a single task was started, think due to page fault */
 			    redo_count++;
-			    atomic_set(&running_done, 0);
-			    PDEBUG_I("Catchup Func: %d Redo computations %d Proc_num: %d Exp stopped: %d\n",round_count, redo_count, proc_num, experiment_stopped);
+			    atomic_set(&exp->running_done, 0);
+			    PDEBUG_I("Catchup Func: %d Redo computations %d Proc_num: %d Exp stopped: %d\n",round_count, redo_count, exp->proc_num, exp->experiment_stopped);
 			    goto redo;
 		    }
 
 			end:
                 set_current_state(TASK_INTERRUPTIBLE);	
 		
-			if(experiment_stopped == NOTRUNNING){
+			if(exp->experiment_stopped == NOTRUNNING){
 				PDEBUG_I("Catchup Func: Waiting to be woken up\n");
 				set_current_state(TASK_INTERRUPTIBLE);	
 				schedule();			
@@ -1178,98 +1583,61 @@ int catchup_func(void *data)
 
 /***
 If a LXC had its TDF changed during an experiment, modify the experiment accordingly (ie, make it the
-new leader, and so forth)
+new leader, and so forth). Only the containers queued on dilation_changes are touched
 ***/
-void change_containers_dilation() {
-        struct list_head *pos;
-        struct list_head *n;
+void change_containers_dilation(struct tk_experiment *exp) {
         struct dilation_task_struct* task;
-        struct dilation_task_struct* possible_leader;
-        int new_highest;
-		unsigned long flags;
+        int new_dilation;
 
-        new_highest = -99999;
-        possible_leader = NULL;
-
-        list_for_each_safe(pos, n, &exp_list)
-        {
-            task = list_entry(pos, struct dilation_task_struct, list);
+		spin_lock(&exp->dilation_changes_lock);
+		while (!list_empty(&exp->dilation_changes)) {
+			task = list_first_entry(&exp->dilation_changes, struct dilation_task_struct, dilation_node);
+			list_del_init(&task->dilation_node);
+			new_dilation = task->newDilation;
+			task->newDilation = -1;
+			spin_unlock(&exp->dilation_changes_lock);
 
 			/* its stopped, so skip it */
-            if (task->stopped  == -1) 
-            {
-				continue;
-            }
-			if (task->newDilation != -1) {
+			if (task->stopped != -1 && new_dilation != -1) {
 
-				/* change its dilation */
-				dilate_proc_recurse_exp(task->linux_task->pid, task->newDilation); 
-				task->newDilation = -1; 
-			
-				/* update its runtime */
-				calcTaskRuntime(task);  
+				/* change its dilation and move it in the TDF tree */
+				dilate_proc_recurse_exp(task->linux_task->pid, new_dilation); 
+				atomic_set(&task->members_changed, 1);
+				tk_tdf_erase(exp, task);
+				tk_tdf_insert(exp, task);
 			}
-
-			acquire_irq_lock(&task->linux_task->dialation_lock,flags);
-            if (task->linux_task->dilation_factor > new_highest)
-            {
-                new_highest = task->linux_task->dilation_factor;
-                possible_leader = task;
-            }
-			release_irq_lock(&task->linux_task->dialation_lock,flags);
-
-        }
-
-		if (new_highest > exp_highest_dilation || new_highest < exp_highest_dilation)
-	    {
-	        /* If we have a new highest dilation, or if the leader container finished - save the new leader  */
-            exp_highest_dilation = new_highest;
-            leader_task = possible_leader;
-            if (leader_task != NULL)
-            {
-                calcExpectedIncrease();
-		        PDEBUG_I("Change Containers Dilation: New highest dilation is: %d new expected_increase: %lld\n", exp_highest_dilation, expected_increase);
-            }
-            /* update running time for each container because we have a new leader */
-            list_for_each_safe(pos, n, &exp_list)
-            {
-                task = list_entry(pos, struct dilation_task_struct, list);
-                calcTaskRuntime(task);
-            }
-        }
+			spin_lock(&exp->dilation_changes_lock);
+		}
 
 		/* reset global flag */
-		dilation_change = 0; 
+		exp->dilation_change = 0; 
+		spin_unlock(&exp->dilation_changes_lock);
+
+		tk_leader_refresh(exp);
 }
 
 /***
 If a container stops in the middle of an experiment, clean it up
 ***/
-void clean_stopped_containers() {
+void clean_stopped_containers(struct tk_experiment *exp) {
     struct list_head *pos;
     struct list_head *n;
     struct dilation_task_struct* task;
     struct dilation_task_struct* next_task;
     struct dilation_task_struct* prev_task;
-    struct dilation_task_struct* possible_leader;
-    int new_highest;
     int did_leader_finish;
-	unsigned long flags;
 
     did_leader_finish = 0;
-    new_highest = -99999;
-    possible_leader = NULL;
 
-	/* for every container in the experiment, see if it has finished execution, if yes, clean it up.
-	also check the possibility of needing to determine a new leader */
-    list_for_each_safe(pos, n, &exp_list)
+	/* for every container in the experiment, see if it has finished execution, if yes, clean it up */
+    list_for_each_safe(pos, n, &exp->exp_list)
     {
 		task = list_entry(pos, struct dilation_task_struct, list);
         if (task->stopped  == -1) //if stopped = -1, the process is no longer running, so free the structure
         {
 
 			PDEBUG_I("Clean Stopped Containers: Detected stopped task\n");
-          	if (leader_task == task)
+          	if (exp->leader_task == task)
 			{ 
 				/* the leader task is done, we NEED a new leader */
            		did_leader_finish = 1;
@@ -1284,12 +1652,12 @@ void clean_stopped_containers() {
 
 			/* handle head/tail logic */
 			if (prev_task == NULL && next_task == NULL) {
-				chainhead[task->cpu_assignment - (TOTAL_CPUS - EXP_CPUS)] = NULL;
-				PDEBUG_I("Clean Stopped Containers: Stopping only head task for cPUID %d\n", task->cpu_assignment - (TOTAL_CPUS - EXP_CPUS));
+				exp->chains[task->cpu_assignment - exp->cpu_base].head = NULL;
+				PDEBUG_I("Clean Stopped Containers: Stopping only head task for cPUID %d\n", task->cpu_assignment - exp->cpu_base);
 			}
 			else if (prev_task == NULL) { 
 				/* the stopped task was the head */
-				chainhead[task->cpu_assignment - (TOTAL_CPUS - EXP_CPUS)] = next_task;
+				exp->chains[task->cpu_assignment - exp->cpu_base].head = next_task;
 				next_task->prev = NULL;
 			}
 			else if (next_task == NULL) { //the stopped task was the tail
@@ -1301,43 +1669,23 @@ void clean_stopped_containers() {
 				next_task->prev = prev_task;
 			}
 
-			chainlength[task->cpu_assignment - (TOTAL_CPUS - EXP_CPUS)] -= task->running_time;
+			exp->chains[task->cpu_assignment - exp->cpu_base].length -= task->running_time;
 
-			proc_num--;
+			exp->proc_num--;
            	PDEBUG_I("Clean Stopped Containers: Process %d is stopped!\n", task->linux_task->pid);
 			list_del(pos);
+			tk_tdf_erase(exp, task);
+			tk_dilation_change_drop(exp, task);
+			clean_up_schedule_list(task);
+			tk_clock_table_remove(task);
            	kfree(task);
-			continue;
         }
-
-		acquire_irq_lock(&task->linux_task->dialation_lock,flags);
-        if (task->linux_task->dilation_factor > new_highest)
-        {
-        	new_highest = task->linux_task->dilation_factor;
-            possible_leader = task;
-        }
-		release_irq_lock(&task->linux_task->dialation_lock,flags);
-
 	}
-    if (new_highest > exp_highest_dilation || did_leader_finish == 1)
-    {   
-		/* If we have a new highest dilation, or if the leader container finished - save the new leader */
-    	exp_highest_dilation = new_highest;
-        leader_task = possible_leader;
-        if (leader_task != NULL)
-        {
-           	calcExpectedIncrease();
-			PDEBUG_I("Clean Stopped Containers: New highest dilation is: %d new expected_increase: %lld\n", exp_highest_dilation, expected_increase);
-        }
 
-        /* update running time for each container because we have a new leader */
-        list_for_each_safe(pos, n, &exp_list)
-        {
-           	task = list_entry(pos, struct dilation_task_struct, list);
-            calcTaskRuntime(task);
-        }
-    }
-	stopped_change = 0;
+	/* If the leader container finished, the next highest TDF in the tree takes over */
+    if (did_leader_finish == 1)
+    	tk_leader_refresh(exp);
+	exp->stopped_change = 0;
     return;
 }
 
@@ -1347,6 +1695,7 @@ should be ran within that round.
 ***/
 enum hrtimer_restart exp_hrtimer_callback( struct hrtimer *timer )
 {
+	struct tk_experiment *exp;
 	int dil;
 	struct dilation_task_struct *task;
 	struct dilation_task_struct * callingtask;
@@ -1358,238 +1707,77 @@ enum hrtimer_restart exp_hrtimer_callback( struct hrtimer *timer )
 
 	do_gettimeofday(&tv);
 	now = timeval_to_ns(&tv);
-
 	task = container_of(timer, struct dilation_task_struct, timer);
+	exp = task->exp;
+	tk_stats_record_timer_lateness(exp, timer);
+
 	dil = task->linux_task->dilation_factor;
 	callingtask = task;
-	int CPUID = callingtask->cpu_assignment - (TOTAL_CPUS - EXP_CPUS);
+	int CPUID = callingtask->cpu_assignment - exp->cpu_base;
 
 	
-	#ifndef MULTI_CORE_NODES
+	/* in a group run (or on a multi core container) last_run is NULL, every thread is frozen by the sync thread */
 	if(task->last_run != NULL){
 		struct task_struct * last_task = task->last_run->curr_task;
-		if(last_task != NULL && find_task_by_pid(task->last_run->pid) != NULL) {
+		if(last_task != NULL && last_task != task->linux_task && !schedule_elem_exited(task->last_run)) {
 			last_task->freeze_time = task->last_timer_fire_time + task->last_timer_duration;
 		}	
 	}
-	#endif
 	
 	
 
-	if (catchup_task == NULL) {
+	if (exp->catchup_task == NULL) {
 		PDEBUG_E("Hrtimer Callback: Proc called but catchup_task is null\n");
 		return HRTIMER_NORESTART;
 	}
 
 	/* if the process is done, dont bother freezing it, just set flag so it gets cleaned in sync phase */
 	if (callingtask->stopped == -1) {
-		stopped_change = 1;
-		curr_process_finished_flag[CPUID] = 1;
-		atomic_set(&wake_up_signal[CPUID], 1);
-		wake_up(&per_cpu_wait_queue[CPUID]);
-		wake_up_process(chaintask[CPUID]);
-
-	}
-	else { 
-		/* its not done, so freeze */
-		task->stopped = 1;
-		curr_process_finished_flag[CPUID] = 1;
-		atomic_set(&wake_up_signal[CPUID], 1);
-		wake_up(&per_cpu_wait_queue[CPUID]);
-		wake_up_process(chaintask[CPUID]);		
-	
-	}
-
-    return HRTIMER_NORESTART;
-}
-/***
-Set's the freeze times of the process and all it's children to the specified argument 
-***/
-void set_all_freeze_times_recurse(struct task_struct * aTask, s64 freeze_time,s64 last_ppp, int max_no_recursions){
-
-	struct list_head *list;
-	struct task_struct *taskRecurse;
-	struct dilation_task_struct *dilTask;
-	struct task_struct *me;
-	struct task_struct *t;
-	unsigned long flags;
-	s32 rem;
-
-	if(max_no_recursions >= 100)
-		return;
-
-    if (aTask == NULL) {
-
-       	PDEBUG_E("Set all freeze times: Task does not exist\n");
-        return;
-    }
-    if (aTask->pid == 0) {
-
-		PDEBUG_E("Set all freeze times: pid 0 error\n");
-        return;
-    }
-
-	me = aTask;
-	t = me;
-	do {
-
-		acquire_irq_lock(&t->dialation_lock,flags);
-		t->freeze_time = freeze_time; 
-		kill(t,SIGSTOP,NULL);
-		release_irq_lock(&t->dialation_lock,flags);
-
-	} while_each_thread(me, t);
-
-	int i = 0;
-    list_for_each(list, &aTask->children)
-    {
-		if(i > 1000)
-			return;
-        taskRecurse = list_entry(list, struct task_struct, sibling);
-        if (taskRecurse->pid == 0) {
-                continue;
-        }
-
-        set_all_freeze_times_recurse(taskRecurse, freeze_time,last_ppp,max_no_recursions + 1);
-		i++;
-
-    }
-}
-
-
-/***
-Set's the past physical times of the process and all it's children to the specified argument 
-***/
-void set_all_past_physical_times_recurse(struct task_struct * aTask, s64 time, int max_no_of_recursions, struct dilation_task_struct * lxc){
-
-	struct list_head *list;
-	struct task_struct *taskRecurse;
-	struct dilation_task_struct *dilTask;
-	struct task_struct *me;
-	struct task_struct *t;
-	unsigned long flags;
-
-	if(max_no_of_recursions >= 100)
-		return;
-
-	if (aTask == NULL) {
-		PDEBUG_E("Set all past physical times: Task does not exist\n");
-		return;
-	}
-
-	if (aTask->pid == 0) {
-		PDEBUG_E("Set all past physical times: pid 0 error\n");
-		return;
-	}
-	
-	if(lxc->linux_task->freeze_time > 0){
-	    lxc->linux_task->past_physical_time = lxc->linux_task->past_physical_time + (time - lxc->linux_task->freeze_time);
-	    lxc->linux_task->freeze_time = 0;
-	}
-
-	me = aTask;
-	t = me;
-	do {
-	
-		if(t->pid != lxc->linux_task->pid){
-			acquire_irq_lock(&t->dialation_lock,flags);
-			if (t->freeze_time > 0)
-		   	{
-				t->past_physical_time = lxc->linux_task->past_physical_time;
-				t->freeze_time = 0;
-		   	}
-		   	else{
-		   	    PDEBUG_I("Set all past physical times: freeze_time not set pid = %d\n", t->pid);
-		   	    t->past_physical_time = lxc->linux_task->past_physical_time;
-	  	    	t->freeze_time = 0;
-		   	}
-			t->virt_start_time = lxc->linux_task->virt_start_time;
-			t->past_virtual_time = lxc->linux_task->past_virtual_time;
-			release_irq_lock(&t->dialation_lock,flags);
-		}
-		
-	} while_each_thread(me, t);
-
-	int i = 0;
-    list_for_each(list, &aTask->children)
-    {
-		if(i > 1000)
-			return;
-
-        taskRecurse = list_entry(list, struct task_struct, sibling);
-        if (taskRecurse->pid == 0) {
-                continue;
-        }
-
-        set_all_past_physical_times_recurse(taskRecurse, time,max_no_of_recursions + 1,lxc);
-		i++;
-
-    }
-}
-
-/***
-Searches an lxc for the process with given pid. returns success if found. Max no of recursiond is just for safety
-***/
-
-struct task_struct * search_lxc(struct task_struct * aTask, int pid, int max_no_of_recursions){
-
-
-	struct list_head *list;
-	struct task_struct *taskRecurse;
-	struct dilation_task_struct *dilTask;
-	struct task_struct *me;
-	struct task_struct *t;
-
-	if(max_no_of_recursions >= 100)
-		return NULL;
-
-	if (aTask == NULL) {
-		PDEBUG_E("Search lxc: Task does not exist\n");
-		return NULL;
-	}
-
-	if (aTask->pid == 0) {
-		PDEBUG_E("Search lxc: pid 0 error\n");
-		return NULL;
-	}
-
-	me = aTask;
-	t = me;
-
-	int i = 0;
-	if(t->pid == pid)
-		return t;
-
-	do {
-		if (t->pid == pid)
-      	{
-			return t;			
-       	}
-	} while_each_thread(me, t);
-
-	list_for_each(list, &aTask->children)
-	{
-		if(i > 1000)
-			return NULL;
+		exp->stopped_change = 1;
+		exp->chains[CPUID].curr_process_finished = 1;
+		atomic_set(&exp->chains[CPUID].wake_up_signal, 1);
+		wake_up(&exp->chains[CPUID].wait_queue);
+		wake_up_process(exp->chains[CPUID].sync_task);
 
-		taskRecurse = list_entry(list, struct task_struct, sibling);
-		if (taskRecurse->pid == 0) {
-			continue;
-		}
-		t =  search_lxc(taskRecurse, pid, max_no_of_recursions + 1);
-		if(t != NULL)
-			return t;
-		i++;
+	}
+	else { 
+		/* its not done, so freeze */
+		task->stopped = 1;
+		exp->chains[CPUID].curr_process_finished = 1;
+		atomic_set(&exp->chains[CPUID].wake_up_signal, 1);
+		wake_up(&exp->chains[CPUID].wait_queue);
+		wake_up_process(exp->chains[CPUID].sync_task);		
+	
 	}
 
-	return NULL;
+    return HRTIMER_NORESTART;
 }
+/***
+Stop every process of a container. SIGSTOP stops a whole thread group, so one signal per process is enough
+***/
+void stop_container_processes(struct task_struct * aTask, int max_no_of_recursions){
+
+	struct list_head *list;
+	struct task_struct *taskRecurse;
+
+	if(max_no_of_recursions >= 100 || aTask == NULL || aTask->pid == 0)
+		return;
 
+	kill(aTask,SIGSTOP,NULL);
+    list_for_each(list, &aTask->children)
+    {
+        taskRecurse = list_entry(list, struct task_struct, sibling);
+        if (taskRecurse->pid == 0) {
+                continue;
+        }
+        stop_container_processes(taskRecurse, max_no_of_recursions + 1);
+    }
+}
 
 /***
 Actually cleans up the experiment by freeing all memory associated with the every container
 ***/
-void clean_exp() {
+void clean_exp(struct tk_experiment *exp) {
 	struct list_head *pos;
 	struct list_head *n;
 	struct dilation_task_struct *task;
@@ -1609,36 +1797,57 @@ void clean_exp() {
 	do_gettimeofday(&now);
 	now_ns = timeval_to_ns(&now);
 
-	if(experiment_type != CS)
+	if(exp->experiment_type != CS)
 		set_current_state(TASK_INTERRUPTIBLE);	
 
-	if(experiment_type != NOTSET){
+	/* the system calls stay hooked as long as another experiment is using them */
+	tk_unhook_syscalls(exp);
+   
+
+	/* stop the pool jobs first, a CS worker in the middle of a window still uses the containers and timelines */
+	for (i=0; i<exp->number_of_heads; i++)
+	{
+		if (exp->experiment_stopped != NOTRUNNING) {
+			PDEBUG_A("Clean Exp: Releasing chaintask %d\n", i);
+
+			/* a CS worker waiting for the end of a slice has to be let go */
+			if (exp->experiment_type == CS) {
+				for (curr = exp->chains[i].timeline_head; curr != NULL; curr = curr->next) {
+					atomic_set(&curr->hrtimer_done,1);
+					wake_up_interruptible_sync(&curr->unfreeze_proc_queue);
+				}
+			}
+		}
 
-		PDEBUG_A("Clean Exp: Resetting Sys Call table\n");
-		orig_cr0 = read_cr0();
-		write_cr0(orig_cr0 & ~0x00010000);
-		sys_call_table[__NR_poll] = (unsigned long *)ref_sys_poll;	
-		sys_call_table[NR_select] = (unsigned long *)ref_sys_select;
-		sys_call_table[__NR_nanosleep] = (unsigned long *)ref_sys_sleep;
-		sys_call_table[__NR_clock_gettime] = (unsigned long *) ref_sys_clock_gettime;
-		sys_call_table[__NR_clock_nanosleep] = (unsigned long *) ref_sys_clock_nanosleep;
-		write_cr0(orig_cr0 | 0x00010000);
-		PDEBUG_A("Clean Exp: Sys Call table Updated\n");
+		/* the pool thread stays around for the next experiment */
+		tk_pool_release(&exp->chains[i]);
+		INIT_LIST_HEAD(&exp->chains[i].work_list);
 	}
-   
 
-	/* free any heap memory associated with each container, cancel corresponding timers */
-    list_for_each_safe(pos, n, &exp_list)
+	/* let go of the callers waiting on a timeline, and wait until none of them looks at it anymore */
+	if (exp->experiment_type == CS) {
+		for (i=0; i<exp->number_of_heads; i++) {
+			for (curr = exp->chains[i].timeline_head; curr != NULL; curr = curr->next) {
+				atomic_set(&curr->done,1);
+				wake_up_interruptible_sync(&curr->w_queue);
+			}
+		}
+		s3f_wait_timeline_waiters(exp);
+	}
+
+	/* free any heap memory associated with each container, cancel corresponding timers. exp_mutex keeps stats readers off the list */
+	mutex_lock(&exp->exp_mutex);
+    list_for_each_safe(pos, n, &exp->exp_list)
     {
         	task = list_entry(pos, struct dilation_task_struct, list);
 		sp.sched_priority = 0;
-		if (experiment_stopped != NOTRUNNING) {
+		if (exp->experiment_stopped != NOTRUNNING) {
 			
-			if(experiment_type == CS)			
+			if(exp->experiment_type == CS)			
 				resume_all(task->linux_task,task);		
 			
 					
-			if (experiment_type == CS || experiment_type == CBE){
+			if (exp->experiment_type == CS || exp->experiment_type == CBE){
 	
 				acquire_irq_lock(&task->linux_task->dialation_lock,flags);
 				task->linux_task->past_physical_time = task->linux_task->past_physical_time + (now_ns - task->linux_task->freeze_time);
@@ -1672,63 +1881,61 @@ void clean_exp() {
         	        ret = hrtimer_cancel( &task->timer );
         	        if (ret) PDEBUG_A("Clean Exp: The timer was still in use...\n");
         	}
+		tk_dilation_change_drop(exp, task);
 		clean_up_schedule_list(task);
+		tk_clock_table_remove(task);
 		kfree(task);
 	}
+	exp->tdf_tree = RB_ROOT;
+	mutex_unlock(&exp->exp_mutex);
 
     PDEBUG_A("Clean Exp: Linked list deleted\n");
-    for (i=0; i<number_of_heads; i++) //clean up cpu specific chains
+    for (i=0; i<exp->number_of_heads; i++) //clean up cpu specific chains
     {
-		chainhead[i] = NULL;
-		chainlength[i] = 0;
-		if (experiment_stopped != NOTRUNNING) {
-			PDEBUG_A("Clean Exp: Stopping chaintask %d\n", i);
-			if (chaintask[i] != NULL && kthread_stop(chaintask[i]) )
-			{
-		        		PDEBUG_A("Clean Exp: Stopping worker %d error\n", i);
-			}
-			PDEBUG_A("Clean Exp: Stopped chaintask %d\n", i);
-		}
+		exp->chains[i].head = NULL;
+		exp->chains[i].pending = NULL;
+		exp->chains[i].length = 0;
 
 		/* clean up timeline structs */
-   		if (experiment_type == CS) {
+   		if (exp->experiment_type == CS) {
 
-			curr = timelineHead[i];
-			timelineHead[i] = NULL;
+			curr = exp->chains[i].timeline_head;
+			exp->chains[i].timeline_head = NULL;
 			tmp = curr;
 			while (curr != NULL) {
 				tmp = curr;
 
-				/* move to next timeline */
+				/* move to next timeline. The chain's worker is stopped and nobody waits on it, so nothing uses it anymore */
 				curr = curr->next; 
-				atomic_set(&tmp->pthread_done,1);
-				atomic_set(&tmp->progress_thread_done,1);
-				atomic_set(&tmp->stop_thread,2);
-				wake_up_interruptible_sync(&tmp->pthread_queue);	
-				wake_up_interruptible_sync(&tmp->progress_thread_queue);				
-				PDEBUG_A("Clean Exp: Stopped all kernel threads for timeline : %d\n",tmp->number);
+				PDEBUG_A("Clean Exp: Freed timeline : %d\n",tmp->number);
+				kfree(tmp);
 			}
 		}
 	}
 
 	
 
-	proc_num = 0;
+	exp->proc_num = 0;
+
+	/* the timelines are freed */
+	hash_init(exp->timelines);
+	atomic_set(&exp->cs_windows, 0);
+	exp->progress_cbe_target = 0;
 
 	/* reset highest_dilation */
-	exp_highest_dilation = -100000000; 
-	leader_task = NULL;
-	atomic_set(&running_done, 0);
-	atomic_set(&experiment_stopping,0);
-	number_of_heads = 0;
-	stopped_change = 0;
+	exp->exp_highest_dilation = -100000000; 
+	exp->leader_task = NULL;
+	atomic_set(&exp->running_done, 0);
+	atomic_set(&exp->experiment_stopping,0);
+	exp->number_of_heads = 0;
+	exp->stopped_change = 0;
 
 
-	if(experiment_stopped != NOTRUNNING && experiment_type == CBE) {
-		wake_up_interruptible(&cbe_exp_stop_queue);
+	if(exp->experiment_stopped != NOTRUNNING && exp->experiment_type == CBE) {
+		wake_up_interruptible(&exp->cbe_exp_stop_queue);
 	}	
-	experiment_stopped = NOTRUNNING;
-	experiment_type = NOTSET;
+	exp->experiment_stopped = NOTRUNNING;
+	exp->experiment_type = NOTSET;
 	
 	PDEBUG_A("Clean Exp: Exited Clean Experiment\n");
 	
@@ -1740,30 +1947,37 @@ void clean_exp() {
 }
 
 /***
-Sets the experiment_stopped flag, signalling catchup_task (sync function) to stop at the end of the current round and clean up
+Sets the experiment_stopped flag of the experiment, signalling its catchup_task (sync function) to stop at the end of the current round and clean up
 ***/
-void set_clean_exp() {
+void set_clean_exp(struct tk_experiment *exp) {
 
 		int ret = 0;
 
 		/* assuming stopExperiment will not be called if still waiting for a S3F progress to return */
-		if (experiment_stopped == NOTRUNNING || experiment_type == CS || experiment_stopped == FROZEN) {
+		if (exp->experiment_stopped == NOTRUNNING || exp->experiment_type == CS || exp->experiment_stopped == FROZEN) {
 
 		    /* sync experiment was never started, so just clean the list */
 			PDEBUG_A("Set Clean Exp: Clean up immediately..\n");
-			experiment_stopped = STOPPING;
-			atomic_set(&experiment_stopping,1);
-		    	clean_exp();
+			mutex_lock(&exp->exp_mutex);
+			exp->experiment_stopped = STOPPING;
+			atomic_set(&exp->experiment_stopping,1);
+			mutex_unlock(&exp->exp_mutex);
+		    	clean_exp(exp);
 		}
-		else if (experiment_stopped == RUNNING) {
+		else if (exp->experiment_stopped == RUNNING) {
 
 			/* the experiment is running, so set the flag */
 			PDEBUG_A("Set Clean Exp: Waiting for catchup task to run before cleanup\n");
+			mutex_lock(&exp->exp_mutex);
+			atomic_set(&exp->experiment_stopping,1);
+			mutex_unlock(&exp->exp_mutex);
 			set_current_state(TASK_INTERRUPTIBLE);
-			atomic_set(&experiment_stopping,1);
+			/* a progress_exp_cbe caller waiting at the round barrier returns, the held catchup task goes on to clean up */
+			wake_up_interruptible(&exp->progress_cbe_wait_queue);
+			wake_up_interruptible(&exp->progress_cbe_catchup_tsk);
 			
 			do{
-				ret = wait_event_interruptible_timeout(cbe_exp_stop_queue,atomic_read(&experiment_stopping) == 0,HZ);
+				ret = wait_event_interruptible_timeout(exp->cbe_exp_stop_queue,atomic_read(&exp->experiment_stopping) == 0,HZ);
 				if(ret == 0)
 					set_current_state(TASK_INTERRUPTIBLE);
 				else
@@ -1783,7 +1997,7 @@ void set_clean_exp() {
 /***
 Set the time dilation variables to be consistent with all children
 ***/
-void set_children_time(struct task_struct *aTask, s64 time) {
+void set_children_time(struct tk_experiment *exp, struct task_struct *aTask, s64 time) {
     struct list_head *list;
     struct task_struct *taskRecurse;
     struct task_struct *me;
@@ -1808,7 +2022,7 @@ void set_children_time(struct task_struct *aTask, s64 time) {
            		t->freeze_time = time;
            		t->past_physical_time = 0;
            		t->past_virtual_time = 0;
-			if(experiment_stopped != RUNNING)
+			if(exp == NULL || exp->experiment_stopped != RUNNING)
      	       	t->wakeup_time = 0;
 		}
 		release_irq_lock(&t->dialation_lock,flags);
@@ -1827,10 +2041,10 @@ void set_children_time(struct task_struct *aTask, s64 time) {
 		taskRecurse->freeze_time = time;
 		taskRecurse->past_physical_time = 0;
 		taskRecurse->past_virtual_time = 0;
-		if(experiment_stopped != RUNNING)
+		if(exp == NULL || exp->experiment_stopped != RUNNING)
 		    taskRecurse->wakeup_time = 0;
 		release_irq_lock(&taskRecurse->dialation_lock,flags);
-		set_children_time(taskRecurse, time);
+		set_children_time(exp, taskRecurse, time);
 	}
 }
 
@@ -2049,6 +2263,7 @@ int freeze_proc_exp_recurse(struct dilation_task_struct *aTask) {
 		aTask->linux_task->freeze_time = now;
 	release_irq_lock(&aTask->linux_task->dialation_lock,flags);
 
+	aTask->stats.n_freezes++;
 	kill(aTask->linux_task, SIGSTOP, aTask);
     freeze_children(aTask->linux_task, aTask->linux_task->freeze_time);
     return 0;
@@ -2059,6 +2274,7 @@ int freeze_proc_exp_recurse(struct dilation_task_struct *aTask) {
 Unfreezes all children associated with a container
 ***/
 int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,struct dilation_task_struct * lxc) {
+	struct tk_experiment *exp = lxc->exp;
 	struct list_head *list;
 	struct task_struct *taskRecurse;
 	struct dilation_task_struct *dilTask;
@@ -2084,7 +2300,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 	do {
 		acquire_irq_lock(&t->dialation_lock,flags);
 
-		if(experiment_stopped == STOPPING){
+		if(exp->experiment_stopped == STOPPING){
 			t->virt_start_time = 0;
 		}
 		
@@ -2124,6 +2340,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 					
 					atomic_set(&task_poll_helper->done,1);
 					wake_up(&task_poll_helper->w_queue);
+					lxc->stats.n_sleeper_wakeups++;
 					release_irq_lock(&t->dialation_lock,flags);
 					kill(t, SIGCONT, NULL);
 
@@ -2132,6 +2349,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 
 					atomic_set(&task_select_helper->done,1);
 					wake_up(&task_select_helper->w_queue);
+					lxc->stats.n_sleeper_wakeups++;
 					release_irq_lock(&t->dialation_lock,flags);
 					kill(t, SIGCONT, NULL);
 				}
@@ -2139,6 +2357,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 
 					atomic_set(&task_sleep_helper->done,1);
 					wake_up(&task_sleep_helper->w_queue);
+					lxc->stats.n_sleeper_wakeups++;
 					release_irq_lock(&t->dialation_lock,flags);
 					kill(t, SIGCONT, NULL);
 
@@ -2166,7 +2385,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 		dilTask = container_of(&taskRecurse, struct dilation_task_struct, linux_task);
 		
 
-		if(experiment_stopped == STOPPING)
+		if(exp->experiment_stopped == STOPPING)
 			taskRecurse->virt_start_time = 0;
 
 		acquire_irq_lock(&taskRecurse->dialation_lock,flags);
@@ -2185,6 +2404,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 			if(task_sleep_helper != NULL) {
 				atomic_set(&task_sleep_helper->done,1);
 				wake_up(&task_sleep_helper->w_queue);
+				lxc->stats.n_sleeper_wakeups++;
 			}
 			
 			release_irq_lock(&taskRecurse->dialation_lock,flags);
@@ -2219,6 +2439,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 
 					atomic_set(&task_poll_helper->done,1);
 					wake_up(&task_poll_helper->w_queue);
+					lxc->stats.n_sleeper_wakeups++;
 					release_irq_lock(&taskRecurse->dialation_lock,flags);
 					kill(taskRecurse, SIGCONT, NULL);
 
@@ -2228,6 +2449,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 
 					atomic_set(&task_select_helper->done,1);
 					wake_up(&task_select_helper->w_queue);
+					lxc->stats.n_sleeper_wakeups++;
 					release_irq_lock(&taskRecurse->dialation_lock,flags);
 					kill(taskRecurse, SIGCONT, NULL);
 				}
@@ -2235,6 +2457,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 					
 					atomic_set(&task_sleep_helper->done,1);
 					wake_up(&task_sleep_helper->w_queue);
+					lxc->stats.n_sleeper_wakeups++;
 					release_irq_lock(&taskRecurse->dialation_lock,flags);
 					kill(taskRecurse, SIGCONT, NULL);
 
@@ -2265,6 +2488,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 					
 					atomic_set(&task_poll_helper->done,1);
 					wake_up(&task_poll_helper->w_queue);
+					lxc->stats.n_sleeper_wakeups++;
 					release_irq_lock(&taskRecurse->dialation_lock,flags);
 					kill(taskRecurse, SIGCONT, NULL);
 
@@ -2274,6 +2498,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 
 					atomic_set(&task_select_helper->done,1);
 					wake_up(&task_select_helper->w_queue);
+					lxc->stats.n_sleeper_wakeups++;
 					release_irq_lock(&taskRecurse->dialation_lock,flags);
 					kill(taskRecurse, SIGCONT, NULL);
 				}
@@ -2281,6 +2506,7 @@ int unfreeze_children(struct task_struct *aTask, s64 time, s64 expected_time,str
 
 					atomic_set(&task_sleep_helper->done,1);
 					wake_up(&task_sleep_helper->w_queue);
+					lxc->stats.n_sleeper_wakeups++;
 					release_irq_lock(&taskRecurse->dialation_lock,flags);
 					kill(taskRecurse, SIGCONT, NULL);
 
@@ -2398,12 +2624,56 @@ int resume_all(struct task_struct *aTask,struct dilation_task_struct * lxc) {
 
 
 
+/***
+A thread can be picked if it did not exit and is not asleep past the end of the round
+***/
+static int schedule_elem_runnable(void * item, void * arg){
+
+	lxc_schedule_elem * elem = item;
+	s64 expected_time = *(s64 *)arg;
+	unsigned long flags;
+	int runnable;
+
+	if(schedule_elem_exited(elem))
+		return 0;
+
+	acquire_irq_lock(&elem->curr_task->dialation_lock,flags);
+	runnable = elem->curr_task->wakeup_time == 0 || elem->curr_task->wakeup_time <= expected_time;
+	release_irq_lock(&elem->curr_task->dialation_lock,flags);
+	return runnable;
+}
+
+/***
+Get the runnable thread of the lxc with the lowest vruntime. Exited threads are left for prune_schedule_list
+***/
+lxc_schedule_elem * pick_next_fair_task(struct dilation_task_struct * lxc, s64 expected_time){
+
+	lxc_schedule_elem * next;
+	s64 slice;
+
+	slice = vt_sched_granularity(lxc->linux_task->dilation_factor, lxc->exp->sched_granularity, Sim_time_scale);
+	next = (lxc_schedule_elem *)vt_sched_pick(&lxc->schedule_queue, &lxc->min_vruntime, slice, schedule_elem_runnable, &expected_time);
+	if(next == NULL){
+		if(schedule_list_size(lxc) == 0) {
+			PDEBUG_I("Pick Next Fair Task: Schedule queue is empty. Pid = %d\n", lxc->linux_task->pid);
+			lxc->stopped = -1;
+		}
+		else {
+			PDEBUG_I("Pick Next Fair Task: ERROR : All tasks simultaneously asleep or exited. Pid = %d\n", lxc->linux_task->pid);
+		}
+		return NULL;
+	}
+
+	/* the thread's priority may have been changed since it was added */
+	vt_sched_reweight(&next->se, next->curr_task->static_prio);
+	return next;
+}
+
 /***
 Get next task to run from the run queue of the lxc
 ***/
 lxc_schedule_elem * get_next_valid_task(struct dilation_task_struct * lxc, s64 expected_time){
 
-	struct pid *pid_struct;
 	struct task_struct *task;
 	int count = 0;
 	struct poll_helper_struct * task_poll_helper;
@@ -2424,12 +2694,10 @@ lxc_schedule_elem * get_next_valid_task(struct dilation_task_struct * lxc, s64 e
 
 	do{
 
-		/* function to find the pid_struct */
-		pid_struct = find_get_pid(head->pid); 	 
-		task = pid_task(pid_struct,PIDTYPE_PID); 
-		task = search_lxc(lxc->linux_task,head->pid,0);
+		/* the element holds a reference on its task, so liveness is a flag test */
+		task = head->curr_task;
 
-		if(task == NULL){	
+		if(schedule_elem_exited(head)){	
 			/* task is no longer running. remove from schedule queue */
 			PDEBUG_I("Get Next Valid Task: Task %d no longer running. Removing from schedule queue\n",head->pid);
 			PDEBUG_V("Get Next Valid Task: Schedule List Before\n");
@@ -2444,7 +2712,6 @@ lxc_schedule_elem * get_next_valid_task(struct dilation_task_struct * lxc, s64 e
 		else{
 			
 			count ++; 
-			head->curr_task= task;
 			acquire_irq_lock(&head->curr_task->dialation_lock,flags);
 			//head->curr_task->virt_start_time = lxc->linux_task->virt_start_time;
 
@@ -2486,6 +2753,7 @@ Add process and recursively its children to the run queue of the lxc
 ***/
 void add_process_to_schedule_queue_recurse(struct dilation_task_struct * lxc, struct task_struct *aTask, s64 window_duration, s64 expected_inc){
 
+	struct tk_experiment *exp = lxc->exp;
 	struct list_head *list;
 	struct task_struct *taskRecurse;
 	struct dilation_task_struct *dilTask;
@@ -2516,11 +2784,11 @@ void add_process_to_schedule_queue_recurse(struct dilation_task_struct * lxc, st
 		t->dilation_factor = aTask->dilation_factor;
 		release_irq_lock(&aTask->dialation_lock,flags);
 		t->static_prio = aTask->static_prio;
-		add_to_schedule_list(lxc,t,FREEZE_QUANTUM,exp_highest_dilation);
+		add_to_schedule_list(lxc,t,exp->freeze_quantum,exp->exp_highest_dilation);
 	} while_each_thread(me, t);
 
 	/* If task already exists, schedule queue would not be modified */
-	add_to_schedule_list(lxc,aTask,FREEZE_QUANTUM,exp_highest_dilation); 
+	add_to_schedule_list(lxc,aTask,exp->freeze_quantum,exp->exp_highest_dilation); 
 	list_for_each(list, &aTask->children)
     {
 		taskRecurse = list_entry(list, struct task_struct, sibling);
@@ -2528,7 +2796,7 @@ void add_process_to_schedule_queue_recurse(struct dilation_task_struct * lxc, st
 				continue;
 		}
 		taskRecurse->static_prio = lxc->linux_task->static_prio; // *** trying
-		add_process_to_schedule_queue_recurse(lxc,taskRecurse,FREEZE_QUANTUM,exp_highest_dilation);
+		add_process_to_schedule_queue_recurse(lxc,taskRecurse,exp->freeze_quantum,exp->exp_highest_dilation);
 	}
 
 
@@ -2536,12 +2804,22 @@ void add_process_to_schedule_queue_recurse(struct dilation_task_struct * lxc, st
 }
 
 /***
-Refresh the run queue of the lxc at the start of every round to add new processes
+Refresh the run queue of the lxc at the start of every round to add new processes. When the fork/exit probes are
+registered, only the members that forked or exited since the last refresh are added or removed (tk_members_apply), the
+process tree is walked only when the container was just added or redilated.
 ***/
 void refresh_lxc_schedule_queue(struct dilation_task_struct *aTask,s64 window_duration, s64 expected_inc){
 
 	if(aTask != NULL){
-		add_process_to_schedule_queue_recurse(aTask,aTask->linux_task,FREEZE_QUANTUM,exp_highest_dilation);
+		struct tk_experiment *exp = aTask->exp;
+
+		if(tk_task_events_enabled) {
+			tk_members_apply(aTask);
+			if(atomic_xchg(&aTask->members_changed, 0) == 0)
+				return;
+		}
+		prune_schedule_list(aTask);
+		add_process_to_schedule_queue_recurse(aTask,aTask->linux_task,exp->freeze_quantum,exp->exp_highest_dilation);
 	}
 }
 
@@ -2549,10 +2827,11 @@ void refresh_lxc_schedule_queue(struct dilation_task_struct *aTask,s64 window_du
 
 
 /***
-Unfreeze process at head of schedule queue of container, run it with possible switches for the run time. Returns the time left in this round.
+Unfreeze the process picked from the schedule queue of the container and run it for its slice. Returns the time left in this round.
 ***/ 
 int run_schedule_queue_single_core_mode(struct dilation_task_struct * lxc, lxc_schedule_elem * head, s64 remaining_run_time, s64 expected_time){
 
+	struct tk_experiment *exp = lxc->exp;
 	struct list_head *list;
 	struct task_struct * curr_task;
 	struct dilation_task_struct *dilTask;
@@ -2573,23 +2852,15 @@ int run_schedule_queue_single_core_mode(struct dilation_task_struct * lxc, lxc_s
 	struct select_helper_struct * task_select_helper = NULL;
 	struct sleep_helper_struct * task_sleep_helper = NULL;
     unsigned long flags;
-    int CPUID = lxc->cpu_assignment - (TOTAL_CPUS - EXP_CPUS);
+    int CPUID = lxc->cpu_assignment - exp->cpu_base;
 
-	if(head->duration_left <= 0 || remaining_run_time <= 0){
+	timer_fire_time = vt_sched_slice(&head->se, remaining_run_time, &rem_time);
+	if(timer_fire_time == 0){
 		PDEBUG_E("Run Schedule Queue Head Process: ERROR Cannot run task. duration left is 0");
 		return remaining_run_time;
 
 	}
 
-	if(head->duration_left < remaining_run_time){
-		timer_fire_time = head->duration_left;
-		rem_time = remaining_run_time - head->duration_left;
-	}
-	else{
-		timer_fire_time = remaining_run_time;
-		rem_time = 0;
-	}
-
 	
 
 	do_gettimeofday(&now);
@@ -2602,17 +2873,22 @@ int run_schedule_queue_single_core_mode(struct dilation_task_struct * lxc, lxc_s
 	if(lxc->last_run == NULL) {
 	    last_run_freeze_time = start_time;
 	}
-	else if (find_task_by_pid(lxc->last_run->pid) != NULL) {
+	else if (!schedule_elem_exited(lxc->last_run) && lxc->last_run->curr_task != lxc->linux_task) {
 	    last_run_freeze_time = lxc->last_run->curr_task->freeze_time;
 	}
 	else{
 	    last_run_freeze_time = start_time;
 	}
+	/* a thread group leader's freeze time is cleared when the container's clock is thawed */
+	if(last_run_freeze_time <= 0)
+	    last_run_freeze_time = start_time;
 	
 	if(lxc->last_timer_fire_time == 0)
     	lxc->last_timer_fire_time = start_time;
     else
         lxc->last_timer_fire_time = last_run_freeze_time;
+
+	materialize_task_clock(lxc, head);
 	
 	acquire_irq_lock(&t->dialation_lock,flags);
 	task_poll_helper = hmap_get_abs(&poll_process_lookup,t->pid);
@@ -2624,6 +2900,7 @@ int run_schedule_queue_single_core_mode(struct dilation_task_struct * lxc, lxc_s
 		t->freeze_time = 0;
 		atomic_set(&task_poll_helper->done,1);
 		wake_up(&task_poll_helper->w_queue);
+		lxc->stats.n_sleeper_wakeups++;
 		release_irq_lock(&t->dialation_lock,flags);
 	}
 	else if(task_select_helper != NULL){
@@ -2632,6 +2909,7 @@ int run_schedule_queue_single_core_mode(struct dilation_task_struct * lxc, lxc_s
 		atomic_set(&task_select_helper->done,1);
 		PDEBUG_V("Select Wakeup. Pid = %d\n", t->pid); 
 		wake_up(&task_select_helper->w_queue);
+		lxc->stats.n_sleeper_wakeups++;
 		release_irq_lock(&t->dialation_lock,flags);
 	}
 	else if( task_sleep_helper != NULL) {
@@ -2640,6 +2918,7 @@ int run_schedule_queue_single_core_mode(struct dilation_task_struct * lxc, lxc_s
 		t->freeze_time = 0;
 		atomic_set(&task_sleep_helper->done,1);
 		wake_up(&task_sleep_helper->w_queue);
+		lxc->stats.n_sleeper_wakeups++;
 		release_irq_lock(&t->dialation_lock,flags);
 	}
 	else if (t->freeze_time > 0)
@@ -2665,25 +2944,20 @@ int run_schedule_queue_single_core_mode(struct dilation_task_struct * lxc, lxc_s
 	ktime = ktime_set( 0, timer_fire_time );
 	int ret;
 
-	set_current_state(TASK_INTERRUPTIBLE);
-	if(experiment_type != CS){
-		hrtimer_start(&lxc->timer,ns_to_ktime(ktime_to_ns(ktime_get()) + timer_fire_time) ,HRTIMER_MODE_ABS);
-		schedule();
+	if(exp->experiment_type != CS){
+		wait_on_lxc_timer(lxc, timer_fire_time, CPUID);
 	}
 	else{
+		set_current_state(TASK_INTERRUPTIBLE);
 		hrtimer_start(&lxc->timer,ktime,HRTIMER_MODE_REL);
 		wait_event_interruptible(lxc->tl->unfreeze_proc_queue,atomic_read(&lxc->tl->hrtimer_done) == 1);
 		atomic_set(&lxc->tl->hrtimer_done,0);
 	}
 	set_current_state(TASK_RUNNING);
-	curr_process_finished_flag[CPUID] = 0;
+	exp->chains[CPUID].curr_process_finished = 0;
 
-	head->duration_left = head->duration_left - timer_fire_time;
-	if(head->duration_left <= 0){
-		PDEBUG_V("Run Schedule Queue Head Process: Resetting head to duration of %lld\n", head->share_factor);
-		head->duration_left = head->share_factor;
-		requeue_schedule_list(lxc);
-	}
+	if(vt_sched_account(&head->se, timer_fire_time))
+		PDEBUG_V("Run Schedule Queue Head Process: Slice of %d used up. vruntime = %lld\n", head->pid, head->se.vruntime);
 	
 
 	me = curr_task;
@@ -2692,9 +2966,12 @@ int run_schedule_queue_single_core_mode(struct dilation_task_struct * lxc, lxc_s
 	now_ns = timeval_to_ns(&now); 
 
 
-	acquire_irq_lock(&t->dialation_lock,flags);
-	t->freeze_time = lxc->last_timer_fire_time + lxc->last_timer_duration;
-	release_irq_lock(&t->dialation_lock,flags);
+	/* the container leader's freeze time is the container's clock, it is frozen at the end of the turn */
+	if(t != lxc->linux_task){
+		acquire_irq_lock(&t->dialation_lock,flags);
+		t->freeze_time = lxc->last_timer_fire_time + lxc->last_timer_duration;
+		release_irq_lock(&t->dialation_lock,flags);
+	}
 	kill(t, SIGSTOP, NULL);
 	/* set the last run task */	
 	lxc->last_run = head;
@@ -2709,15 +2986,166 @@ int run_schedule_queue_single_core_mode(struct dilation_task_struct * lxc, lxc_s
 
 
 
+/***
+Idle (and iowait) time in ns the CPUs in mask have had so far, -1 if the kernel does not keep track of it (no NOHZ)
+***/
+static s64 tk_cpus_idle_time(const struct cpumask * mask){
+	u64 idle;
+	u64 iowait;
+	s64 total = 0;
+	int cpu;
+
+	for_each_cpu(cpu, mask){
+		idle = get_cpu_idle_time_us(cpu, NULL);
+		iowait = get_cpu_iowait_time_us(cpu, NULL);
+		if(idle == (u64)-1 || iowait == (u64)-1)
+			return -1;
+		total += (idle + iowait)*NSEC_PER_USEC;
+	}
+	return total;
+}
+
+/***
+Group run: thaw every runnable thread of the container at once and let the Linux scheduler share the container's
+CPUs among them, with a single hrtimer ending the whole turn. Every thread's vruntime is charged the CPU time it
+actually got (sum_exec_runtime), and so is the container's clock, single or multi core: the CPU time of all its threads
+plus the time its CPUs were idle (vt_group_charge). If no thread is runnable the container idles, so its sleepers still
+get closer to their wake up time.
+***/
+void run_schedule_queue_group_mode(struct dilation_task_struct * lxc, s64 start_ns, s64 expected_time){
+
+	struct tk_experiment *exp = lxc->exp;
+	llist_elem * curr;
+	lxc_schedule_elem * elem;
+	struct task_struct * t;
+	struct task_struct * last_group = NULL;
+	struct poll_helper_struct * task_poll_helper;
+	struct select_helper_struct * task_select_helper;
+	struct sleep_helper_struct * task_sleep_helper;
+	ktime_t ktime;
+	unsigned long flags;
+	s64 cpu_time = 0;
+	s64 idle_start;
+	s64 idle_time;
+	s64 run_time;
+	int n_run = 0;
+	int CPUID = lxc->cpu_assignment - exp->cpu_base;
+	const struct cpumask * cpus = lxc->n_vcpus > 1 ? &lxc->cpus : cpumask_of(lxc->cpu_assignment);
+
+	thaw_container_clock(lxc, start_ns);
+	idle_start = tk_cpus_idle_time(cpus);
+
+	for(curr = lxc->schedule_queue.head; curr != NULL; curr = curr->next){
+		elem = curr->item;
+		if(!schedule_elem_runnable(elem, &expected_time))
+			continue;
+
+		t = elem->curr_task;
+		materialize_task_clock(lxc, elem);
+		if(lxc->n_vcpus > 1 && !cpumask_equal(&t->cpus_allowed, &lxc->cpus))
+			set_cpus_allowed_ptr(t, &lxc->cpus);
+		elem->group_exec_start = t->se.sum_exec_runtime;
+		n_run++;
+
+		acquire_irq_lock(&t->dialation_lock,flags);
+		t->freeze_time = 0;
+		task_poll_helper = hmap_get_abs(&poll_process_lookup,t->pid);
+		task_select_helper = hmap_get_abs(&select_process_lookup,t->pid);
+		task_sleep_helper = hmap_get_abs(&sleep_process_lookup,t->pid);
+		if(task_poll_helper != NULL)
+			atomic_set(&task_poll_helper->done,1);
+		else if(task_select_helper != NULL)
+			atomic_set(&task_select_helper->done,1);
+		else if(task_sleep_helper != NULL)
+			atomic_set(&task_sleep_helper->done,1);
+		release_irq_lock(&t->dialation_lock,flags);
+
+		if(task_poll_helper != NULL){
+			wake_up(&task_poll_helper->w_queue);
+			lxc->stats.n_sleeper_wakeups++;
+		}
+		else if(task_select_helper != NULL){
+			wake_up(&task_select_helper->w_queue);
+			lxc->stats.n_sleeper_wakeups++;
+		}
+		else if(task_sleep_helper != NULL){
+			wake_up(&task_sleep_helper->w_queue);
+			lxc->stats.n_sleeper_wakeups++;
+		}
+		else if(t->group_leader != last_group){
+			/* SIGCONT resumes the whole thread group, the threads of a process are next to each other in the queue */
+			kill(t, SIGCONT, NULL);
+			last_group = t->group_leader;
+		}
+	}
+	PDEBUG_V("Run Schedule Queue Group Mode: Running %d threads of lxc %d on CPU %d\n", n_run, lxc->linux_task->pid, CPUID);
+
+	/* no single thread gets frozen by the hrtimer callback */
+	lxc->last_run = NULL;
+	lxc->last_timer_fire_time = start_ns;
+	lxc->last_timer_duration = lxc->running_time;
+	ktime = ktime_set(0, lxc->running_time);
+
+	if(exp->experiment_type != CS){
+		wait_on_lxc_timer(lxc, lxc->running_time, CPUID);
+	}
+	else{
+		set_current_state(TASK_INTERRUPTIBLE);
+		hrtimer_start(&lxc->timer,ktime,HRTIMER_MODE_REL);
+		wait_event_interruptible(lxc->tl->unfreeze_proc_queue,atomic_read(&lxc->tl->hrtimer_done) == 1);
+		atomic_set(&lxc->tl->hrtimer_done,0);
+	}
+	set_current_state(TASK_RUNNING);
+	exp->chains[CPUID].curr_process_finished = 0;
+
+	stop_container_processes(lxc->linux_task, 0);
+	record_turn_overrun(lxc, start_ns + lxc->running_time);
+	idle_time = tk_cpus_idle_time(cpus);
+	if(idle_start < 0 || idle_time < idle_start)
+		idle_time = -1;
+	else
+		idle_time -= idle_start;
+
+	for(curr = lxc->schedule_queue.head; curr != NULL; curr = curr->next){
+		elem = curr->item;
+		if(elem->group_exec_start < 0)
+			continue;
+
+		t = elem->curr_task;
+		vt_sched_account(&elem->se, t->se.sum_exec_runtime - elem->group_exec_start);
+		cpu_time += t->se.sum_exec_runtime - elem->group_exec_start;
+	}
+
+	run_time = vt_group_charge(cpu_time, idle_time, lxc->n_vcpus, turn_charge(lxc, lxc->running_time));
+	freeze_container_clock(lxc, start_ns + run_time);
+	PDEBUG_V("Run Schedule Queue Group Mode: lxc %d got %lld ns of CPU time and %lld ns idle on %d vCPUs, charged %lld ns\n", lxc->linux_task->pid, cpu_time, idle_time, lxc->n_vcpus, run_time);
+
+	for(curr = lxc->schedule_queue.head; curr != NULL; curr = curr->next){
+		elem = curr->item;
+		if(elem->group_exec_start < 0)
+			continue;
+
+		t = elem->curr_task;
+		elem->group_exec_start = -1;
+		if(t != lxc->linux_task && !schedule_elem_exited(elem)){
+			acquire_irq_lock(&t->dialation_lock,flags);
+			t->freeze_time = start_ns + run_time;
+			release_irq_lock(&t->dialation_lock,flags);
+		}
+	}
+}
+
+
 /***
 Unfreezes and runs each process in shared timeslice mode
 ***/
 int unfreeze_proc_exp_single_core_mode(struct dilation_task_struct *aTask, s64 expected_time) {
+	struct tk_experiment *exp = aTask->exp;
 	struct timeval now;
 	s64 now_ns;
 	s64 start_ns;
 	struct hrtimer * alt_timer = &aTask->timer;
-	int CPUID = aTask->cpu_assignment - (TOTAL_CPUS - EXP_CPUS);
+	int CPUID = aTask->cpu_assignment - exp->cpu_base;
 	int i = 0;
 	unsigned long flags;
 	struct poll_helper_struct * task_poll_helper = NULL;
@@ -2727,7 +3155,6 @@ int unfreeze_proc_exp_single_core_mode(struct dilation_task_struct *aTask, s64 e
 	s64 change_vt;
 	s64 rem_time;
 	lxc_schedule_elem * head;
-	s64 err;
 	s32 rem;
 
     
@@ -2737,12 +3164,15 @@ int unfreeze_proc_exp_single_core_mode(struct dilation_task_struct *aTask, s64 e
 		return -1;
 	}
 	
-	atomic_set(&wake_up_signal_sync_drift[CPUID],0);
+	atomic_set(&exp->chains[CPUID].wake_up_signal_sync_drift,0);
+	aTask->stats.n_thaws++;
 
 
-
-	/* for adding any new tasks that might have been spawned */
-	refresh_lxc_schedule_queue(aTask,aTask->running_time,expected_time); 
+	/* for adding any new tasks that might have been spawned, unless the sync thread already did it ahead of time */
+	if (aTask->round_prepared)
+		aTask->round_prepared = 0;
+	else
+		refresh_lxc_schedule_queue(aTask,aTask->running_time,expected_time); 
 	
 
 	/* Set all past physical times */	
@@ -2764,6 +3194,7 @@ int unfreeze_proc_exp_single_core_mode(struct dilation_task_struct *aTask, s64 e
            
 			aTask->linux_task->past_physical_time = aTask->linux_task->past_physical_time + (now_ns - aTask->linux_task->freeze_time);
 			aTask->linux_task->freeze_time = 0;
+			aTask->clock_epoch++;
 			
 			task_poll_helper = hmap_get_abs(&poll_process_lookup,aTask->linux_task->pid);
 			task_select_helper = hmap_get_abs(&select_process_lookup,aTask->linux_task->pid);
@@ -2777,17 +3208,20 @@ int unfreeze_proc_exp_single_core_mode(struct dilation_task_struct *aTask, s64 e
 				if(task_poll_helper != NULL){				
 					atomic_set(&task_poll_helper->done,1);
 					wake_up(&task_poll_helper->w_queue);
+					aTask->stats.n_sleeper_wakeups++;
 					release_irq_lock(&aTask->linux_task->dialation_lock,flags);
 				}
 				else if(task_select_helper != NULL){					
 					atomic_set(&task_select_helper->done,1);
 					PDEBUG_V("Select Wakeup. Pid = %d\n", aTask->linux_task->pid); 
 					wake_up(&task_select_helper->w_queue);
+					aTask->stats.n_sleeper_wakeups++;
 					release_irq_lock(&aTask->linux_task->dialation_lock,flags);	
 				}
 				else if( task_sleep_helper != NULL) {				
 					atomic_set(&task_sleep_helper->done,1);		
 					wake_up(&task_sleep_helper->w_queue);
+					aTask->stats.n_sleeper_wakeups++;
 					release_irq_lock(&aTask->linux_task->dialation_lock,flags);
 				}
 				else {
@@ -2807,13 +3241,12 @@ int unfreeze_proc_exp_single_core_mode(struct dilation_task_struct *aTask, s64 e
 		
 		aTask->last_timer_fire_time = start_ns;
 		aTask->last_timer_duration = aTask->running_time;
-		set_current_state(TASK_INTERRUPTIBLE);
 		
-		if(experiment_type != CS){
-			hrtimer_start(&aTask->timer,ns_to_ktime(ktime_to_ns(ktime_get()) + aTask->running_time) ,HRTIMER_MODE_ABS);
-			schedule();
+		if(exp->experiment_type != CS){
+			wait_on_lxc_timer(aTask, aTask->running_time, CPUID);
 		}
 		else{
+			set_current_state(TASK_INTERRUPTIBLE);
 			hrtimer_start(&aTask->timer,ktime,HRTIMER_MODE_REL);
 			wait_event_interruptible(aTask->tl->unfreeze_proc_queue,atomic_read(&aTask->tl->hrtimer_done) == 1);
 			atomic_set(&aTask->tl->hrtimer_done,0);
@@ -2824,41 +3257,28 @@ int unfreeze_proc_exp_single_core_mode(struct dilation_task_struct *aTask, s64 e
 
 		PDEBUG_V("Unfreeze Proc Exp Recurse: Single process on CPU %d resumed\n",CPUID);
 
-		mutex_lock(&exp_mutex);
-
-		if(aTask->linux_task->dilation_factor == 0){
-			err = now_ns - start_ns - aTask->running_time;
-		}
-		else if(aTask->linux_task->dilation_factor > 0){
-			err = div_s64_rem((now_ns - start_ns - aTask->running_time)*1000 ,aTask->linux_task->dilation_factor,&rem);
-		}
-		else{
-			err = 0;
-		}
-
-		if(err >= 0){
-		round_error = round_error + err;
-		round_error_sq = round_error_sq + (err*err);
-		n_rounds = n_rounds + 1;
-		}
-		mutex_unlock(&exp_mutex);
-		
 		aTask->last_run = head;		
 		kill(aTask->linux_task, SIGSTOP, NULL);
-		acquire_irq_lock(&aTask->linux_task->dialation_lock,flags);	
-        aTask->linux_task->freeze_time = start_ns + aTask->running_time;
-        release_irq_lock(&aTask->linux_task->dialation_lock,flags);      
+		record_turn_overrun(aTask, start_ns + aTask->running_time);
+		freeze_container_clock(aTask, start_ns + turn_charge(aTask, aTask->running_time));
 	
 		freeze_proc_exp_recurse(aTask);	
 	}
+	else if(aTask->group_run){
+
+		rem_time = 0;
+		run_schedule_queue_group_mode(aTask, start_ns, expected_time);
+	}
 	else {
 	
 	rem_time = aTask->running_time;
-	set_all_past_physical_times_recurse(aTask->linux_task, start_ns,0,aTask);
+
+	/* only the container's clock is thawed, its processes read it through tk_task_virtual_time */
+	thaw_container_clock(aTask, start_ns);
 	do{
 
 		PDEBUG_V("Unfreeze Proc Exp Recurse: Getting next valid task on CPU : %d for lxc : %d\n",CPUID, aTask->linux_task->pid);
-		head = get_next_valid_task(aTask,expected_time);
+		head = pick_next_fair_task(aTask,expected_time);
 		if(head == NULL){
 			/* need to stop container here */
 			PDEBUG_I("Unfreeze Proc Exp Recurse: ERROR. Need to stop container\n");
@@ -2867,15 +3287,17 @@ int unfreeze_proc_exp_single_core_mode(struct dilation_task_struct *aTask, s64 e
 		
 		
 		
-		atomic_set(&wake_up_signal_sync_drift[CPUID],0);
+		atomic_set(&exp->chains[CPUID].wake_up_signal_sync_drift,0);
 		PDEBUG_V("TimeKeeper : Unfreeze Proc Exp Recurse: Running next valid task on CPU : %d for lxc : %d\n",CPUID, aTask->linux_task->pid);
 		rem_time  = run_schedule_queue_single_core_mode(aTask, head, rem_time, expected_time);
-		set_all_freeze_times_recurse(aTask->linux_task,start_ns + aTask->running_time - rem_time,aTask->running_time,0);
 		i++;	
 	}while(rem_time > 0 && schedule_list_size(aTask) > 1);
 
-	/* Set all freeze times */
-	set_all_freeze_times_recurse(aTask->linux_task,start_ns + aTask->running_time - rem_time,aTask->running_time,0);
+	/* freeze the container's clock, and stop any process that was woken up during the turn. A turn that ran out of
+	runnable processes stopped early and did not overrun, so it is not charged the overshoot */
+	freeze_container_clock(aTask, start_ns + (rem_time > 0 ? aTask->running_time - rem_time : turn_charge(aTask, aTask->running_time)));
+	stop_container_processes(aTask->linux_task, 0);
+	record_turn_overrun(aTask, start_ns + aTask->running_time - rem_time);
 	
 	}
 	
@@ -2901,177 +3323,54 @@ int unfreeze_proc_exp_single_core_mode(struct dilation_task_struct *aTask, s64 e
 
 
 /***
-Unfreeze process at head of schedule queue of container, run it with possible switches for the run time. Returns the time left in this round.
-***/ 
-int run_schedule_queue_multi_core_mode(struct dilation_task_struct * lxc, lxc_schedule_elem * head, s64 start_time, s64 vt_advance){
-
-	struct list_head *list;
-	struct task_struct * curr_task;
-	struct dilation_task_struct *dilTask;
-	struct task_struct *me;
-	struct task_struct *t;
-	ktime_t ktime;
-	struct timeval ktv;
-	s64 now;
-	s64 timer_fire_time;
-	s64 rem_time;
-	s32 rem;
-	s64 now_ns;
-	s64 last_run_freeze_time;
-	unsigned int sleep_duration = 0;
-	struct poll_helper_struct * helper = NULL;
-	struct select_helper_struct * select_helper = NULL;
-	struct poll_helper_struct * task_poll_helper = NULL;
-	struct select_helper_struct * task_select_helper = NULL;
-	struct sleep_helper_struct * task_sleep_helper = NULL;
-    unsigned long flags;
-    int CPUID = lxc->cpu_assignment - (TOTAL_CPUS - EXP_CPUS);
-    
-    curr_task = head->curr_task;
-	t = curr_task;	
-	timer_fire_time = vt_advance;
-	lxc->last_timer_fire_time = start_time;
-	
-
-	acquire_irq_lock(&t->dialation_lock,flags);
-	task_poll_helper = hmap_get_abs(&poll_process_lookup,t->pid);
-	task_select_helper = hmap_get_abs(&select_process_lookup,t->pid);
-	task_sleep_helper = hmap_get_abs(&sleep_process_lookup,t->pid);
-
-	
-	if(task_poll_helper != NULL){
-		atomic_set(&task_poll_helper->done,1);
-		release_irq_lock(&t->dialation_lock,flags);		
-		wake_up(&task_poll_helper->w_queue);
-		
-	}
-	else if(task_select_helper != NULL){
-		atomic_set(&task_select_helper->done,1);
-		release_irq_lock(&t->dialation_lock,flags);
-		wake_up(&task_select_helper->w_queue);
-		
-	}
-	else if( task_sleep_helper != NULL) {
-	
-		/* Sending a Continue signal here will wake all threads up. We dont want that */
-		atomic_set(&task_sleep_helper->done,1);
-		release_irq_lock(&t->dialation_lock,flags);
-		wake_up(&task_sleep_helper->w_queue);
-	}
-	else 
-   	{	
-		release_irq_lock(&t->dialation_lock,flags);
-	    kill(t, SIGCONT, NULL);
-
-    }
-		
-    lxc->last_run = head; 
-	lxc->last_timer_duration = timer_fire_time;
-	ktime = ktime_set( 0, timer_fire_time );
-	int ret;
-
-	set_current_state(TASK_INTERRUPTIBLE);	
-	if(experiment_type != CS){
-		hrtimer_start(&lxc->timer,ns_to_ktime(ktime_to_ns(ktime_get()) + timer_fire_time) ,HRTIMER_MODE_ABS);
-		schedule();
-	}
-	else{
-		hrtimer_start(&lxc->timer,ktime,HRTIMER_MODE_REL);
-		wait_event_interruptible(lxc->tl->unfreeze_proc_queue,atomic_read(&lxc->tl->hrtimer_done) == 1);
-		atomic_set(&lxc->tl->hrtimer_done,0);
-	}
-	
-	curr_process_finished_flag[CPUID] = 0;
-	set_current_state(TASK_RUNNING);
-		
-	requeue_schedule_list(lxc);
-	t = curr_task;
-	
-    if(find_task_by_pid(head->pid) != NULL) {
-	    kill(t, SIGSTOP, NULL);
-	}
-	
-	return 0;
-
-	
-}
-
-
-
-/***
-Unfreezes the container, then calls unfreeze_children to unfreeze all of the children
+Unfreezes a multi core container: all of its runnable threads run at once on the container's CPUs for its whole turn
+(see run_schedule_queue_group_mode). Whatever virtual time it could not make up in this turn is added to its run time
+in the next round, instead of running it again right away.
 ***/
 int unfreeze_proc_exp_multi_core_mode(struct dilation_task_struct *aTask, s64 expected_time) {
+	struct tk_experiment *exp = aTask->exp;
 	struct timeval now;
-	s64 now_ns;
 	s64 start_ns;
-	struct hrtimer * alt_timer = &aTask->timer;
-	int CPUID = aTask->cpu_assignment - (TOTAL_CPUS - EXP_CPUS);
-	int i = 0;
-	unsigned long flags;
-	struct poll_helper_struct * task_poll_helper = NULL;
-	struct select_helper_struct * task_select_helper = NULL;
-	struct sleep_helper_struct * task_sleep_helper = NULL;
-	s64 virt_time;
-	s64 change_vt;
-	s64 rem_time;
-	unsigned int sleep_duration;
-	s32 rem;
+	int CPUID = aTask->cpu_assignment - exp->cpu_base;
 
-    aTask->last_timer_fire_time = 0;
-    
 	if (aTask->linux_task->freeze_time == 0)
 	{
+		PDEBUG_I("Unfreeze Proc Exp Multi Core: Process not frozen pid: %d dilation %d\n", aTask->linux_task->pid, aTask->linux_task->dilation_factor);
 		return -1;
 	}
-        
-	atomic_set(&wake_up_signal_sync_drift[CPUID],0);
 
-	
-	/* for adding any new tasks that might have been spawned */
-	refresh_lxc_schedule_queue(aTask,aTask->running_time,expected_time); 
-		
-    do_gettimeofday(&now);
-    now_ns = timeval_to_ns(&now);
-    start_ns = now_ns;
-    aTask->wake_up_time = start_ns;
-    
-    /* Set all past physical times */
-    lxc_schedule_elem * head;
+	atomic_set(&exp->chains[CPUID].wake_up_signal_sync_drift,0);
+	aTask->stats.n_thaws++;
 
-    do{
+	/* for adding any new tasks that might have been spawned, unless the sync thread already did it ahead of time */
+	if (aTask->round_prepared)
+		aTask->round_prepared = 0;
+	else
+		refresh_lxc_schedule_queue(aTask,aTask->running_time,expected_time);
 
-	    head = get_next_valid_task(aTask,expected_time);
-	    if(head == NULL){
-		    return 0;
-	    }
-	
-	    atomic_set(&wake_up_signal_sync_drift[CPUID],0);
-	    run_schedule_queue_multi_core_mode(aTask, head, start_ns,aTask->running_time);
-	    i++;
-    }while(i < schedule_list_size(aTask));
+	do_gettimeofday(&now);
+	start_ns = timeval_to_ns(&now);
+	aTask->last_timer_fire_time = 0;
 
-    
-	
-    return 0;
+	run_schedule_queue_group_mode(aTask, start_ns, expected_time);
+	return 0;
 }
 
 
 /***
-Unfreezes the container, then calls unfreeze_children to unfreeze all of the children
+Unfreezes the container, running it on one or on several CPUs depending on the number of vCPUs it was added with.
+Its clock is published in the clock table when the slice starts and when it is over
 ***/
 int unfreeze_proc_exp_recurse(struct dilation_task_struct *aTask, s64 expected_time) {
+	int ret;
 
-	if(experiment_type != CS) {
-		#ifdef MULTI_CORE_NODES
-			return unfreeze_proc_exp_multi_core_mode(aTask,expected_time);
-		#else
-			return unfreeze_proc_exp_single_core_mode(aTask,expected_time);
-		#endif
-	}
-	else{
-		return unfreeze_proc_exp_single_core_mode(aTask,expected_time);
-	}
+	tk_clock_table_publish(aTask, TK_CLOCK_RUNNING);
+	if(aTask->exp->experiment_type != CS && aTask->n_vcpus > 1)
+		ret = unfreeze_proc_exp_multi_core_mode(aTask,expected_time);
+	else
+		ret = unfreeze_proc_exp_single_core_mode(aTask,expected_time);
+	tk_clock_table_publish(aTask, TK_CLOCK_FROZEN);
 
+	return ret;
 }
 
@@ -0,0 +1,370 @@
+#include "dilation_module.h"
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+/***
+Tracks the membership of every container from the scheduler's fork and exit tracepoints. Every schedule queue element
+is indexed by pid in a hashtable. When a member forks (or clones a thread), the fork probe creates and indexes the
+child's element right away and queues it on the container's members_added list; when a member exits, its element is
+queued on members_exited. The sync thread owns the schedule queue, so it moves just those elements in or out of it when
+it refreshes the container (tk_members_apply) instead of walking the container's process tree.
+
+The index also tells which container's clock a task reads (tk_task_virtual_time): the container leader holds the
+authoritative clock. The thread group leaders of the container get a copy at every thaw and freeze, since the patched
+kernel reads a task's virtual time from its group leader, but the other threads of a container are not touched. The
+hooked system calls use it to find the experiment of the calling task (tk_task_experiment).
+
+The probes run for every fork/exit in the system with preemption disabled, so they only do a hash lookup and (for a
+member's fork) an atomic allocation under a spinlock. tk_members_lock protects the index and the pending lists. Clock readers only take the RCU read lock; elements are freed after a grace period.
+***/
+
+#define TK_MEMBER_HASH_BITS 10
+
+static DEFINE_HASHTABLE(tk_members, TK_MEMBER_HASH_BITS);
+static DEFINE_SPINLOCK(tk_members_lock);
+
+/* 1 if the probes are registered, otherwise containers are refreshed every round */
+int tk_task_events_enabled = 0;
+
+
+/***
+Returns the schedule queue element of a task, NULL if it is not a member of any container. Matched on the task rather
+than the pid, an exited element still in the index may carry a pid that was reused since. Must hold tk_members_lock
+***/
+static lxc_schedule_elem * tk_member_lookup(struct task_struct * task) {
+	lxc_schedule_elem * elem;
+
+	hash_for_each_possible(tk_members, elem, member_node, task->pid) {
+		if (elem->curr_task == task)
+			return elem;
+	}
+	return NULL;
+}
+
+/***
+Returns the schedule queue element of a task. Must be in an RCU read side section
+***/
+static lxc_schedule_elem * tk_member_lookup_rcu(struct task_struct * task) {
+	lxc_schedule_elem * elem;
+
+	hash_for_each_possible_rcu(tk_members, elem, member_node, task->pid) {
+		if (elem->curr_task == task)
+			return elem;
+	}
+	return NULL;
+}
+
+/***
+The task_struct holding the clock a task reads: its container's leader if it is (or its thread group leader is)
+a member of a container, otherwise its own thread group leader. Must be in an RCU read side section
+***/
+static struct task_struct * tk_clock_task(struct task_struct * task) {
+	lxc_schedule_elem * elem;
+
+	elem = tk_member_lookup_rcu(task);
+	if (elem == NULL && task->group_leader != task)
+		elem = tk_member_lookup_rcu(task->group_leader);
+	if (elem != NULL)
+		return elem->clock_task;
+	return task->group_leader;
+}
+
+/***
+Current virtual time of a task, derived from its container's clock
+***/
+s64 tk_task_virtual_time(struct task_struct * task, s64 now) {
+	struct task_struct * clock;
+	s64 virt_time;
+
+	rcu_read_lock();
+	clock = tk_clock_task(task);
+	virt_time = vt_virtual_time(now, clock->virt_start_time, clock->freeze_time, clock->past_physical_time, clock->past_virtual_time, clock->dilation_factor);
+	rcu_read_unlock();
+
+	return virt_time;
+}
+
+/***
+Returns 1 if the container (clock) of the task is frozen
+***/
+int tk_task_frozen(struct task_struct * task) {
+	int frozen;
+
+	rcu_read_lock();
+	frozen = tk_clock_task(task)->freeze_time != 0;
+	rcu_read_unlock();
+
+	return frozen;
+}
+
+/***
+The experiment a task is part of, NULL if it is not part of any. A task without an element of its own (one that was
+not a member yet when its container was added) is looked up through its ancestors
+***/
+struct tk_experiment * tk_task_experiment(struct task_struct * task) {
+	lxc_schedule_elem * elem;
+	struct task_struct * t;
+	struct tk_experiment * exp = NULL;
+
+	rcu_read_lock();
+	elem = tk_member_lookup_rcu(task);
+	for (t = task->group_leader; elem == NULL && t->pid > 1; t = rcu_dereference(t->real_parent))
+		elem = tk_member_lookup_rcu(t);
+	if (elem != NULL)
+		exp = elem->exp;
+	rcu_read_unlock();
+
+	return exp;
+}
+
+/***
+Ties an element to its container before it is indexed
+***/
+static void tk_member_init(struct dilation_task_struct * lxc, lxc_schedule_elem * elem) {
+	elem->lxc = lxc;
+	elem->exp = lxc->exp;
+	elem->clock_task = lxc->linux_task;
+	get_task_struct(elem->clock_task);
+}
+
+/***
+Creates the element of a member's new child (process or thread) and queues it for the sync thread. The child is not
+running yet, it inherited the clock fields, CPU mask and policy of its parent
+***/
+static void tk_probe_sched_process_fork(void * data, struct task_struct * parent, struct task_struct * child) {
+	lxc_schedule_elem * parent_elem;
+	lxc_schedule_elem * elem;
+	unsigned long flags;
+
+	/* tasks that were never part of an experiment have never had their virtual start time set */
+	if (parent->virt_start_time == 0)
+		return;
+
+	spin_lock_irqsave(&tk_members_lock, flags);
+	parent_elem = tk_member_lookup(parent);
+	if (parent_elem == NULL)
+		goto out;
+
+	elem = kmalloc(sizeof(lxc_schedule_elem), GFP_ATOMIC);
+	if (elem == NULL) {
+		/* fall back to a walk of the container's process tree */
+		atomic_set(&parent_elem->lxc->members_changed, 1);
+		goto out;
+	}
+	get_task_struct(child);
+	elem->curr_task = child;
+	elem->pid = child->pid;
+	elem->exited = 0;
+	elem->queued = 0;
+	elem->clock_epoch = -1;
+	elem->group_exec_start = -1;
+	tk_member_init(parent_elem->lxc, elem);
+	hash_add_rcu(tk_members, &elem->member_node, elem->pid);
+	list_add_tail(&elem->pending_node, &elem->lxc->members_added);
+out:
+	spin_unlock_irqrestore(&tk_members_lock, flags);
+}
+
+/***
+Marks the exiting task's schedule queue element and queues it for removal. The element keeps its task reference until
+the sync thread removes it from the queue, since the sync thread may be stopping or signalling the task at this very
+moment. An element still on members_added is dropped by tk_members_apply instead
+***/
+static void tk_probe_sched_process_exit(void * data, struct task_struct * p) {
+	lxc_schedule_elem * elem;
+	unsigned long flags;
+
+	if (p->virt_start_time == 0)
+		return;
+
+	spin_lock_irqsave(&tk_members_lock, flags);
+	hash_for_each_possible(tk_members, elem, member_node, p->pid) {
+		if (elem->curr_task == p) {
+			elem->exited = 1;
+			if (elem->queued && list_empty(&elem->pending_node))
+				list_add_tail(&elem->pending_node, &elem->lxc->members_exited);
+		}
+	}
+	spin_unlock_irqrestore(&tk_members_lock, flags);
+}
+
+/***
+Adds a schedule queue element to the membership index. Called from add_to_schedule_list
+***/
+void tk_member_add(struct dilation_task_struct * lxc, lxc_schedule_elem * elem) {
+	unsigned long flags;
+
+	tk_member_init(lxc, elem);
+	spin_lock_irqsave(&tk_members_lock, flags);
+	hash_add_rcu(tk_members, &elem->member_node, elem->pid);
+	spin_unlock_irqrestore(&tk_members_lock, flags);
+}
+
+/***
+Removes a schedule queue element from the membership index and from the pending list it may be on. Must be called
+before the element is freed
+***/
+void tk_member_del(lxc_schedule_elem * elem) {
+	unsigned long flags;
+
+	spin_lock_irqsave(&tk_members_lock, flags);
+	hash_del_rcu(&elem->member_node);
+	list_del_init(&elem->pending_node);
+	spin_unlock_irqrestore(&tk_members_lock, flags);
+}
+
+static void tk_member_free_rcu(struct rcu_head * head) {
+	lxc_schedule_elem * elem = container_of(head, lxc_schedule_elem, rcu);
+
+	put_task_struct(elem->curr_task);
+	put_task_struct(elem->clock_task);
+	kfree(elem);
+}
+
+/***
+Drops the element's task references and frees it once no clock reader can see it anymore
+***/
+void tk_member_free(lxc_schedule_elem * elem) {
+	call_rcu(&elem->rcu, tk_member_free_rcu);
+}
+
+/***
+Moves the members that forked or exited since the last call into or out of the container's schedule queue. Called by
+the sync thread owning the container when it refreshes it
+***/
+void tk_members_apply(struct dilation_task_struct * lxc) {
+	LIST_HEAD(added);
+	LIST_HEAD(exited);
+	lxc_schedule_elem * elem;
+	lxc_schedule_elem * tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&tk_members_lock, flags);
+	list_splice_init(&lxc->members_added, &added);
+	list_splice_init(&lxc->members_exited, &exited);
+	spin_unlock_irqrestore(&tk_members_lock, flags);
+
+	list_for_each_entry_safe(elem, tmp, &exited, pending_node) {
+		PDEBUG_I("Members Apply: Task %d exited. Removing from schedule queue\n", elem->pid);
+		schedule_list_remove(lxc, elem);
+	}
+
+	list_for_each_entry_safe(elem, tmp, &added, pending_node) {
+		/* from here on, an exit queues it on members_exited */
+		spin_lock_irqsave(&tk_members_lock, flags);
+		list_del_init(&elem->pending_node);
+		elem->queued = 1;
+		spin_unlock_irqrestore(&tk_members_lock, flags);
+
+		if (schedule_list_add_member(lxc, elem) != 0) {
+			tk_member_del(elem);
+			tk_member_free(elem);
+		}
+	}
+}
+
+/***
+Frees the members the fork probe created that are still waiting on members_added. They are unindexed under the lock, so
+none of them can fork another one meanwhile. Called when a container is cleaned up, after its schedule queue was emptied
+***/
+void tk_members_drop(struct dilation_task_struct * lxc) {
+	LIST_HEAD(added);
+	lxc_schedule_elem * elem;
+	lxc_schedule_elem * tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&tk_members_lock, flags);
+	list_for_each_entry_safe(elem, tmp, &lxc->members_added, pending_node) {
+		hash_del_rcu(&elem->member_node);
+		list_move_tail(&elem->pending_node, &added);
+	}
+	spin_unlock_irqrestore(&tk_members_lock, flags);
+
+	list_for_each_entry_safe(elem, tmp, &added, pending_node) {
+		list_del_init(&elem->pending_node);
+		tk_member_free(elem);
+	}
+}
+
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,15,0)
+
+/* since 3.15, tracepoints are registered by struct tracepoint, which is looked up by name */
+static struct tracepoint * tp_sched_process_fork;
+static struct tracepoint * tp_sched_process_exit;
+
+static void tk_find_tracepoint(struct tracepoint * tp, void * priv) {
+	if (strcmp(tp->name, "sched_process_fork") == 0)
+		tp_sched_process_fork = tp;
+	else if (strcmp(tp->name, "sched_process_exit") == 0)
+		tp_sched_process_exit = tp;
+}
+
+static int tk_register_probes(void) {
+	int ret;
+
+	for_each_kernel_tracepoint(tk_find_tracepoint, NULL);
+	if (tp_sched_process_fork == NULL || tp_sched_process_exit == NULL)
+		return -EINVAL;
+
+	ret = tracepoint_probe_register(tp_sched_process_fork, tk_probe_sched_process_fork, NULL);
+	if (ret)
+		return ret;
+	ret = tracepoint_probe_register(tp_sched_process_exit, tk_probe_sched_process_exit, NULL);
+	if (ret)
+		tracepoint_probe_unregister(tp_sched_process_fork, tk_probe_sched_process_fork, NULL);
+	return ret;
+}
+
+static void tk_unregister_probes(void) {
+	tracepoint_probe_unregister(tp_sched_process_fork, tk_probe_sched_process_fork, NULL);
+	tracepoint_probe_unregister(tp_sched_process_exit, tk_probe_sched_process_exit, NULL);
+}
+
+#else
+
+static int tk_register_probes(void) {
+	int ret;
+
+	ret = tracepoint_probe_register("sched_process_fork", tk_probe_sched_process_fork, NULL);
+	if (ret)
+		return ret;
+	ret = tracepoint_probe_register("sched_process_exit", tk_probe_sched_process_exit, NULL);
+	if (ret)
+		tracepoint_probe_unregister("sched_process_fork", tk_probe_sched_process_fork, NULL);
+	return ret;
+}
+
+static void tk_unregister_probes(void) {
+	tracepoint_probe_unregister("sched_process_fork", tk_probe_sched_process_fork, NULL);
+	tracepoint_probe_unregister("sched_process_exit", tk_probe_sched_process_exit, NULL);
+}
+
+#endif
+
+
+/***
+Registers the fork/exit probes. If they cannot be registered, containers are refreshed on every slice as before
+***/
+void tk_task_events_init(void) {
+
+	if (tk_register_probes() != 0) {
+		PDEBUG_E("Task Events: Cannot register sched_process_fork/exit probes. Schedule queues are refreshed every round\n");
+		tk_task_events_enabled = 0;
+		return;
+	}
+	tk_task_events_enabled = 1;
+	PDEBUG_A("Task Events: Tracking container membership through sched_process_fork/exit\n");
+}
+
+void tk_task_events_exit(void) {
+
+	if (tk_task_events_enabled) {
+		tk_unregister_probes();
+		tracepoint_synchronize_unregister();
+		tk_task_events_enabled = 0;
+	}
+
+	/* schedule queue elements still waiting for their grace period */
+	rcu_barrier();
+}
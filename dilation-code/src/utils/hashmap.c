@@ -1,10 +1,5 @@
 #include "hashmap.h"
-//#include <stdio.h>
-//#include <stdlib.h>
-#include <linux/string.h>
-#include <linux/module.h>
-#include <linux/kernel.h>
-#include <linux/slab.h>
+#include "../vtcore/vt_compat.h"
 
 
 int default_hash(void * elem){
@@ -2,7 +2,9 @@
 #define __HASHMAP_H
 
 #include "linkedlist.h"
+#ifdef __KERNEL__
 #include <linux/spinlock_types.h>
+#endif
 
 #define DEFAULT_MAP_SIZE 1000
 
@@ -1,10 +1,6 @@
 
 #include "linkedlist.h"
-//#include <stdio.h>
-//#include <stdlib.h>
-#include <linux/module.h>
-#include <linux/kernel.h>
-#include <linux/slab.h>
+#include "../vtcore/vt_compat.h"
 
 int equals(void * elem1, void * elem2){
 
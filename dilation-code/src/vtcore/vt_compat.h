@@ -0,0 +1,48 @@
+#ifndef __VT_COMPAT_H
+#define __VT_COMPAT_H
+
+/***
+Lets the virtual time core (and the utils it depends on) build both inside the kernel module and as a plain
+userspace library (see vtsim/ and preload/). Only the handful of kernel primitives that the core uses are mapped.
+***/
+
+#ifdef __KERNEL__
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef int64_t s64;
+typedef int32_t s32;
+typedef uint64_t u64;
+typedef uint32_t u32;
+
+#define GFP_KERNEL 0
+#define GFP_ATOMIC 0
+#define KERN_INFO ""
+#define KERN_ERR ""
+#define kmalloc(size, flags) malloc(size)
+#define kfree(ptr) free(ptr)
+#define printk printf
+
+static inline s64 div_s64_rem(s64 dividend, s32 divisor, s32 *remainder) {
+	*remainder = dividend % divisor;
+	return dividend / divisor;
+}
+
+static inline s64 div64_s64(s64 dividend, s64 divisor) {
+	return dividend / divisor;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,181 @@
+#include "vt_math.h"
+
+/***
+Returns the virtual time of a clock (the group leader's fields in the module) at physical time now
+***/
+s64 vt_virtual_time(s64 now, s64 virt_start_time, s64 freeze_time, s64 past_physical_time, s64 past_virtual_time, int tdf) {
+	s64 real_running_time;
+	s64 temp_past_physical_time;
+	s64 dilated_running_time;
+	s32 rem;
+
+	real_running_time = now - virt_start_time;
+
+	/* time spent frozen does not count towards virtual time */
+	if (freeze_time != 0)
+		temp_past_physical_time = past_physical_time + (now - freeze_time);
+	else
+		temp_past_physical_time = past_physical_time;
+
+	if (tdf > 0)
+		dilated_running_time = div_s64_rem((real_running_time - temp_past_physical_time)*VT_PRECISION, tdf, &rem) + past_virtual_time;
+	else if (tdf < 0)
+		dilated_running_time = div_s64_rem((real_running_time - temp_past_physical_time)*(tdf*-1), VT_PRECISION, &rem) + past_virtual_time;
+	else
+		dilated_running_time = (real_running_time - temp_past_physical_time) + past_virtual_time;
+
+	return dilated_running_time + virt_start_time;
+}
+
+/***
+How much virtual time should increase at each round, given the quantum (in physical time) of the container with the
+highest TDF
+***/
+s64 vt_expected_increase(s64 quantum, s64 highest_tdf) {
+	s64 expected_increase;
+	s32 rem;
+
+	if (highest_tdf > 0) {
+		expected_increase = div_s64_rem(quantum*VT_PRECISION, highest_tdf, &rem);
+		expected_increase += rem;
+	}
+	else if (highest_tdf == 0)
+		expected_increase = quantum;
+	else
+		expected_increase = div_s64_rem(quantum*(highest_tdf*-1), VT_PRECISION, &rem);
+
+	return expected_increase;
+}
+
+/***
+Given a TDF, determine how long (physical time) a container should be allowed to run in each round so that it
+advances as much virtual time as the leader. Returns -1 if the combination cannot happen once the leader is known
+(the caller then keeps the previous running time)
+***/
+s64 vt_task_runtime(s64 quantum, s64 highest_tdf, int tdf) {
+	s64 temp_proc;
+	s64 temp_high;
+	s32 rem;
+
+	/* temp_proc and temp_high are temporary dilations for the container and leader respectively.
+	this is done just to make sure the Math works (no divide by 0 errors if the TDF is 0, by making the temp TDF 1) */
+	temp_proc = 0;
+	temp_high = 0;
+	if (highest_tdf == 0)
+		temp_high = 1;
+	else if (highest_tdf < 0)
+		temp_high = highest_tdf*-1;
+
+	if (tdf == 0)
+		temp_proc = 1;
+	else if (tdf < 0)
+		temp_proc = tdf*-1;
+
+	/* if the leaders' TDF and the containers TDF are the same, let it run for the full amount (do not need to scale) */
+	if (highest_tdf == tdf)
+		return quantum;
+	if (highest_tdf > 0 && tdf > 0)
+		return (div_s64_rem(quantum, highest_tdf, &rem) + rem)*tdf;
+	if (highest_tdf > 0 && tdf == 0)
+		return div_s64_rem(quantum*VT_PRECISION, highest_tdf, &rem) + rem;
+	if (highest_tdf > 0 && tdf < 0)
+		return div_s64_rem(quantum*VT_PRECISION*VT_PRECISION, highest_tdf*temp_proc, &rem) + rem;
+	if (highest_tdf == 0 && tdf < 0)
+		return div_s64_rem(quantum*VT_PRECISION, temp_proc, &rem) + rem;
+	if (highest_tdf < 0 && tdf < 0)
+		return (div_s64_rem(quantum, temp_proc, &rem) + rem)*temp_high;
+
+	return -1;
+}
+
+/***
+Physical time corresponding to the distance between a virtual time and the expected virtual time. The sign is
+negative when the clock has to catch up, unless invert_ahead is set (CS), in which case it is negative when the
+clock is ahead
+***/
+s64 vt_calculate_change(s64 virt_time, s64 expected_time, int tdf, int invert_ahead) {
+	s64 change = 0;
+	s32 rem;
+
+	if (expected_time - virt_time < 0) {
+		if (tdf > 0)
+			change = div_s64_rem(((expected_time - virt_time)*-1)*tdf, VT_PRECISION, &rem);
+		else if (tdf < 0) {
+			change = div_s64_rem(((expected_time - virt_time)*-1)*VT_PRECISION, tdf*-1, &rem);
+			change += rem;
+		}
+		else
+			change = (expected_time - virt_time)*-1;
+		if (invert_ahead)
+			change *= -1;
+	}
+	else {
+		if (tdf > 0)
+			change = div_s64_rem((expected_time - virt_time)*tdf, VT_PRECISION, &rem);
+		else if (tdf < 0) {
+			change = div_s64_rem((expected_time - virt_time)*VT_PRECISION, tdf*-1, &rem);
+			change += rem;
+		}
+		else
+			change = (expected_time - virt_time);
+		if (!invert_ahead)
+			change *= -1;
+	}
+
+	return change;
+}
+
+/***
+Physical time a container should run in the coming round to bring its virtual time from virt_time to
+expected_time. A container that is already ahead does not run at all
+***/
+s64 vt_slice_runtime(s64 virt_time, s64 expected_time, int tdf) {
+	s32 rem;
+
+	if (virt_time > expected_time)
+		return 0;
+
+	if (tdf > 0)
+		return div_s64_rem((expected_time - virt_time)*tdf, VT_PRECISION, &rem);
+
+	return expected_time - virt_time;
+}
+
+/***
+Physical time a group run of run_time on n_vcpus CPUs is charged: the CPU time all its threads got together plus the
+time its CPUs sat idle because none of them was runnable, per vCPU. So an idle container still moves forward, but time
+other tasks took from its CPUs (timer and signal latency, the sync thread, another container) is not charged. If the
+idle time could not be measured (idle_time < 0) the whole turn is charged
+***/
+s64 vt_group_charge(s64 cpu_time, s64 idle_time, int n_vcpus, s64 run_time) {
+	s64 charge;
+
+	if (idle_time < 0)
+		return run_time;
+	if (n_vcpus < 1)
+		n_vcpus = 1;
+
+	charge = div64_s64(cpu_time + idle_time, n_vcpus);
+	if (charge > run_time)
+		charge = run_time;
+	if (charge < 0)
+		charge = 0;
+	return charge;
+}
+
+/***
+Overrun feedback for a container: err is how much longer than the slice it was meant to have the container ran in its
+last turn, i.e. its measured overrun past the requested end minus the overshoot the slice was cut short by (negative if
+it stopped early). Integrating it learns a systematic overrun (hrtimer lateness, signal latency) within a few rounds
+while random noise is smoothed out. The estimate stays within +-limit, the physical length of one round
+***/
+s64 vt_overshoot_update(s64 overshoot, s64 err, s64 limit) {
+	s32 rem;
+
+	overshoot += div_s64_rem(err, 1 << VT_OVERSHOOT_SHIFT, &rem);
+	if (overshoot > limit)
+		return limit;
+	if (overshoot < -limit)
+		return -limit;
+	return overshoot;
+}
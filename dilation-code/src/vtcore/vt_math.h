@@ -0,0 +1,24 @@
+#ifndef __VT_MATH_H
+#define __VT_MATH_H
+
+#include "vt_compat.h"
+
+/* TDFs are stored scaled by VT_PRECISION (2.0 -> 2000, 0.5 -> -2000, 1.0 -> 0 or 1000) */
+#define VT_PRECISION 1000
+
+/* weight of a new residual in the overrun estimate of vt_overshoot_update: 1/2^VT_OVERSHOOT_SHIFT */
+#define VT_OVERSHOOT_SHIFT 3
+
+/***
+Virtual time math shared by the kernel module and the userspace simulator. Everything here works on plain
+values so it can be exercised without a patched kernel.
+***/
+s64 vt_virtual_time(s64 now, s64 virt_start_time, s64 freeze_time, s64 past_physical_time, s64 past_virtual_time, int tdf);
+s64 vt_expected_increase(s64 quantum, s64 highest_tdf);
+s64 vt_task_runtime(s64 quantum, s64 highest_tdf, int tdf);
+s64 vt_calculate_change(s64 virt_time, s64 expected_time, int tdf, int invert_ahead);
+s64 vt_slice_runtime(s64 virt_time, s64 expected_time, int tdf);
+s64 vt_group_charge(s64 cpu_time, s64 idle_time, int n_vcpus, s64 run_time);
+s64 vt_overshoot_update(s64 overshoot, s64 err, s64 limit);
+
+#endif
@@ -0,0 +1,119 @@
+#include "vt_sched.h"
+
+/* CFS load weights of static priorities 100 (nice -20) to 139 (nice 19), each nice level is worth ~10% of CPU */
+static const s64 vt_prio_to_weight[40] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	9548, 7620, 6100, 4904, 3906,
+	3121, 2501, 1991, 1586, 1277,
+	1024, 820, 655, 526, 423,
+	335, 272, 215, 172, 137,
+	110, 87, 70, 56, 45,
+	36, 29, 23, 18, 15,
+};
+
+/***
+Load weight of a thread. Real time threads (static priority < 100) are weighted like nice -20 threads
+***/
+s64 vt_sched_weight(int static_priority) {
+	if (static_priority < 100)
+		return vt_prio_to_weight[0];
+	if (static_priority > 139)
+		return vt_prio_to_weight[39];
+	return vt_prio_to_weight[static_priority - 100];
+}
+
+/***
+Length of a slice in a container with the given TDF. The granularity is scaled by the TDF, like the container's run
+time in a round, so a slice always covers the same amount of virtual time
+***/
+s64 vt_sched_granularity(int tdf, s64 granularity, s64 time_scale) {
+	s64 scale;
+	s32 rem;
+
+	scale = div_s64_rem(tdf, 1000, &rem);
+	if (scale <= 0)
+		scale = 1;
+	return granularity*scale*time_scale;
+}
+
+/***
+New threads start at the container's min_vruntime, so they neither starve the threads already there nor get starved
+***/
+void vt_sched_entity_init(struct vt_sched_entity * se, int static_priority, s64 min_vruntime) {
+	se->static_priority = static_priority;
+	se->weight = vt_sched_weight(static_priority);
+	se->vruntime = min_vruntime;
+	se->duration_left = 0;
+}
+
+void vt_sched_reweight(struct vt_sched_entity * se, int static_priority) {
+	if (se->static_priority == static_priority)
+		return;
+	se->static_priority = static_priority;
+	se->weight = vt_sched_weight(static_priority);
+}
+
+/***
+Picks the runnable entity with the lowest vruntime and gives it a new slice if its last one was used up. A thread
+that was not runnable for a while is placed at most one slice behind min_vruntime, so a long sleep does not let it
+monopolize the container afterwards. Returns NULL if no entity is runnable
+***/
+struct vt_sched_entity * vt_sched_pick(llist * queue, s64 * min_vruntime, s64 slice, int (*runnable)(void * item, void * arg), void * arg) {
+	llist_elem * curr;
+	struct vt_sched_entity * se;
+	struct vt_sched_entity * best = NULL;
+
+	for (curr = queue->head; curr != NULL; curr = curr->next) {
+		se = curr->item;
+		if (runnable != NULL && !runnable(curr->item, arg))
+			continue;
+		if (best == NULL || se->vruntime < best->vruntime)
+			best = se;
+	}
+
+	if (best == NULL)
+		return NULL;
+
+	if (best->vruntime < *min_vruntime - slice)
+		best->vruntime = *min_vruntime - slice;
+	if (best->vruntime > *min_vruntime)
+		*min_vruntime = best->vruntime;
+	if (best->duration_left <= 0)
+		best->duration_left = slice;
+
+	return best;
+}
+
+/***
+Length of the next slice of the picked entity given the physical time left for the container in this round. The time
+that will be left after the slice is stored in rem_time. Returns 0 if nothing can run
+***/
+s64 vt_sched_slice(struct vt_sched_entity * se, s64 remaining_run_time, s64 * rem_time) {
+	if (se->duration_left <= 0 || remaining_run_time <= 0) {
+		*rem_time = remaining_run_time;
+		return 0;
+	}
+
+	if (se->duration_left < remaining_run_time) {
+		*rem_time = remaining_run_time - se->duration_left;
+		return se->duration_left;
+	}
+
+	*rem_time = 0;
+	return remaining_run_time;
+}
+
+/***
+Charges a finished slice to an entity's vruntime. Returns 1 if its slice is used up, i.e. another thread may be
+picked next
+***/
+int vt_sched_account(struct vt_sched_entity * se, s64 ran) {
+	se->vruntime += div64_s64(ran*VT_NICE_0_WEIGHT, se->weight);
+	se->duration_left = se->duration_left - ran;
+	if (se->duration_left <= 0) {
+		se->duration_left = 0;
+		return 1;
+	}
+	return 0;
+}
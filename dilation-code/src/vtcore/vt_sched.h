@@ -0,0 +1,31 @@
+#ifndef __VT_SCHED_H
+#define __VT_SCHED_H
+
+#include "vt_compat.h"
+#include "../utils/linkedlist.h"
+
+/* load weight of a nice 0 thread, vruntime advances at the physical rate for it */
+#define VT_NICE_0_WEIGHT 1024
+
+/***
+Per-thread scheduling state inside a container. Threads are scheduled like CFS does: each one accumulates virtual
+runtime (physical run time scaled by NICE_0 weight / its weight) and the runnable thread with the lowest vruntime
+runs next for one slice. The slice length (granularity) is independent of the weights, which only decide how often a
+thread gets picked. The schedule queue items must start with their vt_sched_entity.
+***/
+struct vt_sched_entity {
+	s64 vruntime;					// weighted physical time the thread has run for
+	s64 weight;						// CFS load weight of the thread's static priority
+	s64 duration_left;				// what is left of the slice the thread got when it was picked
+	int static_priority;
+};
+
+s64 vt_sched_weight(int static_priority);
+s64 vt_sched_granularity(int tdf, s64 granularity, s64 time_scale);
+void vt_sched_entity_init(struct vt_sched_entity * se, int static_priority, s64 min_vruntime);
+void vt_sched_reweight(struct vt_sched_entity * se, int static_priority);
+struct vt_sched_entity * vt_sched_pick(llist * queue, s64 * min_vruntime, s64 slice, int (*runnable)(void * item, void * arg), void * arg);
+s64 vt_sched_slice(struct vt_sched_entity * se, s64 remaining_run_time, s64 * rem_time);
+int vt_sched_account(struct vt_sched_entity * se, s64 ran);
+
+#endif
@@ -0,0 +1,469 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "TimeKeeper_functions.h"
+#include "TimeKeeper_definitions.h"
+#include "utility_functions.h"
+
+/*
+Round throughput of TimeKeeper as the number of containers grows. For every container count of the sweep it spawns
+that many containers (processes) with a number of threads each running a CPU, sleep or socket pattern, runs them in
+a CBE and/or CS experiment and reports:
+	rounds_per_sec     - rounds completed per second of wall time
+	barrier_latency    - round wall time (seen from userspace) minus the longest chain's run time (CBE)
+	overhead_pct       - share of the round wall time not spent running containers
+	vt_drift           - spread of the containers' virtual times at the round barrier
+Needs root and the TimeKeeper module. Results are written as JSON.
+
+	sudo ./bin/scale_bench -n 1,10,50,100,200 -m 4 -p mixed -e both -o scale.json
+*/
+
+#define MAX_POINTS 32
+#define MAX_CONTAINERS 4096
+#define STATUS_BUF_SIZE (1 << 20)
+
+#define PATTERN_CPU 0
+#define PATTERN_SLEEP 1
+#define PATTERN_SOCKET 2
+#define PATTERN_MIXED 3
+
+struct bench_config {
+	int counts[MAX_POINTS];
+	int n_counts;
+	int n_threads;
+	int pattern;
+	double tdf;
+	long timeslice;				// CBE: physical run time of every container per round (ns)
+	int interval;				// CS: virtual time every container advances per round (us)
+	int n_timelines;
+	int exp_cpus;
+	int rounds;
+	int warmup;
+	int run_cbe;
+	int run_cs;
+};
+
+struct round_sample {
+	long long wall;
+	long long max_chain;
+	long long vt_spread;
+};
+
+static struct bench_config cfg;
+static char * status_buf;
+
+static long long now_ns() {
+	struct timespec ts;
+	/* only called from the controller, which is never dilated */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void * thread_cpu(void * arg) {
+	volatile unsigned long x = 0;
+
+	(void)arg;
+	while (1) {
+		x++;
+	}
+	return NULL;
+}
+
+static void * thread_sleep(void * arg) {
+	(void)arg;
+	while (1) {
+		usleep(1000);
+	}
+	return NULL;
+}
+
+/*
+Sends a datagram to itself over loopback and waits for it with poll, so every iteration goes through the dilated poll path
+*/
+static void * thread_socket(void * arg) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	struct pollfd pfd;
+	char buf[64];
+	int fd;
+
+	(void)arg;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	getsockname(fd, (struct sockaddr *)&addr, &len);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (1) {
+		sendto(fd, "ping", 4, 0, (struct sockaddr *)&addr, sizeof(addr));
+		if (poll(&pfd, 1, 10) > 0)
+			recv(fd, buf, sizeof(buf), 0);
+	}
+	return NULL;
+}
+
+static void * (*pattern_fn(int idx))(void *) {
+	int pattern = cfg.pattern == PATTERN_MIXED ? idx % 3 : cfg.pattern;
+
+	if (pattern == PATTERN_SLEEP)
+		return thread_sleep;
+	if (pattern == PATTERN_SOCKET)
+		return thread_socket;
+	return thread_cpu;
+}
+
+/*
+Forks a container with cfg.n_threads threads. The container's main thread runs the pattern of thread 0
+*/
+static pid_t spawn_container() {
+	pthread_t tid;
+	pid_t pid;
+	int i;
+
+	pid = fork();
+	if (pid != 0)
+		return pid;
+
+	for (i = 1; i < cfg.n_threads; i++)
+		pthread_create(&tid, NULL, pattern_fn(i), NULL);
+	pattern_fn(0)(NULL);
+	exit(0);
+}
+
+static void kill_containers(pid_t * pids, int n) {
+	int i;
+	int status;
+
+	for (i = 0; i < n; i++)
+		kill(pids[i], SIGKILL);
+	for (i = 0; i < n; i++)
+		waitpid(pids[i], &status, 0);
+}
+
+/*
+Parses /proc/dilation/status: the longest last round time of any chain, the number of chains and the spread of the
+containers' virtual times
+*/
+static void read_status(long long * max_chain, int * n_chains, long long * vt_spread) {
+	FILE * fp;
+	size_t n;
+	char * line;
+	char * save;
+	int section = 0;
+	long long vt_min = 0, vt_max = 0, vt, round_time;
+	int pid, cpu, tdf, chain, first = 1;
+	long long rounds;
+
+	*max_chain = 0;
+	*n_chains = 0;
+	*vt_spread = 0;
+
+	fp = fopen("/proc/dilation/status", "r");
+	if (fp == NULL)
+		return;
+	n = fread(status_buf, 1, STATUS_BUF_SIZE - 1, fp);
+	status_buf[n] = '\0';
+	fclose(fp);
+
+	for (line = strtok_r(status_buf, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+		if (strncmp(line, "containers:", 11) == 0) { section = 1; continue; }
+		if (strncmp(line, "chains:", 7) == 0) { section = 2; continue; }
+		if (strncmp(line, "round_error:", 12) == 0) { section = 0; continue; }
+
+		if (section == 1 && sscanf(line, "%d %d %d %lld", &pid, &cpu, &tdf, &vt) == 4) {
+			if (first || vt < vt_min) vt_min = vt;
+			if (first || vt > vt_max) vt_max = vt;
+			first = 0;
+		}
+		else if (section == 2 && sscanf(line, "%d %lld %lld", &chain, &rounds, &round_time) == 3) {
+			(*n_chains)++;
+			if (round_time > *max_chain)
+				*max_chain = round_time;
+		}
+	}
+	*vt_spread = vt_max - vt_min;
+}
+
+static int cmp_ll(const void * a, const void * b) {
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*
+Summarises the round samples of one data point and prints its JSON object
+*/
+static void report(FILE * out, int * first, const char * mode, int n, struct round_sample * samples, int n_samples,
+		long long ideal, int n_chains, ioctl_args * stats) {
+	long long * walls;
+	double wall_sum = 0, barrier_sum = 0, spread_sum = 0;
+	long long spread_max = 0;
+	int i;
+
+	walls = malloc(sizeof(long long)*n_samples);
+	for (i = 0; i < n_samples; i++) {
+		walls[i] = samples[i].wall;
+		wall_sum += samples[i].wall;
+		if (samples[i].max_chain > 0)
+			barrier_sum += samples[i].wall - samples[i].max_chain;
+		spread_sum += samples[i].vt_spread;
+		if (samples[i].vt_spread > spread_max)
+			spread_max = samples[i].vt_spread;
+	}
+	qsort(walls, n_samples, sizeof(long long), cmp_ll);
+
+	fprintf(out, "%s\n    {\"mode\": \"%s\", \"containers\": %d, \"threads\": %d, \"chains\": %d, \"rounds\": %d, "
+		"\"rounds_per_sec\": %.2f, \"round_wall_mean_ns\": %.0f, \"round_wall_p50_ns\": %lld, \"round_wall_p99_ns\": %lld, "
+		"\"barrier_latency_mean_ns\": %.0f, \"overhead_pct\": %.3f, \"vt_drift_mean_ns\": %.0f, \"vt_drift_max_ns\": %lld, "
+		"\"round_error_mean_ns\": %.0f, \"timer_lateness_mean_ns\": %.0f}",
+		*first ? "" : ",", mode, n, cfg.n_threads, n_chains, n_samples,
+		wall_sum > 0 ? n_samples/(wall_sum/1e9) : 0.0, wall_sum/n_samples, walls[n_samples/2], walls[(int)((n_samples - 1)*0.99)],
+		strcmp(mode, "cbe") == 0 ? barrier_sum/n_samples : 0.0,
+		wall_sum > 0 ? 100.0*(wall_sum - (double)ideal*n_samples)/wall_sum : 0.0,
+		spread_sum/n_samples, spread_max,
+		stats->n_rounds ? (double)stats->round_error/stats->n_rounds : 0.0,
+		stats->n_timer_fires ? (double)stats->timer_lateness/stats->n_timer_fires : 0.0);
+	fflush(out);
+	*first = 0;
+	free(walls);
+}
+
+static void run_cbe(FILE * out, int * first, int n) {
+	pid_t * pids;
+	struct round_sample * samples;
+	ioctl_args stats;
+	long long t0, per_chain;
+	int n_chains = cfg.exp_cpus;
+	int i;
+
+	pids = malloc(sizeof(pid_t)*n);
+	samples = calloc(cfg.rounds, sizeof(struct round_sample));
+
+	for (i = 0; i < n; i++) {
+		pids[i] = spawn_container();
+		dilate_all(pids[i], cfg.tdf);
+		addToExp(pids[i], -1);
+	}
+	setCBETimeslice(cfg.timeslice);
+	synchronizeAndFreeze();
+	sleep(1);
+	startExp();
+
+	progressExpCBE(cfg.warmup);
+	getExpStats(&stats);
+
+	for (i = 0; i < cfg.rounds; i++) {
+		t0 = now_ns();
+		progressExpCBE(1);
+		samples[i].wall = now_ns() - t0;
+		read_status(&samples[i].max_chain, &n_chains, &samples[i].vt_spread);
+	}
+	memset(&stats, 0, sizeof(stats));
+	getExpStats(&stats);
+
+	resumeExpCBE();
+	stopExp();
+	sleep(1);
+	kill_containers(pids, n);
+
+	if (n_chains <= 0)
+		n_chains = cfg.exp_cpus;
+	/* all containers have the same TDF, so each one runs for one timeslice per round */
+	per_chain = (n + n_chains - 1)/n_chains;
+	report(out, first, "cbe", n, samples, cfg.rounds, per_chain*cfg.timeslice, n_chains, &stats);
+	fprintf(stderr, "scale_bench: cbe with %d containers done\n", n);
+
+	free(pids);
+	free(samples);
+}
+
+static pthread_barrier_t round_start;
+static pthread_barrier_t round_end;
+
+static void * cs_timeline_driver(void * arg) {
+	int timeline = (int)(long)arg;
+	int i;
+
+	for (i = 0; i < cfg.warmup + cfg.rounds; i++) {
+		pthread_barrier_wait(&round_start);
+		progress(timeline, 0);
+		pthread_barrier_wait(&round_end);
+	}
+	return NULL;
+}
+
+static void run_cs(FILE * out, int * first, int n) {
+	pid_t * pids;
+	pthread_t * drivers;
+	struct round_sample * samples;
+	ioctl_args stats;
+	long long t0, ideal, per_timeline, timelines_per_cpu;
+	int n_tl = cfg.n_timelines < n ? cfg.n_timelines : n;
+	int n_chains;
+	long long max_chain;
+	int i;
+
+	pids = malloc(sizeof(pid_t)*n);
+	drivers = malloc(sizeof(pthread_t)*n_tl);
+	samples = calloc(cfg.rounds, sizeof(struct round_sample));
+
+	for (i = 0; i < n; i++) {
+		pids[i] = spawn_container();
+		dilate_all(pids[i], cfg.tdf);
+		addToExp(pids[i], i % n_tl);
+	}
+	synchronizeAndFreeze();
+	for (i = 0; i < n; i++)
+		setInterval(pids[i], cfg.interval, i % n_tl);
+
+	pthread_barrier_init(&round_start, NULL, n_tl + 1);
+	pthread_barrier_init(&round_end, NULL, n_tl + 1);
+	for (i = 0; i < n_tl; i++)
+		pthread_create(&drivers[i], NULL, cs_timeline_driver, (void *)(long)i);
+
+	for (i = 0; i < cfg.warmup; i++) {
+		pthread_barrier_wait(&round_start);
+		pthread_barrier_wait(&round_end);
+	}
+	getExpStats(&stats);
+
+	for (i = 0; i < cfg.rounds; i++) {
+		t0 = now_ns();
+		pthread_barrier_wait(&round_start);
+		pthread_barrier_wait(&round_end);
+		samples[i].wall = now_ns() - t0;
+		read_status(&max_chain, &n_chains, &samples[i].vt_spread);
+	}
+	memset(&stats, 0, sizeof(stats));
+	getExpStats(&stats);
+
+	for (i = 0; i < n_tl; i++)
+		pthread_join(drivers[i], NULL);
+	pthread_barrier_destroy(&round_start);
+	pthread_barrier_destroy(&round_end);
+
+	stopExp();
+	sleep(1);
+	kill_containers(pids, n);
+
+	/* every container of a timeline runs interval * tdf of physical time, timelines on the same cpu run one after the other */
+	per_timeline = (n + n_tl - 1)/n_tl;
+	timelines_per_cpu = (n_tl + cfg.exp_cpus - 1)/cfg.exp_cpus;
+	ideal = (long long)(per_timeline*timelines_per_cpu*cfg.interval*1000LL*(cfg.tdf < 1.0 ? 1.0 : cfg.tdf));
+	report(out, first, "cs", n, samples, cfg.rounds, ideal, cfg.exp_cpus, &stats);
+	fprintf(stderr, "scale_bench: cs with %d containers done\n", n);
+
+	free(pids);
+	free(drivers);
+	free(samples);
+}
+
+static void usage(char * prog) {
+	fprintf(stderr, "Usage: %s [-n count,count,...] [-m threads per container] [-p cpu|sleep|socket|mixed]\n"
+		"\t[-d tdf] [-q CBE timeslice ns] [-i CS interval us] [-l CS timelines] [-c experiment cpus]\n"
+		"\t[-r rounds] [-w warmup rounds] [-e cbe|cs|both] [-o output file, - for stdout]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char * argv[]) {
+	char * out_path = "scale_bench.json";
+	FILE * out;
+	char * tok;
+	int first = 1;
+	int opt;
+	int i;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.counts[0] = 1; cfg.counts[1] = 10; cfg.counts[2] = 50; cfg.counts[3] = 100;
+	cfg.n_counts = 4;
+	cfg.n_threads = 2;
+	cfg.pattern = PATTERN_CPU;
+	cfg.tdf = 1.0;
+	cfg.timeslice = 1000000;
+	cfg.interval = 1000;
+	cfg.n_timelines = 2;
+	cfg.exp_cpus = 2;
+	cfg.rounds = 200;
+	cfg.warmup = 10;
+	cfg.run_cbe = 1;
+
+	while ((opt = getopt(argc, argv, "n:m:p:d:q:i:l:c:r:w:e:o:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				cfg.n_counts = 0;
+				for (tok = strtok(optarg, ","); tok != NULL && cfg.n_counts < MAX_POINTS; tok = strtok(NULL, ","))
+					cfg.counts[cfg.n_counts++] = atoi(tok);
+				break;
+			case 'm': cfg.n_threads = atoi(optarg); break;
+			case 'p':
+				if (strcmp(optarg, "sleep") == 0) cfg.pattern = PATTERN_SLEEP;
+				else if (strcmp(optarg, "socket") == 0) cfg.pattern = PATTERN_SOCKET;
+				else if (strcmp(optarg, "mixed") == 0) cfg.pattern = PATTERN_MIXED;
+				else cfg.pattern = PATTERN_CPU;
+				break;
+			case 'd': cfg.tdf = atof(optarg); break;
+			case 'q': cfg.timeslice = atol(optarg); break;
+			case 'i': cfg.interval = atoi(optarg); break;
+			case 'l': cfg.n_timelines = atoi(optarg); break;
+			case 'c': cfg.exp_cpus = atoi(optarg); break;
+			case 'r': cfg.rounds = atoi(optarg); break;
+			case 'w': cfg.warmup = atoi(optarg); break;
+			case 'e':
+				cfg.run_cbe = strcmp(optarg, "cs") != 0;
+				cfg.run_cs = strcmp(optarg, "cbe") != 0;
+				break;
+			case 'o': out_path = optarg; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (cfg.n_counts <= 0 || cfg.n_threads <= 0 || cfg.rounds <= 0 || cfg.warmup <= 0 || cfg.n_timelines <= 0 || cfg.exp_cpus <= 0)
+		usage(argv[0]);
+	for (i = 0; i < cfg.n_counts; i++) {
+		if (cfg.counts[i] <= 0 || cfg.counts[i] > MAX_CONTAINERS)
+			usage(argv[0]);
+	}
+
+	if (!is_root() || !isModuleLoaded())
+		return 1;
+
+	out = strcmp(out_path, "-") == 0 ? stdout : fopen(out_path, "w");
+	status_buf = malloc(STATUS_BUF_SIZE);
+	if (out == NULL || status_buf == NULL) {
+		perror("scale_bench");
+		return 1;
+	}
+
+	fprintf(out, "{\n  \"benchmark\": \"scale_bench\",\n  \"threads_per_container\": %d,\n  \"pattern\": %d,\n  \"tdf\": %.3f,\n"
+		"  \"timeslice_ns\": %ld,\n  \"interval_us\": %d,\n  \"timelines\": %d,\n  \"results\": [",
+		cfg.n_threads, cfg.pattern, cfg.tdf, cfg.timeslice, cfg.interval, cfg.n_timelines);
+
+	for (i = 0; i < cfg.n_counts; i++) {
+		if (cfg.run_cbe)
+			run_cbe(out, &first, cfg.counts[i]);
+		if (cfg.run_cs)
+			run_cs(out, &first, cfg.counts[i]);
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout)
+		fclose(out);
+	free(status_buf);
+	return 0;
+}
@@ -0,0 +1,374 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "TimeKeeper_functions.h"
+#include "TimeKeeper_definitions.h"
+#include "utility_functions.h"
+
+/*
+Per-call latency distributions of the system calls TimeKeeper hooks or dilates. Every call is measured in three cases:
+	plain   - a normal process, no experiment
+	dilated - a process with a TDF, outside any experiment
+	cbe     - a process inside a running CBE experiment, for every TDF of the matrix
+The dilated and cbe cases need root and a loaded module, otherwise they are reported as skipped.
+
+Latencies are taken from the TSC (calibrated against CLOCK_MONOTONIC before any process is dilated), so they are
+physical time even when the process' own clocks are dilated. Results are written as JSON.
+
+	sudo ./bin/syscall_bench -n 100000 -s 1000 -t 1,2,4 -o results.json
+*/
+
+#define MAX_TDFS 16
+#define RESULT_SIZE 16384
+#define SLEEP_NS 1000
+#define POLL_TIMEOUT_MS 1
+
+enum bench_call {
+	CALL_CLOCK_GETTIME,
+	CALL_GETTIMEOFDAY,
+	CALL_NANOSLEEP,
+	CALL_CLOCK_NANOSLEEP,
+	CALL_POLL,
+	CALL_SELECT,
+	CALL_EPOLL_WAIT,
+	CALL_TIMERFD,
+	N_CALLS
+};
+
+static const char * call_names[N_CALLS] = {
+	"clock_gettime", "gettimeofday", "nanosleep", "clock_nanosleep", "poll", "select", "epoll_wait", "timerfd"
+};
+
+/* calls that block for SLEEP_NS get the smaller iteration count */
+static const int call_sleeps[N_CALLS] = { 0, 0, 1, 1, 0, 0, 0, 1 };
+
+static int n_fast = 100000;
+static int n_slow = 1000;
+static double ns_per_tick = 1.0;
+
+static inline uint64_t bench_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+	__asm__ __volatile__ ("rdtscp" : "=a"(lo), "=d"(hi) : : "rcx");
+	return ((uint64_t)hi << 32) | lo;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+Number of nanoseconds per tick. Must run before the process is dilated
+*/
+static void calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+	struct timespec start, end, req;
+	uint64_t t_start, t_end;
+
+	req.tv_sec = 0;
+	req.tv_nsec = 200000000;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	t_start = bench_ticks();
+	nanosleep(&req, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	t_end = bench_ticks();
+	ns_per_tick = ((end.tv_sec - start.tv_sec)*1e9 + (end.tv_nsec - start.tv_nsec)) / (double)(t_end - t_start);
+#endif
+}
+
+static int cmp_u64(const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static uint64_t percentile(uint64_t * samples, int n, double p) {
+	int idx = (int)(p*(n - 1));
+	return samples[idx];
+}
+
+/*
+Runs one call n times and appends its JSON summary to out
+*/
+static void bench_call(int call, int n, char * out, size_t out_size) {
+	uint64_t * samples;
+	uint64_t t0, t1;
+	struct timespec ts, req;
+	struct timeval tv;
+	struct pollfd pfd;
+	struct epoll_event ev;
+	struct itimerspec its;
+	uint64_t expirations;
+	fd_set rfds;
+	int pipefd[2];
+	int epfd = -1;
+	int tfd = -1;
+	int i;
+	double sum = 0;
+	size_t len;
+
+	samples = malloc(sizeof(uint64_t)*n);
+	if (samples == NULL)
+		return;
+
+	/* a pipe that is always readable, so poll/select/epoll go through the timeout handling but return immediately */
+	if (pipe(pipefd) == -1) {
+		free(samples);
+		return;
+	}
+	write(pipefd[1], "x", 1);
+	epfd = epoll_create1(0);
+	ev.events = EPOLLIN;
+	ev.data.fd = pipefd[0];
+	epoll_ctl(epfd, EPOLL_CTL_ADD, pipefd[0], &ev);
+	tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+
+	req.tv_sec = 0;
+	req.tv_nsec = SLEEP_NS;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_nsec = SLEEP_NS;
+
+	for (i = 0; i < n; i++) {
+		switch (call) {
+			case CALL_CLOCK_GETTIME:
+				t0 = bench_ticks();
+				clock_gettime(CLOCK_REALTIME, &ts);
+				t1 = bench_ticks();
+				break;
+			case CALL_GETTIMEOFDAY:
+				t0 = bench_ticks();
+				gettimeofday(&tv, NULL);
+				t1 = bench_ticks();
+				break;
+			case CALL_NANOSLEEP:
+				t0 = bench_ticks();
+				nanosleep(&req, NULL);
+				t1 = bench_ticks();
+				break;
+			case CALL_CLOCK_NANOSLEEP:
+				t0 = bench_ticks();
+				clock_nanosleep(CLOCK_MONOTONIC, 0, &req, NULL);
+				t1 = bench_ticks();
+				break;
+			case CALL_POLL:
+				pfd.fd = pipefd[0];
+				pfd.events = POLLIN;
+				t0 = bench_ticks();
+				poll(&pfd, 1, POLL_TIMEOUT_MS);
+				t1 = bench_ticks();
+				break;
+			case CALL_SELECT:
+				FD_ZERO(&rfds);
+				FD_SET(pipefd[0], &rfds);
+				tv.tv_sec = 0;
+				tv.tv_usec = POLL_TIMEOUT_MS*1000;
+				t0 = bench_ticks();
+				select(pipefd[0] + 1, &rfds, NULL, NULL, &tv);
+				t1 = bench_ticks();
+				break;
+			case CALL_EPOLL_WAIT:
+				t0 = bench_ticks();
+				epoll_wait(epfd, &ev, 1, POLL_TIMEOUT_MS);
+				t1 = bench_ticks();
+				break;
+			case CALL_TIMERFD:
+				t0 = bench_ticks();
+				timerfd_settime(tfd, 0, &its, NULL);
+				read(tfd, &expirations, sizeof(expirations));
+				t1 = bench_ticks();
+				break;
+			default:
+				t0 = t1 = 0;
+		}
+		samples[i] = (uint64_t)((t1 - t0)*ns_per_tick);
+		sum += samples[i];
+	}
+
+	qsort(samples, n, sizeof(uint64_t), cmp_u64);
+	len = strlen(out);
+	snprintf(out + len, out_size - len,
+		"%s\"%s\": {\"n\": %d, \"min_ns\": %llu, \"mean_ns\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+		call == 0 ? "" : ", ", call_names[call], n, (unsigned long long)samples[0], sum/n,
+		(unsigned long long)percentile(samples, n, 0.50), (unsigned long long)percentile(samples, n, 0.99),
+		(unsigned long long)percentile(samples, n, 0.999), (unsigned long long)samples[n - 1]);
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+	close(epfd);
+	close(tfd);
+	free(samples);
+}
+
+/*
+Body of the measuring child. Waits for the go byte from the controller (sent once the child has been dilated
+and/or added to the experiment), then measures every call and writes the JSON object to the result pipe
+*/
+static void bench_worker(int go_fd, int result_fd) {
+	char * out;
+	char go;
+	int call;
+
+	out = calloc(1, RESULT_SIZE);
+	if (read(go_fd, &go, 1) != 1 || out == NULL)
+		exit(1);
+
+	for (call = 0; call < N_CALLS; call++)
+		bench_call(call, call_sleeps[call] ? n_slow : n_fast, out, RESULT_SIZE);
+
+	write(result_fd, out, strlen(out));
+	exit(0);
+}
+
+/*
+Spinner that keeps a CBE experiment going while the worker measures
+*/
+static pid_t start_spinner() {
+	pid_t pid = fork();
+	if (pid == 0) {
+		while (1) {}
+	}
+	return pid;
+}
+
+/*
+Runs one case and prints its JSON object to out_fp. mode: 0 = plain, 1 = dilated, 2 = cbe
+*/
+static int run_case(FILE * out_fp, const char * name, int mode, double tdf, long timeslice, int first) {
+	int go_pipe[2];
+	int result_pipe[2];
+	char * result;
+	pid_t worker;
+	pid_t spinner = -1;
+	int status;
+	ssize_t n, total = 0;
+
+	if (pipe(go_pipe) == -1 || pipe(result_pipe) == -1)
+		return -1;
+
+	fflush(out_fp);
+	worker = fork();
+	if (worker == 0) {
+		close(go_pipe[1]);
+		close(result_pipe[0]);
+		bench_worker(go_pipe[0], result_pipe[1]);
+	}
+	close(go_pipe[0]);
+	close(result_pipe[1]);
+
+	if (mode >= 1)
+		dilate_all(worker, tdf);
+
+	if (mode == 2) {
+		spinner = start_spinner();
+		dilate_all(spinner, tdf);
+		addToExp(worker, -1);
+		addToExp(spinner, -1);
+		setCBETimeslice(timeslice);
+		synchronizeAndFreeze();
+		sleep(1);
+		startExp();
+	}
+
+	write(go_pipe[1], "g", 1);
+
+	result = calloc(1, RESULT_SIZE);
+	while (result != NULL && (n = read(result_pipe[0], result + total, RESULT_SIZE - 1 - total)) > 0)
+		total += n;
+	waitpid(worker, &status, 0);
+
+	if (mode == 2) {
+		stopExp();
+		sleep(1);
+		kill(spinner, SIGKILL);
+		waitpid(spinner, &status, 0);
+	}
+
+	fprintf(out_fp, "%s\n    {\"case\": \"%s\", \"tdf\": %.3f, \"timeslice_ns\": %ld, \"calls\": {%s}}",
+		first ? "" : ",", name, mode == 0 ? 1.0 : tdf, mode == 2 ? timeslice : 0, total > 0 ? result : "");
+
+	fprintf(stderr, "syscall_bench: finished case %s tdf %.3f\n", name, mode == 0 ? 1.0 : tdf);
+	close(go_pipe[1]);
+	close(result_pipe[0]);
+	free(result);
+	return 0;
+}
+
+static void usage(char * prog) {
+	fprintf(stderr, "Usage: %s [-n iterations of fast calls] [-s iterations of sleeping calls] [-t tdf,tdf,...]\n"
+		"\t[-q CBE timeslice ns] [-o output file, - for stdout]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char * argv[]) {
+	double tdfs[MAX_TDFS] = { 1.0, 2.0, 4.0 };
+	int n_tdfs = 3;
+	long timeslice = 1000000;
+	char * out_path = "syscall_bench.json";
+	FILE * out_fp;
+	char * tok;
+	int can_dilate;
+	int opt;
+	int i;
+	int first = 1;
+
+	while ((opt = getopt(argc, argv, "n:s:t:q:o:h")) != -1) {
+		switch (opt) {
+			case 'n': n_fast = atoi(optarg); break;
+			case 's': n_slow = atoi(optarg); break;
+			case 'q': timeslice = atol(optarg); break;
+			case 'o': out_path = optarg; break;
+			case 't':
+				n_tdfs = 0;
+				for (tok = strtok(optarg, ","); tok != NULL && n_tdfs < MAX_TDFS; tok = strtok(NULL, ","))
+					tdfs[n_tdfs++] = atof(tok);
+				break;
+			default: usage(argv[0]);
+		}
+	}
+	if (n_fast <= 0 || n_slow <= 0 || n_tdfs <= 0)
+		usage(argv[0]);
+
+	out_fp = strcmp(out_path, "-") == 0 ? stdout : fopen(out_path, "w");
+	if (out_fp == NULL) {
+		perror("syscall_bench: output file");
+		return 1;
+	}
+
+	calibrate();
+	can_dilate = geteuid() == 0 && access("/proc/dilation/status", F_OK) != -1;
+
+	fprintf(out_fp, "{\n  \"benchmark\": \"syscall_bench\",\n  \"ns_per_tick\": %.6f,\n  \"iterations_fast\": %d,\n"
+		"  \"iterations_sleep\": %d,\n  \"sleep_ns\": %d,\n  \"poll_timeout_ms\": %d,\n  \"timekeeper\": %s,\n  \"results\": [",
+		ns_per_tick, n_fast, n_slow, SLEEP_NS, POLL_TIMEOUT_MS, can_dilate ? "true" : "false");
+
+	run_case(out_fp, "plain", 0, 1.0, timeslice, first);
+	first = 0;
+
+	if (!can_dilate) {
+		fprintf(stderr, "syscall_bench: needs root and the TimeKeeper module for the dilated and cbe cases, skipping them\n");
+	}
+	else {
+		for (i = 0; i < n_tdfs; i++)
+			run_case(out_fp, "dilated", 1, tdfs[i], timeslice, 0);
+		for (i = 0; i < n_tdfs; i++)
+			run_case(out_fp, "cbe", 2, tdfs[i], timeslice, 0);
+	}
+
+	fprintf(out_fp, "\n  ]\n}\n");
+	if (out_fp != stdout)
+		fclose(out_fp);
+	return 0;
+}
@@ -11,6 +11,10 @@ import os
 from signal import SIGSTOP, SIGCONT
 import time
 import subprocess
+import mmap
+import struct
+import sys
+import threading
 
 TIMEKEEPER_FILE_NAME = "/proc/dilation/status"
 DILATE = 'A'
@@ -32,6 +36,34 @@ SET_CBE_EXP_TIMESLICE = 'T'
 SET_NETDEVICE_OWNER  = 'U'
 PROGRESS_EXP_CBE = 'V'
 RESUME_CBE = 'W'
+RESET_EXP = 'a'
+SET_VT_COMPENSATION = 'b'
+SET_GROUP_RUN = 'Y'
+SET_EXP_CPUS = 'Z'
+EXPERIMENT_PREFIX = '@'
+
+# the experiment commands are sent to, see select_experiment
+TK_EXPERIMENT = 0
+
+# clock table, see tk_clock_table in scripts/TimeKeeper_definitions.h
+CLOCK_TABLE_FILE_NAME = "/proc/dilation/clocks"
+CLOCK_TABLE_MAGIC = 0x544b4354
+CLOCK_TABLE_HEADER = struct.Struct("II56x")
+CLOCK_TABLE_SLOTS = 512
+CLOCK_TABLE_ENTRY = struct.Struct("Iiiiiiqqq16x")
+CLOCK_FREE = 0
+CLOCK_FROZEN = 1
+CLOCK_RUNNING = 2
+CLOCK_EXITED = 3
+
+# native binding of libtimekeeper (scripts/python, make python in scripts), see open_handle
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "../scripts/python"))
+try :
+	import _timekeeper
+except ImportError :
+	_timekeeper = None
+BATCH_SEPARATOR = "\n"
+BATCH_MAXSIZE = 65536
 
 
 
@@ -126,10 +158,31 @@ def send_to_timekeeper(cmd) :
 		print "ERROR sending cmd to timekeeper"
 		return -1
 
+	if TK_EXPERIMENT != 0 :
+		cmd = EXPERIMENT_PREFIX + str(TK_EXPERIMENT) + "," + cmd
+
 	with open(TIMEKEEPER_FILE_NAME,"w") as f :
 		f.write(cmd)
 	return 1
 
+# Selects the experiment the following commands are sent to. Experiment 0 is the default one
+def select_experiment(id) :
+
+	global TK_EXPERIMENT
+	if id < 0 :
+		return -1
+	TK_EXPERIMENT = int(id)
+	return 0
+
+# Sets the CPUs the containers of the selected experiment run on. Must be called before any container is added
+def set_experiment_cpus(first_cpu, n_cpus) :
+
+	if is_root() == 0 or is_Module_Loaded() == 0 :
+		print "ERROR setting experiment CPUs"
+		return -1
+	cmd = SET_EXP_CPUS + "," + str(first_cpu) + "," + str(n_cpus)
+	return send_to_timekeeper(cmd)
+
 # timeslice in nanosecs
 def set_cbe_experiment_timeslice(timeslice) :
 
@@ -145,14 +198,16 @@ def set_cbe_experiment_timeslice(timeslice) :
 
 
 #
-#Given a pid, add that container to a CBE experiment.
+#Given a pid, add that container to a CBE experiment. A container with more than one vCPU spans that many experiment CPUs.
 #
 
-def addToExp(pid) :
+def addToExp(pid, n_vcpus = 1) :
 
 	if is_root() == 0 or is_Module_Loaded() == 0 :
 		return -1 
 	cmd = ADD_TO_EXP_CBE + "," + str(pid)
+	if n_vcpus > 1 :
+		cmd = cmd + "," + str(n_vcpus)
 	return send_to_timekeeper(cmd)
 
 
@@ -363,4 +418,169 @@ def resume_exp_cbe() :
 	else:
 		return -1
 
+#Restarts a synchronized experiment (frozen, or CBE held at the round barrier) at the current time, keeping its
+#containers, sync threads and hooked system calls
+def reset_exp() :
+	if is_root() and is_Module_Loaded() :
+		return send_to_timekeeper(RESET_EXP)
+	else:
+		return -1
+
+#Turns the overrun feedback of a CBE experiment on (1) or off (0): containers that keep running past the end of their
+#slices get them cut short. See the overshoot and residual columns of /proc/dilation/stats
+def set_vt_compensation(enable) :
+	if is_root() and is_Module_Loaded() :
+		cmd = SET_VT_COMPENSATION + "," + str(int(enable))
+		return send_to_timekeeper(cmd)
+	else:
+		return -1
+
+#Maps the container clock table of the module read-only, None if it is not available
+def map_clock_table() :
+	try :
+		fd = os.open(CLOCK_TABLE_FILE_NAME, os.O_RDONLY)
+	except OSError :
+		return None
+	table = mmap.mmap(fd, CLOCK_TABLE_HEADER.size + CLOCK_TABLE_SLOTS*CLOCK_TABLE_ENTRY.size, mmap.MAP_SHARED, mmap.PROT_READ)
+	os.close(fd)
+	if CLOCK_TABLE_HEADER.unpack_from(table, 0)[0] != CLOCK_TABLE_MAGIC :
+		table.close()
+		return None
+	return table
+
+#Reads every container clock of a table mapped with map_clock_table, each one consistent.
+#Returns a list of (pid, experiment, state, tdf, virtual_time, round)
+def read_clock_table(table) :
+	magic, n_slots = CLOCK_TABLE_HEADER.unpack_from(table, 0)
+	clocks = []
+	for i in range(0, n_slots) :
+		offset = CLOCK_TABLE_HEADER.size + i*CLOCK_TABLE_ENTRY.size
+		while True :
+			entry = CLOCK_TABLE_ENTRY.unpack_from(table, offset)
+			if entry[0] & 1 == 0 and struct.unpack_from("I", table, offset)[0] == entry[0] :
+				break
+		seq, pid, experiment, state, tdf, pad, virtual_time, round_number, updated = entry
+		if state != CLOCK_FREE :
+			clocks.append((pid, experiment, state, tdf, virtual_time, round_number))
+	return clocks
+
+
+#
+#Persistent handle on the module with command batching, for when _timekeeper is not built. Same methods as
+#_timekeeper.Handle: the queued commands are written all at once by flush, send writes them together with one more command.
+#Every call takes the handle's lock, so several threads can share one handle
+#
+class Handle :
+
+	def __init__(self, experiment = 0) :
+		if is_root() == 0 or is_Module_Loaded() == 0 :
+			raise IOError("cannot open " + TIMEKEEPER_FILE_NAME)
+		self.fd = os.open(TIMEKEEPER_FILE_NAME, os.O_WRONLY)
+		self.prefix = ""
+		if experiment != 0 :
+			self.prefix = EXPERIMENT_PREFIX + str(experiment) + ","
+		self.batch = []
+		self.batch_len = 0
+		self.lock = threading.RLock()
+
+	def queue(self, cmd) :
+		line = self.prefix + cmd + "," + BATCH_SEPARATOR
+		with self.lock :
+			if self.fd == -1 :
+				raise ValueError("TimeKeeper handle is closed")
+			if self.batch_len + len(line) > BATCH_MAXSIZE :
+				self.flush()
+			self.batch.append(line)
+			self.batch_len += len(line)
+		return 0
+
+	def flush(self) :
+		with self.lock :
+			if self.fd == -1 :
+				raise ValueError("TimeKeeper handle is closed")
+			n = len(self.batch)
+			batch = "".join(self.batch)
+			self.batch = []
+			self.batch_len = 0
+			if n > 0 :
+				os.write(self.fd, batch)
+		return n
+
+	def send(self, cmd) :
+		with self.lock :
+			self.queue(cmd)
+			self.flush()
+		return 0
+
+	def close(self) :
+		with self.lock :
+			if self.fd != -1 :
+				self.flush()
+				os.close(self.fd)
+				self.fd = -1
+		return 0
 
+	def dilate(self, pid, dilation) :
+		dil = fixDilation(dilation)
+		if dil < 0 :
+			return self.queue(DILATE + "," + str(pid) + ",1," + str(-dil))
+		return self.queue(DILATE + "," + str(pid) + "," + str(dil))
+
+	def dilate_all(self, pid, dilation) :
+		dil = fixDilation(dilation)
+		if dil < 0 :
+			return self.queue(DILATE_ALL + "," + str(pid) + ",1," + str(-dil))
+		return self.queue(DILATE_ALL + "," + str(pid) + "," + str(dil))
+
+	def leap(self, pid, interval) :
+		return self.queue(LEAP + "," + str(pid) + "," + str(interval))
+
+	def add_to_exp(self, pid, n_vcpus = 1) :
+		if n_vcpus > 1 :
+			return self.queue(ADD_TO_EXP_CBE + "," + str(pid) + "," + str(n_vcpus))
+		return self.queue(ADD_TO_EXP_CBE + "," + str(pid))
+
+	def add_to_cs_exp(self, pid, timeline) :
+		return self.queue(ADD_TO_EXP_CS + "," + str(pid) + "," + str(timeline))
+
+	def set_interval(self, pid, interval, timeline) :
+		return self.queue(SET_INTERVAL + "," + str(pid) + "," + str(interval) + "," + str(timeline))
+
+	def set_group_run(self, pid, enable) :
+		return self.queue(SET_GROUP_RUN + "," + str(pid) + "," + str(enable))
+
+	def freeze(self, pid) :
+		return self.queue(FREEZE_OR_UNFREEZE + "," + str(pid) + "," + str(int(SIGSTOP)))
+
+	def unfreeze(self, pid) :
+		return self.queue(FREEZE_OR_UNFREEZE + "," + str(pid) + "," + str(int(SIGCONT)))
+
+	def reset_exp(self) :
+		return self.queue(RESET_EXP)
+
+	#containers is a list of (pid, tdf) or (pid, tdf, timeline). The native handle adds them with a single ioctl,
+	#this one queues a dilate_all and an add for each
+	def add_bulk(self, containers) :
+		with self.lock :
+			for c in containers :
+				self.dilate_all(c[0], c[1])
+				if len(c) > 2 and c[2] >= 0 :
+					self.add_to_cs_exp(c[0], c[2])
+				else :
+					self.add_to_exp(c[0])
+			self.flush()
+		return len(containers)
+
+#Opens a persistent handle on the module whose commands go to the given experiment (the selected one by default),
+#the native one if _timekeeper is built. Queue commands on it and flush them at once:
+#	tk = open_handle()
+#	for pid in pids :
+#		tk.dilate(pid, 2.0)
+#		tk.add_to_exp(pid)
+#	tk.flush()
+def open_handle(experiment = None) :
+	if experiment is None :
+		experiment = TK_EXPERIMENT
+	if _timekeeper is not None :
+		return _timekeeper.Handle(experiment)
+	return Handle(experiment)
@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "../src/vtcore/vt_math.h"
+#include "../src/vtcore/vt_sched.h"
+#include "../src/utils/hashmap.h"
+
+/***
+Userspace simulator for the CBE round scheduler. It replays a synthetic container workload through the same virtual
+time math and schedule queue logic the kernel module uses (src/vtcore) and reports the round overhead and the
+virtual time error at round boundaries. Physical time is simulated, so a run of thousands of rounds takes well
+under a second and is deterministic for a given seed.
+
+By default a container is frozen at thaw time + requested run time, as the module stamps it, so hrtimer lateness and
+switch costs only show up in the round overhead and the virtual time error is 0. -a stamps the freeze at the actual end
+of the slice instead, which is what the error figures are meant for:
+
+	./vtsim -n 16 -t 4 -c 2 -r 1000 -d 2000,1000 -l 20000 -s 5000		(round overhead)
+	./vtsim -n 16 -t 4 -c 2 -r 1000 -d 2000,1000 -l 20000 -s 5000 -a	(virtual time error)
+***/
+
+#define PATTERN_CPU 0
+#define PATTERN_SLEEP 1
+#define PATTERN_MIXED 2
+
+#define MAX_TDFS 64
+
+typedef struct sim_thread_struct {
+	struct vt_sched_entity se;		// must stay first, the schedule queue holds sim_thread pointers
+	int pid;
+	int static_priority;
+	int sleeper;
+	int spawn_round;
+} sim_thread;
+
+typedef struct sim_container_struct {
+	int pid;
+	int tdf;
+	int chain;
+
+	/* the container leader's clock, same fields as in the patched task_struct */
+	s64 virt_start_time;
+	s64 freeze_time;
+	s64 past_physical_time;
+	s64 past_virtual_time;
+
+	s64 running_time;
+	s64 overrun;				// how long it ran past the requested end of its last turn, -1 if it did not run
+	s64 overshoot;				// learned overrun its slices are cut short by (-C), as in the module's lxc_stats
+	s64 min_vruntime;
+	int n_threads;
+	sim_thread * threads;
+	llist schedule_queue;
+	hashmap valid_children;
+	struct sim_container_struct * next;
+} sim_container;
+
+struct sim_config {
+	int n_containers;
+	int n_threads;
+	int n_chains;
+	int n_rounds;
+	s64 quantum;
+	int tdfs[MAX_TDFS];
+	int n_tdfs;
+	int pattern;
+	s64 switch_cost;			// cost of a thaw or freeze of a container
+	s64 ctx_cost;				// cost of switching the running thread inside a container
+	s64 granularity;			// slice a thread runs for when it is picked (at TDF 1)
+	int group_run;				// all threads of a container run at once for its whole turn
+	s64 wakeup_cost;			// cost of waking up a dilated sleeper
+	s64 barrier_cost;			// cost of the end of round barrier
+	s64 prep_cost;				// sync thread bookkeeping per container (runtime computation, schedule queue refresh)
+	int pipelined;				// bookkeeping of a container overlaps with the run of the one before it in the chain
+	s64 max_lateness;			// hrtimers fire up to this late (uniform)
+	int exact_freeze;			// freeze stamps are thaw time + requested run time (as in the module) instead of the actual end
+	int spawn_every;			// a new thread joins every container every spawn_every rounds (0 = never)
+	int compensate;				// overrun feedback (vt_overshoot_update), like SET_VT_COMPENSATION
+	unsigned int seed;
+};
+
+struct sim_result {
+	s64 total_wall;
+	s64 total_busy;				// sum over rounds of the longest chain's requested run time
+	s64 total_cpu;				// sum of all slices that ran
+	s64 n_slices;
+	s64 n_stalled;
+	s64 n_wakeups;
+	s64 n_catchups;
+	s64 n_errors;
+	double err_sum;
+	double err_sq;
+	s64 err_max;
+	s64 n_ahead;
+	double overshoot_sum;
+	s64 n_residuals;
+	double residual_sum;		// absolute overrun past the slice each turn was meant to have, not charged with exact_freeze
+};
+
+static unsigned int rng;
+
+static s64 sim_lateness(struct sim_config * cfg) {
+	if (cfg->max_lateness <= 0)
+		return 0;
+	return rand_r(&rng) % (cfg->max_lateness + 1);
+}
+
+static s64 sim_virtual_time(sim_container * c, s64 now) {
+	return vt_virtual_time(now, c->virt_start_time, c->freeze_time, c->past_physical_time, c->past_virtual_time, c->tdf);
+}
+
+/***
+Adds the threads that exist by this round to the container's schedule queue, like refresh_lxc_schedule_queue
+***/
+static void sim_refresh_queue(sim_container * c, int round) {
+	int i;
+	sim_thread * t;
+
+	for (i = 0; i < c->n_threads; i++) {
+		t = &c->threads[i];
+		if (t->spawn_round > round || hmap_get_abs(&c->valid_children, t->pid) != NULL)
+			continue;
+		vt_sched_entity_init(&t->se, t->static_priority, c->min_vruntime);
+		llist_append(&c->schedule_queue, t);
+		hmap_put_abs(&c->valid_children, t->pid, t);
+	}
+}
+
+/***
+Runs one container for its share of the round starting at physical time now. Returns the physical time at which
+the container is frozen again
+***/
+static s64 sim_run_container(struct sim_config * cfg, struct sim_result * res, sim_container * c, s64 now, s64 target, int round) {
+	s64 start;
+	s64 rem_time;
+	s64 slice;
+	s64 intended_end;
+	sim_thread * head;
+	sim_thread * last = NULL;
+	int i;
+	s64 granularity;
+	int catchups = 0;
+
+	sim_refresh_queue(c, round);
+	granularity = vt_sched_granularity(c->tdf, cfg->granularity, 1);
+
+	do {
+		if (c->running_time <= 0)
+			return now;
+
+		/* thaw */
+		now += cfg->switch_cost;
+		c->past_physical_time += now - c->freeze_time;
+		c->freeze_time = 0;
+		start = now;
+		intended_end = start;
+
+		rem_time = c->running_time;
+		if (cfg->group_run && rem_time > 0) {
+			/* one timer for the whole turn: sleepers are woken and go back to sleep right away, the busy threads
+			share the CPU evenly. The clock is charged the CPU time they got plus the idle time, like the module */
+			int n_busy = 0;
+			s64 cpu_time;
+
+			for (i = 0; i < c->schedule_queue.size; i++) {
+				head = llist_get(&c->schedule_queue, i);
+				if (head->sleeper) {
+					now += cfg->wakeup_cost;
+					res->n_wakeups++;
+				}
+				else
+					n_busy++;
+			}
+			for (i = 0; i < c->schedule_queue.size && n_busy > 0; i++) {
+				head = llist_get(&c->schedule_queue, i);
+				if (!head->sleeper)
+					vt_sched_account(&head->se, rem_time/n_busy);
+			}
+			cpu_time = n_busy > 0 ? rem_time : 0;
+			intended_end += vt_group_charge(cpu_time, rem_time - cpu_time, 1, rem_time);
+			now += rem_time + sim_lateness(cfg);
+			res->total_cpu += cpu_time;
+			res->n_slices++;
+			rem_time = 0;
+		}
+		while (rem_time > 0) {
+			head = (sim_thread *)vt_sched_pick(&c->schedule_queue, &c->min_vruntime, granularity, NULL, NULL);
+			if (head == NULL)
+				break;
+			slice = vt_sched_slice(&head->se, rem_time, &rem_time);
+			if (slice == 0) {
+				res->n_stalled++;
+				break;
+			}
+			if (head->sleeper) {
+				now += cfg->wakeup_cost;
+				res->n_wakeups++;
+			}
+			intended_end += slice;
+			now += slice + sim_lateness(cfg);
+			res->total_cpu += slice;
+			res->n_slices++;
+			if (last != NULL && last != head)
+				now += cfg->ctx_cost;
+			last = head;
+			vt_sched_account(&head->se, slice);
+		}
+
+		/* freeze. A turn that ran its whole slice is charged the overshoot it was cut short by, like turn_charge */
+		c->overrun = now > intended_end ? now - intended_end : 0;
+		if (rem_time <= 0)
+			intended_end += c->overshoot;
+		c->freeze_time = cfg->exact_freeze ? intended_end : now;
+		now += cfg->switch_cost;
+
+		/* still behind: run again for the remaining distance, as the module does */
+		c->running_time = vt_slice_runtime(sim_virtual_time(c, now), target, c->tdf);
+		if (c->running_time > 0)
+			res->n_catchups++;
+		catchups++;
+	} while (c->running_time > 0 && catchups < 8);
+
+	return now;
+}
+
+static void sim_record_error(struct sim_result * res, s64 err) {
+	s64 abs_err = err < 0 ? -err : err;
+
+	if (err > 0)
+		res->n_ahead++;
+	res->n_errors++;
+	res->err_sum += abs_err;
+	res->err_sq += (double)abs_err*abs_err;
+	if (abs_err > res->err_max)
+		res->err_max = abs_err;
+}
+
+static int parse_tdfs(char * arg, int * tdfs) {
+	int n = 0;
+	char * tok = strtok(arg, ",");
+
+	while (tok != NULL && n < MAX_TDFS) {
+		tdfs[n++] = atoi(tok);
+		tok = strtok(NULL, ",");
+	}
+	return n;
+}
+
+static void usage(char * prog) {
+	fprintf(stderr, "Usage: %s [-n containers] [-t threads] [-c chains] [-r rounds] [-q quantum ns]\n"
+		"\t[-d tdf,tdf,...] [-p cpu|sleep|mixed] [-s switch cost ns] [-x ctx switch cost ns]\n"
+		"\t[-w sleeper wakeup cost ns] [-b barrier cost ns] [-l max hrtimer lateness ns]\n"
+		"\t[-a (freeze at actual slice end)] [-g spawn a thread every N rounds] [-S seed]\n"
+		"\t[-k per container bookkeeping cost ns] [-u (bookkeeping of the whole chain before the first thaw)]\n"
+		"\t[-G thread slice granularity ns] [-R (group run: all threads of a container run at once)]\n"
+		"\t[-C (overrun feedback: slices are cut short by the overrun each container has shown)]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char * argv[]) {
+	struct sim_config cfg;
+	struct sim_result res;
+	sim_container * containers;
+	sim_container * c;
+	sim_container ** chainhead;
+	s64 * chainlength;
+	s64 * chain_now;
+	s64 highest_tdf;
+	s64 expected_increase;
+	s64 actual_time;
+	s64 now;
+	s64 round_end;
+	s64 busy;
+	s64 start_time = 1000000000;
+	int opt;
+	int i, j, k, round;
+	struct timespec host_start, host_end;
+	double host_secs;
+
+	memset(&cfg, 0, sizeof(cfg));
+	memset(&res, 0, sizeof(res));
+	cfg.n_containers = 8;
+	cfg.n_threads = 1;
+	cfg.n_chains = 2;
+	cfg.n_rounds = 1000;
+	cfg.quantum = 300000000;
+	cfg.tdfs[0] = 1000;
+	cfg.n_tdfs = 1;
+	cfg.pattern = PATTERN_CPU;
+	cfg.switch_cost = 5000;
+	cfg.ctx_cost = 2000;
+	cfg.granularity = 100000;
+	cfg.wakeup_cost = 3000;
+	cfg.barrier_cost = 10000;
+	cfg.max_lateness = 20000;
+	cfg.exact_freeze = 1;
+	cfg.pipelined = 1;
+	cfg.seed = 1;
+
+	while ((opt = getopt(argc, argv, "n:t:c:r:q:d:p:s:x:w:b:l:ag:S:k:uG:RCh")) != -1) {
+		switch (opt) {
+			case 'n': cfg.n_containers = atoi(optarg); break;
+			case 't': cfg.n_threads = atoi(optarg); break;
+			case 'c': cfg.n_chains = atoi(optarg); break;
+			case 'r': cfg.n_rounds = atoi(optarg); break;
+			case 'q': cfg.quantum = atoll(optarg); break;
+			case 'd': cfg.n_tdfs = parse_tdfs(optarg, cfg.tdfs); break;
+			case 'p':
+				if (strcmp(optarg, "sleep") == 0)
+					cfg.pattern = PATTERN_SLEEP;
+				else if (strcmp(optarg, "mixed") == 0)
+					cfg.pattern = PATTERN_MIXED;
+				else
+					cfg.pattern = PATTERN_CPU;
+				break;
+			case 's': cfg.switch_cost = atoll(optarg); break;
+			case 'x': cfg.ctx_cost = atoll(optarg); break;
+			case 'w': cfg.wakeup_cost = atoll(optarg); break;
+			case 'b': cfg.barrier_cost = atoll(optarg); break;
+			case 'l': cfg.max_lateness = atoll(optarg); break;
+			case 'a': cfg.exact_freeze = 0; break;
+			case 'g': cfg.spawn_every = atoi(optarg); break;
+			case 'S': cfg.seed = atoi(optarg); break;
+			case 'k': cfg.prep_cost = atoll(optarg); break;
+			case 'u': cfg.pipelined = 0; break;
+			case 'G': cfg.granularity = atoll(optarg); break;
+			case 'R': cfg.group_run = 1; break;
+			case 'C': cfg.compensate = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if (cfg.n_containers <= 0 || cfg.n_threads <= 0 || cfg.n_chains <= 0 || cfg.n_rounds <= 0 || cfg.n_tdfs <= 0)
+		usage(argv[0]);
+
+	rng = cfg.seed;
+	containers = calloc(cfg.n_containers, sizeof(sim_container));
+	chainhead = calloc(cfg.n_chains, sizeof(sim_container *));
+	chainlength = calloc(cfg.n_chains, sizeof(s64));
+	chain_now = calloc(cfg.n_chains, sizeof(s64));
+
+	/* the leader is the container with the highest TDF */
+	highest_tdf = -100000000;
+	for (i = 0; i < cfg.n_containers; i++) {
+		c = &containers[i];
+		c->pid = 1000 + i*100;
+		c->tdf = cfg.tdfs[i % cfg.n_tdfs];
+		if (c->tdf > highest_tdf)
+			highest_tdf = c->tdf;
+	}
+	expected_increase = vt_expected_increase(cfg.quantum, highest_tdf);
+
+	for (i = 0; i < cfg.n_containers; i++) {
+		c = &containers[i];
+		c->virt_start_time = start_time;
+		c->freeze_time = start_time;
+		c->overrun = -1;
+		c->n_threads = cfg.n_threads;
+		c->threads = calloc(cfg.n_threads, sizeof(sim_thread));
+		llist_init(&c->schedule_queue);
+		hmap_init(&c->valid_children, "int", 0);
+		for (j = 0; j < cfg.n_threads; j++) {
+			c->threads[j].pid = c->pid + j;
+			c->threads[j].static_priority = 120;
+			c->threads[j].sleeper = (cfg.pattern == PATTERN_SLEEP && j > 0) || (cfg.pattern == PATTERN_MIXED && j % 2 == 1);
+			c->threads[j].spawn_round = cfg.spawn_every > 0 ? j*cfg.spawn_every : 0;
+		}
+
+		/* assign to the chain with the smallest aggregated running time, like assign_to_cpu */
+		k = 0;
+		for (j = 1; j < cfg.n_chains; j++) {
+			if (chainlength[j] < chainlength[k])
+				k = j;
+		}
+		c->chain = k;
+		chainlength[k] += vt_task_runtime(cfg.quantum, highest_tdf, c->tdf);
+		c->next = chainhead[k];
+		chainhead[k] = c;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &host_start);
+
+	now = start_time;
+	actual_time = start_time;
+	for (round = 0; round < cfg.n_rounds; round++) {
+		actual_time += expected_increase;
+		round_end = now;
+		busy = 0;
+
+		for (k = 0; k < cfg.n_chains; k++) {
+			s64 requested = 0;
+			s64 slice;
+			int prepared = 0;
+
+			chain_now[k] = now;
+			if (!cfg.pipelined) {
+				for (c = chainhead[k]; c != NULL; c = c->next)
+					chain_now[k] += cfg.prep_cost;
+			}
+			for (c = chainhead[k]; c != NULL; c = c->next) {
+				/* pipelined: only paid when the container before it did not run (or for the head of the chain) */
+				if (cfg.pipelined && !prepared)
+					chain_now[k] += cfg.prep_cost;
+				/* the overrun of its last turn is fed back with -C, a container that did not run is skipped */
+				if (c->overrun >= 0) {
+					s64 err = c->overrun - c->overshoot;
+
+					res.n_residuals++;
+					res.residual_sum += err < 0 ? -err : err;
+					if (cfg.compensate)
+						c->overshoot = vt_overshoot_update(c->overshoot, err, vt_slice_runtime(0, expected_increase, c->tdf));
+					c->overrun = -1;
+				}
+				slice = vt_slice_runtime(sim_virtual_time(c, chain_now[k]), actual_time, c->tdf);
+				c->running_time = slice > c->overshoot ? slice - c->overshoot : 0;
+				requested += c->running_time;
+				prepared = c->running_time > 0;
+				chain_now[k] = sim_run_container(&cfg, &res, c, chain_now[k], actual_time, round);
+			}
+			if (chain_now[k] > round_end)
+				round_end = chain_now[k];
+			if (requested > busy)
+				busy = requested;
+		}
+
+		round_end += cfg.barrier_cost;
+		res.total_wall += round_end - now;
+		res.total_busy += busy;
+		now = round_end;
+
+		/* virtual time error of every container at the round boundary */
+		for (i = 0; i < cfg.n_containers; i++) {
+			s64 err = sim_virtual_time(&containers[i], now) - actual_time;
+
+			sim_record_error(&res, err);
+			res.overshoot_sum += containers[i].overshoot;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &host_end);
+	host_secs = (host_end.tv_sec - host_start.tv_sec) + (host_end.tv_nsec - host_start.tv_nsec)/1e9;
+
+	printf("containers: %d\n", cfg.n_containers);
+	printf("threads_per_container: %d\n", cfg.n_threads);
+	printf("chains: %d\n", cfg.n_chains);
+	printf("rounds: %d\n", cfg.n_rounds);
+	printf("expected_increase_ns: %lld\n", (long long)expected_increase);
+	printf("avg_round_wall_ns: %lld\n", (long long)(res.total_wall/cfg.n_rounds));
+	printf("round_overhead_pct: %.3f\n", res.total_wall ? 100.0*(res.total_wall - res.total_busy)/res.total_wall : 0.0);
+	printf("cpu_utilization_pct: %.3f\n", res.total_wall ? 100.0*res.total_cpu/((double)res.total_wall*cfg.n_chains) : 0.0);
+	printf("slices: %lld\n", (long long)res.n_slices);
+	printf("catchup_runs: %lld\n", (long long)res.n_catchups);
+	printf("stalled_slices: %lld\n", (long long)res.n_stalled);
+	printf("sleeper_wakeups: %lld\n", (long long)res.n_wakeups);
+	printf("vt_error_mean_ns: %.1f\n", res.n_errors ? res.err_sum/res.n_errors : 0.0);
+	printf("vt_error_rms_ns: %.1f\n", res.n_errors ? sqrt(res.err_sq/res.n_errors) : 0.0);
+	printf("vt_error_max_ns: %lld\n", (long long)res.err_max);
+	printf("vt_ahead_pct: %.3f\n", res.n_errors ? 100.0*res.n_ahead/res.n_errors : 0.0);
+	printf("vt_overshoot_mean_ns: %.1f\n", res.n_errors ? res.overshoot_sum/res.n_errors : 0.0);
+	printf("turn_residual_mean_ns: %.1f\n", res.n_residuals ? res.residual_sum/res.n_residuals : 0.0);
+	printf("sim_rounds_per_sec: %.0f\n", host_secs > 0 ? cfg.n_rounds/host_secs : 0.0);
+
+	for (i = 0; i < cfg.n_containers; i++) {
+		hmap_destroy(&containers[i].valid_children);
+		llist_destroy(&containers[i].schedule_queue);
+		free(containers[i].threads);
+	}
+	free(containers);
+	free(chainhead);
+	free(chainlength);
+	free(chain_now);
+	return 0;
+}